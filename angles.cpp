@@ -10,7 +10,7 @@ int main(void) {
 
     NeuralNetworkConfig config = {inputSize, hiddenSize, outputSize, learningRate};
     NeuralNetwork neuralNetwork(config, activation);
-    int modelLoaded = neuralNetwork.loadModel("angles-model.txt");
+    int modelLoaded = neuralNetwork.loadModel("angles-model.bin");
 
     if(!modelLoaded) {
         std::vector<std::pair<std::vector<double>, std::vector<double>>> trainingData;
@@ -31,7 +31,7 @@ int main(void) {
         std::cout << "Training finished!" << std::endl;
 
         std::cout << "Saving model..." << std::endl;
-        neuralNetwork.saveModel("angles-model.txt");
+        neuralNetwork.saveModel("angles-model.bin");
         std::cout << "Model saved!" << std::endl;
     }
 
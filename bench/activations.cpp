@@ -0,0 +1,107 @@
+#include <functional>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Element throughput and worst error of the sigmoid, tanh and softmax kernels
+// for every activation accuracy, instruction set and precision. Errors are
+// measured against long double libm on inputs spread over [-20, 20]: absolute
+// for sigmoid and tanh, relative for the softmax outputs (rows of 100 logits,
+// the CIFAR-100 output layer).
+constexpr int ELEMENTS = 4096;
+constexpr int SOFTMAX_ROW = 100;
+
+const char* accuracyName(ActivationAccuracy accuracy) {
+    switch (accuracy) {
+    case ACTIVATION_FAST:
+        return "fast";
+    case ACTIVATION_TABLE:
+        return "table";
+    default:
+        return "exact";
+    }
+}
+
+std::vector<long double> softmaxReference(const std::vector<long double>& inputs) {
+    std::vector<long double> outputs(inputs.size());
+    for (std::size_t first = 0; first < inputs.size(); first += SOFTMAX_ROW) {
+        const std::size_t last = std::min(inputs.size(), first + SOFTMAX_ROW);
+        const long double max = *std::max_element(inputs.begin() + first, inputs.begin() + last);
+        long double sum = 0.0L;
+        for (std::size_t i = first; i < last; i++) {
+            outputs[i] = std::exp(inputs[i] - max);
+            sum += outputs[i];
+        }
+        for (std::size_t i = first; i < last; i++) {
+            outputs[i] /= sum;
+        }
+    }
+    return outputs;
+}
+
+template <typename T>
+void benchmark(const char* precision) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-20.0, 20.0);
+    std::vector<T> inputs(ELEMENTS);
+    std::vector<long double> exactInputs(ELEMENTS);
+    for (int i = 0; i < ELEMENTS; i++) {
+        inputs[i] = static_cast<T>(dist(gen));
+        exactInputs[i] = inputs[i];
+    }
+    std::vector<long double> sigmoidReference(ELEMENTS), tanhReference(ELEMENTS);
+    for (int i = 0; i < ELEMENTS; i++) {
+        sigmoidReference[i] = 1.0L / (1.0L + std::exp(-exactInputs[i]));
+        tanhReference[i] = std::tanh(exactInputs[i]);
+    }
+    const std::vector<long double> softmaxExact = softmaxReference(exactInputs);
+    std::vector<T> values(ELEMENTS);
+
+    for (SimdInstructionSet instructionSet : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+        if (!isInstructionSetSupported(instructionSet)) {
+            continue;
+        }
+        for (ActivationAccuracy accuracy : {ACTIVATION_EXACT, ACTIVATION_FAST, ACTIVATION_TABLE}) {
+            const KernelTable<T>& simd = kernelTable<T>(instructionSet, accuracy);
+            auto softmaxRows = [&](T* row, int) {
+                for (int first = 0; first < ELEMENTS; first += SOFTMAX_ROW) {
+                    simd.softmax(row + first, std::min(SOFTMAX_ROW, ELEMENTS - first));
+                }
+            };
+            struct Kernel {
+                const char* name;
+                std::function<void(T*, int)> apply;
+                const std::vector<long double>* reference;
+                bool relative;
+            };
+            for (const Kernel& kernel : {Kernel{"sigmoid", simd.sigmoid, &sigmoidReference, false},
+                                         Kernel{"tanh", simd.tanh, &tanhReference, false},
+                                         Kernel{"softmax", softmaxRows, &softmaxExact, true}}) {
+                const double nanoseconds = nanosecondsPerCall([&] {
+                    std::copy(inputs.begin(), inputs.end(), values.begin());
+                    kernel.apply(values.data(), ELEMENTS);
+                });
+                double worst = 0.0;
+                for (int i = 0; i < ELEMENTS; i++) {
+                    const long double reference = (*kernel.reference)[i];
+                    long double error = std::abs(values[i] - reference);
+                    if (kernel.relative && reference > 0.0L) {
+                        error /= reference;
+                    }
+                    worst = std::max(worst, static_cast<double>(error));
+                }
+                std::cout << "  " << std::left << std::setw(8) << precision << std::setw(8) << simd.name
+                          << std::setw(7) << accuracyName(accuracy) << std::setw(9) << kernel.name << std::right
+                          << std::fixed << std::setprecision(2) << std::setw(8) << ELEMENTS / nanoseconds
+                          << " elements/ns   max " << (kernel.relative ? "relative" : "absolute") << " error "
+                          << std::scientific << std::setprecision(2) << worst << std::endl;
+            }
+        }
+    }
+}
+
+int main(void) {
+    benchmark<double>("double");
+    benchmark<float>("float");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+#include <atomic>
+#include <iomanip>
+#include <new>
+#include "../src/nn.cpp"
+
+// Counts heap allocations in the steady-state training and inference loops.
+// Every loop runs once to warm its buffers up, then again with the counter
+// armed; the program fails if any of them allocated.
+std::atomic<long> allocations{0};
+
+void* operator new(std::size_t bytes) {
+    allocations++;
+    if (void* memory = std::malloc(bytes == 0 ? 1 : bytes)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment) {
+    allocations++;
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* memory = std::aligned_alloc(align, (bytes + align - 1) / align * align)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC pairs the inlined replacement deletes with the builtin operator new and
+// flags the free(); every allocation above comes from malloc or aligned_alloc.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+// Discards the progress bar output of train()
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+int failures = 0;
+// The real standard output; std::cout is silenced while the loops run
+std::ostream console(nullptr);
+
+template <typename Loop>
+void check(const std::string& name, long iterations, Loop loop) {
+    loop();
+    const long before = allocations.load();
+    loop();
+    const long count = allocations.load() - before;
+    console << "  " << std::left << std::setw(36) << name << std::right << std::setw(8) << count
+          << " allocations over " << iterations << " iterations" << std::endl;
+    failures += count != 0;
+}
+
+template <typename T>
+void checkNetwork(const std::string& precision, int threads, ParallelMode mode, OptimizerType optimizer = SGD) {
+    const int inputs = 64;
+    const int classes = 10;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<T> dist(0, 1);
+    TrainingData<T> data;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> labels;
+    for (int i = 0; i < 256; i++) {
+        std::vector<T> sample(inputs);
+        for (T& value : sample) {
+            value = dist(gen);
+            pixels.push_back(static_cast<uint8_t>(value * 255));
+        }
+        std::vector<T> targets(classes, T(0));
+        targets[i % classes] = T(1);
+        labels.push_back(static_cast<uint8_t>(i % classes));
+        data.push_back({sample, targets});
+    }
+    const TrainingData<T> batch(data.begin(), data.begin() + 32);
+    const TrainingData<T> validation(data.begin(), data.begin() + 16);
+
+    NeuralNetworkConfig config = {inputs, 0, 0, 0.01, SIGMOID};
+    config.layers = {{32, RELU}, {32, TANH}, {classes, SIGMOID}};
+    config.batchSize = 32;
+    config.threads = threads;
+    config.parallelMode = mode;
+    config.optimizer.type = optimizer;
+    config.learningRateSchedule.type = COSINE_SCHEDULE;
+    config.learningRateSchedule.totalSteps = 10000;
+    NeuralNetwork<T> network(config, SIGMOID, 0.1);
+    console << precision << ", " << threads << " thread(s)" << (threads > 1 ? mode == HOGWILD ? ", hogwild" : ", all-reduce" : "")
+            << (optimizer == ADAM ? ", adam" : "") << std::endl;
+
+    const long iterations = 1000;
+    std::vector<T> outputs(classes);
+    check("feedforward(const T*, T*)", iterations, [&] {
+        for (long i = 0; i < iterations; i++) {
+            network.feedforward(data[i % data.size()].first.data(), outputs.data());
+        }
+    });
+    check("feedforward(vector, vector&)", iterations, [&] {
+        for (long i = 0; i < iterations; i++) {
+            network.feedforward(data[i % data.size()].first, outputs, false);
+        }
+    });
+    check("backpropagation", iterations, [&] {
+        for (long i = 0; i < iterations; i++) {
+            network.backpropagation(data[i % data.size()].first, data[i % data.size()].second);
+        }
+    });
+    check("trainBatch", iterations / 10, [&] {
+        for (long i = 0; i < iterations / 10; i++) {
+            network.trainBatch(batch);
+        }
+    });
+    check("train (checkpoint every 100)", iterations, [&] {
+        network.train(data, validation, iterations, 100);
+    });
+    typename DataLoader<T>::Options options;
+    options.batchSize = 32;
+    DataLoader<T> loader(ByteView(pixels.data(), labels.size(), inputs, inputs),
+                         ByteView(labels.data(), labels.size(), 1, 1), classes, options);
+    check("train (DataLoader)", iterations / 10, [&] {
+        network.train(loader, validation, iterations / 10, 100);
+    });
+    Matrix<T> batchInputs(256, inputs);
+    Matrix<T> batchOutputs;
+    check("predictBatch", 100, [&] {
+        for (int i = 0; i < 100; i++) {
+            network.predictBatch(batchInputs, batchOutputs);
+        }
+    });
+}
+
+int main(void) {
+    NullBuffer nullBuffer;
+    console.rdbuf(std::cout.rdbuf());
+    std::cout.rdbuf(&nullBuffer);
+    checkNetwork<double>("double", 1, ALL_REDUCE);
+    checkNetwork<float>("float", 1, ALL_REDUCE);
+    checkNetwork<float>("float", 2, ALL_REDUCE);
+    checkNetwork<float>("float", 2, HOGWILD);
+    checkNetwork<float>("float", 1, ALL_REDUCE, ADAM);
+    checkNetwork<float>("float", 2, ALL_REDUCE, ADAM);
+    std::cout.rdbuf(console.rdbuf());
+    std::cout << (failures == 0 ? "no allocations in steady state" : "steady-state loops allocated") << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,54 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+
+// Training throughput of per-sample backpropagation against trainBatch().
+std::vector<std::pair<std::vector<double>, std::vector<double>>> syntheticData(int count, int inputSize, int outputSize) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<std::pair<std::vector<double>, std::vector<double>>> data;
+    for (int i = 0; i < count; i++) {
+        std::vector<double> inputs(inputSize);
+        for (double& value : inputs) {
+            value = dist(gen);
+        }
+        std::vector<double> targets(outputSize, 0.0);
+        targets[i % outputSize] = 1.0;
+        data.push_back({inputs, targets});
+    }
+    return data;
+}
+
+void benchmarkShape(const std::string& name, int inputSize, int hiddenSize, int outputSize, int samples) {
+    auto data = syntheticData(samples, inputSize, outputSize);
+    NeuralNetworkConfig config = {inputSize, hiddenSize, outputSize, 0.01, SIGMOID};
+    std::cout << name << " " << inputSize << "x" << hiddenSize << "x" << outputSize << std::endl;
+
+    for (int batchSize : {1, 8, 32, 128}) {
+        std::vector<std::vector<std::pair<std::vector<double>, std::vector<double>>>> batches;
+        for (int first = 0; first < samples; first += batchSize) {
+            batches.emplace_back(data.begin() + first, data.begin() + std::min(first + batchSize, samples));
+        }
+
+        NeuralNetwork network(config, SIGMOID);
+        auto start = std::chrono::steady_clock::now();
+        if (batchSize == 1) {
+            for (const auto& [inputs, targets] : data) {
+                network.backpropagation(inputs, targets);
+            }
+        } else {
+            for (const auto& batch : batches) {
+                network.trainBatch(batch);
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "  batch " << std::setw(3) << batchSize << ": " << std::fixed << std::setprecision(0)
+                  << samples / elapsed.count() << " samples/s" << std::endl;
+    }
+}
+
+int main(void) {
+    benchmarkShape("MNIST", 784, 128, 10, 4096);
+    benchmarkShape("CIFAR-100", 3072, 100, 100, 1024);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// What checkpoints cost the trainer, and whether resuming is exact. On the
+// MNIST shape with Adam, train() runs without checkpoints and with one every
+// CHECKPOINT_STEPS steps; the trainer's time per checkpoint (the snapshot
+// copy, the telemetry's checkpoint phase) is set against writing the same
+// checkpoint synchronously. Then a run is stopped halfway, resumed from its
+// checkpoint in a new network, and must end with bit-identical outputs to a
+// run that was never stopped, both for TrainingData and DataLoader training
+// and for a network whose first layer has no parameters (fails otherwise).
+constexpr int INPUTS = 784;
+constexpr int CLASSES = 10;
+constexpr long CHECKPOINT_STEPS = 20;
+
+std::string temporaryPath(const char* name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+TrainingData<float> syntheticData(int samples, int inputs, int classes) {
+    Xoshiro256 generator(3);
+    TrainingData<float> data;
+    for (int s = 0; s < samples; s++) {
+        std::vector<float> sample(inputs);
+        for (float& value : sample) {
+            value = generator.uniform<float>();
+        }
+        std::vector<float> targets(classes, 0.0f);
+        targets[s % classes] = 1.0f;
+        data.push_back({sample, targets});
+    }
+    return data;
+}
+
+NeuralNetworkConfig mnistConfig(const std::string& checkpointPath) {
+    NeuralNetworkConfig config = {INPUTS, 0, 0, 1e-3, TANH};
+    config.layers = {{128, TANH}, {CLASSES, TANH}};
+    config.batchSize = 32;
+    config.optimizer.type = ADAM;
+    config.seed = 42;
+    config.telemetry.progress = PROGRESS_OFF;
+    config.checkpoint.path = checkpointPath;
+    config.checkpoint.interval = CHECKPOINT_STEPS;
+    return config;
+}
+
+void benchmarkStall() {
+    const TrainingData<float> data = syntheticData(512, INPUTS, CLASSES);
+    const TrainingData<float> validation(data.begin(), data.begin() + 32);
+    const long steps = 400;
+    const std::string path = temporaryPath("checkpoint_bench.ckpt");
+    std::cout << "784x128x10 float network, Adam, batch 32, " << steps << " steps, checkpoint every "
+              << CHECKPOINT_STEPS << std::endl;
+
+    double withoutSeconds = 1e30;
+    double withSeconds = 1e30;
+    double snapshotSeconds = 1e30;
+    for (int repetition = 0; repetition < 3; repetition++) {
+        NeuralNetwork<float> plain(mnistConfig(""), TANH);
+        auto start = std::chrono::steady_clock::now();
+        plain.train(data, validation, steps, static_cast<int>(steps));
+        withoutSeconds = std::min(withoutSeconds, secondsSince(start));
+
+        NeuralNetwork<float> checkpointed(mnistConfig(path), TANH);
+        start = std::chrono::steady_clock::now();
+        checkpointed.train(data, validation, steps, static_cast<int>(steps));
+        withSeconds = std::min(withSeconds, secondsSince(start));
+        snapshotSeconds = std::min(snapshotSeconds, checkpointed.telemetry().phaseSeconds(PHASE_CHECKPOINT) /
+                                                        checkpointed.telemetry().phaseCount(PHASE_CHECKPOINT));
+    }
+    TrainingSnapshot<float> snapshot;
+    std::string error;
+    if (!readCheckpointFile<float>(path, snapshot, error)) {
+        std::cout << "  " << error << std::endl;
+        return;
+    }
+    const int writes = 10;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < writes; i++) {
+        writeCheckpointFile<float>(path, snapshot, error);
+    }
+    const double writeSeconds = secondsSince(start) / writes;
+
+    // With fewer cores than threads the writer takes its time from training, which shows in the totals
+    // but not in the snapshot time
+    std::cout << std::fixed << std::setprecision(3) << "  checkpoint size        "
+              << std::filesystem::file_size(path) / 1024.0 / 1024.0 << " MiB" << std::endl;
+    std::cout << "  train, no checkpoints  " << withoutSeconds << " s" << std::endl;
+    std::cout << "  train, checkpoints     " << withSeconds << " s (" << std::thread::hardware_concurrency()
+              << " hardware threads)" << std::endl;
+    std::cout << "  trainer stall          synchronous write " << writeSeconds * 1e3 << " ms, snapshot "
+              << snapshotSeconds * 1e3 << " ms per checkpoint" << std::endl;
+    std::filesystem::remove(path);
+}
+
+std::vector<float> outputsOf(NeuralNetwork<float>& network, const Matrix<float>& inputs) {
+    Matrix<float> outputs;
+    network.predictBatch(inputs, outputs);
+    return std::vector<float>(outputs.data(), outputs.data() + outputs.size());
+}
+
+// `flattenFirst` reads the 16 inputs as a 4x4 image and starts with a
+// flatten() layer, which has no parameters and so no optimizer moments
+NeuralNetworkConfig resumeConfig(const std::string& checkpointPath, bool flattenFirst = false) {
+    NeuralNetworkConfig config = {16, 0, 0, 0.01, SOFTMAX};
+    config.layers = {{32, RELU}, {4, SOFTMAX}};
+    if (flattenFirst) {
+        config.inputShape = {1, 4, 4};
+        config.layers.insert(config.layers.begin(), flatten());
+    }
+    config.batchSize = 8;
+    config.threads = 2;
+    config.optimizer.type = ADAM;
+    config.seed = 1234;
+    config.telemetry.progress = PROGRESS_OFF;
+    config.checkpoint.path = checkpointPath;
+    config.checkpoint.interval = 30;
+    return config;
+}
+
+// `run(network, iterations)` trains; the straight run goes to 2 * half
+// iterations, the other stops at half and resumes in a new network
+template <typename Run>
+bool checkResume(const char* name, const Matrix<float>& inputs, long half, Run run, bool flattenFirst = false) {
+    const std::string path = temporaryPath("checkpoint_bench_resume.ckpt");
+    NeuralNetwork<float> straight(resumeConfig("", flattenFirst), SOFTMAX, 0.1);
+    run(straight, 2 * half);
+
+    {
+        NeuralNetwork<float> stopped(resumeConfig(path, flattenFirst), SOFTMAX, 0.1);
+        run(stopped, half);
+    }
+    NeuralNetwork<float> resumed(resumeConfig(path, flattenFirst), SOFTMAX, 0.1);
+    const bool loaded = resumed.resumeTraining(path);
+    run(resumed, 2 * half);
+    std::filesystem::remove(path);
+
+    const std::vector<float> expected = outputsOf(straight, inputs);
+    const std::vector<float> actual = outputsOf(resumed, inputs);
+    const bool same = loaded && std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0;
+    std::cout << "  " << std::left << std::setw(14) << name << (same ? "bit-identical" : "DIFFERS") << std::endl;
+    return same;
+}
+
+int main(void) {
+    benchmarkStall();
+
+    const long half = 150;
+    std::cout << "Resume after " << half << " of " << 2 * half << " steps, Adam, dropout 0.1, 2 all-reduce threads"
+              << std::endl;
+    const TrainingData<float> data = syntheticData(100, 16, 4);
+    Matrix<float> inputs(static_cast<int>(data.size()), 16);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        std::copy(data[i].first.begin(), data[i].first.end(), inputs.row(static_cast<int>(i)));
+    }
+    const auto trainOnData = [&](NeuralNetwork<float>& network, long steps) { network.train(data, data, steps, 50); };
+    const bool dataOk = checkResume("TrainingData", inputs, half, trainOnData);
+    const bool flattenOk = checkResume("flatten first", inputs, half, trainOnData, true);
+
+    std::vector<uint8_t> pixels(data.size() * 16);
+    std::vector<uint8_t> labels(data.size());
+    for (std::size_t i = 0; i < data.size(); i++) {
+        for (int p = 0; p < 16; p++) {
+            pixels[i * 16 + p] = static_cast<uint8_t>(data[i].first[p] * 255.0f);
+        }
+        labels[i] = static_cast<uint8_t>(i % 4);
+    }
+    const ByteView images(pixels.data(), data.size(), 16, 16);
+    const ByteView classes(labels.data(), data.size(), 1, 1);
+    DataLoader<float>::Options options;
+    options.batchSize = 8;
+    const bool loaderOk = checkResume("DataLoader", inputs, half, [&](NeuralNetwork<float>& network, long steps) {
+        DataLoader<float> loader(images, classes, 4, options);
+        network.train(loader, data, steps, 50);
+    });
+    return dataOk && flattenOk && loaderOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,112 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include "../src/nn.cpp"
+
+// Helpers shared by the benchmarks, included by them rather than built on
+// their own.
+
+// MNIST-shaped synthetic digits, see syntheticDigits()
+constexpr int DIGIT_INPUTS = 784;
+constexpr int DIGIT_CLASSES = 10;
+
+// Average time of function(), called often enough to run for 0.2 s
+template <typename Function>
+double nanosecondsPerCall(Function function) {
+    long calls = 1;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < calls; i++) {
+            function();
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() > 2e8) {
+            return elapsed.count() / calls;
+        }
+        calls *= 2;
+    }
+}
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// `samples` digits cycling through the classes: ten fixed random prototypes
+// (the same for every seed) plus uniform noise of width `noise` drawn from
+// `seed`, clamped to [0, 1]
+template <typename T>
+TrainingData<T> syntheticDigits(int samples, uint64_t seed, float noise = 4.0f) {
+    Xoshiro256 prototypes(7);
+    std::vector<std::vector<float>> digits(DIGIT_CLASSES, std::vector<float>(DIGIT_INPUTS));
+    for (std::vector<float>& digit : digits) {
+        for (float& pixel : digit) {
+            pixel = prototypes.uniform<float>() < 0.2f ? 0.5f : 0.0f;
+        }
+    }
+    Xoshiro256 generator(seed);
+    TrainingData<T> data;
+    for (int s = 0; s < samples; s++) {
+        const int label = s % DIGIT_CLASSES;
+        std::vector<T> sample(DIGIT_INPUTS);
+        for (int p = 0; p < DIGIT_INPUTS; p++) {
+            const float offset = noise * (generator.uniform<float>() - 0.5f);
+            sample[p] = static_cast<T>(std::min(1.0f, std::max(0.0f, digits[label][p] + offset)));
+        }
+        std::vector<T> targets(DIGIT_CLASSES, T(0));
+        targets[label] = T(1);
+        data.push_back({sample, targets});
+    }
+    return data;
+}
+
+// The inputs of the first `count` samples, a row each
+template <typename T>
+Matrix<T> inputsOf(const TrainingData<T>& data, std::size_t count) {
+    Matrix<T> inputs(static_cast<int>(count), static_cast<int>(data[0].first.size()));
+    for (std::size_t i = 0; i < count; i++) {
+        std::copy(data[i].first.begin(), data[i].first.end(), inputs.row(static_cast<int>(i)));
+    }
+    return inputs;
+}
+
+template <typename T>
+Matrix<T> inputsOf(const TrainingData<T>& data) {
+    return inputsOf(data, data.size());
+}
+
+// The most probable class of each row of outputs
+template <typename T>
+std::vector<int> classesOf(const Matrix<T>& outputs) {
+    std::vector<int> classes(outputs.rows());
+    for (int r = 0; r < outputs.rows(); r++) {
+        const T* row = outputs.row(r);
+        classes[r] = static_cast<int>(std::max_element(row, row + outputs.cols()) - row);
+    }
+    return classes;
+}
+
+// DIGIT_INPUTS x hidden tanh x DIGIT_CLASSES softmax, trained with Adam
+inline NeuralNetworkConfig digitsConfig(int hidden) {
+    NeuralNetworkConfig config = {DIGIT_INPUTS, 0, 0, 1e-3, SOFTMAX};
+    config.layers = {{hidden, TANH}, {DIGIT_CLASSES, SOFTMAX}};
+    config.batchSize = 32;
+    config.optimizer.type = ADAM;
+    config.seed = 42;
+    config.telemetry.progress = PROGRESS_OFF;
+    return config;
+}
+
+inline float largestDifference(const Matrix<float>& a, const Matrix<float>& b) {
+    float largest = 0.0f;
+    for (std::size_t i = 0; i < a.size(); i++) {
+        largest = std::max(largest, std::abs(a.data()[i] - b.data()[i]));
+    }
+    return largest;
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Convolutional vs dense networks on CIFAR-shaped images (3x32x32, planar).
+// Ten classes, each a small colored pattern pasted at a random position over
+// noise. The dense baseline is cifar-100.cpp's network (3072 inputs, 100
+// hidden units). The convolutional one has two 3x3 convolutions, each
+// followed by 2x2 max pooling, and then a dense output layer. The bench
+// reports parameters, forward FLOPs per sample, train step and predictBatch
+// times and held-out accuracy. Then a single 3x3 layer is timed on both
+// inference paths, im2col + GEMM and the direct kernel, for each instruction
+// set the CPU supports. Fails if the convolutional network misses 90%
+// accuracy or the two paths disagree.
+constexpr int CHANNELS = 3;
+constexpr int SIDE = 32;
+constexpr int INPUTS = CHANNELS * SIDE * SIDE;
+constexpr int CLASSES = 10;
+constexpr int PATTERN = 6;
+constexpr int BATCH = 32;
+constexpr long STEPS = 1500;
+
+TrainingData<float> shiftedPatterns(int samples, uint64_t seed) {
+    Xoshiro256 prototypes(7);
+    std::vector<std::vector<float>> patterns(CLASSES, std::vector<float>(CHANNELS * PATTERN * PATTERN));
+    for (std::vector<float>& pattern : patterns) {
+        for (float& value : pattern) {
+            value = prototypes.uniform<float>() < 0.5f ? 1.0f : 0.0f;
+        }
+    }
+    Xoshiro256 generator(seed);
+    TrainingData<float> data;
+    for (int s = 0; s < samples; s++) {
+        const int label = s % CLASSES;
+        std::vector<float> image(INPUTS);
+        for (float& value : image) {
+            value = 0.5f * generator.uniform<float>();
+        }
+        const int top = static_cast<int>(generator.below(SIDE - PATTERN + 1));
+        const int left = static_cast<int>(generator.below(SIDE - PATTERN + 1));
+        for (int c = 0; c < CHANNELS; c++) {
+            for (int y = 0; y < PATTERN; y++) {
+                for (int x = 0; x < PATTERN; x++) {
+                    image[(c * SIDE + top + y) * SIDE + left + x] = patterns[label][(c * PATTERN + y) * PATTERN + x];
+                }
+            }
+        }
+        std::vector<float> targets(CLASSES, 0.0f);
+        targets[label] = 1.0f;
+        data.push_back({image, targets});
+    }
+    return data;
+}
+
+// Multiply-adds of one forward pass, times two
+double forwardFlops(const NeuralNetwork<float>& network) {
+    double flops = 0.0;
+    for (int l = 0; l < network.layerCount(); l++) {
+        const Matrix<float>& weights = network.layerWeights(l);
+        const double positions = network.layerType(l) == CONV2D ? network.layerOutputs(l) / weights.cols() : 1;
+        flops += 2.0 * positions * weights.size();
+    }
+    return flops;
+}
+
+NeuralNetworkConfig configWith(std::vector<LayerConfig> layers) {
+    NeuralNetworkConfig config = {INPUTS, 0, 0, 1e-3, SOFTMAX};
+    config.inputShape = {CHANNELS, SIDE, SIDE};
+    config.layers = std::move(layers);
+    config.batchSize = BATCH;
+    config.optimizer.type = ADAM;
+    config.seed = 42;
+    config.telemetry.progress = PROGRESS_OFF;
+    return config;
+}
+
+bool compareNetworks() {
+    const TrainingData<float> training = shiftedPatterns(4000, 1);
+    const TrainingData<float> test = shiftedPatterns(1000, 2);
+    const TrainingData<float> validation(test.begin(), test.begin() + 100);
+    Matrix<float> inputs(static_cast<int>(test.size()), INPUTS);
+    for (std::size_t i = 0; i < test.size(); i++) {
+        std::copy(test[i].first.begin(), test[i].first.end(), inputs.row(static_cast<int>(i)));
+    }
+    const TrainingData<float> batch(training.begin(), training.begin() + BATCH);
+
+    struct Candidate {
+        const char* name;
+        std::vector<LayerConfig> layers;
+    };
+    const Candidate candidates[] = {
+        {"dense 3072x100x10", {{100, RELU}, {CLASSES, SOFTMAX}}},
+        {"conv 3x3x16, pool, 3x3x32, pool, 10",
+         {conv2d(16, 3, RELU), maxPool(2), conv2d(32, 3, RELU), maxPool(2), flatten(), {CLASSES, SOFTMAX}}},
+    };
+    std::cout << "CIFAR-shaped shifted patterns, float, batch " << BATCH << ", Adam, " << STEPS << " steps, "
+              << kernels<float>().name << " kernels" << std::endl;
+    double convAccuracy = 0.0;
+    for (const Candidate& candidate : candidates) {
+        NeuralNetwork<float> network(configWith(candidate.layers), SOFTMAX);
+        const double flops = forwardFlops(network);
+        const auto start = std::chrono::steady_clock::now();
+        network.train(training, validation, STEPS, static_cast<int>(STEPS));
+        const double trainSeconds = secondsSince(start);
+        const double accuracy = network.evaluate(test).accuracy;
+        const double stepNs = nanosecondsPerCall([&] { network.trainBatch(batch); });
+        Matrix<float> outputs;
+        const double predictNs = nanosecondsPerCall([&] { network.predictBatch(inputs, outputs); }) / test.size();
+        if (network.layerType(0) == CONV2D) {
+            convAccuracy = accuracy;
+        }
+        std::cout << "  " << candidate.name << std::endl;
+        std::cout << std::fixed << std::setprecision(2) << "    parameters " << network.parameterCount()
+                  << ", forward " << flops / 1e6 << " MFLOP per sample, " << std::setprecision(4)
+                  << network.parameterCount() / (flops / 1e3) << " parameters per kFLOP" << std::endl;
+        std::cout << std::setprecision(1) << "    trained in " << trainSeconds << " s, train step "
+                  << stepNs / 1e3 << " us, predictBatch " << predictNs / 1e3 << " us per sample, accuracy "
+                  << accuracy * 100 << "%" << std::endl;
+    }
+    return convAccuracy >= 0.9;
+}
+
+// One image through a 3x3 layer, im2col + GEMM against the direct kernel
+bool compareKernels(ImageShape input, bool planar, int filters) {
+    const ImageWindow window = imageWindow(input, planar, 3, 1, 1, filters);
+    Xoshiro256 generator(11);
+    AlignedVector<float> image(input.size());
+    AlignedVector<float> weights(static_cast<std::size_t>(window.patchSize()) * filters);
+    AlignedVector<float> biases(filters);
+    AlignedVector<float> patches(static_cast<std::size_t>(window.positions()) * window.patchSize());
+    AlignedVector<float> lowered(static_cast<std::size_t>(window.positions()) * filters);
+    AlignedVector<float> direct(lowered.size());
+    for (AlignedVector<float>* values : {&image, &weights, &biases}) {
+        for (float& value : *values) {
+            value = generator.uniform<float>() - 0.5f;
+        }
+    }
+    std::cout << "3x3 layer, " << input.channels << "x" << input.height << "x" << input.width << " "
+              << (planar ? "planar" : "channels-last") << " image to " << filters << " filters, relu" << std::endl;
+    bool same = true;
+    for (SimdInstructionSet instructionSet : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+        if (!isInstructionSetSupported(instructionSet)) {
+            continue;
+        }
+        const KernelTable<float>& simd = kernelTable<float>(instructionSet);
+        const double loweredNs = nanosecondsPerCall([&] {
+            im2col(window, image.data(), patches.data());
+            simd.denseForward(patches.data(), weights.data(), biases.data(), lowered.data(), window.positions(),
+                              window.patchSize(), filters, RELU);
+        });
+        const double directNs = nanosecondsPerCall([&] {
+            simd.conv3x3Forward(image.data(), weights.data(), biases.data(), direct.data(), input.height, input.width,
+                                input.channels, filters, window.channelStride(), window.pixelStride(), RELU);
+        });
+        float largest = 0.0f;
+        for (std::size_t i = 0; i < lowered.size(); i++) {
+            largest = std::max(largest, std::abs(lowered[i] - direct[i]));
+        }
+        same = same && largest < 1e-5f;
+        std::cout << "  " << std::left << std::setw(8) << simd.name << std::right << std::fixed << std::setprecision(1)
+                  << "im2col + GEMM " << std::setw(7) << loweredNs / 1e3 << " us   direct " << std::setw(7)
+                  << directNs / 1e3 << " us   " << std::setprecision(2) << loweredNs / directNs << "x   max difference "
+                  << std::scientific << std::setprecision(1) << largest << std::fixed << std::endl;
+    }
+    return same;
+}
+
+int main(void) {
+    const bool learned = compareNetworks();
+    const bool planarSame = compareKernels({CHANNELS, SIDE, SIDE}, true, 16);
+    const bool channelsLastSame = compareKernels({16, SIDE / 2, SIDE / 2}, false, 32);
+    return learned && planarSame && channelsLastSame ? EXIT_SUCCESS : EXIT_FAILURE;
+}
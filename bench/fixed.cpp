@@ -0,0 +1,73 @@
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Single-sample inference latency of the dynamic NeuralNetwork against
+// FixedNetwork on the xor (2-3-1), angles (2-8-4) and iris (4-8-3) shapes.
+// Each FixedNetwork loads the model file the NeuralNetwork saved, and their
+// outputs must agree to 1e-12 on every sample (fails otherwise).
+constexpr int SAMPLES = 64;
+
+template <int Inputs, int Hidden, int Outputs, ActivationFunction Activation>
+bool benchmarkShape(const char* name) {
+    NeuralNetworkConfig config = {Inputs, Hidden, Outputs, 0.1, Activation};
+    config.seed = 5;
+    NeuralNetwork<double> network(config, Activation);
+    const std::string path = (std::filesystem::temp_directory_path() / (std::string("fixed_bench-") + name)).string();
+    network.saveModel(path);
+    FixedNetwork<Inputs, Hidden, Outputs, Activation> fixed;
+    const bool loaded = fixed.loadModel(path);
+    std::filesystem::remove(path);
+
+    Xoshiro256 generator(11);
+    std::vector<double> inputs(SAMPLES * Inputs);
+    for (double& value : inputs) {
+        value = 4.0 * generator.uniform<double>() - 2.0;
+    }
+    double largestError = 0.0;
+    for (int s = 0; s < SAMPLES; s++) {
+        double dynamicOutputs[Outputs];
+        double fixedOutputs[Outputs];
+        network.feedforward(&inputs[s * Inputs], dynamicOutputs, false);
+        fixed.predict(&inputs[s * Inputs], fixedOutputs);
+        for (int o = 0; o < Outputs; o++) {
+            largestError = std::max(largestError, std::abs(dynamicOutputs[o] - fixedOutputs[o]));
+        }
+    }
+
+    int next = 0;
+    double sink = 0.0;
+    double outputs[Outputs];
+    const double dynamicNs = nanosecondsPerCall([&] {
+        network.feedforward(&inputs[next * Inputs], outputs, false);
+        sink += outputs[0];
+        next = (next + 1) % SAMPLES;
+    });
+    const double fixedNs = nanosecondsPerCall([&] {
+        fixed.predict(&inputs[next * Inputs], outputs);
+        sink += outputs[0];
+        next = (next + 1) % SAMPLES;
+    });
+    const bool ok = loaded && largestError <= 1e-12;
+    std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1)
+              << "NeuralNetwork " << std::setw(7) << dynamicNs << " ns  FixedNetwork " << std::setw(6) << fixedNs
+              << " ns  " << std::setprecision(1) << dynamicNs / fixedNs << "x  " << std::scientific
+              << std::setprecision(1) << "max diff " << largestError << (ok ? "" : "  MISMATCH") << std::defaultfloat
+              << std::endl;
+    if (sink == 0.5) {
+        std::cout << std::endl;  // Keeps the outputs from being optimized away
+    }
+    return ok;
+}
+
+int main(void) {
+    std::cout << "Single-sample inference, double, kernels " << kernels<double>().name << std::endl;
+    bool ok = benchmarkShape<2, 3, 1, SIGMOID>("xor");
+    ok = benchmarkShape<2, 8, 4, SIGMOID>("angles") && ok;
+    ok = benchmarkShape<4, 8, 3, SIGMOID>("iris") && ok;
+    ok = benchmarkShape<4, 8, 3, TANH>("iris-tanh") && ok;
+    ok = benchmarkShape<4, 8, 3, SOFTMAX>("iris-softmax") && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
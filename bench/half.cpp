@@ -0,0 +1,219 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include "../src/halfNetwork.cpp"
+#include "./common.cpp"
+
+// bfloat16 and fp16 weight storage against the double baseline on a wide
+// MNIST-shaped network (784 x 1024 x 10, synthetic digits as in the pruning
+// bench). A double network and a float master network are trained the same
+// way; the master is rounded into a bfloat16 and an fp16 HalfNetwork. Reports
+// model size, predictBatch and single-sample throughput, test accuracy and
+// agreement with the double network, then the same timings for an untrained
+// 3072 x 2048 layer, whose weights are well past the L2 cache at any width.
+// Fails if the SIMD conversions differ from the scalar ones, a half network
+// drifts from its master, update() after more training differs from a fresh
+// conversion, or a half model does not survive save/load.
+constexpr int HIDDEN = 1024;
+constexpr int CLASSES = 10;
+constexpr int BATCH = 256;
+
+double agreement(const std::vector<int>& a, const std::vector<int>& b) {
+    long same = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+        same += a[i] == b[i];
+    }
+    return static_cast<double>(same) / a.size();
+}
+
+// Whether toHalf matches floatToHalf bit for bit on every instruction set's
+// vector path: ties, subnormals, overflow, infinities and NaNs, then random bits
+bool conversionsMatch() {
+    std::vector<float> values = {0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65520.0f, 1e6f, 6e-8f, 3e-8f, 1e-10f,
+                                 1.00390625f, 1.01171875f, 1.00048828125f, 1.00146484375f,
+                                 std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                                 std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::denorm_min(),
+                                 std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+    Xoshiro256 generator(5);
+    while (values.size() < 100000) {
+        const uint32_t bits = static_cast<uint32_t>(generator());
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        values.push_back(value);
+    }
+    const KernelTable<float>& simd = kernels<float>();
+    std::vector<uint16_t> half(values.size());
+    for (HalfFormat format : {HALF_BFLOAT16, HALF_FLOAT16}) {
+        simd.toHalf(values.data(), half.data(), static_cast<int>(values.size()), format);
+        for (std::size_t i = 0; i < values.size(); i++) {
+            if (half[i] != floatToHalf(values[i], format)) {
+                std::cout << "  toHalf(" << values[i] << ") gave " << half[i] << ", expected "
+                          << floatToHalf(values[i], format) << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct Row {
+    const char* name;
+    std::size_t bytes;
+    double batchNs;   // Per sample, predictBatch of BATCH rows
+    double singleNs;  // One sample
+};
+
+void printRows(const std::vector<Row>& rows) {
+    const Row& baseline = rows.front();
+    for (const Row& row : rows) {
+        std::cout << "  " << std::left << std::setw(9) << row.name << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(7) << row.bytes / 1024.0 << " KiB   batch " << std::setw(6) << row.batchNs
+                  << " ns/sample (" << std::setprecision(2) << baseline.batchNs / row.batchNs << "x)   single "
+                  << std::setprecision(0) << std::setw(8) << row.singleNs << " ns (" << std::setprecision(2)
+                  << baseline.singleNs / row.singleNs << "x)" << std::endl;
+    }
+}
+
+template <typename Network, typename T>
+Row timeNetwork(const char* name, Network& network, std::size_t bytes, const Matrix<T>& batch) {
+    Matrix<T> outputs;
+    Matrix<T> one(1, batch.cols());
+    std::copy(batch.row(0), batch.row(0) + batch.cols(), one.row(0));
+    Row row = {name, bytes, 0.0, 0.0};
+    row.batchNs = nanosecondsPerCall([&] { network.predictBatch(batch, outputs); }) / batch.rows();
+    row.singleNs = nanosecondsPerCall([&] { network.predictBatch(one, outputs); });
+    return row;
+}
+
+template <typename T>
+std::size_t networkBytes(const NeuralNetwork<T>& network) {
+    return sizeof(T) * network.parameterCount();
+}
+
+// The widest layers: 3072 x 2048 relu into 10 softmax outputs, untrained,
+// as inference speed does not depend on what was learned
+void benchmarkWideLayer() {
+    NeuralNetworkConfig config = {3072, 0, 0, 1e-3, SOFTMAX};
+    config.layers = {{2048, RELU}, {CLASSES, SOFTMAX}};
+    config.seed = 3;
+    NeuralNetwork<double> baseline(config, SOFTMAX);
+    NeuralNetwork<float> master(config, SOFTMAX);
+    HalfNetwork<float> bfloat16 = HalfNetwork<float>::fromNetwork(master, HALF_BFLOAT16);
+    HalfNetwork<float> float16 = HalfNetwork<float>::fromNetwork(master, HALF_FLOAT16);
+    Matrix<double> batch(BATCH, 3072);
+    Matrix<float> floatBatch(BATCH, 3072);
+    Xoshiro256 generator(9);
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        floatBatch.data()[i] = generator.uniform<float>();
+        batch.data()[i] = floatBatch.data()[i];
+    }
+    std::cout << "3072x2048x10, untrained, speedup over double" << std::endl;
+    printRows({timeNetwork("double", baseline, networkBytes(baseline), batch),
+               timeNetwork("float", master, networkBytes(master), floatBatch),
+               timeNetwork("bfloat16", bfloat16, bfloat16.modelBytes(), floatBatch),
+               timeNetwork("fp16", float16, float16.modelBytes(), floatBatch)});
+}
+
+int main(void) {
+    bool ok = conversionsMatch();
+
+    const TrainingData<double> training = syntheticDigits<double>(3000, 1);
+    const TrainingData<double> test = syntheticDigits<double>(2000, 2);
+    const TrainingData<double> validation(test.begin(), test.begin() + 100);
+    const TrainingData<float> floatTraining = syntheticDigits<float>(3000, 1);
+    const TrainingData<float> floatTest = syntheticDigits<float>(2000, 2);
+    const TrainingData<float> floatValidation(floatTest.begin(), floatTest.begin() + 100);
+
+    const NeuralNetworkConfig config = digitsConfig(HIDDEN);
+    NeuralNetwork<double> baseline(config, SOFTMAX);
+    baseline.train(training, validation, 600, 600);
+    NeuralNetwork<float> master(config, SOFTMAX);
+    master.train(floatTraining, floatValidation, 600, 600);
+    HalfNetwork<float> bfloat16 = HalfNetwork<float>::fromNetwork(master, HALF_BFLOAT16);
+    HalfNetwork<float> float16 = HalfNetwork<float>::fromNetwork(master, HALF_FLOAT16);
+
+    const Matrix<double> inputs = inputsOf(test);
+    const Matrix<float> floatInputs = inputsOf(floatTest);
+    std::vector<int> labels(test.size());
+    for (std::size_t i = 0; i < test.size(); i++) {
+        labels[i] = static_cast<int>(i % CLASSES);
+    }
+    Matrix<double> baselineOutputs;
+    Matrix<float> masterOutputs;
+    Matrix<float> bfloat16Outputs;
+    Matrix<float> float16Outputs;
+    baseline.predictBatch(inputs, baselineOutputs);
+    master.predictBatch(floatInputs, masterOutputs);
+    bfloat16.predictBatch(floatInputs, bfloat16Outputs);
+    float16.predictBatch(floatInputs, float16Outputs);
+    const std::vector<int> baselineClasses = classesOf(baselineOutputs);
+    const std::vector<int> masterClasses = classesOf(masterOutputs);
+    const std::vector<int> bfloat16Classes = classesOf(bfloat16Outputs);
+    const std::vector<int> float16Classes = classesOf(float16Outputs);
+
+    std::cout << "784x1024x10, " << kernels<float>().name << " kernels; accuracy (agreement with double)" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto [name, classes] : {std::pair<const char*, const std::vector<int>*>{"double", &baselineClasses},
+                                 {"float", &masterClasses},
+                                 {"bfloat16", &bfloat16Classes},
+                                 {"fp16", &float16Classes}}) {
+        std::cout << "  " << std::left << std::setw(9) << name << std::right << std::setw(6)
+                  << 100.0 * agreement(*classes, labels) << "%  (" << 100.0 * agreement(*classes, baselineClasses)
+                  << "%)" << std::endl;
+    }
+    std::cout << "  largest output difference from the float master: bfloat16 " << std::setprecision(4)
+              << largestDifference(masterOutputs, bfloat16Outputs) << ", fp16 "
+              << largestDifference(masterOutputs, float16Outputs) << std::endl;
+    ok = ok && agreement(bfloat16Classes, masterClasses) >= 0.98 && agreement(float16Classes, masterClasses) >= 0.99;
+
+    const Matrix<double> batch = inputsOf(TrainingData<double>(test.begin(), test.begin() + BATCH));
+    const Matrix<float> floatBatch = inputsOf(TrainingData<float>(floatTest.begin(), floatTest.begin() + BATCH));
+    std::cout << "Inference, speedup over double" << std::endl;
+    printRows({timeNetwork("double", baseline, networkBytes(baseline), batch),
+               timeNetwork("float", master, networkBytes(master), floatBatch),
+               timeNetwork("bfloat16", bfloat16, bfloat16.modelBytes(), floatBatch),
+               timeNetwork("fp16", float16, float16.modelBytes(), floatBatch)});
+
+    // More training on the float master, rounded into the existing copy
+    master.train(floatTraining, floatValidation, 100, 100);
+    const auto start = std::chrono::steady_clock::now();
+    ok = bfloat16.update(master) && ok;
+    const std::chrono::duration<double, std::micro> updateTime = std::chrono::steady_clock::now() - start;
+    HalfNetwork<float> fresh = HalfNetwork<float>::fromNetwork(master, HALF_BFLOAT16);
+    Matrix<float> updatedOutputs;
+    Matrix<float> freshOutputs;
+    bfloat16.predictBatch(floatInputs, updatedOutputs);
+    fresh.predictBatch(floatInputs, freshOutputs);
+    master.predictBatch(floatInputs, masterOutputs);
+    ok = ok && std::equal(updatedOutputs.data(), updatedOutputs.data() + updatedOutputs.size(), freshOutputs.data());
+    std::cout << "update() from the master after 100 more steps: " << std::setprecision(0) << updateTime.count()
+              << " us, bfloat16 accuracy " << std::setprecision(2)
+              << 100.0 * agreement(classesOf(updatedOutputs), labels) << "% (master "
+              << 100.0 * agreement(classesOf(masterOutputs), labels) << "%)" << std::endl;
+
+    const std::string path = (std::filesystem::temp_directory_path() / "half_bench.half").string();
+    for (HalfNetwork<float>* network : {&bfloat16, &float16}) {
+        HalfNetwork<float> loaded;
+        std::string error;
+        Matrix<float> outputs;
+        Matrix<float> loadedOutputs;
+        const bool saved = network->save(path, error) && loaded.load(path, error);
+        std::filesystem::remove(path);
+        network->predictBatch(floatInputs, outputs);
+        if (saved) {
+            loaded.predictBatch(floatInputs, loadedOutputs);
+        }
+        if (!saved || loaded.halfFormat() != network->halfFormat() ||
+            !std::equal(outputs.data(), outputs.data() + outputs.size(), loadedOutputs.data())) {
+            std::cout << "  save/load FAILED " << error << std::endl;
+            ok = false;
+        }
+    }
+
+    benchmarkWideLayer();
+    if (!ok) {
+        std::cout << "FAILED" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,78 @@
+#include <iomanip>
+#include <tuple>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Throughput of every kernel for each instruction set the CPU supports.
+// Feedforward/backpropagation use the widest one; run with NN_SIMD=scalar or
+// NN_SIMD=avx2 to time the network on a narrower path.
+
+void report(const std::string& kernel, const std::string& shape, double nanoseconds, double elements) {
+    std::cout << "  " << std::left << std::setw(28) << kernel << std::setw(14) << shape << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << nanoseconds << " ns" << std::setprecision(2)
+              << std::setw(10) << elements / nanoseconds << " elements/ns" << std::endl;
+}
+
+int main(void) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    auto randomVector = [&](std::size_t count) {
+        std::vector<double> values(count);
+        for (double& value : values) {
+            value = dist(gen);
+        }
+        return values;
+    };
+
+    const int batchSize = 32, inputSize = 784, hiddenSize = 128, activations = 4096;
+    std::vector<double> inputs = randomVector(inputSize);
+    std::vector<double> hidden = randomVector(hiddenSize);
+    std::vector<double> weights = randomVector(inputSize * hiddenSize);
+    std::vector<double> batchInputs = randomVector(batchSize * inputSize);
+    std::vector<double> batchHidden = randomVector(batchSize * hiddenSize);
+    std::vector<double> values = randomVector(activations);
+    std::vector<double> scratch(activations);
+
+    for (SimdInstructionSet instructionSet : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+        if (!isInstructionSetSupported(instructionSet)) {
+            continue;
+        }
+        const KernelTable<double>& simd = kernelTable<double>(instructionSet);
+        std::cout << simd.name << std::endl;
+
+        volatile double sink = 0.0;
+        report("dot", "784", nanosecondsPerCall([&] { sink = sink + simd.dot(inputs.data(), weights.data(), inputSize); }), inputSize);
+        report("axpy", "128", nanosecondsPerCall([&] { simd.axpy(1e-9, hidden.data(), scratch.data(), hiddenSize); }), hiddenSize);
+        report("outerUpdate", "784x128", nanosecondsPerCall([&] {
+            simd.outerUpdate(1e-9, inputs.data(), inputSize, hidden.data(), hiddenSize, weights.data());
+        }), inputSize * hiddenSize);
+        report("gemm", "32x784x128", nanosecondsPerCall([&] {
+            simd.gemm(batchInputs.data(), weights.data(), batchHidden.data(), batchSize, inputSize, hiddenSize);
+        }), 1.0 * batchSize * inputSize * hiddenSize);
+        report("gemmTransposedAAccumulate", "32x784x128", nanosecondsPerCall([&] {
+            simd.gemmTransposedAAccumulate(batchInputs.data(), batchHidden.data(), weights.data(), batchSize, inputSize, hiddenSize, 1e-9);
+        }), 1.0 * batchSize * inputSize * hiddenSize);
+
+        for (auto [name, activation] : {std::make_pair("sigmoid", simd.sigmoid), std::make_pair("tanh", simd.tanh),
+                                        std::make_pair("relu", simd.relu), std::make_pair("softmax", simd.softmax)}) {
+            report(name, "4096", nanosecondsPerCall([&, activation = activation] {
+                std::copy(values.begin(), values.end(), scratch.begin());
+                activation(scratch.data(), activations);
+            }), activations);
+        }
+    }
+
+    std::cout << "network (" << kernels<double>().name << ")" << std::endl;
+    for (auto [name, inputSize, hiddenSize, outputSize] : {std::make_tuple("MNIST", 784, 128, 10), std::make_tuple("CIFAR-100", 3072, 100, 100)}) {
+        NeuralNetworkConfig config = {inputSize, hiddenSize, outputSize, 1e-6, TANH};
+        NeuralNetwork network(config, TANH);
+        std::vector<double> networkInputs = randomVector(inputSize);
+        std::vector<double> targets(outputSize, 0.0);
+        std::string shape = std::to_string(inputSize) + "x" + std::to_string(hiddenSize) + "x" + std::to_string(outputSize);
+        report(std::string(name) + " feedforward", shape, nanosecondsPerCall([&] { network.feedforward(networkInputs, false); }),
+               inputSize * hiddenSize + hiddenSize * outputSize);
+        report(std::string(name) + " backpropagation", shape, nanosecondsPerCall([&] { network.backpropagation(networkInputs, targets); }),
+               inputSize * hiddenSize + hiddenSize * outputSize);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include "../src/nn.cpp"
+
+// Fused dense layers (matmul + bias + activation in one kernel) against the
+// same stack run as a GEMM followed by separate bias and activation passes,
+// on a deep CIFAR-100 shaped network; then training throughput by depth.
+struct DenseLayer {
+    int inputs;
+    int outputs;
+    ActivationFunction activation;
+    std::vector<double> weights;
+    std::vector<double> biases;
+};
+
+double secondsFor(int repetitions, const std::function<void()>& function) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++) {
+        function();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(void) {
+    const KernelTable<double>& simd = kernels<double>();
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-0.05, 0.05);
+
+    const int rows = 256;
+    const std::vector<int> widths = {3072, 512, 256, 128, 100};
+    std::vector<DenseLayer> layers;
+    for (std::size_t l = 0; l + 1 < widths.size(); l++) {
+        DenseLayer layer = {widths[l], widths[l + 1], l + 2 < widths.size() ? RELU : SOFTMAX, {}, {}};
+        layer.weights.resize(static_cast<std::size_t>(layer.inputs) * layer.outputs);
+        layer.biases.resize(layer.outputs);
+        for (double& value : layer.weights) {
+            value = dist(gen);
+        }
+        for (double& value : layer.biases) {
+            value = dist(gen);
+        }
+        layers.push_back(layer);
+    }
+    std::vector<std::vector<double>> activations;
+    for (int width : widths) {
+        activations.emplace_back(static_cast<std::size_t>(rows) * width);
+    }
+    for (double& value : activations[0]) {
+        value = dist(gen) * 20.0;
+    }
+
+    auto fused = [&] {
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const DenseLayer& layer = layers[l];
+            simd.denseForward(activations[l].data(), layer.weights.data(), layer.biases.data(), activations[l + 1].data(),
+                              rows, layer.inputs, layer.outputs, layer.activation);
+        }
+    };
+    auto separate = [&] {
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const DenseLayer& layer = layers[l];
+            double* outputs = activations[l + 1].data();
+            simd.gemm(activations[l].data(), layer.weights.data(), outputs, rows, layer.inputs, layer.outputs);
+            for (int r = 0; r < rows; r++) {
+                simd.axpy(1.0, layer.biases.data(), outputs + static_cast<std::size_t>(r) * layer.outputs, layer.outputs);
+            }
+            if (layer.activation == RELU) {
+                simd.relu(outputs, rows * layer.outputs);
+            } else {
+                for (int r = 0; r < rows; r++) {
+                    simd.softmax(outputs + static_cast<std::size_t>(r) * layer.outputs, layer.outputs);
+                }
+            }
+        }
+    };
+
+    std::cout << "3072x512x256x128x100 inference, " << rows << " rows per call (" << simd.name << ")" << std::endl;
+    const int repetitions = 20;
+    fused();
+    separate();
+    for (auto [name, function] : {std::make_pair("fused", std::function<void()>(fused)),
+                                  std::make_pair("separate passes", std::function<void()>(separate))}) {
+        const double seconds = secondsFor(repetitions, function);
+        std::cout << "  " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(8) << repetitions * rows / seconds << " samples/s" << std::endl;
+    }
+
+    std::cout << "training, batch 32 on CIFAR-100 shaped data" << std::endl;
+    TrainingData<double> data;
+    for (int i = 0; i < 512; i++) {
+        std::vector<double> inputs(3072);
+        for (double& value : inputs) {
+            value = dist(gen) * 20.0;
+        }
+        std::vector<double> targets(100, 0.0);
+        targets[i % 100] = 1.0;
+        data.push_back({inputs, targets});
+    }
+    for (std::vector<LayerConfig> stack : {std::vector<LayerConfig>{{100, RELU}, {100, SOFTMAX}},
+                                           std::vector<LayerConfig>{{512, RELU}, {256, RELU}, {100, SOFTMAX}},
+                                           std::vector<LayerConfig>{{512, RELU}, {256, RELU}, {128, RELU}, {100, SOFTMAX}}}) {
+        NeuralNetworkConfig config = {3072, 0, 0, 1e-4, RELU};
+        config.layers = stack;
+        NeuralNetwork network(config, RELU);
+        std::string shape = "3072";
+        for (const LayerConfig& layer : stack) {
+            shape += "x" + std::to_string(layer.size);
+        }
+        const int batches = 16;
+        const double seconds = secondsFor(batches, [&] {
+            network.trainBatch(TrainingData<double>(data.begin(), data.begin() + 32));
+        });
+        std::cout << "  " << std::left << std::setw(24) << shape << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(8) << batches * 32 / seconds << " samples/s" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
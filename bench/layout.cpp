@@ -0,0 +1,124 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+
+// Reference copy of the nested-vector forward/backward passes the library used
+// before weights moved into Matrix, kept here to measure the layout change.
+class NestedVectorNetwork {
+public:
+    NestedVectorNetwork(int inputSize, int hiddenSize, int outputSize, double learningRate)
+        : inputSize(inputSize), hiddenSize(hiddenSize), outputSize(outputSize), learningRate(learningRate),
+          inputToHidden(inputSize, std::vector<double>(hiddenSize, 0.01)),
+          hiddenToOutput(hiddenSize, std::vector<double>(outputSize, 0.01)) {}
+
+    std::vector<double> feedforward(const std::vector<double>& inputs) {
+        std::vector<double> hiddenOutputs(hiddenSize, 0.0);
+        for (int i = 0; i < hiddenSize; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < inputSize; j++) {
+                sum += inputs[j] * inputToHidden[j][i];
+            }
+            hiddenOutputs[i] = MathUtils::sigmoid(sum);
+        }
+        std::vector<double> outputs(outputSize, 0.0);
+        for (int i = 0; i < outputSize; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < hiddenSize; j++) {
+                sum += hiddenOutputs[j] * hiddenToOutput[j][i];
+            }
+            outputs[i] = MathUtils::sigmoid(sum);
+        }
+        return outputs;
+    }
+
+    void backpropagation(const std::vector<double>& inputs, const std::vector<double>& targets) {
+        std::vector<double> hiddenOutputs(hiddenSize, 0.0);
+        std::vector<double> outputs(outputSize, 0.0);
+        for (int i = 0; i < hiddenSize; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < inputSize; j++) {
+                sum += inputs[j] * inputToHidden[j][i];
+            }
+            hiddenOutputs[i] = MathUtils::sigmoid(sum);
+        }
+        for (int i = 0; i < outputSize; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < hiddenSize; j++) {
+                sum += hiddenOutputs[j] * hiddenToOutput[j][i];
+            }
+            outputs[i] = MathUtils::sigmoid(sum);
+        }
+        std::vector<double> outputErrors(outputSize, 0.0);
+        for (int i = 0; i < outputSize; i++) {
+            outputErrors[i] = targets[i] - outputs[i];
+        }
+        std::vector<double> hiddenErrors(hiddenSize, 0.0);
+        for (int i = 0; i < hiddenSize; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < outputSize; j++) {
+                sum += outputErrors[j] * hiddenToOutput[i][j];
+            }
+            hiddenErrors[i] = hiddenOutputs[i] * (1.0 - hiddenOutputs[i]) * sum;
+        }
+        for (int i = 0; i < hiddenSize; i++) {
+            for (int j = 0; j < outputSize; j++) {
+                hiddenToOutput[i][j] += learningRate * outputErrors[j] * hiddenOutputs[i];
+            }
+        }
+        for (int i = 0; i < inputSize; i++) {
+            for (int j = 0; j < hiddenSize; j++) {
+                inputToHidden[i][j] += learningRate * hiddenErrors[j] * inputs[i];
+            }
+        }
+    }
+
+private:
+    int inputSize;
+    int hiddenSize;
+    int outputSize;
+    double learningRate;
+    std::vector<std::vector<double>> inputToHidden;
+    std::vector<std::vector<double>> hiddenToOutput;
+};
+
+template <typename Function>
+double microsecondsPerCall(int calls, Function function) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++) {
+        function();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / calls;
+}
+
+void benchmarkShape(const std::string& name, int inputSize, int hiddenSize, int outputSize, int calls) {
+    std::vector<double> inputs(inputSize);
+    for (int i = 0; i < inputSize; i++) {
+        inputs[i] = static_cast<double>(i % 255) / 255.0;
+    }
+    std::vector<double> targets(outputSize, 0.0);
+    targets[0] = 1.0;
+
+    NeuralNetworkConfig config = {inputSize, hiddenSize, outputSize, 0.001, SIGMOID};
+    NeuralNetwork network(config, SIGMOID);
+    NestedVectorNetwork nested(inputSize, hiddenSize, outputSize, 0.001);
+
+    double nestedForward = microsecondsPerCall(calls, [&] { nested.feedforward(inputs); });
+    double matrixForward = microsecondsPerCall(calls, [&] { network.feedforward(inputs, false); });
+    double nestedBackward = microsecondsPerCall(calls, [&] { nested.backpropagation(inputs, targets); });
+    double matrixBackward = microsecondsPerCall(calls, [&] { network.backpropagation(inputs, targets); });
+
+    std::cout << std::fixed << std::setprecision(1)
+              << name << " " << inputSize << "x" << hiddenSize << "x" << outputSize << std::endl
+              << "  feedforward:     nested " << nestedForward << " us, matrix " << matrixForward
+              << " us, speedup " << std::setprecision(2) << nestedForward / matrixForward << "x" << std::endl
+              << std::setprecision(1)
+              << "  backpropagation: nested " << nestedBackward << " us, matrix " << matrixBackward
+              << " us, speedup " << std::setprecision(2) << nestedBackward / matrixBackward << "x" << std::endl;
+}
+
+int main(void) {
+    benchmarkShape("MNIST", 784, 128, 10, 2000);
+    benchmarkShape("CIFAR-100", 3072, 100, 100, 500);
+    return EXIT_SUCCESS;
+}
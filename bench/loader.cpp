@@ -0,0 +1,78 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Building the whole normalized TrainingData up front against streaming
+// batches from a DataLoader, on CIFAR-100 shaped samples (3072 uint8 pixels,
+// 100 classes): time before the first step, memory held for the samples,
+// and training throughput once running.
+constexpr int IMAGE_SIZE = 3072;
+constexpr int CLASSES = 100;
+
+void report(const std::string& name, double startup, std::size_t bytes, double samplesPerSecond) {
+    std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(3)
+              << "startup " << std::setw(7) << startup << " s  " << std::setprecision(0) << "samples "
+              << std::setw(7) << bytes / 1024 << " KiB  "
+              << "train " << std::setw(7) << samplesPerSecond << " samples/s" << std::endl;
+}
+
+int main(void) {
+    const int count = 20000;
+    const int batchSize = 32;
+    const long steps = 200;
+
+    // Raw records laid out like the CIFAR-100 file: coarse, fine, pixels
+    std::mt19937 gen(42);
+    std::vector<uint8_t> records(static_cast<std::size_t>(count) * CifarDataset::RECORD_BYTES);
+    for (uint8_t& byte : records) {
+        byte = static_cast<uint8_t>(gen());
+    }
+    for (int i = 0; i < count; i++) {
+        records[static_cast<std::size_t>(i) * CifarDataset::RECORD_BYTES + 1] = static_cast<uint8_t>(i % CLASSES);
+    }
+    const ByteView images(records.data() + 2, count, IMAGE_SIZE, CifarDataset::RECORD_BYTES);
+    const ByteView labels(records.data() + 1, count, 1, CifarDataset::RECORD_BYTES);
+
+    NeuralNetworkConfig config = {IMAGE_SIZE, 100, CLASSES, 1e-3, RELU};
+    config.batchSize = batchSize;
+    const TrainingData<float> validationData;
+    std::cout << count << " CIFAR-100 shaped samples, 3072x100x100 float network, batch " << batchSize << std::endl;
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        TrainingData<float> data;
+        for (int i = 0; i < count; i++) {
+            std::vector<float> inputs(IMAGE_SIZE);
+            for (int p = 0; p < IMAGE_SIZE; p++) {
+                inputs[p] = images[i][p] / 255.0f;
+            }
+            std::vector<float> targets(CLASSES, 0.0f);
+            targets[labels[i][0]] = 1.0f;
+            data.push_back({inputs, targets});
+        }
+        const double startup = secondsSince(start);
+        NeuralNetwork<float> network(config, RELU);
+        start = std::chrono::steady_clock::now();
+        network.train(data, validationData, steps, steps + 1);
+        const double seconds = secondsSince(start);
+        report("TrainingData", startup, static_cast<std::size_t>(count) * (IMAGE_SIZE + CLASSES) * sizeof(float),
+               steps * batchSize / seconds);
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        DataLoader<float>::Options options;
+        options.batchSize = batchSize;
+        DataLoader<float> loader(images, labels, CLASSES, options);
+        const double startup = secondsSince(start);
+        NeuralNetwork<float> network(config, RELU);
+        start = std::chrono::steady_clock::now();
+        network.train(loader, validationData, steps, steps + 1);
+        const double seconds = secondsSince(start);
+        // The bytes themselves are the mapped file; the loader adds two batches
+        report("DataLoader", startup, 2 * static_cast<std::size_t>(batchSize) * (IMAGE_SIZE + CLASSES) * sizeof(float),
+               steps * batchSize / seconds);
+    }
+    return EXIT_SUCCESS;
+}
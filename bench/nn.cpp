@@ -0,0 +1,215 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include "../src/nn.cpp"
+
+// End-to-end benchmark suite: feedforward, backpropagation, calculateLoss,
+// saveModel, loadModel and train() on the network shapes of the xor, angles,
+// iris, mnist and cifar-100 examples, all on synthetic data so that no
+// dataset is needed. Progress goes to stderr and the results to stdout (or
+// --output FILE) as JSON, one entry per shape and operation, for comparing
+// releases. Every entry is the best of REPETITIONS timings, each running the
+// operation for at least --min-time seconds (0.2 by default).
+constexpr int SAMPLES = 256;
+constexpr int REPETITIONS = 3;
+
+struct Shape {
+    const char* name;
+    int inputs;
+    std::vector<LayerConfig> layers;
+    int batchSize;  // Of the train() steps, as in the example
+    OptimizerType optimizer;
+    double dropoutRate;
+    long trainIterations;  // Steps per timed train() call
+};
+
+struct Result {
+    std::string shape;
+    std::string operation;
+    const char* unit;
+    double nanoseconds;  // Per unit
+};
+
+// Discards the progress bar output of train() and the messages of loadModel()
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+// Best time per call of `operation` over REPETITIONS runs of at least minSeconds each
+template <typename Operation>
+double nanosecondsPerCall(double minSeconds, Operation operation) {
+    double best = std::numeric_limits<double>::max();
+    for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+        long calls = 1;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < calls; i++) {
+                operation();
+            }
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= minSeconds * 1e9) {
+                best = std::min(best, elapsed.count() / calls);
+                break;
+            }
+            calls *= 2;
+        }
+    }
+    return best;
+}
+
+TrainingData<double> syntheticData(int inputs, int classes, uint64_t seed) {
+    Xoshiro256 generator(seed);
+    TrainingData<double> data;
+    for (int s = 0; s < SAMPLES; s++) {
+        std::vector<double> sample(inputs);
+        for (double& value : sample) {
+            value = generator.uniform<double>();
+        }
+        std::vector<double> targets(classes, 0.0);
+        targets[generator.below(classes)] = 1.0;
+        data.push_back({sample, targets});
+    }
+    return data;
+}
+
+void benchmarkShape(const Shape& shape, double minSeconds, std::vector<Result>& results) {
+    const int classes = shape.layers.back().size;
+    const TrainingData<double> data = syntheticData(shape.inputs, classes, 1);
+    const TrainingData<double> validation(data.begin(), data.begin() + 16);
+
+    NeuralNetworkConfig config = {shape.inputs, 0, 0, 0.01, shape.layers.back().activation};
+    config.layers = shape.layers;
+    config.batchSize = shape.batchSize;
+    config.optimizer.type = shape.optimizer;
+    config.seed = 42;
+    NeuralNetwork<double> network(config, shape.layers.back().activation, shape.dropoutRate);
+    const std::string modelPath =
+        (std::filesystem::temp_directory_path() / (std::string("nn_bench-") + shape.name + ".bin")).string();
+
+    auto record = [&](const char* operation, const char* unit, double nanoseconds) {
+        results.push_back({shape.name, operation, unit, nanoseconds});
+        std::cerr << "  " << std::left << std::setw(10) << shape.name << std::setw(16) << operation << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(14) << nanoseconds << " ns/" << unit << std::endl;
+    };
+
+    std::size_t next = 0;
+    std::vector<double> outputs(classes);
+    record("feedforward", "sample", nanosecondsPerCall(minSeconds, [&] {
+        network.feedforward(data[next].first.data(), outputs.data(), false);
+        next = (next + 1) % data.size();
+    }));
+    record("backpropagation", "sample", nanosecondsPerCall(minSeconds, [&] {
+        network.backpropagation(data[next].first, data[next].second);
+        next = (next + 1) % data.size();
+    }));
+    record("calculateLoss", "sample",
+           nanosecondsPerCall(minSeconds, [&] { network.calculateLoss(data); }) / data.size());
+
+    std::streambuf* console = std::cout.rdbuf();
+    NullBuffer nullBuffer;
+    std::cout.rdbuf(&nullBuffer);
+    record("saveModel", "call", nanosecondsPerCall(minSeconds, [&] { network.saveModel(modelPath); }));
+    record("loadModel", "call", nanosecondsPerCall(minSeconds, [&] { network.loadModel(modelPath); }));
+    // Checking the validation loss only at the end keeps train() from stopping early
+    const long iterations = shape.trainIterations;
+    record("train", "sample", nanosecondsPerCall(minSeconds, [&] {
+        network.train(data, validation, iterations, static_cast<int>(iterations));
+    }) / (iterations * shape.batchSize));
+    std::cout.rdbuf(console);
+    std::filesystem::remove(modelPath);
+}
+
+std::string jsonString(const std::string& value) {
+    std::string escaped = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+void writeJson(std::ostream& out, const std::vector<Shape>& shapes, const std::vector<Result>& results) {
+    out << "{\n";
+    out << "  \"benchmark\": \"nn_bench\",\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": " << jsonString(__VERSION__) << ",\n";
+#endif
+    out << "  \"kernels\": " << jsonString(kernels<double>().name) << ",\n";
+    out << "  \"precision\": \"double\",\n";
+    out << "  \"repetitions\": " << REPETITIONS << ",\n";
+    out << "  \"shapes\": {";
+    for (std::size_t s = 0; s < shapes.size(); s++) {
+        out << (s == 0 ? "\n" : ",\n") << "    " << jsonString(shapes[s].name) << ": {\"layers\": [" << shapes[s].inputs;
+        for (const LayerConfig& layer : shapes[s].layers) {
+            out << ", " << layer.size;
+        }
+        out << "], \"batchSize\": " << shapes[s].batchSize << "}";
+    }
+    out << "\n  },\n";
+    out << "  \"results\": [";
+    for (std::size_t r = 0; r < results.size(); r++) {
+        const Result& result = results[r];
+        out << (r == 0 ? "\n" : ",\n") << "    {\"shape\": " << jsonString(result.shape)
+            << ", \"operation\": " << jsonString(result.operation) << ", \"unit\": " << jsonString(result.unit)
+            << std::setprecision(6) << std::defaultfloat << ", \"nanoseconds\": " << result.nanoseconds
+            << ", \"perSecond\": " << 1e9 / result.nanoseconds << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    double minSeconds = 0.2;
+    std::string outputPath;
+    std::string only;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--shape") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--min-time SECONDS] [--output FILE] [--shape NAME]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::vector<Shape> allShapes = {
+        {"xor", 2, {{3, SIGMOID}, {1, SIGMOID}}, 4, MOMENTUM, 0.0, 1000},
+        {"angles", 2, {{8, SIGMOID}, {4, SIGMOID}}, 1, SGD, 0.0, 1000},
+        {"iris", 4, {{8, SIGMOID}, {3, SIGMOID}}, 1, SGD, 0.0, 1000},
+        {"mnist", 784, {{128, TANH}, {10, TANH}}, 32, ADAM, 0.2, 20},
+        {"cifar-100", 3072, {{100, RELU}, {100, RELU}}, 1, SGD, 0.0, 100},
+    };
+    std::vector<Shape> shapes;
+    for (const Shape& shape : allShapes) {
+        if (only.empty() || only == shape.name) {
+            shapes.push_back(shape);
+        }
+    }
+    if (shapes.empty()) {
+        std::cerr << "Unknown shape " << only << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "nn_bench, kernels " << kernels<double>().name << ", best of " << REPETITIONS << std::endl;
+    std::vector<Result> results;
+    for (const Shape& shape : shapes) {
+        benchmarkShape(shape, minSeconds, results);
+    }
+
+    if (outputPath.empty()) {
+        writeJson(std::cout, shapes, results);
+    } else {
+        std::ofstream file(outputPath);
+        if (!file) {
+            std::cerr << "Unable to write " << outputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+        writeJson(file, shapes, results);
+    }
+    return EXIT_SUCCESS;
+}
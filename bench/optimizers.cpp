@@ -0,0 +1,148 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Time to a target accuracy for every optimizer, on XOR (2x3x1 sigmoid,
+// full batch, until every output is within 0.1 of its target) and on
+// synthetic MNIST-shaped digits (784x128x10 relu/softmax, batches of 32,
+// until 95% test accuracy). Networks start from random weights, so every
+// configuration runs several times; the report gives how many runs reached
+// the target and the median steps and time of those that did.
+constexpr int RUNS = 5;
+// Less noise than the digits default, so every optimizer can reach 95%
+constexpr float DIGIT_NOISE = 3.0f;
+
+struct Result {
+    long steps = -1;  // -1 when the target was not reached
+    double seconds = 0.0;
+};
+
+struct Setup {
+    const char* name;
+    double learningRate;
+    OptimizerConfig optimizer;
+    LearningRateSchedule schedule;
+};
+
+// Calls step() until reached() holds, checking every `interval` steps
+template <typename Step, typename Reached>
+Result timeToTarget(long maxSteps, long interval, Step step, Reached reached) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 1; i <= maxSteps; i++) {
+        step();
+        if (i % interval == 0 && reached()) {
+            result.steps = i;
+            break;
+        }
+    }
+    result.seconds = secondsSince(start);
+    return result;
+}
+
+void report(const Setup& setup, std::vector<Result> results) {
+    results.erase(std::remove_if(results.begin(), results.end(), [](const Result& result) { return result.steps < 0; }),
+                  results.end());
+    std::cout << "  " << std::left << std::setw(26) << setup.name << std::right << results.size() << "/" << RUNS
+              << " reached";
+    if (results.empty()) {
+        std::cout << std::endl;
+        return;
+    }
+    std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.steps < b.steps; });
+    const Result& median = results[results.size() / 2];
+    std::cout << std::setw(8) << median.steps << " steps" << std::fixed << std::setprecision(3) << std::setw(10)
+              << median.seconds << " s" << std::endl;
+}
+
+Result trainXor(const Setup& setup) {
+    NeuralNetworkConfig config = {2, 3, 1, setup.learningRate, SIGMOID};
+    config.batchSize = 4;
+    config.optimizer = setup.optimizer;
+    config.learningRateSchedule = setup.schedule;
+    NeuralNetwork<double> network(config, SIGMOID);
+    const TrainingData<double> data = {{{0, 0}, {0}}, {{0, 1}, {1}}, {{1, 0}, {1}}, {{1, 1}, {0}}};
+    std::vector<double> output;
+    return timeToTarget(1000000, 100, [&] { network.trainBatch(data); }, [&] {
+        for (const auto& [inputs, targets] : data) {
+            network.feedforward(inputs, output, false);
+            if (std::abs(output[0] - targets[0]) > 0.1) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+Result trainDigits(const Setup& setup, const TrainingData<float>& train, const TrainingData<float>& test) {
+    NeuralNetworkConfig config = {DIGIT_INPUTS, 0, 0, setup.learningRate, RELU};
+    config.layers = {{128, RELU}, {DIGIT_CLASSES, SOFTMAX}};
+    config.batchSize = 32;
+    config.optimizer = setup.optimizer;
+    config.learningRateSchedule = setup.schedule;
+    NeuralNetwork<float> network(config, RELU);
+    std::size_t next = 0;
+    TrainingData<float> batch;
+    return timeToTarget(5000, 10, [&] {
+        batch.assign(train.begin() + next, train.begin() + next + 32);
+        next = (next + 32) % (train.size() - 32);
+        network.trainBatch(batch);
+    }, [&] { return network.evaluate(test, 1).accuracy >= 0.95; });
+}
+
+int main(void) {
+    OptimizerConfig sgd;
+    OptimizerConfig momentum;
+    momentum.type = MOMENTUM;
+    OptimizerConfig nesterov;
+    nesterov.type = NESTEROV;
+    OptimizerConfig adam;
+    adam.type = ADAM;
+    OptimizerConfig adamw;
+    adamw.type = ADAMW;
+    adamw.weightDecay = 1e-4;
+    LearningRateSchedule constant;
+    LearningRateSchedule warmupCosine;
+    warmupCosine.type = COSINE_SCHEDULE;
+    warmupCosine.warmupSteps = 100;
+    warmupCosine.totalSteps = 5000;
+
+    const std::vector<Setup> xorSetups = {
+        {"sgd 0.1", 0.1, sgd, constant},
+        {"sgd 1", 1.0, sgd, constant},
+        {"momentum 0.1", 0.1, momentum, constant},
+        {"nesterov 0.1", 0.1, nesterov, constant},
+        {"adam 0.05", 0.05, adam, constant},
+        {"adamw 0.05", 0.05, adamw, constant},
+        {"adam 0.05 warmup+cosine", 0.05, adam, warmupCosine},
+    };
+    std::cout << "XOR, every output within 0.1" << std::endl;
+    for (const Setup& setup : xorSetups) {
+        std::vector<Result> results;
+        for (int run = 0; run < RUNS; run++) {
+            results.push_back(trainXor(setup));
+        }
+        report(setup, results);
+    }
+
+    const TrainingData<float> train = syntheticDigits<float>(10000, 1, DIGIT_NOISE);
+    const TrainingData<float> test = syntheticDigits<float>(1000, 2, DIGIT_NOISE);
+    const std::vector<Setup> digitSetups = {
+        {"sgd 0.05", 0.05, sgd, constant},
+        {"momentum 0.01", 0.01, momentum, constant},
+        {"nesterov 0.01", 0.01, nesterov, constant},
+        {"adam 0.001", 0.001, adam, constant},
+        {"adamw 0.001", 0.001, adamw, constant},
+        {"adam 0.001 warmup+cosine", 0.001, adam, warmupCosine},
+    };
+    std::cout << "Synthetic digits (MNIST shape), 95% test accuracy, kernels " << kernels<float>().name << std::endl;
+    for (const Setup& setup : digitSetups) {
+        std::vector<Result> results;
+        for (int run = 0; run < RUNS; run++) {
+            results.push_back(trainDigits(setup, train, test));
+        }
+        report(setup, results);
+    }
+    return EXIT_SUCCESS;
+}
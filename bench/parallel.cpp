@@ -0,0 +1,56 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+
+// Data-parallel training throughput on MNIST-shaped synthetic data, from one
+// thread up to every hardware thread, for both parallel modes.
+int main(void) {
+    const int inputSize = 784, hiddenSize = 128, outputSize = 10, batchSize = 64;
+    const long iterations = 200;
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<std::pair<std::vector<double>, std::vector<double>>> trainingData;
+    for (int i = 0; i < 4096; i++) {
+        std::vector<double> inputs(inputSize);
+        for (double& value : inputs) {
+            value = dist(gen);
+        }
+        std::vector<double> targets(outputSize, 0.0);
+        targets[i % outputSize] = 1.0;
+        trainingData.push_back({inputs, targets});
+    }
+    std::vector<std::pair<std::vector<double>, std::vector<double>>> validationData(trainingData.begin(), trainingData.begin() + 64);
+
+    int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "MNIST " << inputSize << "x" << hiddenSize << "x" << outputSize << ", batch " << batchSize
+              << ", " << maxThreads << " hardware threads" << std::endl;
+    for (ParallelMode mode : {ALL_REDUCE, HOGWILD}) {
+        for (int threads : threadCounts) {
+            NeuralNetworkConfig config = {inputSize, hiddenSize, outputSize, 0.01, SIGMOID};
+            config.batchSize = batchSize;
+            config.threads = threads;
+            config.parallelMode = mode;
+            NeuralNetwork network(config, SIGMOID);
+
+            // Silence the progress bar while timing
+            std::streambuf* output = std::cout.rdbuf(nullptr);
+            auto start = std::chrono::steady_clock::now();
+            network.train(trainingData, validationData, iterations, iterations);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout.rdbuf(output);
+            std::cout.clear();
+
+            std::cout << "  " << (mode == ALL_REDUCE ? "all-reduce" : "hogwild   ") << " threads " << std::setw(3) << threads
+                      << ": " << std::fixed << std::setprecision(0) << iterations * batchSize / elapsed.count()
+                      << " samples/s" << std::endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// float against double networks on the MNIST shape (784 x 128 x 10): training
+// and inference throughput, model size and test accuracy. The image files are
+// not shipped with the repository, so the samples are the shared synthetic
+// digits quantized to uint8 pixels like the real set. Both precisions see
+// exactly the same pixels.
+constexpr int IMAGE_SIZE = DIGIT_INPUTS;
+constexpr int CLASSES = DIGIT_CLASSES;
+
+struct Images {
+    std::vector<uint8_t> pixels;  // count x IMAGE_SIZE
+    std::vector<uint8_t> labels;
+};
+
+// The shared synthetic digits quantized to uint8 pixels like the real set
+Images digitImages(int count, uint64_t seed) {
+    const TrainingData<float> digits = syntheticDigits<float>(count, seed, 2.0f);
+    Images images;
+    images.pixels.resize(static_cast<std::size_t>(count) * IMAGE_SIZE);
+    images.labels.resize(count);
+    for (int i = 0; i < count; i++) {
+        const std::vector<float>& targets = digits[i].second;
+        images.labels[i] = static_cast<uint8_t>(std::max_element(targets.begin(), targets.end()) - targets.begin());
+        for (int p = 0; p < IMAGE_SIZE; p++) {
+            images.pixels[static_cast<std::size_t>(i) * IMAGE_SIZE + p] =
+                static_cast<uint8_t>(std::lround(255.0f * digits[i].first[p]));
+        }
+    }
+    return images;
+}
+
+// Mean image of the training set, in [0, 1] units
+std::vector<double> meanImage(const Images& images) {
+    std::vector<double> mean(IMAGE_SIZE, 0.0);
+    for (std::size_t i = 0; i < images.pixels.size(); i++) {
+        mean[i % IMAGE_SIZE] += images.pixels[i] / 255.0;
+    }
+    for (double& value : mean) {
+        value /= images.labels.size();
+    }
+    return mean;
+}
+
+// Pixels centred on the training mean so the sigmoid hidden layer does not start saturated
+template <typename T>
+void normalizeImage(const uint8_t* pixels, const std::vector<double>& mean, T* inputs) {
+    for (int p = 0; p < IMAGE_SIZE; p++) {
+        inputs[p] = static_cast<T>(pixels[p] / 255.0 - mean[p]);
+    }
+}
+
+template <typename T>
+TrainingData<T> toTrainingData(const Images& images, const std::vector<double>& mean) {
+    TrainingData<T> data;
+    for (std::size_t i = 0; i < images.labels.size(); i++) {
+        std::vector<T> inputs(IMAGE_SIZE);
+        normalizeImage(&images.pixels[i * IMAGE_SIZE], mean, inputs.data());
+        std::vector<T> targets(CLASSES, T(0));
+        targets[images.labels[i]] = T(1);
+        data.push_back({inputs, targets});
+    }
+    return data;
+}
+
+template <typename T>
+void benchmarkPrecision(const std::string& name, const Images& train, const Images& test, int epochs) {
+    const int batchSize = 32;
+    NeuralNetworkConfig config = {IMAGE_SIZE, 128, CLASSES, 0.05, SIGMOID};
+    config.batchSize = batchSize;
+    NeuralNetwork<T> network(config, SIGMOID);
+    const std::vector<double> mean = meanImage(train);
+    const TrainingData<T> trainingData = toTrainingData<T>(train, mean);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int epoch = 0; epoch < epochs; epoch++) {
+        for (std::size_t first = 0; first < trainingData.size(); first += batchSize) {
+            const std::size_t last = std::min(first + batchSize, trainingData.size());
+            network.trainBatch(TrainingData<T>(trainingData.begin() + first, trainingData.begin() + last));
+        }
+    }
+    std::chrono::duration<double> trainTime = std::chrono::steady_clock::now() - start;
+
+    Matrix<T> inputs(static_cast<int>(test.labels.size()), IMAGE_SIZE);
+    for (int i = 0; i < inputs.rows(); i++) {
+        normalizeImage(&test.pixels[static_cast<std::size_t>(i) * IMAGE_SIZE], mean, inputs.row(i));
+    }
+    Matrix<T> outputs;
+    start = std::chrono::steady_clock::now();
+    network.predictBatch(inputs, outputs);
+    std::chrono::duration<double> inferenceTime = std::chrono::steady_clock::now() - start;
+
+    EvaluationResult result = network.evaluate(
+        test.labels.size(),
+        [&](std::size_t i, T* row) { std::copy(inputs.row(static_cast<int>(i)), inputs.row(static_cast<int>(i)) + IMAGE_SIZE, row); },
+        [&](std::size_t i) { return test.labels[i]; },
+        1);
+
+    const std::size_t parameters = static_cast<std::size_t>(IMAGE_SIZE) * 128 + 128 * CLASSES;
+    std::cout << std::left << std::setw(7) << name << std::right << std::fixed << std::setprecision(0)
+              << "train " << std::setw(7) << epochs * train.labels.size() / trainTime.count() << " samples/s  "
+              << "infer " << std::setw(8) << test.labels.size() / inferenceTime.count() << " samples/s  "
+              << "model " << std::setw(4) << parameters * sizeof(T) / 1024 << " KiB  "
+              << "accuracy " << std::setprecision(2) << 100.0 * result.accuracy << "%" << std::endl;
+}
+
+int main(void) {
+    const Images train = digitImages(10000, 1);
+    const Images test = digitImages(2000, 2);
+    std::cout << "MNIST shape, " << train.labels.size() << " training / " << test.labels.size()
+              << " test samples, kernels " << kernels<float>().name << std::endl;
+    benchmarkPrecision<double>("double", train, test, 2);
+    benchmarkPrecision<float>("float", train, test, 2);
+    return EXIT_SUCCESS;
+}
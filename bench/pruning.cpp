@@ -0,0 +1,171 @@
+#include <filesystem>
+#include <iomanip>
+#include "../src/sparseNetwork.cpp"
+#include "./common.cpp"
+
+// Magnitude pruning on the MNIST shape. A 784x128x10 float network is
+// trained on synthetic digits (ten random prototypes plus noise), then
+// pruned one-shot to 80, 90 and 95% sparsity, per weight (stored as CSR) and
+// per 1x16 block (stored block-sparse), and fine-tuned with the zeros held
+// in place. Reports accuracy before and after fine-tuning, model size and
+// the predictBatch and single-sample speedups of the sparse network over the
+// dense one, then the same timings for the 3072x100 CIFAR first layer and a
+// run of gradual pruning during train(). Fails if a sparse network's outputs
+// differ from the pruned network's, fine-tuning loses the sparsity, the
+// sparse model does not survive save/load, or a file whose layers do not
+// chain loads.
+constexpr int HIDDEN = 128;
+constexpr int CLASSES = 10;
+constexpr int BATCH = 256;
+
+struct Timing {
+    double denseBatchNs;   // Per sample, predictBatch of BATCH rows
+    double sparseBatchNs;
+    double denseSingleNs;  // One sample
+    double sparseSingleNs;
+};
+
+Timing timePredictions(NeuralNetwork<float>& network, SparseNetwork<float>& sparse, const Matrix<float>& batch) {
+    Matrix<float> one(1, batch.cols());
+    std::copy(batch.row(0), batch.row(0) + batch.cols(), one.row(0));
+    Matrix<float> outputs;
+    std::vector<float> output(sparse.outputSize());
+    Timing timing;
+    timing.denseBatchNs = nanosecondsPerCall([&] { network.predictBatch(batch, outputs); }) / batch.rows();
+    timing.sparseBatchNs = nanosecondsPerCall([&] { sparse.predictBatch(batch, outputs); }) / batch.rows();
+    timing.denseSingleNs = nanosecondsPerCall([&] { network.predictBatch(one, outputs); });
+    timing.sparseSingleNs = nanosecondsPerCall([&] { sparse.predict(one.row(0), output.data()); });
+    return timing;
+}
+
+void printTiming(const Timing& timing) {
+    std::cout << std::setprecision(0) << "batch " << std::setw(5) << timing.sparseBatchNs << " ns/sample ("
+              << std::setprecision(2) << std::setw(4) << timing.denseBatchNs / timing.sparseBatchNs << "x)   single "
+              << std::setprecision(0) << std::setw(6) << timing.sparseSingleNs << " ns (" << std::setprecision(2)
+              << std::setw(4) << timing.denseSingleNs / timing.sparseSingleNs << "x)" << std::endl;
+}
+
+// A sparse model file whose second layer does not take the first layer's
+// outputs, which load() must refuse
+bool checkMismatchedChain() {
+    const std::string path = (std::filesystem::temp_directory_path() / "pruning_bench_chain.sparse").string();
+    PackedFileWriter writer({{4, 3, TANH, 0}, {5, 2, SOFTMAX, 0}});
+    std::string error;
+    SparseNetwork<float> loaded;
+    const bool refused = writer.write(path, SPARSE_FILE_MAGIC, SPARSE_FILE_VERSION, 0, error) &&
+                         !loaded.load(path, error);
+    std::filesystem::remove(path);
+    std::cout << "Mismatched layer chain: " << (refused ? "refused, " + error : std::string("LOADED")) << std::endl;
+    return refused;
+}
+
+// The first layer of the CIFAR-100 network (3072x100 relu, then 10 softmax
+// outputs here), untrained: pruning speed does not depend on what was learned
+void benchmarkCifarLayer() {
+    NeuralNetworkConfig config = {3072, 0, 0, 1e-3, SOFTMAX};
+    config.layers = {{100, RELU}, {CLASSES, SOFTMAX}};
+    config.seed = 3;
+    Matrix<float> batch(BATCH, 3072);
+    Xoshiro256 generator(9);
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        batch.data()[i] = generator.uniform<float>();
+    }
+    std::cout << "3072x100x10 (CIFAR first layer), speedup over dense" << std::endl;
+    for (double sparsity : {0.8, 0.9, 0.95}) {
+        for (PruningGranularity granularity : {PRUNE_WEIGHTS, PRUNE_BLOCKS}) {
+            NeuralNetwork<float> network(config, SOFTMAX);
+            network.pruneWeights(sparsity, granularity);
+            SparseNetwork<float> sparse = SparseNetwork<float>::fromNetwork(
+                network, granularity == PRUNE_BLOCKS ? SPARSE_BLOCKS : SPARSE_CSR);
+            std::cout << "  " << std::setprecision(0) << sparsity * 100 << "% "
+                      << (granularity == PRUNE_BLOCKS ? "blocks " : "weights") << "   ";
+            printTiming(timePredictions(network, sparse, batch));
+        }
+    }
+}
+
+int main(void) {
+    const TrainingData<float> training = syntheticDigits<float>(3000, 1);
+    const TrainingData<float> test = syntheticDigits<float>(2000, 2);
+    const TrainingData<float> validation(test.begin(), test.begin() + 100);
+    const Matrix<float> batch = inputsOf(test, BATCH);
+
+    NeuralNetworkConfig config = digitsConfig(HIDDEN);
+    NeuralNetwork<float> trained(config, SOFTMAX);
+    trained.train(training, validation, 1500, 1500);
+    const double denseAccuracy = trained.evaluate(test).accuracy;
+    const std::string modelPath = (std::filesystem::temp_directory_path() / "pruning_bench.bin").string();
+    trained.saveModel(modelPath);
+    std::cout << "784x128x10 float network, accuracy " << std::fixed << std::setprecision(2) << denseAccuracy * 100
+              << "%, " << kernels<float>().name << " kernels" << std::endl;
+    std::cout << "  sparsity      one-shot  fine-tuned   size       speedup over dense" << std::endl;
+
+    bool ok = true;
+    for (double sparsity : {0.8, 0.9, 0.95}) {
+        for (PruningGranularity granularity : {PRUNE_WEIGHTS, PRUNE_BLOCKS}) {
+            NeuralNetwork<float> network(config, SOFTMAX);
+            ok = network.loadModel(modelPath) && ok;
+            network.pruneWeights(sparsity, granularity);
+            const double oneShotAccuracy = network.evaluate(test).accuracy;
+            network.train(training, validation, 500, 500);
+            const double fineTunedAccuracy = network.evaluate(test).accuracy;
+            // The output layer is never pruned
+            ok = ok && network.weightSparsity(0) >= sparsity - 1e-3;
+
+            const SparseFormat format = granularity == PRUNE_BLOCKS ? SPARSE_BLOCKS : SPARSE_CSR;
+            SparseNetwork<float> sparse = SparseNetwork<float>::fromNetwork(network, format);
+            Matrix<float> expected;
+            Matrix<float> outputs;
+            network.predictBatch(batch, expected);
+            sparse.predictBatch(batch, outputs);
+            Matrix<float> single(1, CLASSES);
+            sparse.predict(batch.row(0), single.row(0));
+            Matrix<float> expectedSingle(1, CLASSES);
+            std::copy(expected.row(0), expected.row(0) + CLASSES, expectedSingle.row(0));
+            ok = ok && sparse.layerFormat(0) == format && largestDifference(expected, outputs) < 1e-5f &&
+                 largestDifference(expectedSingle, single) < 1e-5f;
+            const double denseBytes = static_cast<double>(sizeof(float) * trained.parameterCount());
+
+            std::cout << "  " << std::setprecision(0) << sparsity * 100 << "% "
+                      << (granularity == PRUNE_BLOCKS ? "blocks " : "weights") << "   " << std::setprecision(2)
+                      << std::setw(6) << oneShotAccuracy * 100 << "%   " << std::setw(6) << fineTunedAccuracy * 100
+                      << "%   " << std::setprecision(1) << std::setw(5) << sparse.modelBytes() / 1024.0 << " KiB ("
+                      << std::setprecision(1) << denseBytes / sparse.modelBytes() << "x)   ";
+            printTiming(timePredictions(network, sparse, batch));
+
+            if (sparsity == 0.9) {
+                const std::string path = (std::filesystem::temp_directory_path() / "pruning_bench.sparse").string();
+                SparseNetwork<float> loaded;
+                std::string error;
+                Matrix<float> loadedOutputs;
+                const bool saved = sparse.save(path, error) && loaded.load(path, error);
+                std::filesystem::remove(path);
+                if (saved) {
+                    loaded.predictBatch(batch, loadedOutputs);
+                }
+                if (!saved || !std::equal(outputs.data(), outputs.data() + outputs.size(), loadedOutputs.data())) {
+                    std::cout << "  save/load FAILED " << error << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    std::filesystem::remove(modelPath);
+
+    ok = checkMismatchedChain() && ok;
+    benchmarkCifarLayer();
+
+    // Gradual pruning to 90% over steps 300..1200 of a fresh run
+    config.pruning.targetSparsity = 0.9;
+    config.pruning.startStep = 300;
+    config.pruning.endStep = 1200;
+    config.pruning.interval = 100;
+    NeuralNetwork<float> gradual(config, SOFTMAX);
+    gradual.train(training, validation, 1500, 1500);
+    const double gradualAccuracy = gradual.evaluate(test).accuracy;
+    ok = ok && gradual.weightSparsity(0) >= 0.9 - 1e-3;
+    std::cout << "Gradual pruning to 90% during train(): sparsity " << std::setprecision(1)
+              << gradual.weightSparsity(0) * 100 << "%, accuracy " << std::setprecision(2) << gradualAccuracy * 100
+              << "% (dense " << denseAccuracy * 100 << "%)" << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include "../src/quantized.cpp"
+#include "./common.cpp"
+
+// Int8 post-training quantization on the MNIST shape. A 784x128x10 float
+// network is trained on synthetic digits (ten random prototypes plus noise),
+// quantized with 256 calibration samples, and both are scored on held-out
+// samples: accuracy, agreement, model size and predictBatch throughput. Then
+// the float and int8 dense kernels are timed on the 784x128 layer for each
+// instruction set the CPU supports. Fails if quantization costs more than one
+// point of accuracy or the quantized model does not survive save/load.
+constexpr int INPUTS = 784;
+constexpr int HIDDEN = 128;
+constexpr int BATCH = 256;
+
+void benchmarkKernels() {
+    Xoshiro256 generator(11);
+    AlignedVector<float> inputs(BATCH * INPUTS);
+    AlignedVector<float> weights(INPUTS * HIDDEN);
+    AlignedVector<float> biases(HIDDEN, 0.0f);
+    AlignedVector<float> outputs(BATCH * HIDDEN);
+    // Rows padded as QuantizedNetwork pads them
+    const int stride = (INPUTS + QUANTIZED_ROW_ALIGNMENT - 1) / QUANTIZED_ROW_ALIGNMENT * QUANTIZED_ROW_ALIGNMENT;
+    AlignedVector<int8_t> quantizedInputs(BATCH * stride);
+    AlignedVector<int8_t> quantizedWeights(HIDDEN * stride);
+    AlignedVector<float> scales(HIDDEN, 1e-4f);
+    for (float& value : inputs) {
+        value = generator.uniform<float>();
+    }
+    for (float& value : weights) {
+        value = generator.uniform<float>() - 0.5f;
+    }
+    for (int8_t& value : quantizedInputs) {
+        value = static_cast<int8_t>(generator.uniform<float>() * 127.0f);
+    }
+    for (int8_t& value : quantizedWeights) {
+        value = static_cast<int8_t>(generator.uniform<float>() * 254.0f - 127.0f);
+    }
+    std::cout << "Dense 784x128 layer, batch " << BATCH << ", tanh" << std::endl;
+    for (SimdInstructionSet instructionSet : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+        if (!isInstructionSetSupported(instructionSet)) {
+            continue;
+        }
+        const KernelTable<float>& simd = kernelTable<float>(instructionSet);
+        const double floatNs = nanosecondsPerCall([&] {
+            simd.denseForward(inputs.data(), weights.data(), biases.data(), outputs.data(), BATCH, INPUTS, HIDDEN,
+                              TANH);
+        });
+        const double int8Ns = nanosecondsPerCall([&] {
+            simd.denseInt8(quantizedInputs.data(), quantizedWeights.data(), scales.data(), biases.data(),
+                           outputs.data(), BATCH, stride, stride, HIDDEN, TANH);
+        });
+        std::cout << "  " << std::left << std::setw(8) << simd.name << std::right << std::fixed
+                  << std::setprecision(1) << "float " << std::setw(8) << floatNs / 1e3 << " us   int8 "
+                  << std::setw(8) << int8Ns / 1e3 << " us   " << std::setprecision(2) << floatNs / int8Ns << "x"
+                  << std::endl;
+    }
+}
+
+int main(void) {
+    const TrainingData<float> training = syntheticDigits<float>(3000, 1);
+    const TrainingData<float> test = syntheticDigits<float>(2000, 2);
+    const TrainingData<float> validation(test.begin(), test.begin() + 100);
+
+    NeuralNetwork<float> network(digitsConfig(HIDDEN), SOFTMAX);
+    auto start = std::chrono::steady_clock::now();
+    network.train(training, validation, 1500, 1500);
+    std::cout << "784x128x10 float network, trained in " << std::fixed << std::setprecision(1) << secondsSince(start)
+              << " s" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    QuantizedNetwork<float> quantized = QuantizedNetwork<float>::quantize(network, inputsOf(training, 256));
+    const double quantizeSeconds = secondsSince(start);
+    const QuantizationReport report = compareQuantized(network, quantized, test);
+
+    const Matrix<float> inputs = inputsOf(test);
+    Matrix<float> outputs;
+    const double floatNs = nanosecondsPerCall([&] { network.predictBatch(inputs, outputs); }) / test.size();
+    const double int8Ns = nanosecondsPerCall([&] { quantized.predictBatch(inputs, outputs); }) / test.size();
+
+    const std::string path = (std::filesystem::temp_directory_path() / "quantized_bench.bin").string();
+    std::string error;
+    QuantizedNetwork<float> loaded;
+    const bool saved = quantized.save(path, error) && loaded.load(path, error);
+    const std::size_t fileBytes = saved ? std::filesystem::file_size(path) : 0;
+    std::filesystem::remove(path);
+    Matrix<float> loadedOutputs;
+    if (saved) {
+        quantized.predictBatch(inputs, outputs);
+        loaded.predictBatch(inputs, loadedOutputs);
+    }
+    const bool roundTrip =
+        saved && std::equal(outputs.data(), outputs.data() + outputs.size(), loadedOutputs.data());
+
+    std::cout << std::setprecision(2) << "  quantized in           " << quantizeSeconds * 1e3 << " ms ("
+              << kernels<float>().name << " kernels)" << std::endl;
+    std::cout << "  accuracy               float " << report.floatAccuracy * 100 << "%, int8 "
+              << report.quantizedAccuracy * 100 << "% (" << std::showpos << report.accuracyDelta * 100
+              << std::noshowpos << " points) on " << report.samples << " samples" << std::endl;
+    std::cout << "  agreement              " << report.agreement * 100 << "%, max output error "
+              << std::setprecision(5) << report.maxOutputError << std::endl;
+    std::cout << std::setprecision(1) << "  model size             float " << report.floatBytes / 1024.0 << " KiB, int8 "
+              << report.quantizedBytes / 1024.0 << " KiB (" << std::setprecision(2)
+              << static_cast<double>(report.floatBytes) / report.quantizedBytes << "x smaller), file "
+              << std::setprecision(1) << fileBytes / 1024.0 << " KiB" << std::endl;
+    std::cout << "  predictBatch           float " << floatNs << " ns, int8 " << int8Ns << " ns per sample ("
+              << std::setprecision(2) << floatNs / int8Ns << "x)" << std::endl;
+    std::cout << "  save/load              " << (roundTrip ? "identical outputs" : "FAILED " + error) << std::endl;
+
+    benchmarkKernels();
+    return roundTrip && report.accuracyDelta > -0.01 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+#include <cstring>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Sampling and dropout throughput of the old generators (rand(), mt19937 with
+// the <random> distributions) against Xoshiro256 and the bulk dropout
+// kernel, then a reproducibility check: two networks trained with the same
+// seed, dropout on and two all-reduce threads must predict bit-identical
+// outputs (fails otherwise).
+constexpr int MASK_ROWS = 32;
+constexpr int MASK_COLS = 128;
+
+void line(const char* name, double nanoseconds, const char* unit) {
+    std::cout << "  " << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(9) << nanoseconds << " ns/" << unit << std::endl;
+}
+
+void benchmarkSampling() {
+    const std::size_t samples = 60000;
+    std::size_t sink = 0;
+    std::cout << "Sample index in [0, " << samples << ")" << std::endl;
+    line("rand() % n", nanosecondsPerCall([&] { sink += rand() % samples; }), "index");
+    std::mt19937 mersenne(42);
+    std::uniform_int_distribution<std::size_t> pick(0, samples - 1);
+    line("mt19937 + uniform_int_distribution", nanosecondsPerCall([&] { sink += pick(mersenne); }), "index");
+    Xoshiro256 generator(42);
+    line("Xoshiro256::below", nanosecondsPerCall([&] { sink += generator.below(samples); }), "index");
+    if (sink == 1) {
+        std::cout << std::endl;  // Keeps the draws from being optimized away
+    }
+}
+
+template <typename T>
+void benchmarkDropout(const char* precision) {
+    const int count = MASK_ROWS * MASK_COLS;
+    const T dropoutRate = T(0.2);
+    const T keptScale = T(1) / (T(1) - dropoutRate);
+    std::vector<T> values(count, T(1));
+    std::vector<T> mask(count);
+    std::cout << "Dropout mask, " << precision << ", " << MASK_ROWS << "x" << MASK_COLS << std::endl;
+
+    std::mt19937 mersenne(42);
+    std::bernoulli_distribution keep(1.0 - static_cast<double>(dropoutRate));
+    line("mt19937 + bernoulli_distribution", nanosecondsPerCall([&] {
+        for (int i = 0; i < count; i++) {
+            mask[i] = keep(mersenne) ? keptScale : T(0);
+            values[i] *= mask[i];
+        }
+    }) / count, "element");
+
+    Xoshiro256 generator(42);
+    std::vector<int32_t> uniform24(count);
+    for (SimdInstructionSet instructionSet : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+        if (!isInstructionSetSupported(instructionSet)) {
+            continue;
+        }
+        const KernelTable<T>& simd = kernelTable<T>(instructionSet);
+        const std::string name = std::string("Xoshiro256::fill24 + dropout ") + simd.name;
+        line(name.c_str(), nanosecondsPerCall([&] {
+            generator.fill24(uniform24.data(), count);
+            simd.dropout(values.data(), mask.data(), uniform24.data(), count, (T(1) - dropoutRate) * T(1 << 24),
+                         keptScale);
+        }) / count, "element");
+    }
+    const long kept = std::count_if(mask.begin(), mask.end(), [](T value) { return value != T(0); });
+    std::cout << "  kept " << std::setprecision(4) << static_cast<double>(kept) / count << " (expected "
+              << 1.0 - static_cast<double>(dropoutRate) << ")" << std::endl;
+}
+
+template <typename T>
+std::vector<T> trainSeeded(uint64_t seed, const TrainingData<T>& data, const Matrix<T>& inputs) {
+    NeuralNetworkConfig config = {16, 0, 0, 0.05, SIGMOID};
+    config.layers = {{32, RELU}, {32, TANH}, {4, SOFTMAX}};
+    config.batchSize = 16;
+    config.threads = 2;
+    config.seed = seed;
+    NeuralNetwork<T> network(config, SOFTMAX, 0.2);
+    // train() reports its progress on std::cout; keep it out of the results
+    std::ostringstream discarded;
+    std::streambuf* console = std::cout.rdbuf(discarded.rdbuf());
+    network.train(data, data, 200, 1000);
+    std::cout.rdbuf(console);
+    Matrix<T> outputs;
+    network.predictBatch(inputs, outputs);
+    return std::vector<T>(outputs.data(), outputs.data() + outputs.size());
+}
+
+template <typename T>
+bool checkReproducible(const char* precision) {
+    Xoshiro256 generator(7);
+    TrainingData<T> data;
+    Matrix<T> inputs(64, 16);
+    for (int i = 0; i < 64; i++) {
+        std::vector<T> sample(16);
+        for (int j = 0; j < 16; j++) {
+            sample[j] = inputs.row(i)[j] = generator.uniform<T>();
+        }
+        std::vector<T> targets(4, T(0));
+        targets[i % 4] = T(1);
+        data.push_back({sample, targets});
+    }
+    const std::vector<T> first = trainSeeded<T>(1234, data, inputs);
+    const std::vector<T> second = trainSeeded<T>(1234, data, inputs);
+    const std::vector<T> other = trainSeeded<T>(4321, data, inputs);
+    const bool same = std::memcmp(first.data(), second.data(), first.size() * sizeof(T)) == 0;
+    const bool different = std::memcmp(first.data(), other.data(), first.size() * sizeof(T)) != 0;
+    std::cout << "  " << std::left << std::setw(8) << precision << "same seed " << (same ? "bit-identical" : "DIFFERS")
+              << ", other seed " << (different ? "differs" : "IDENTICAL") << std::endl;
+    return same && different;
+}
+
+int main(void) {
+    benchmarkSampling();
+    benchmarkDropout<double>("double");
+    benchmarkDropout<float>("float");
+
+    std::cout << "Seeded training, 2 all-reduce threads, dropout 0.2" << std::endl;
+    const bool doubleOk = checkReproducible<double>("double");
+    const bool floatOk = checkReproducible<float>("float");
+    return doubleOk && floatOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
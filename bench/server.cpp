@@ -0,0 +1,191 @@
+#include <iomanip>
+#include "../src/inferenceServer.cpp"
+
+// The inference server on an MNIST-shaped network (784x128x10, float),
+// in-process over a Unix domain socket. The model goes through a model file
+// and readModelConfig(), as in tools/serve.cpp. First a client checks the
+// served outputs against predictBatch(), then closed-loop clients load the
+// server with dynamic batching off (batches of 1) and on, at a few levels of
+// concurrency, reporting requests per second, p50/p99 latency and the mean
+// batch. Fails if any output differs, a rejected request is answered out of
+// order, a client that stops reading its responses holds up another client's
+// requests, or a run answers no requests.
+constexpr int INPUTS = 784;
+constexpr int HIDDEN = 128;
+constexpr int OUTPUTS = 10;
+constexpr double SECONDS = 1.0;
+
+bool checkOutputs(NeuralNetwork<float>& reference, const ServerAddress& address) {
+    InferenceClient client;
+    std::string error;
+    if (!client.connect(address, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    constexpr int SAMPLES = 100;
+    Matrix<float> inputs(SAMPLES, INPUTS);
+    Xoshiro256 generator(3);
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        inputs.data()[i] = generator.uniform<float>();
+    }
+    Matrix<float> expected;
+    reference.predictBatch(inputs, expected);
+    std::vector<float> outputs(OUTPUTS);
+    float largest = 0.0f;
+    for (int s = 0; s < SAMPLES; s++) {
+        if (!client.predict(inputs.row(s), outputs.data(), error)) {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        for (int o = 0; o < OUTPUTS; o++) {
+            largest = std::max(largest, std::abs(outputs[o] - expected(s, o)));
+        }
+    }
+    std::cout << "served outputs vs predictBatch, max difference " << std::scientific << std::setprecision(1)
+              << largest << std::fixed << std::endl;
+    return largest < 1e-5f;
+}
+
+// Pipelines a request, one with the wrong input count and another request,
+// which must be answered in that order
+bool checkRejectionOrder(const ServerAddress& address) {
+    std::string error;
+    const int socket = openSocket(address, false, error);
+    ServerHello hello;
+    if (socket < 0 || !readFully(socket, &hello, sizeof(hello))) {
+        std::cerr << "unable to connect: " << error << std::endl;
+        return false;
+    }
+    const std::vector<float> inputs(INPUTS + 1, 0.5f);
+    const uint32_t counts[3] = {INPUTS, INPUTS + 1, INPUTS};
+    bool ok = true;
+    for (uint32_t id = 0; id < 3; id++) {
+        const RequestHeader header = {id, counts[id]};
+        ok = ok && writeFully(socket, &header, sizeof(header)) &&
+             writeFully(socket, inputs.data(), counts[id] * sizeof(float));
+    }
+    std::vector<float> outputs(OUTPUTS);
+    for (uint32_t id = 0; id < 3 && ok; id++) {
+        ResponseHeader header;
+        ok = readFully(socket, &header, sizeof(header)) && header.id == id &&
+             header.status == (id == 1 ? RESPONSE_BAD_INPUT_COUNT : RESPONSE_OK) &&
+             readFully(socket, outputs.data(), header.count * sizeof(float));
+    }
+    ::close(socket);
+    std::cout << "rejected request answered " << (ok ? "in order" : "OUT OF ORDER") << std::endl;
+    return ok;
+}
+
+// One client pipelines requests without reading any response until the
+// server drops it; another client must still be answered meanwhile
+bool checkStalledClient(const ServerAddress& address) {
+    InferenceClient stalled;
+    InferenceClient client;
+    std::string error;
+    if (!stalled.connect(address, error) || !client.connect(address, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    std::vector<float> inputs(INPUTS, 0.5f);
+    std::vector<float> outputs(OUTPUTS);
+    std::thread flood([&] {
+        for (uint32_t id = 0; id < 100000 && stalled.send(id, inputs.data()); id++) {
+        }
+    });
+    // Long enough for the stalled client's socket buffers to fill
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const auto start = std::chrono::steady_clock::now();
+    bool answered = true;
+    for (int i = 0; i < 100 && answered; i++) {
+        answered = client.predict(inputs.data(), outputs.data(), error);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    flood.join();
+    std::cout << "100 requests next to a client that does not read: " << (answered ? "answered" : error) << " in "
+              << std::setprecision(3) << seconds << " s" << std::endl;
+    return answered;
+}
+
+int main(void) {
+    NeuralNetworkConfig config = {INPUTS, HIDDEN, OUTPUTS, 0.01, RELU};
+    config.layers = {{HIDDEN, RELU}, {OUTPUTS, SOFTMAX}};
+    config.seed = 5;
+    NeuralNetwork<float> trained(config, RELU);
+    const std::string modelPath = "/tmp/nn-server-bench-" + std::to_string(getpid()) + ".bin";
+    trained.saveModel(modelPath);
+
+    NeuralNetworkConfig fileConfig;
+    ActivationFunction activation;
+    std::string error;
+    if (!readModelConfig(modelPath, fileConfig, activation, error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    NeuralNetwork<float> network(fileConfig, activation);
+    const bool loaded = network.loadModel(modelPath);
+    std::remove(modelPath.c_str());
+    if (!loaded) {
+        return EXIT_FAILURE;
+    }
+
+    ServerConfig serverConfig;
+    serverConfig.address.socketPath = "/tmp/nn-server-bench-" + std::to_string(getpid()) + ".sock";
+    bool ok;
+    {
+        InferenceServer<float> server(network, serverConfig);
+        if (!server.start(error)) {
+            std::cerr << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        ok = checkOutputs(trained, server.address());
+        ok = checkRejectionOrder(server.address()) && ok;
+    }
+    {
+        ServerConfig stallConfig = serverConfig;
+        stallConfig.writeTimeoutMilliseconds = 100;
+        InferenceServer<float> server(network, stallConfig);
+        if (!server.start(error)) {
+            std::cerr << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        ok = checkStalledClient(server.address()) && ok;
+    }
+
+    struct Setting {
+        const char* name;
+        int maxBatch;
+        int maxDelayMicroseconds;
+    };
+    const Setting settings[] = {{"batch 1", 1, 0}, {"batch <= 64, no delay", 64, 0}, {"batch <= 64, 200 us", 64, 200}};
+    std::cout << "784x128x10 float, Unix socket, " << SECONDS << " s per run, " << kernels<float>().name << " kernels"
+              << std::endl;
+    for (int connections : {1, 8, 32}) {
+        for (const Setting& setting : settings) {
+            serverConfig.maxBatch = setting.maxBatch;
+            serverConfig.maxDelayMicroseconds = setting.maxDelayMicroseconds;
+            InferenceServer<float> server(network, serverConfig);
+            if (!server.start(error)) {
+                std::cerr << error << std::endl;
+                return EXIT_FAILURE;
+            }
+            LoadConfig load;
+            load.address = server.address();
+            load.connections = connections;
+            load.seconds = SECONDS;
+            LoadReport report;
+            if (!generateLoad(load, report, error)) {
+                std::cerr << error << std::endl;
+                return EXIT_FAILURE;
+            }
+            server.stop();
+            const ServerStats stats = server.takeStats();
+            ok = ok && report.requests > 0 && report.errors == 0;
+            std::cout << "  " << std::setw(2) << connections << " clients, " << std::left << std::setw(22)
+                      << setting.name << std::right << std::setprecision(0) << std::setw(8)
+                      << report.requestsPerSecond() << " requests/s   p50 " << std::setprecision(1) << std::setw(7)
+                      << report.p50Microseconds << " us   p99 " << std::setw(7) << report.p99Microseconds
+                      << " us   mean batch " << std::setprecision(1) << stats.meanBatch() << std::endl;
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,88 @@
+#include <cstring>
+#include <iomanip>
+#include "../src/nn.cpp"
+#include "./common.cpp"
+
+// Dense vs sparse first layer on the MNIST shape (784x128x10, batch 32, SGD)
+// as the fraction of nonzero inputs grows: training steps (forward pass,
+// backward pass and update) and predictBatch, with the sparse path forced
+// (sparseInputDensity 1) or disabled (0). MNIST pixels are about 19%
+// nonzero. Both paths add the same products in the same order, so the
+// networks they train must end up identical (fails otherwise).
+constexpr int INPUTS = 784;
+constexpr int HIDDEN = 128;
+constexpr int CLASSES = 10;
+constexpr int BATCH = 32;
+
+// Samples whose pixels are nonzero with probability `density`, like a digit on a blank background
+TrainingData<float> sparseSamples(int samples, double density) {
+    Xoshiro256 generator(5);
+    TrainingData<float> data;
+    for (int s = 0; s < samples; s++) {
+        std::vector<float> sample(INPUTS, 0.0f);
+        for (float& pixel : sample) {
+            if (generator.uniform<double>() < density) {
+                pixel = generator.uniform<float>() + 1e-3f;
+            }
+        }
+        std::vector<float> targets(CLASSES, 0.0f);
+        targets[s % CLASSES] = 1.0f;
+        data.push_back({sample, targets});
+    }
+    return data;
+}
+
+NeuralNetworkConfig configWith(double sparseInputDensity) {
+    NeuralNetworkConfig config = {INPUTS, 0, 0, 0.01, SOFTMAX};
+    config.layers = {{HIDDEN, TANH}, {CLASSES, SOFTMAX}};
+    config.batchSize = BATCH;
+    config.seed = 42;
+    config.telemetry.progress = PROGRESS_OFF;
+    config.sparseInputDensity = sparseInputDensity;
+    return config;
+}
+
+int main(void) {
+    bool identical = true;
+    std::cout << "784x128x10 float network, batch " << BATCH << ", SGD, " << kernels<float>().name << " kernels"
+              << std::endl;
+    std::cout << "  nonzero   train step dense / sparse            predictBatch dense / sparse (per sample)"
+              << std::endl;
+    for (double density : {0.02, 0.05, 0.1, 0.19, 0.3, 0.5, 1.0}) {
+        const TrainingData<float> data = sparseSamples(BATCH * 8, density);
+        Matrix<float> inputs(static_cast<int>(data.size()), INPUTS);
+        for (std::size_t i = 0; i < data.size(); i++) {
+            std::copy(data[i].first.begin(), data[i].first.end(), inputs.row(static_cast<int>(i)));
+        }
+        const TrainingData<float> batch(data.begin(), data.begin() + BATCH);
+
+        NeuralNetwork<float> dense(configWith(0.0), SOFTMAX);
+        NeuralNetwork<float> sparse(configWith(1.0), SOFTMAX);
+        Matrix<float> outputs;
+        const double denseStep = nanosecondsPerCall([&] { dense.trainBatch(batch); });
+        const double sparseStep = nanosecondsPerCall([&] { sparse.trainBatch(batch); });
+        const double densePredict = nanosecondsPerCall([&] { dense.predictBatch(inputs, outputs); }) / data.size();
+        const double sparsePredict = nanosecondsPerCall([&] { sparse.predictBatch(inputs, outputs); }) / data.size();
+
+        // Same seed, same steps: the weights must not depend on the path
+        NeuralNetwork<float> denseTrained(configWith(0.0), SOFTMAX);
+        NeuralNetwork<float> sparseTrained(configWith(1.0), SOFTMAX);
+        denseTrained.train(data, data, 50, 50);
+        sparseTrained.train(data, data, 50, 50);
+        Matrix<float> denseOutputs;
+        Matrix<float> sparseOutputs;
+        denseTrained.predictBatch(inputs, denseOutputs);
+        sparseTrained.predictBatch(inputs, sparseOutputs);
+        const bool same =
+            std::memcmp(denseOutputs.data(), sparseOutputs.data(), denseOutputs.size() * sizeof(float)) == 0;
+        identical = identical && same;
+
+        std::cout << std::fixed << std::setprecision(0) << "  " << std::setw(4) << density * 100 << "%   "
+                  << std::setprecision(1) << std::setw(8) << denseStep / 1e3 << " / " << std::setw(7)
+                  << sparseStep / 1e3 << " us (" << std::setprecision(2) << std::setw(5) << denseStep / sparseStep
+                  << "x)      " << std::setprecision(0) << std::setw(6) << densePredict << " / " << std::setw(6)
+                  << sparsePredict << " ns (" << std::setprecision(2) << std::setw(5) << densePredict / sparsePredict
+                  << "x)   " << (same ? "identical" : "DIFFERS") << std::endl;
+    }
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,6 +3,7 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include "src/dataset.cpp"
 #include "src/nn.cpp"
 
 std::vector<std::string> read_label_names(const std::string& file_path) {
@@ -23,7 +24,7 @@ std::vector<std::string> read_label_names(const std::string& file_path) {
 std::vector<std::string> coarse_label_names = read_label_names("dataset/cifar-100-binary/coarse_label_names.txt");
 std::vector<std::string> fine_label_names = read_label_names("dataset/cifar-100-binary/fine_label_names.txt");
 
-void display_image(const std::vector<uint8_t>& image) {
+void display_image(const uint8_t* image) {
     // clear the screen
     std::cout << "\033[2J";
     // move the cursor to the top left corner
@@ -43,99 +44,74 @@ void display_image(const std::vector<uint8_t>& image) {
     std::cout << std::endl;
 }
 
-// read CIFAR-100 dataset from binary file
-std::vector<std::pair<std::vector<uint8_t>, std::pair<uint8_t, uint8_t>>> read_cifar100(const std::string& file_path) {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Error: failed to open file " << file_path << std::endl;
-        return {};
-    }
-
-    std::vector<std::pair<std::vector<uint8_t>, std::pair<uint8_t, uint8_t>>> data;
-    while (!file.eof()) {
-        std::vector<uint8_t> image(3072);
-        uint8_t coarse_label, fine_label;
-        file.read(reinterpret_cast<char*>(&coarse_label), 1);
-        file.read(reinterpret_cast<char*>(&fine_label), 1);
-        file.read(reinterpret_cast<char*>(image.data()), 3072);
-        // Push the image and label pair into the data vector
-        data.push_back({image, {coarse_label, fine_label}});
-
-        // debug
-        // display_image(image);
-        // std::cout << "Coarse label: " << coarse_label_names[coarse_label] << std::endl;
-        // std::cout << "Fine label: " << fine_label_names[fine_label] << std::endl;
-        // std::cin.get();
-    }
-
-    return data;
-}
-
-
-
-
 int main(void) {
     std::cout << "\033[33;1mWARNING:\033[0m This program isn't 100\% accurate, I (Augustin) can't guarantee the accuracy of the results." << std::endl;
     std::string train_file_path = "dataset/cifar-100-binary/train.bin";
     std::string test_file_path = "dataset/cifar-100-binary/test.bin";
 
-    std::cout << "Reading CIFAR-100 train dataset..." << std::endl;
-    auto train_data = read_cifar100(train_file_path);
-    std::cout << "Reading CIFAR-100 test dataset..." << std::endl;
-    auto test_data = read_cifar100(test_file_path);
+    std::string error;
+    CifarDataset train_data;
+    if (!train_data.open(train_file_path, error) || !train_data.checkLabels(error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    CifarDataset test_data;
+    if (!test_data.open(test_file_path, error) || !test_data.checkLabels(error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
 
     NeuralNetworkConfig config;
     config.inputSize = 3072;
-    config.hiddenSize = 100;
     config.outputSize = 100;
-    config.learningRate = 0.01;
+    config.learningRate = 0.001;
     config.activationFunction = ActivationFunction::RELU;
+    config.threads = 0;
+    // The pixels are planar: a 32x32 plane each of red, green and blue
+    config.inputShape = {3, 32, 32};
+    config.layers = {conv2d(32, 3, RELU), maxPool(2), conv2d(64, 3, RELU), maxPool(2), flatten(), {100, SOFTMAX}};
+    config.batchSize = 32;
+    config.optimizer.type = ADAM;
 
     NeuralNetwork cifar100_network(config, config.activationFunction);
 
-    int modelLoaded = cifar100_network.loadModel("cifar100-model.txt");
+    int modelLoaded = cifar100_network.loadModel("cifar100-model.bin");
 
     if (!modelLoaded) {
-        std::cout << "Loading CIFAR-100 traning data..." << std::endl;
-        std::vector<std::pair<std::vector<double>, std::vector<double>>> cifar100_training_data;
-        for (size_t i = 0; i < train_data.size(); ++i) {
+        // Batches are normalized from the mapped pixels on a background thread
+        DataLoader<double>::Options loaderOptions;
+        loaderOptions.batchSize = config.batchSize;
+        DataLoader<double> loader(train_data.images, train_data.fineLabels, 100, loaderOptions);
+
+        std::vector<std::pair<std::vector<double>, std::vector<double>>> cifar100_validation_data;
+        for (size_t i = 0; i < std::min<size_t>(test_data.size(), 1000); ++i) {
             std::vector<double> pixelValues(3072, 0.0);
             for (size_t j = 0; j < 3072; ++j) {
-                pixelValues[j] = static_cast<double>(train_data[i].first[j]) / 255.0;
+                pixelValues[j] = static_cast<double>(test_data.images[i][j]) / 255.0;
             }
-            std::vector<double> target(255, 0.0);
-            target[train_data[i].second.first] = 1.0;
-            cifar100_training_data.push_back({pixelValues, target});
+            std::vector<double> target(100, 0.0);
+            target[test_data.fineLabels[i][0]] = 1.0;
+            cifar100_validation_data.push_back({pixelValues, target});
         }
         std::cout << "Training CIFAR-100 neural network..." << std::endl;
-        cifar100_network.train(cifar100_training_data, cifar100_training_data, 10000);
+        cifar100_network.train(loader, cifar100_validation_data, 10000);
         std::cout << "Saving CIFAR-100 neural network model..." << std::endl;
-        cifar100_network.saveModel("cifar100-model.txt");
+        cifar100_network.saveModel("cifar100-model.bin");
     }
 
     std::cout << "Testing CIFAR-100 neural network..." << std::endl;
 
-    int correct_predictions = 0;
-    ProgressBar progress_bar(test_data.size());
-    for (size_t i = 0; i < test_data.size(); ++i) {
-        progress_bar.update();
-        std::vector<double> pixelValues(3072, 0.0);
-        for (size_t j = 0; j < 3072; ++j) {
-            pixelValues[j] = static_cast<double>(test_data[i].first[j]) / 255.0;
-        }
-        std::vector<double> prediction = cifar100_network.feedforward(pixelValues);
-        size_t max_index = 0;
-        for (size_t j = 1; j < prediction.size(); ++j) {
-            if (prediction[j] > prediction[max_index]) {
-                max_index = j;
+    EvaluationResult evaluation = cifar100_network.evaluate(
+        test_data.size(),
+        [&](size_t i, double* pixelValues) {
+            for (size_t j = 0; j < 3072; ++j) {
+                pixelValues[j] = static_cast<double>(test_data.images[i][j]) / 255.0;
             }
-        }
-        if (max_index == test_data[i].second.first) {
-            correct_predictions++;
-        }
-    }
+        },
+        [&](size_t i) { return test_data.fineLabels[i][0]; });
 
-    std::cout << "Accuracy: " << static_cast<double>(correct_predictions) / test_data.size() << std::endl;
+    std::cout << "Accuracy: " << evaluation.accuracy << std::endl;
+    std::cout << "Top-" << evaluation.topK << " accuracy: " << evaluation.topKAccuracy << std::endl;
 
     while (true) {
         std::cout << "Enter an image index to test (0-" << test_data.size() - 1 << "): ";
@@ -145,11 +121,11 @@ int main(void) {
             std::cout << "Invalid index" << std::endl;
             continue;
         }
-        display_image(test_data[index].first);
-        std::cout << "Label: " << fine_label_names[test_data[index].second.first] << std::endl;
+        display_image(test_data.images[index]);
+        std::cout << "Label: " << fine_label_names[test_data.fineLabels[index][0]] << std::endl;
         std::vector<double> pixelValues(3072, 0.0);
         for (size_t j = 0; j < 3072; ++j) {
-            pixelValues[j] = static_cast<double>(test_data[index].first[j]) / 255.0;
+            pixelValues[j] = static_cast<double>(test_data.images[index][j]) / 255.0;
         }
         std::vector<double> prediction = cifar100_network.feedforward(pixelValues);
         size_t max_index = 0;
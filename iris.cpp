@@ -53,7 +53,7 @@ int main(void) {
 
     NeuralNetwork neuralNetwork(config, ActivationFunction::SIGMOID);
 
-    int modelLoaded = neuralNetwork.loadModel("iris-model.txt");
+    int modelLoaded = neuralNetwork.loadModel("iris-model.bin");
 
     std::vector<std::pair<std::vector<double>, std::vector<double>>> irisData = loadIrisData("./dataset/iris.csv");
 
@@ -62,7 +62,7 @@ int main(void) {
         neuralNetwork.train(irisData, irisData, 1000000);
         std::cout << "Training complete." << std::endl;
 
-        neuralNetwork.saveModel("iris-model.txt");
+        neuralNetwork.saveModel("iris-model.bin");
     }
 
     int correctPredictions = 0;
@@ -1,69 +1,10 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include "src/dataset.cpp"
 #include "src/nn.cpp"
 
-std::vector<std::vector<uint8_t>> read_mnist_images(const std::string& file_path) {
-    std::ifstream file(file_path, std::ios::binary);
-    
-    if (!file) {
-        std::cerr << "Failed to open file: " << file_path << std::endl;
-        return {};
-    }
-    
-    uint32_t magic_number, num_images, num_rows, num_cols;
-    file.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-    file.read(reinterpret_cast<char*>(&num_images), sizeof(num_images));
-    file.read(reinterpret_cast<char*>(&num_rows), sizeof(num_rows));
-    file.read(reinterpret_cast<char*>(&num_cols), sizeof(num_cols));
-    
-    // __builtin_bswap32 is a GCC builtin that swaps the bytes of a 32-bit integer
-    magic_number = __builtin_bswap32(magic_number);
-    num_images = __builtin_bswap32(num_images);
-    num_rows = __builtin_bswap32(num_rows);
-    num_cols = __builtin_bswap32(num_cols);
-    
-    if (magic_number != 2051) {
-        std::cerr << "Invalid MNIST image file!" << std::endl;
-        return {};
-    }
-    
-    std::vector<std::vector<uint8_t>> images(num_images, std::vector<uint8_t>(num_rows * num_cols));
-    for (auto& image : images) {
-        file.read(reinterpret_cast<char*>(image.data()), num_rows * num_cols);
-    }
-    
-    return images;
-}
-
-std::vector<uint8_t> read_mnist_labels(const std::string& file_path) {
-    std::ifstream file(file_path, std::ios::binary);
-    
-    if (!file) {
-        std::cerr << "Failed to open file: " << file_path << std::endl;
-        return {};
-    }
-    
-    uint32_t magic_number, num_labels;
-    file.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-    file.read(reinterpret_cast<char*>(&num_labels), sizeof(num_labels));
-    
-    // __builtin_bswap32 is a GCC builtin that swaps the bytes of a 32-bit integer
-    magic_number = __builtin_bswap32(magic_number);
-    num_labels = __builtin_bswap32(num_labels);
-    
-    if (magic_number != 2049) {
-        std::cerr << "Invalid MNIST label file!" << std::endl;
-        return {};
-    }
-    
-    std::vector<uint8_t> labels(num_labels);
-    file.read(reinterpret_cast<char*>(labels.data()), num_labels);
-    
-    return labels;
-}
-
-void display_mnist_image(const std::vector<uint8_t>& image, uint32_t num_rows, uint32_t num_cols) {
+void display_mnist_image(const uint8_t* image, uint32_t num_rows, uint32_t num_cols) {
     for (uint32_t i = 0; i < num_rows * num_cols; ++i) {
         if (i % num_cols == 0 && i != 0) {
             std::cout << std::endl;
@@ -79,72 +20,70 @@ int main(void) {
     std::string images_file_path = "dataset/images/train-images.idx3-ubyte";
     std::string labels_file_path = "dataset/images/train-labels.idx1-ubyte";
     
-    std::vector<std::vector<uint8_t>> images = read_mnist_images(images_file_path);
-    std::vector<uint8_t> labels = read_mnist_labels(labels_file_path);
-    if (images.size() != labels.size()) {
-        std::cerr << "Number of images and labels do not match!" << std::endl;
+    MnistDataset mnist;
+    std::string error;
+    if (!mnist.open(images_file_path, labels_file_path, error)) {
+        std::cerr << error << std::endl;
         return 1;
     }
+    const ByteView& images = mnist.images;
+    const ByteView& labels = mnist.labels;
 
-    if (images.empty() || labels.empty()) {
-        return 1;
-    }
-    
-    uint32_t num_rows = 28; 
-    uint32_t num_cols = 28;
-    uint32_t num_images = images.size();
+    uint32_t num_rows = mnist.rows;
+    uint32_t num_cols = mnist.cols;
+    uint32_t num_images = mnist.size();
     
     NeuralNetworkConfig config;
     config.inputSize = num_rows * num_cols;
     config.hiddenSize = 128;
     config.outputSize = 10;
-    config.learningRate = 0.01;
+    config.learningRate = 0.001;
     config.activationFunction = TANH;
+    config.optimizer.type = ADAM;
+    config.threads = 0;
 
     double dropoutRate = 0.2;
     NeuralNetwork mnistNetwork(config, config.activationFunction, dropoutRate);
 
-    int modelLoaded = mnistNetwork.loadModel("mnist-model.txt");
+    int modelLoaded = mnistNetwork.loadModel("mnist-model.bin");
 
     if (!modelLoaded) {
-        std::cout << "Loading MNIST traning data..." << std::endl;
-        std::vector<std::pair<std::vector<double>, std::vector<double>>> mnistTrainingData;
-        for (size_t i = 0; i < num_images; ++i) {
+        // Batches are normalized from the mapped pixels on a background thread
+        DataLoader<double>::Options loaderOptions;
+        loaderOptions.batchSize = 32;
+        DataLoader<double> loader(images, labels, 10, loaderOptions);
+
+        std::vector<std::pair<std::vector<double>, std::vector<double>>> validationData;
+        for (size_t i = 0; i < std::min<size_t>(num_images, 1000); ++i) {
             std::vector<double> pixelValues(num_rows * num_cols, 0.0);
             for (size_t j = 0; j < num_rows * num_cols; ++j) {
                 pixelValues[j] = static_cast<double>(images[i][j]) / 255.0;
             }
             std::vector<double> target(10, 0.0);
-            target[labels[i]] = 1.0;
-            mnistTrainingData.push_back({pixelValues, target});
+            target[labels[i][0]] = 1.0;
+            validationData.push_back({pixelValues, target});
         }
-        std::cout << "MNIST data loaded !" << std::endl;
 
         std::cout << "Training neural network..." << std::endl;
-        mnistNetwork.train(mnistTrainingData, mnistTrainingData, 100);
+        mnistNetwork.train(loader, validationData, 2000, 200);
         std::cout << "Training complete." << std::endl;
 
-        mnistNetwork.saveModel("mnist-model.txt");
+        mnistNetwork.saveModel("mnist-model.bin");
     }
 
-    int correctPredictions = 0;
     std::cout << "Testing neural network..." << std::endl;
-    ProgressBar progressBar(num_images);
-    for (size_t i = 0; i < num_images; ++i) {
-        progressBar.update();
-        std::vector<double> pixelValues(num_rows * num_cols, 0.0);
-        for (size_t j = 0; j < num_rows * num_cols; ++j) {
-            pixelValues[j] = static_cast<double>(images[i][j]) / 255.0;
-        }
-        std::vector<double> output = mnistNetwork.feedforward(pixelValues);
-        int predictedLabel = std::distance(output.begin(), std::max_element(output.begin(), output.end()));
-        if (predictedLabel == static_cast<int>(labels[i])) {
-            correctPredictions++;
-        }
-    }
+    EvaluationResult evaluation = mnistNetwork.evaluate(
+        num_images,
+        [&](size_t i, double* pixelValues) {
+            for (size_t j = 0; j < num_rows * num_cols; ++j) {
+                pixelValues[j] = static_cast<double>(images[i][j]) / 255.0;
+            }
+        },
+        [&](size_t i) { return labels[i][0]; },
+        3);
 
-    double accuracy = static_cast<double>(correctPredictions) / num_images * 100.0;
-    std::cout << "Accuracy: " << accuracy << "%" << std::endl;
+    std::cout << "Accuracy: " << evaluation.accuracy * 100.0 << "%" << std::endl;
+    std::cout << "Top-" << evaluation.topK << " accuracy: " << evaluation.topKAccuracy * 100.0 << "%" << std::endl;
 
     // part to allow user to test the model
     while (true) {
@@ -161,7 +100,7 @@ int main(void) {
         }
         std::vector<double> output = mnistNetwork.feedforward(pixelValues);
         std::cout << "Predicted label: " << std::distance(output.begin(), std::max_element(output.begin(), output.end())) << std::endl;
-        std::cout << "Actual label: " << static_cast<int>(labels[index]) << std::endl;
+        std::cout << "Actual label: " << static_cast<int>(labels[index][0]) << std::endl;
         display_mnist_image(images[index], num_rows, num_cols);
     }
 
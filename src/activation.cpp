@@ -0,0 +1,29 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+// Activation applied to the outputs of a layer. SOFTMAX normalizes each sample's
+// outputs as a whole; every other function acts element-wise.
+enum ActivationFunction {
+    TANH,
+    SIGMOID,
+    RELU,
+    LINEAR,
+    TANH_DERIVATIVE,
+    SOFTMAX
+};
+
+// How the vectorized kernels evaluate exp, sigmoid and tanh. RELU and LINEAR
+// are exact in every mode. Bounds are for inputs of any magnitude.
+enum ActivationAccuracy {
+    // exp to within 2 ulp (degree-12 polynomial for double, degree 7 for float)
+    ACTIVATION_EXACT,
+    // Degree-5 polynomial exp: relative error below 3e-6, sigmoid and tanh
+    // within 1e-6 and 2e-6 absolute, softmax outputs within 6e-6 relative
+    ACTIVATION_FAST,
+    // Sigmoid interpolated linearly from a 32-points-per-unit table over
+    // [-16, 16] (8 KB for double), tanh(x) = 2 * sigmoid(2x) - 1: sigmoid
+    // within 1.2e-5 and tanh within 2.4e-5 absolute. Softmax uses the FAST exp.
+    ACTIVATION_TABLE
+};
+
+#endif
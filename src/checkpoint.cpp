@@ -0,0 +1,311 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "./mappedFile.cpp"
+#include "./modelFile.cpp"
+#include "./tensor.cpp"
+
+// Training checkpoints: everything a killed train() run needs to continue
+// exactly where it stopped, written to disk by a background thread.
+//
+// Binary format, little-endian:
+//
+//   CheckpointHeader             128 bytes
+//   ModelFileLayer[layerCount]   16 bytes each, as in model files
+//   generator states             generatorCount x 4 uint64 (Xoshiro256 words)
+//   matrices                     matrixCount matrices of header.dtype, each zero-padded
+//                                to a multiple of 64 bytes, in the order of
+//                                TrainingSnapshot::matrices
+//
+// As with model files, the checksum covers every byte after the header, and
+// the file is written next to its path and renamed over it, so a crash
+// mid-write leaves the previous checkpoint intact.
+
+constexpr char CHECKPOINT_FILE_MAGIC[8] = {'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t CHECKPOINT_FILE_VERSION = 1;
+// Sets of every layer's weights and biases a checkpoint can hold: the
+// weights, two optimizer moments and the best weights
+constexpr uint32_t CHECKPOINT_MAX_MATRIX_SETS = 4;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layerCount;
+    uint32_t generatorCount;
+    uint32_t matrixCount;
+    uint32_t optimizerType;     // OptimizerType value
+    int64_t iteration;          // Training steps run
+    int64_t totalIterations;    // numberOfIterations of the run
+    int64_t optimizerSteps;
+    int64_t loaderBatch;        // Batches the DataLoader had served, -1 for TrainingData runs
+    double bestValidationLoss;
+    uint32_t hasBest;           // Whether the best weights are stored
+    uint32_t reserved0;
+    uint64_t dataBytes;         // Size of everything after the header
+    uint64_t checksum;          // FNV-1a of bytes [sizeof(CheckpointHeader), end of file)
+    uint8_t reserved[32];
+};
+static_assert(sizeof(CheckpointHeader) == 128, "checkpoint header must stay 128 bytes");
+
+struct CheckpointConfig {
+    std::string path;       // Empty disables checkpoints
+    long interval = 1000;   // Training steps between checkpoints; the end of a run is always saved
+};
+
+// A copy of the training state at one step. Per layer, `matrices` holds the
+// weights and biases, then the first and second moments of both when the
+// optimizer keeps them, then the best weights and biases when hasBest.
+template <typename T>
+struct TrainingSnapshot {
+    CheckpointHeader header = {};
+    std::vector<ModelFileLayer> layers;
+    std::vector<uint64_t> generators;  // 4 words per generator
+    std::vector<Matrix<T>> matrices;
+};
+
+inline uint64_t checkpointMatrixBytes(std::size_t values, std::size_t valueBytes) {
+    const uint64_t bytes = static_cast<uint64_t>(values) * valueBytes;
+    return (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+template <typename T>
+bool writeCheckpointFile(const std::string& path, TrainingSnapshot<T>& snapshot, std::string& error) {
+    CheckpointHeader& header = snapshot.header;
+    std::memcpy(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_FILE_VERSION;
+    header.dtype = dtypeOf<T>();
+    header.layerCount = static_cast<uint32_t>(snapshot.layers.size());
+    header.generatorCount = static_cast<uint32_t>(snapshot.generators.size() / 4);
+    header.matrixCount = static_cast<uint32_t>(snapshot.matrices.size());
+
+    const char padding[MODEL_FILE_ALIGNMENT] = {};
+    const std::size_t tableBytes = snapshot.layers.size() * sizeof(ModelFileLayer);
+    const std::size_t generatorBytes = snapshot.generators.size() * sizeof(uint64_t);
+    uint64_t checksum = fnv1a(snapshot.layers.data(), tableBytes);
+    checksum = fnv1a(snapshot.generators.data(), generatorBytes, checksum);
+    header.dataBytes = tableBytes + generatorBytes;
+    for (const Matrix<T>& matrix : snapshot.matrices) {
+        const std::size_t bytes = matrix.size() * sizeof(T);
+        const uint64_t paddedBytes = checkpointMatrixBytes(matrix.size(), sizeof(T));
+        checksum = fnv1a(matrix.data(), bytes, checksum);
+        checksum = fnv1a(padding, paddedBytes - bytes, checksum);
+        header.dataBytes += paddedBytes;
+    }
+    header.checksum = checksum;
+
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "unable to open " + temporaryPath;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(snapshot.layers.data()), static_cast<std::streamsize>(tableBytes));
+    file.write(reinterpret_cast<const char*>(snapshot.generators.data()), static_cast<std::streamsize>(generatorBytes));
+    for (const Matrix<T>& matrix : snapshot.matrices) {
+        const std::size_t bytes = matrix.size() * sizeof(T);
+        file.write(reinterpret_cast<const char*>(matrix.data()), static_cast<std::streamsize>(bytes));
+        file.write(padding, static_cast<std::streamsize>(checkpointMatrixBytes(matrix.size(), sizeof(T)) - bytes));
+    }
+    file.close();
+    if (!file) {
+        error = "failed to write " + temporaryPath;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        error = "failed to replace " + path;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads a checkpoint written for T. The matrices come back with the shapes
+// recorded in the layer table, in the order described at TrainingSnapshot.
+template <typename T>
+bool readCheckpointFile(const std::string& path, TrainingSnapshot<T>& snapshot, std::string& error) {
+    std::shared_ptr<MappedFile> mapped = MappedFile::open(path, MappedFile::READ_ONLY, error);
+    if (mapped == nullptr) {
+        return false;
+    }
+    const unsigned char* bytes = mapped->data();
+    if (mapped->size() < sizeof(CheckpointHeader)) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    CheckpointHeader& header = snapshot.header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    if (header.version != CHECKPOINT_FILE_VERSION) {
+        error = path + ": unsupported checkpoint version " + std::to_string(header.version);
+        return false;
+    }
+    if (header.dtype != dtypeOf<T>()) {
+        error = path + ": checkpoint dtype does not match the network";
+        return false;
+    }
+    if (sizeof(CheckpointHeader) + header.dataBytes != mapped->size()) {
+        error = path + ": truncated or oversized file";
+        return false;
+    }
+    if (fnv1a(bytes + sizeof(CheckpointHeader), mapped->size() - sizeof(CheckpointHeader)) != header.checksum) {
+        error = path + ": checksum mismatch";
+        return false;
+    }
+
+    const unsigned char* current = bytes + sizeof(CheckpointHeader);
+    const unsigned char* end = bytes + mapped->size();
+    const std::size_t tableBytes = static_cast<std::size_t>(header.layerCount) * sizeof(ModelFileLayer);
+    const std::size_t generatorBytes = static_cast<std::size_t>(header.generatorCount) * 4 * sizeof(uint64_t);
+    if (static_cast<std::size_t>(end - current) < tableBytes + generatorBytes) {
+        error = path + ": truncated layer table";
+        return false;
+    }
+    snapshot.layers.resize(header.layerCount);
+    std::memcpy(snapshot.layers.data(), current, tableBytes);
+    current += tableBytes;
+    snapshot.generators.resize(static_cast<std::size_t>(header.generatorCount) * 4);
+    std::memcpy(snapshot.generators.data(), current, generatorBytes);
+    current += generatorBytes;
+
+    // Weights, biases and every optional set of both share the layer shapes
+    const std::size_t perLayer = 2;
+    if (header.layerCount == 0 || header.matrixCount % (perLayer * header.layerCount) != 0 ||
+        header.matrixCount / (perLayer * header.layerCount) > CHECKPOINT_MAX_MATRIX_SETS) {
+        error = path + ": unexpected matrix count";
+        return false;
+    }
+    for (const ModelFileLayer& layer : snapshot.layers) {
+        if (layer.inputs > INT_MAX || layer.outputs > INT_MAX) {
+            error = path + ": layer shape out of range";
+            return false;
+        }
+    }
+    // Each matrix is only sized once the file is known to hold its values
+    snapshot.matrices.resize(header.matrixCount);
+    for (std::size_t m = 0; m < header.matrixCount; m++) {
+        const ModelFileLayer& layer = snapshot.layers[m / perLayer % header.layerCount];
+        const uint32_t rows = m % perLayer == 1 ? 1 : layer.inputs;
+        const uint64_t paddedBytes =
+            checkpointMatrixBytes(static_cast<std::size_t>(rows) * layer.outputs, sizeof(T));
+        if (static_cast<uint64_t>(end - current) < paddedBytes) {
+            error = path + ": truncated matrices";
+            return false;
+        }
+        Matrix<T>& matrix = snapshot.matrices[m];
+        matrix.resize(static_cast<int>(rows), static_cast<int>(layer.outputs));
+        std::memcpy(matrix.data(), current, matrix.size() * sizeof(T));
+        current += paddedBytes;
+    }
+    return true;
+}
+
+// Writes snapshots on a background thread so that training only pays for
+// copying its state into memory. There are two snapshot buffers: the trainer
+// fills one while the thread writes the other. When a checkpoint comes due
+// before the previous one is on disk, the newest snapshot replaces the one
+// still waiting, so the trainer never waits on I/O.
+template <typename T>
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::string path) : path(std::move(path)), writer([this] { run(); }) {}
+
+    ~CheckpointWriter() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        writer.join();
+    }
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    const std::string& filePath() const { return path; }
+
+    // The buffer to fill with the next snapshot: never the one being written,
+    // and withdrawn from the queue if it was waiting there
+    TrainingSnapshot<T>& acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        filling = writing == 0 ? 1 : 0;
+        if (pending == filling) {
+            pending = -1;
+        }
+        return snapshots[filling];
+    }
+
+    // Queues the buffer returned by the last acquire() for writing
+    void submit() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = filling;
+        }
+        changed.notify_all();
+    }
+
+    // Waits until every submitted snapshot is on disk. Returns false, with
+    // the error, when a write failed since the last flush().
+    bool flush(std::string* error = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return pending < 0 && writing < 0; });
+        const bool ok = lastError.empty();
+        if (error != nullptr) {
+            *error = lastError;
+        }
+        lastError.clear();
+        return ok;
+    }
+
+private:
+    std::string path;
+    TrainingSnapshot<T> snapshots[2];
+    int filling = 0;
+    int pending = -1;
+    int writing = -1;
+    bool stopping = false;
+    std::string lastError;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread writer;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || pending >= 0; });
+            if (pending < 0) {
+                return;
+            }
+            writing = std::exchange(pending, -1);
+            lock.unlock();
+            std::string error;
+            const bool ok = writeCheckpointFile(path, snapshots[writing], error);
+            lock.lock();
+            if (!ok) {
+                lastError = error;
+            }
+            writing = -1;
+            changed.notify_all();
+        }
+    }
+};
+
+#endif
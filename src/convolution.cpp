@@ -0,0 +1,229 @@
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <algorithm>
+#include <cstdint>
+#include "./kernels.cpp"
+
+// Kind of a layer of NeuralNetworkConfig::layers
+enum LayerType : uint32_t {
+    DENSE,    // Every output sees every input
+    CONV2D,   // Filters slid over an image, see ImageWindow
+    MAX_POOL, // Largest value of each window, per channel
+    FLATTEN   // The image as a plain vector, for the dense layers after it
+};
+
+// An image of height x width pixels with `channels` values each
+struct ImageShape {
+    int channels = 0;
+    int height = 0;
+    int width = 0;
+
+    int size() const { return channels * height * width; }
+    bool empty() const { return size() == 0; }
+};
+
+// A kernel x kernel window moved over an image by `stride` pixels, padded
+// with `padding` pixels of zeros on every side, as run by CONV2D and
+// MAX_POOL layers on each sample.
+//
+// The network's inputs are planar (CHW: one height x width plane per
+// channel, as CIFAR stores its images), while every CONV2D and MAX_POOL
+// layer writes its outputs channels last (HWC). Then a window row of an
+// im2col patch is one contiguous copy, and output position p of a
+// convolution is row p of its GEMM, so the GEMM result is the output image.
+struct ImageWindow {
+    ImageShape input;
+    ImageShape output;
+    int kernel = 0;
+    int stride = 1;
+    int padding = 0;
+    bool planarInput = false;
+
+    // Values in a window, the rows of a CONV2D layer's weights
+    int patchSize() const { return kernel * kernel * input.channels; }
+    int positions() const { return output.height * output.width; }
+    // Input value (c, y, x) is at c * channelStride() + (y * width + x) * pixelStride()
+    int channelStride() const { return planarInput ? input.height * input.width : 1; }
+    int pixelStride() const { return planarInput ? 1 : input.channels; }
+};
+
+// The window of a layer over `input`, which has `outputChannels` channels
+// out. The padding is kept below the kernel size, so that every window
+// overlaps the image.
+inline ImageWindow imageWindow(const ImageShape& input, bool planarInput, int kernel, int stride, int padding,
+                               int outputChannels) {
+    ImageWindow window;
+    window.input = input;
+    window.kernel = std::max(1, kernel);
+    window.stride = std::max(1, stride);
+    window.padding = std::min(std::max(0, padding), window.kernel - 1);
+    window.planarInput = planarInput;
+    window.output.channels = outputChannels;
+    window.output.height =
+        std::max(0, (input.height + 2 * window.padding - window.kernel) / window.stride + 1);
+    window.output.width = std::max(0, (input.width + 2 * window.padding - window.kernel) / window.stride + 1);
+    return window;
+}
+
+// Packs the kernel, stride and padding of a layer into the 32-bit layer
+// description of model files: the LayerType in the low byte, then one byte
+// each. 0 is a dense layer, as in files written before convolutions.
+inline uint32_t packLayerGeometry(LayerType type, const ImageWindow& window) {
+    if (type != CONV2D && type != MAX_POOL) {
+        return type;
+    }
+    return type | static_cast<uint32_t>(window.kernel & 0xff) << 8 | static_cast<uint32_t>(window.stride & 0xff) << 16 |
+           static_cast<uint32_t>(window.padding & 0xff) << 24;
+}
+
+// First and one past the last kernel offsets of a window starting at
+// `origin` that fall inside [0, size)
+inline void windowRange(int origin, int kernel, int size, int& first, int& last) {
+    first = std::max(0, -origin);
+    last = std::min(kernel, size - origin);
+}
+
+// Copies a planar image (CHW) into channels-last order (HWC)
+template <typename T>
+void planarToChannelsLast(const ImageShape& shape, const T* planar, T* channelsLast) {
+    const int pixels = shape.height * shape.width;
+    for (int c = 0; c < shape.channels; c++) {
+        const T* plane = planar + static_cast<std::size_t>(c) * pixels;
+        for (int p = 0; p < pixels; p++) {
+            channelsLast[static_cast<std::size_t>(p) * shape.channels + c] = plane[p];
+        }
+    }
+}
+
+// Lowers one image to the rows of a convolution's GEMM: row p of `patches`
+// holds the window at output position p, ordered (ky, kx, c) like the rows
+// of the weights, with zeros where the window overhangs the image.
+template <typename T>
+void im2col(const ImageWindow& window, const T* image, T* patches) {
+    const int channels = window.input.channels;
+    const int kernel = window.kernel;
+    const int rowValues = kernel * channels;
+    const int channelStride = window.channelStride();
+    const int pixelStride = window.pixelStride();
+    T* patch = patches;
+    for (int oy = 0; oy < window.output.height; oy++) {
+        const int y0 = oy * window.stride - window.padding;
+        for (int ox = 0; ox < window.output.width; ox++, patch += window.patchSize()) {
+            const int x0 = ox * window.stride - window.padding;
+            int kxFirst, kxLast;
+            windowRange(x0, kernel, window.input.width, kxFirst, kxLast);
+            for (int ky = 0; ky < kernel; ky++) {
+                T* row = patch + ky * rowValues;
+                const int y = y0 + ky;
+                if (y < 0 || y >= window.input.height) {
+                    std::fill(row, row + rowValues, T(0));
+                    continue;
+                }
+                std::fill(row, row + kxFirst * channels, T(0));
+                const T* pixels =
+                    image + (static_cast<std::size_t>(y) * window.input.width + x0 + kxFirst) * pixelStride;
+                if (!window.planarInput) {
+                    std::copy(pixels, pixels + (kxLast - kxFirst) * channels, row + kxFirst * channels);
+                } else {
+                    for (int kx = kxFirst; kx < kxLast; kx++) {
+                        for (int c = 0; c < channels; c++) {
+                            row[kx * channels + c] = pixels[static_cast<std::size_t>(c) * channelStride + kx - kxFirst];
+                        }
+                    }
+                }
+                std::fill(row + kxLast * channels, row + rowValues, T(0));
+            }
+        }
+    }
+}
+
+// The reverse of im2col() for the backward pass: adds every value of
+// `patches` to the image value it was copied from. Overlapping windows add
+// up; the padding is dropped.
+template <typename T>
+void col2imAdd(const ImageWindow& window, const T* patches, T* image) {
+    const KernelTable<T>& simd = kernels<T>();
+    const int channels = window.input.channels;
+    const int kernel = window.kernel;
+    const int channelStride = window.channelStride();
+    const int pixelStride = window.pixelStride();
+    const T* patch = patches;
+    for (int oy = 0; oy < window.output.height; oy++) {
+        const int y0 = oy * window.stride - window.padding;
+        int kyFirst, kyLast;
+        windowRange(y0, kernel, window.input.height, kyFirst, kyLast);
+        for (int ox = 0; ox < window.output.width; ox++, patch += window.patchSize()) {
+            const int x0 = ox * window.stride - window.padding;
+            int kxFirst, kxLast;
+            windowRange(x0, kernel, window.input.width, kxFirst, kxLast);
+            for (int ky = kyFirst; ky < kyLast; ky++) {
+                const T* row = patch + ky * kernel * channels;
+                T* pixels =
+                    image + (static_cast<std::size_t>(y0 + ky) * window.input.width + x0 + kxFirst) * pixelStride;
+                if (!window.planarInput) {
+                    simd.axpy(T(1), row + kxFirst * channels, pixels, (kxLast - kxFirst) * channels);
+                } else {
+                    for (int kx = kxFirst; kx < kxLast; kx++) {
+                        for (int c = 0; c < channels; c++) {
+                            pixels[static_cast<std::size_t>(c) * channelStride + kx - kxFirst] +=
+                                row[kx * channels + c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Max pooling of one image, per channel, written channels last. indices[i]
+// is the offset in `image` of the value output i came from, for
+// maxPoolBackward(). Windows overhanging the image only see its inside.
+template <typename T>
+void maxPoolForward(const ImageWindow& window, const T* image, T* output, int32_t* indices) {
+    const int channels = window.input.channels;
+    const int channelStride = window.channelStride();
+    const int pixelStride = window.pixelStride();
+    for (int oy = 0; oy < window.output.height; oy++) {
+        const int y0 = oy * window.stride - window.padding;
+        int kyFirst, kyLast;
+        windowRange(y0, window.kernel, window.input.height, kyFirst, kyLast);
+        for (int ox = 0; ox < window.output.width; ox++) {
+            const int x0 = ox * window.stride - window.padding;
+            int kxFirst, kxLast;
+            windowRange(x0, window.kernel, window.input.width, kxFirst, kxLast);
+            const std::size_t position = static_cast<std::size_t>(oy) * window.output.width + ox;
+            T* maxima = output + position * channels;
+            int32_t* sources = indices + position * channels;
+            const int corner = ((y0 + kyFirst) * window.input.width + x0 + kxFirst) * pixelStride;
+            for (int c = 0; c < channels; c++) {
+                sources[c] = corner + c * channelStride;
+                maxima[c] = image[sources[c]];
+            }
+            for (int ky = kyFirst; ky < kyLast; ky++) {
+                for (int kx = kxFirst; kx < kxLast; kx++) {
+                    const int pixel = ((y0 + ky) * window.input.width + x0 + kx) * pixelStride;
+                    // Selects rather than branches, so the channels vectorize
+                    for (int c = 0; c < channels; c++) {
+                        const int32_t offset = pixel + c * channelStride;
+                        const bool larger = image[offset] > maxima[c];
+                        maxima[c] = larger ? image[offset] : maxima[c];
+                        sources[c] = larger ? offset : sources[c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Adds each output error of maxPoolForward() to the input value its window
+// picked; the other inputs get no error
+template <typename T>
+void maxPoolBackward(const ImageWindow& window, const T* errors, const int32_t* indices, T* inputErrors) {
+    const int count = window.output.size();
+    for (int i = 0; i < count; i++) {
+        inputErrors[indices[i]] += errors[i];
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./dataset.cpp"
+#include "./random.cpp"
+#include "./tensor.cpp"
+
+// One training batch: a sample per row
+template <typename T>
+struct DataBatch {
+    Matrix<T> inputs;   // rows x sample width, normalized
+    Matrix<T> targets;  // rows x classes, one-hot
+    long epoch = 0;     // Epoch the first row was drawn from
+};
+
+// Streams batches of raw uint8 samples (for example the views of an
+// MnistDataset or CifarDataset) to the training loop. A background thread
+// normalizes the samples, shuffles their order at every epoch and packs the
+// next batch while the current one is being trained on, so the samples are
+// only ever held as bytes plus two batches.
+//
+// Batches always have batchSize rows; an epoch that does not divide evenly
+// runs on into the next one.
+template <typename T>
+class DataLoader {
+public:
+    struct Options {
+        int batchSize = 32;
+        bool shuffle = true;
+        unsigned seed = 42;
+        // Each input is pixel * scale - mean[i], or pixel * scale when mean is empty
+        T scale = T(1) / T(255);
+        std::vector<T> mean = {};
+    };
+
+    // `inputs[i]` is sample i and `labels[i][0]` its class, which must be below
+    // `classes`. Throws std::invalid_argument if the labels, classes or
+    // options do not fit the samples, before any batch is packed.
+    DataLoader(const ByteView& inputs, const ByteView& labels, int classes, const Options& options)
+        : inputs(inputs), labels(labels), classes(classes), options(options), order(inputs.size()) {
+        validate();
+        for (DataBatch<T>& slot : slots) {
+            slot.inputs.resize(options.batchSize, static_cast<int>(inputs.width()));
+            slot.targets.resize(options.batchSize, classes);
+        }
+        restart(0);
+    }
+
+    ~DataLoader() { stop(); }
+
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    // Samples per epoch
+    std::size_t size() const { return inputs.size(); }
+    int batchSize() const { return options.batchSize; }
+    int sampleWidth() const { return static_cast<int>(inputs.width()); }
+    int classCount() const { return classes; }
+
+    // Hands the previous batch back to the producer and returns the next one,
+    // waiting only if it is not packed yet. The batch stays valid until the
+    // following call. Must not be called on an empty loader.
+    const DataBatch<T>& next() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (holding) {
+            ready[current] = false;
+            current ^= 1;
+            changed.notify_all();
+        }
+        changed.wait(lock, [this] { return ready[current]; });
+        holding = true;
+        served++;
+        return slots[current];
+    }
+
+    // Batches returned by next() so far, counting from the batch seek() went to
+    long batchesServed() const { return served; }
+
+    // Makes the next batch batch number `batch` of the loader's sequence, the
+    // one a fresh loader with the same options would return after `batch`
+    // calls to next(), by replaying the epoch shuffles up to it. Used to
+    // resume training from a checkpoint. Invalidates the current batch.
+    void seek(long batch) {
+        stop();
+        restart(batch);
+    }
+
+private:
+    ByteView inputs;
+    ByteView labels;
+    int classes;
+    Options options;
+
+    // Producer state, only touched by the producer thread after construction
+    std::vector<std::size_t> order;
+    std::size_t position = 0;
+    long epoch = 0;
+    Xoshiro256 generator;
+    long served = 0;
+
+    // Double buffer: the producer fills slots[k] while ready[k] is false, the
+    // consumer reads slots[current] once it is ready and clears the flag when
+    // it asks for the next batch.
+    DataBatch<T> slots[2];
+    bool ready[2] = {false, false};
+    int current = 0;
+    bool holding = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread producer;
+
+    // The producer writes targets(r, label) and reads mean[i] without checks,
+    // so everything it indexes with is checked here once
+    void validate() const {
+        if (options.batchSize <= 0) {
+            throw std::invalid_argument("DataLoader: batch size must be positive, got " +
+                                        std::to_string(options.batchSize));
+        }
+        if (classes <= 0) {
+            throw std::invalid_argument("DataLoader: classes must be positive, got " +
+                                        std::to_string(classes));
+        }
+        if (labels.size() != inputs.size()) {
+            throw std::invalid_argument("DataLoader: " + std::to_string(labels.size()) + " labels for " +
+                                        std::to_string(inputs.size()) + " samples");
+        }
+        if (!labels.empty() && labels.width() == 0) {
+            throw std::invalid_argument("DataLoader: labels are empty records");
+        }
+        if (!options.mean.empty() && options.mean.size() != inputs.width()) {
+            throw std::invalid_argument("DataLoader: mean has " + std::to_string(options.mean.size()) +
+                                        " values for samples of " + std::to_string(inputs.width()));
+        }
+        for (std::size_t i = 0; i < labels.size(); i++) {
+            if (labels[i][0] >= classes) {
+                throw std::invalid_argument("DataLoader: label " + std::to_string(labels[i][0]) + " of sample " +
+                                            std::to_string(i) + " is not below " + std::to_string(classes) +
+                                            " classes");
+            }
+        }
+    }
+
+    // Positions the producer state at batch `batch` and starts the producer
+    void restart(long batch) {
+        std::iota(order.begin(), order.end(), std::size_t(0));
+        generator.seed(options.seed);
+        if (options.shuffle) {
+            shuffle(order.begin(), order.end(), generator);
+        }
+        epoch = 0;
+        position = 0;
+        if (!order.empty()) {
+            const uint64_t samples = static_cast<uint64_t>(batch) * options.batchSize;
+            epoch = static_cast<long>(samples / order.size());
+            position = static_cast<std::size_t>(samples % order.size());
+            for (long e = 0; e < epoch && options.shuffle; e++) {
+                shuffle(order.begin(), order.end(), generator);
+            }
+        }
+        served = batch;
+        ready[0] = ready[1] = false;
+        current = 0;
+        holding = false;
+        stopping = false;
+        if (!inputs.empty()) {
+            producer = std::thread([this] { produce(); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (producer.joinable()) {
+            producer.join();
+        }
+    }
+
+    void fill(DataBatch<T>& batch) {
+        const int width = sampleWidth();
+        batch.epoch = epoch;
+        batch.targets.fill(T(0));
+        for (int r = 0; r < options.batchSize; r++) {
+            const std::size_t sample = order[position];
+            const uint8_t* pixels = inputs[sample];
+            T* row = batch.inputs.row(r);
+            if (options.mean.empty()) {
+                for (int i = 0; i < width; i++) {
+                    row[i] = static_cast<T>(pixels[i]) * options.scale;
+                }
+            } else {
+                for (int i = 0; i < width; i++) {
+                    row[i] = static_cast<T>(pixels[i]) * options.scale - options.mean[i];
+                }
+            }
+            batch.targets(r, labels[sample][0]) = T(1);
+
+            if (++position == order.size()) {
+                position = 0;
+                epoch++;
+                if (options.shuffle) {
+                    shuffle(order.begin(), order.end(), generator);
+                }
+            }
+        }
+    }
+
+    void produce() {
+        for (int slot = 0;; slot ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return stopping || !ready[slot]; });
+                if (stopping) {
+                    return;
+                }
+            }
+            fill(slots[slot]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[slot] = true;
+            }
+            changed.notify_all();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "./mappedFile.cpp"
+
+// Readers for the MNIST (IDX) and CIFAR binary datasets. The files are
+// memory-mapped and exposed as views into the mapping, so opening a dataset
+// only reads its headers: nothing is copied, and records are paged in as
+// they are used.
+
+// `count` records of `width` bytes, the first at `base` and each `stride`
+// bytes after the previous one. Does not own the bytes.
+class ByteView {
+public:
+    ByteView() = default;
+    ByteView(const uint8_t* base, std::size_t count, std::size_t width, std::size_t stride)
+        : base(base), count(count), recordWidth(width), recordStride(stride) {}
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::size_t width() const { return recordWidth; }
+    std::size_t stride() const { return recordStride; }
+
+    // First byte of record i
+    const uint8_t* operator[](std::size_t i) const { return base + i * recordStride; }
+
+private:
+    const uint8_t* base = nullptr;
+    std::size_t count = 0;
+    std::size_t recordWidth = 0;
+    std::size_t recordStride = 0;
+};
+
+// An IDX file of unsigned bytes (type 0x08), as used by MNIST: a big-endian
+// header giving the size of each dimension, then the values row-major.
+class IdxFile {
+public:
+    static constexpr uint8_t UNSIGNED_BYTE = 0x08;
+
+    // Maps and validates `path`; returns nullptr and sets `error` on failure.
+    static std::shared_ptr<IdxFile> open(const std::string& path, std::string& error) {
+        std::shared_ptr<MappedFile> mapped = MappedFile::open(path, MappedFile::READ_ONLY, error);
+        if (mapped == nullptr) {
+            return nullptr;
+        }
+        const uint8_t* bytes = mapped->data();
+        if (mapped->size() < 4 || bytes[0] != 0 || bytes[1] != 0) {
+            error = path + " is not an IDX file";
+            return nullptr;
+        }
+        if (bytes[2] != UNSIGNED_BYTE) {
+            error = path + ": only unsigned byte IDX files are supported";
+            return nullptr;
+        }
+
+        std::shared_ptr<IdxFile> file(new IdxFile(mapped));
+        const std::size_t dimensions = bytes[3];
+        const std::size_t headerBytes = 4 + 4 * dimensions;
+        if (dimensions == 0 || mapped->size() < headerBytes) {
+            error = path + ": truncated IDX header";
+            return nullptr;
+        }
+        uint64_t values = 1;
+        for (std::size_t d = 0; d < dimensions; d++) {
+            const uint8_t* field = bytes + 4 + 4 * d;
+            const uint32_t dimension = static_cast<uint32_t>(field[0]) << 24 | static_cast<uint32_t>(field[1]) << 16 |
+                                       static_cast<uint32_t>(field[2]) << 8 | field[3];
+            file->sizes.push_back(dimension);
+            values *= dimension;
+        }
+        if (headerBytes + values != mapped->size()) {
+            error = path + ": expected " + std::to_string(headerBytes + values) + " bytes, found " +
+                    std::to_string(mapped->size());
+            return nullptr;
+        }
+        file->values = bytes + headerBytes;
+        return file;
+    }
+
+    const std::vector<uint32_t>& dimensions() const { return sizes; }
+
+    // One record per entry of the first dimension, each holding the remaining dimensions
+    ByteView records() const {
+        std::size_t width = 1;
+        for (std::size_t d = 1; d < sizes.size(); d++) {
+            width *= sizes[d];
+        }
+        return ByteView(values, sizes[0], width, width);
+    }
+
+private:
+    std::shared_ptr<MappedFile> mapped;
+    std::vector<uint32_t> sizes;
+    const uint8_t* values = nullptr;
+
+    explicit IdxFile(std::shared_ptr<MappedFile> mapped) : mapped(std::move(mapped)) {}
+};
+
+// MNIST images and their labels: images[i] points at the rows x cols pixels
+// of image i and labels[i][0] is its digit.
+struct MnistDataset {
+    ByteView images;
+    ByteView labels;
+    int rows = 0;
+    int cols = 0;
+
+    std::size_t size() const { return images.size(); }
+
+    // Opens an image file (magic 2051) and its label file (magic 2049),
+    // checking that they hold the same number of records and that every
+    // label is a digit. Returns false and sets `error` on failure.
+    bool open(const std::string& imagesPath, const std::string& labelsPath, std::string& error) {
+        std::shared_ptr<IdxFile> images = IdxFile::open(imagesPath, error);
+        if (images == nullptr) {
+            return false;
+        }
+        std::shared_ptr<IdxFile> labels = IdxFile::open(labelsPath, error);
+        if (labels == nullptr) {
+            return false;
+        }
+        if (images->dimensions().size() != 3) {
+            error = imagesPath + " is not an MNIST image file";
+            return false;
+        }
+        if (labels->dimensions().size() != 1) {
+            error = labelsPath + " is not an MNIST label file";
+            return false;
+        }
+        if (images->dimensions()[0] != labels->dimensions()[0]) {
+            error = imagesPath + " has " + std::to_string(images->dimensions()[0]) + " images but " + labelsPath +
+                    " has " + std::to_string(labels->dimensions()[0]) + " labels";
+            return false;
+        }
+        ByteView labelView = labels->records();
+        for (std::size_t i = 0; i < labelView.size(); i++) {
+            if (labelView[i][0] > 9) {
+                error = labelsPath + ": label " + std::to_string(i) + " is not a digit";
+                return false;
+            }
+        }
+
+        imageFile = images;
+        labelFile = labels;
+        this->images = images->records();
+        this->labels = labelView;
+        rows = static_cast<int>(images->dimensions()[1]);
+        cols = static_cast<int>(images->dimensions()[2]);
+        return true;
+    }
+
+private:
+    std::shared_ptr<IdxFile> imageFile;
+    std::shared_ptr<IdxFile> labelFile;
+};
+
+// CIFAR-100 binary file: records of one coarse label byte, one fine label
+// byte and 3072 pixel bytes (32x32 red, then green, then blue). The views
+// stride over the records, so images[i], coarseLabels[i][0] and
+// fineLabels[i][0] all point into record i.
+struct CifarDataset {
+    static constexpr std::size_t IMAGE_BYTES = 32 * 32 * 3;
+    static constexpr std::size_t RECORD_BYTES = 2 + IMAGE_BYTES;
+
+    ByteView images;
+    ByteView coarseLabels;
+    ByteView fineLabels;
+
+    std::size_t size() const { return images.size(); }
+
+    // Returns false and sets `error` when the file cannot be mapped or is not
+    // a whole number of records. Labels are not range-checked here: they are
+    // spread over the whole file, and checking them would read all of it.
+    // Call checkLabels() before using them as indices.
+    bool open(const std::string& path, std::string& error) {
+        std::shared_ptr<MappedFile> mapped = MappedFile::open(path, MappedFile::READ_ONLY, error);
+        if (mapped == nullptr) {
+            return false;
+        }
+        if (mapped->size() == 0 || mapped->size() % RECORD_BYTES != 0) {
+            error = path + ": size " + std::to_string(mapped->size()) + " is not a multiple of the " +
+                    std::to_string(RECORD_BYTES) + "-byte CIFAR-100 record";
+            return false;
+        }
+
+        file = mapped;
+        const std::size_t count = mapped->size() / RECORD_BYTES;
+        coarseLabels = ByteView(mapped->data(), count, 1, RECORD_BYTES);
+        fineLabels = ByteView(mapped->data() + 1, count, 1, RECORD_BYTES);
+        images = ByteView(mapped->data() + 2, count, IMAGE_BYTES, RECORD_BYTES);
+        return true;
+    }
+
+    // True when every coarse label is below 20 and every fine label below
+    // 100; touches every record, so pages in the whole file.
+    bool checkLabels(std::string& error) const {
+        for (std::size_t i = 0; i < size(); i++) {
+            if (coarseLabels[i][0] >= 20 || fineLabels[i][0] >= 100) {
+                error = "record " + std::to_string(i) + " has an invalid label";
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::shared_ptr<MappedFile> file;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef FIXED_NETWORK_H
+#define FIXED_NETWORK_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "./activation.cpp"
+#include "./modelFile.cpp"
+
+// Loops whose trip count is a template argument, expanded into straight-line
+// code: body(std::integral_constant<std::size_t, i>) for i in [0, N)
+template <typename Body, std::size_t... I>
+inline void unrolled(Body&& body, std::index_sequence<I...>) {
+    (body(std::integral_constant<std::size_t, I>()), ...);
+}
+
+template <std::size_t N, typename Body>
+inline void unrolled(Body&& body) {
+    unrolled(std::forward<Body>(body), std::make_index_sequence<N>());
+}
+
+// Weights a FixedNetwork may have: every loop is unrolled, so code size grows with them
+constexpr std::size_t FIXED_NETWORK_MAX_WEIGHTS = 1024;
+
+// Inference-only network with one hidden layer whose sizes and activation are
+// template arguments, for the tiny models (xor, angles, iris) where the
+// dynamic NeuralNetwork spends more time on its bookkeeping than on the
+// arithmetic. Weights live in std::arrays inside the object, every loop is
+// unrolled at compile time and the activation is picked by `if constexpr`,
+// so predict() is a few dozen multiply-adds with no allocation, no indirect
+// call and no branch on the configuration.
+//
+// The layers match a NeuralNetwork built from hiddenSize/outputSize with the
+// same activation: Activation on both layers, or a linear hidden layer and a
+// softmax output for SOFTMAX. Models are exchanged through the model file
+// format of saveModel()/loadModel(), in either dtype.
+template <int Inputs, int Hidden, int Outputs, ActivationFunction Activation, typename T = double>
+class FixedNetwork {
+    static_assert(Inputs > 0 && Hidden > 0 && Outputs > 0, "layer sizes must be positive");
+    static_assert(static_cast<std::size_t>(Inputs) * Hidden + static_cast<std::size_t>(Hidden) * Outputs <=
+                      FIXED_NETWORK_MAX_WEIGHTS,
+                  "FixedNetwork is meant for tiny models, use NeuralNetwork");
+    static_assert(Activation == TANH || Activation == SIGMOID || Activation == RELU || Activation == LINEAR ||
+                      Activation == SOFTMAX,
+                  "unsupported activation");
+
+public:
+    static constexpr ActivationFunction HIDDEN_ACTIVATION = Activation == SOFTMAX ? LINEAR : Activation;
+    static constexpr ActivationFunction OUTPUT_ACTIVATION = Activation;
+
+    // All weights and biases start at zero; load a trained model with loadModel()
+    FixedNetwork() : hiddenWeights{}, hiddenBiases{}, outputWeights{}, outputBiases{} {}
+
+    void predict(const T* inputs, T* outputs) const {
+        std::array<T, Hidden> hidden;
+        dense<Inputs, Hidden, HIDDEN_ACTIVATION>(inputs, hiddenWeights, hiddenBiases, hidden.data());
+        dense<Hidden, Outputs, OUTPUT_ACTIVATION>(hidden.data(), outputWeights, outputBiases, outputs);
+    }
+
+    std::array<T, Outputs> predict(const std::array<T, Inputs>& inputs) const {
+        std::array<T, Outputs> outputs;
+        predict(inputs.data(), outputs.data());
+        return outputs;
+    }
+
+    // Loads a model written by NeuralNetwork::saveModel() or saveModel(). Its
+    // two layers must have this network's shapes and activations; weights of
+    // the other dtype are converted.
+    bool loadModel(const std::string& filePath) {
+        std::string error;
+        // Every weight is copied out of the file, so verifying costs little
+        std::shared_ptr<ModelFile> file = ModelFile::open(filePath, error, true);
+        if (file == nullptr) {
+            std::cout << "Unable to load model: " << error << std::endl;
+            return false;
+        }
+        const ModelFileLayer expected[2] = {
+            {static_cast<uint32_t>(Inputs), static_cast<uint32_t>(Hidden), static_cast<uint32_t>(HIDDEN_ACTIVATION), 0},
+            {static_cast<uint32_t>(Hidden), static_cast<uint32_t>(Outputs), static_cast<uint32_t>(OUTPUT_ACTIVATION), 0}};
+        if (file->header().layerCount != 2) {
+            std::cout << "Unable to load model: " << filePath << " has " << file->header().layerCount
+                      << " layers, expected 2" << std::endl;
+            return false;
+        }
+        for (std::size_t l = 0; l < 2; l++) {
+            const ModelFileLayer& layer = file->layer(l);
+            if (layer.inputs != expected[l].inputs || layer.outputs != expected[l].outputs ||
+                layer.activation != expected[l].activation) {
+                std::cout << "Unable to load model: layer " << l << " of " << filePath << " is " << layer.inputs
+                          << "x" << layer.outputs << " with activation " << layer.activation << ", expected "
+                          << expected[l].inputs << "x" << expected[l].outputs << " with activation "
+                          << expected[l].activation << std::endl;
+                return false;
+            }
+        }
+        readValues(*file, file->weights(0), hiddenWeights.data(), hiddenWeights.size());
+        readValues(*file, file->biases(0), hiddenBiases.data(), hiddenBiases.size());
+        readValues(*file, file->weights(1), outputWeights.data(), outputWeights.size());
+        readValues(*file, file->biases(1), outputBiases.data(), outputBiases.size());
+        return true;
+    }
+
+    void saveModel(const std::string& filePath) const {
+        const std::vector<ModelFileLayer> layers = {
+            {static_cast<uint32_t>(Inputs), static_cast<uint32_t>(Hidden), static_cast<uint32_t>(HIDDEN_ACTIVATION), 0},
+            {static_cast<uint32_t>(Hidden), static_cast<uint32_t>(Outputs), static_cast<uint32_t>(OUTPUT_ACTIVATION), 0}};
+        std::string error;
+        if (!writeModelFile<T>(filePath, layers, {hiddenWeights.data(), outputWeights.data()},
+                               {hiddenBiases.data(), outputBiases.data()}, error)) {
+            std::cout << "Unable to save model: " << error << std::endl;
+        }
+    }
+
+private:
+    // [input][output], the layout of NeuralNetwork layers and model files
+    std::array<T, Inputs * Hidden> hiddenWeights;
+    std::array<T, Hidden> hiddenBiases;
+    std::array<T, Hidden * Outputs> outputWeights;
+    std::array<T, Outputs> outputBiases;
+
+    template <ActivationFunction Function>
+    static T activate(T x) {
+        if constexpr (Function == SIGMOID) {
+            return T(1) / (T(1) + std::exp(-x));
+        } else if constexpr (Function == TANH) {
+            // One exp instead of std::tanh, as in the vectorized kernels
+            return T(1) - T(2) / (std::exp(T(2) * x) + T(1));
+        } else if constexpr (Function == RELU) {
+            return x > T(0) ? x : T(0);
+        } else {
+            return x;
+        }
+    }
+
+    // outputs = activation(inputs * weights + biases), accumulating one input
+    // row at a time like the dynamic kernels
+    template <int In, int Out, ActivationFunction Function>
+    static void dense(const T* inputs, const std::array<T, In * Out>& weights, const std::array<T, Out>& biases,
+                      T* outputs) {
+        std::array<T, Out> sums = biases;
+        unrolled<In>([&](auto i) {
+            const T input = inputs[i];
+            unrolled<Out>([&](auto o) { sums[o] += input * weights[i * Out + o]; });
+        });
+        if constexpr (Function == SOFTMAX) {
+            T largest = sums[0];
+            unrolled<Out>([&](auto o) { largest = std::max(largest, sums[o]); });
+            T total = T(0);
+            unrolled<Out>([&](auto o) {
+                sums[o] = std::exp(sums[o] - largest);
+                total += sums[o];
+            });
+            unrolled<Out>([&](auto o) { outputs[o] = sums[o] / total; });
+        } else {
+            unrolled<Out>([&](auto o) { outputs[o] = activate<Function>(sums[o]); });
+        }
+    }
+
+    // Copies `count` values of the file's dtype, or zeros for version 1 files without biases
+    static void readValues(const ModelFile& file, const void* values, T* destination, std::size_t count) {
+        if (values == nullptr) {
+            std::fill(destination, destination + count, T(0));
+        } else if (file.header().dtype == DTYPE_FLOAT32) {
+            const float* source = static_cast<const float*>(values);
+            std::transform(source, source + count, destination, [](float value) { return static_cast<T>(value); });
+        } else {
+            const double* source = static_cast<const double*>(values);
+            std::transform(source, source + count, destination, [](double value) { return static_cast<T>(value); });
+        }
+    }
+};
+
+#endif
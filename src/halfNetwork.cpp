@@ -0,0 +1,216 @@
+#ifndef HALF_NETWORK_H
+#define HALF_NETWORK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "./modelFile.cpp"
+#include "./nn.cpp"
+#include "./tensor.cpp"
+
+// Mixed-precision inference for a trained NeuralNetwork: weights and the
+// activations passed between layers are stored as 16-bit floats, either
+// bfloat16 (the top half of a float: float's range with 8 significant bits)
+// or IEEE fp16 (11 significant bits, but only up to 65504 and down to 6e-8).
+// That halves the bytes a forward pass streams against float and quarters
+// them against double. The denseHalf kernel widens both operands to float as
+// they are loaded into registers and sums in float; biases and the outputs
+// of the last layer stay T.
+//
+// The NeuralNetwork a HalfNetwork is made from is its master copy: training
+// keeps updating that in full precision, since a step smaller than half the
+// spacing of 16-bit values around a weight (1 / 256 of it for bfloat16)
+// would round away, and update() rounds the new weights into the half copy
+// without reallocating.
+//
+// Half models are packed files (see modelFile.cpp) whose header options hold
+// the HalfFormat of the weights. Each layer's block holds float
+// biases[outputs], then uint16 weights[inputs][outputs] in that format.
+
+constexpr char HALF_FILE_MAGIC[8] = {'N', 'N', 'H', 'A', 'L', 'F', '\0', '\0'};
+constexpr uint32_t HALF_FILE_VERSION = 1;
+
+// Inference-only 16-bit copy of a NeuralNetwork<T>. predictBatch() reuses its
+// buffers, so a network serves one thread at a time; give each serving
+// thread its own copy.
+template <typename T = float>
+class HalfNetwork {
+public:
+    HalfNetwork() = default;
+
+    // Rounds the weights of `network` to `format`. Only networks of dense
+    // layers are converted; others give an empty network.
+    static HalfNetwork fromNetwork(const NeuralNetwork<T>& network, HalfFormat format = HALF_BFLOAT16) {
+        HalfNetwork half;
+        half.format = format;
+        for (int l = 0; l < network.layerCount(); l++) {
+            if (network.layerType(l) != DENSE) {
+                std::cerr << "Unable to convert to half precision: layer " << l << " is not a dense layer"
+                          << std::endl;
+                return half;
+            }
+        }
+        for (int l = 0; l < network.layerCount(); l++) {
+            const Matrix<T>& weights = network.layerWeights(l);
+            Layer layer;
+            layer.inputs = weights.rows();
+            layer.outputs = weights.cols();
+            layer.activation = network.layerActivation(l);
+            layer.weights.resize(weights.size());
+            half.layers.push_back(std::move(layer));
+        }
+        half.update(network);
+        return half;
+    }
+
+    // Rounds the current weights and biases of `network`, the master copy
+    // this network was made from, into it. Returns false, leaving the
+    // network as it was, if the layer shapes differ.
+    bool update(const NeuralNetwork<T>& network) {
+        if (network.layerCount() != layerCount()) {
+            return false;
+        }
+        for (int l = 0; l < layerCount(); l++) {
+            const Matrix<T>& weights = network.layerWeights(l);
+            if (network.layerType(l) != DENSE || weights.rows() != layers[l].inputs ||
+                weights.cols() != layers[l].outputs) {
+                return false;
+            }
+        }
+        const KernelTable<T>& simd = kernels<T>();
+        for (int l = 0; l < layerCount(); l++) {
+            Layer& layer = layers[l];
+            const Matrix<T>& weights = network.layerWeights(l);
+            const Matrix<T>& biases = network.layerBiases(l);
+            simd.toHalf(weights.data(), layer.weights.data(), static_cast<int>(weights.size()), format);
+            // Biases are kept as float, as saved
+            layer.biases.resize(layer.outputs);
+            for (int j = 0; j < layer.outputs; j++) {
+                layer.biases[j] = static_cast<T>(static_cast<float>(biases.data()[j]));
+            }
+        }
+        return true;
+    }
+
+    int layerCount() const { return static_cast<int>(layers.size()); }
+    int inputSize() const { return layers.empty() ? 0 : layers.front().inputs; }
+    int outputSize() const { return layers.empty() ? 0 : layers.back().outputs; }
+    HalfFormat halfFormat() const { return format; }
+
+    // Bytes of the 16-bit weights and the float biases, as saved
+    std::size_t modelBytes() const {
+        std::size_t bytes = 0;
+        for (const Layer& layer : layers) {
+            bytes += sizeof(uint16_t) * layer.inputs * layer.outputs + sizeof(float) * layer.outputs;
+        }
+        return bytes;
+    }
+
+    // Inference for every row of `inputs`; `outputs` is resized to inputs.rows() x outputSize()
+    void predictBatch(const Matrix<T>& inputs, Matrix<T>& outputs) {
+        outputs.resize(inputs.rows(), outputSize());
+        for (int first = 0; first < inputs.rows(); first += INFERENCE_CHUNK_ROWS) {
+            const int rows = std::min(INFERENCE_CHUNK_ROWS, inputs.rows() - first);
+            forwardRows(inputs.row(first), rows, outputs.row(first));
+        }
+    }
+
+    // Inference for one sample of inputSize() values into outputSize() values
+    void predict(const T* inputs, T* outputs) { forwardRows(inputs, 1, outputs); }
+
+    bool save(const std::string& filePath, std::string& error) const {
+        std::vector<ModelFileLayer> entries;
+        for (const Layer& layer : layers) {
+            entries.push_back({static_cast<uint32_t>(layer.inputs), static_cast<uint32_t>(layer.outputs),
+                               static_cast<uint32_t>(layer.activation), 0});
+        }
+        PackedFileWriter file(entries);
+        for (const Layer& layer : layers) {
+            file.appendFloats(layer.biases.data(), layer.biases.size());
+            file.append(layer.weights.data(), sizeof(uint16_t) * layer.weights.size());
+            file.endBlock();
+        }
+        return file.write(filePath, HALF_FILE_MAGIC, HALF_FILE_VERSION, static_cast<uint32_t>(format), error);
+    }
+
+    bool load(const std::string& filePath, std::string& error) {
+        PackedFileReader file;
+        if (!file.open(filePath, HALF_FILE_MAGIC, HALF_FILE_VERSION, "half precision model", error)) {
+            return false;
+        }
+        if (file.header().options > HALF_FLOAT16) {
+            error = filePath + ": unknown half format " + std::to_string(file.header().options);
+            return false;
+        }
+        const std::vector<ModelFileLayer>& entries = file.layers();
+        uint64_t expectedBytes = 0;
+        for (const ModelFileLayer& entry : entries) {
+            expectedBytes += blockBytes(entry.inputs, entry.outputs);
+        }
+        if (expectedBytes != file.dataSize()) {
+            error = filePath + ": layer shapes do not match the data size";
+            return false;
+        }
+
+        std::vector<Layer> loaded(entries.size());
+        const unsigned char* block = file.blocks();
+        for (std::size_t l = 0; l < entries.size(); l++) {
+            Layer& layer = loaded[l];
+            layer.inputs = static_cast<int>(entries[l].inputs);
+            layer.outputs = static_cast<int>(entries[l].outputs);
+            layer.activation = static_cast<ActivationFunction>(entries[l].activation);
+            const unsigned char* current = block;
+            layer.biases.resize(layer.outputs);
+            for (T& bias : layer.biases) {
+                bias = PackedFileReader::readFloat<T>(current);
+            }
+            layer.weights.resize(static_cast<std::size_t>(layer.inputs) * layer.outputs);
+            PackedFileReader::read(current, layer.weights.data(), sizeof(uint16_t) * layer.weights.size());
+            block += blockBytes(layer.inputs, layer.outputs);
+        }
+        layers = std::move(loaded);
+        format = static_cast<HalfFormat>(file.header().options);
+        return true;
+    }
+
+private:
+    struct Layer {
+        int inputs = 0;
+        int outputs = 0;
+        ActivationFunction activation = LINEAR;
+        AlignedVector<uint16_t> weights;  // inputs x outputs, as in NeuralNetwork
+        AlignedVector<T> biases;
+    };
+    std::vector<Layer> layers;
+    HalfFormat format = HALF_BFLOAT16;
+    // Buffers of forwardRows(), reused from call to call
+    AlignedVector<uint16_t> halfInputs;
+    Matrix<T> hidden;
+
+    static uint64_t blockBytes(uint64_t inputs, uint64_t outputs) {
+        const uint64_t bytes = sizeof(float) * outputs + sizeof(uint16_t) * inputs * outputs;
+        return (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+    }
+
+    void forwardRows(const T* inputs, int rows, T* outputs) {
+        const KernelTable<T>& simd = kernels<T>();
+        const T* layerInputs = inputs;
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            // Every layer's inputs are rounded to 16 bits, like its weights
+            halfInputs.resize(static_cast<std::size_t>(rows) * layer.inputs);
+            simd.toHalf(layerInputs, halfInputs.data(), rows * layer.inputs, format);
+            T* layerOutputs = outputs;
+            if (l + 1 < layers.size()) {
+                hidden.resize(rows, layer.outputs);
+                layerOutputs = hidden.data();
+            }
+            simd.denseHalf(halfInputs.data(), layer.weights.data(), layer.biases.data(), layerOutputs, rows,
+                           layer.inputs, layer.outputs, layer.activation, format);
+            layerInputs = layerOutputs;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,799 @@
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "./nn.cpp"
+
+// Serving a trained network over a local socket: InferenceServer answers
+// prediction requests from any number of connections, and coalesces the
+// requests that arrive close together into one predictBatch() call.
+//
+// Protocol, little-endian, over a Unix domain socket or TCP on 127.0.0.1:
+//
+//   on connect, server -> client   ServerHello
+//   client -> server               RequestHeader, then count float32 inputs
+//   server -> client               ResponseHeader, then count float32 outputs
+//
+// A client may send several requests before reading any response. The
+// responses of a connection come back in request order, each echoing the id
+// of its request; rejected requests answer in their place.
+
+constexpr char SERVER_MAGIC[4] = {'N', 'N', 'S', 'V'};
+constexpr uint32_t SERVER_PROTOCOL_VERSION = 1;
+// Requests announcing more values than this are a protocol error, and the connection is closed
+constexpr uint32_t SERVER_MAX_VALUES = 1u << 24;
+
+struct ServerHello {
+    char magic[4];
+    uint32_t version;
+    uint32_t inputs;   // Values per request
+    uint32_t outputs;  // Values per response
+};
+static_assert(sizeof(ServerHello) == 16, "server hello must stay 16 bytes");
+
+struct RequestHeader {
+    uint32_t id;     // Chosen by the client, echoed in the response
+    uint32_t count;  // Input values that follow
+};
+static_assert(sizeof(RequestHeader) == 8, "request header must stay 8 bytes");
+
+enum ResponseStatus : uint32_t {
+    RESPONSE_OK,
+    RESPONSE_BAD_INPUT_COUNT  // The request did not have ServerHello::inputs values; no outputs follow
+};
+
+struct ResponseHeader {
+    uint32_t id;
+    uint32_t status;  // ResponseStatus value
+    uint32_t count;   // Output values that follow
+};
+static_assert(sizeof(ResponseHeader) == 12, "response header must stay 12 bytes");
+
+// Reads exactly `bytes` bytes; false on end of stream or error
+inline bool readFully(int socket, void* data, std::size_t bytes) {
+    char* next = static_cast<char*>(data);
+    while (bytes > 0) {
+        const ssize_t received = ::recv(socket, next, bytes, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        next += received;
+        bytes -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+// Writes exactly `bytes` bytes. A peer that went away is an error, not a SIGPIPE.
+inline bool writeFully(int socket, const void* data, std::size_t bytes) {
+    const char* next = static_cast<const char*>(data);
+    while (bytes > 0) {
+        const ssize_t sent = ::send(socket, next, bytes, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        next += sent;
+        bytes -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+// Where a server listens: a Unix domain socket at `socketPath`, or else TCP
+// `port` on 127.0.0.1 only
+struct ServerAddress {
+    std::string socketPath;
+    int port = 0;  // 0 lets a server pick a free port
+
+    std::string describe() const {
+        return socketPath.empty() ? "127.0.0.1:" + std::to_string(port) : socketPath;
+    }
+};
+
+// Opens a stream socket for `address`, bound and listening when `listening`,
+// else connected. Returns -1 and sets `error` on failure.
+inline int openSocket(const ServerAddress& address, bool listening, std::string& error) {
+    const bool local = !address.socketPath.empty();
+    sockaddr_un unixAddress = {};
+    sockaddr_in tcpAddress = {};
+    sockaddr* socketAddress;
+    socklen_t addressLength;
+    if (local) {
+        if (address.socketPath.size() >= sizeof(unixAddress.sun_path)) {
+            error = "socket path too long: " + address.socketPath;
+            return -1;
+        }
+        unixAddress.sun_family = AF_UNIX;
+        std::memcpy(unixAddress.sun_path, address.socketPath.c_str(), address.socketPath.size() + 1);
+        socketAddress = reinterpret_cast<sockaddr*>(&unixAddress);
+        addressLength = sizeof(unixAddress);
+    } else {
+        tcpAddress.sin_family = AF_INET;
+        tcpAddress.sin_port = htons(static_cast<uint16_t>(address.port));
+        tcpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socketAddress = reinterpret_cast<sockaddr*>(&tcpAddress);
+        addressLength = sizeof(tcpAddress);
+    }
+
+    const int descriptor = ::socket(local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (descriptor < 0) {
+        error = std::string("unable to create a socket: ") + std::strerror(errno);
+        return -1;
+    }
+    const int on = 1;
+    if (!local) {
+        // Responses are small and latency is the point: no Nagle delay
+        setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    bool ok;
+    if (listening) {
+        if (local) {
+            ::unlink(address.socketPath.c_str());
+        } else {
+            setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        }
+        ok = ::bind(descriptor, socketAddress, addressLength) == 0 && ::listen(descriptor, SOMAXCONN) == 0;
+    } else {
+        ok = ::connect(descriptor, socketAddress, addressLength) == 0;
+    }
+    if (!ok) {
+        error = std::string(listening ? "unable to listen on " : "unable to connect to ") + address.describe() +
+                ": " + std::strerror(errno);
+        ::close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+// Latencies counted in log-linear buckets: values below 32 ns exactly, then 32
+// buckets per power of two, so percentiles are within about 3% with a fixed
+// table that never allocates.
+class LatencyHistogram {
+public:
+    void record(int64_t nanoseconds) {
+        counts[bucketOf(static_cast<uint64_t>(std::max<int64_t>(0, nanoseconds)))]++;
+        total++;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+    }
+
+    void clear() {
+        counts.fill(0);
+        total = 0;
+    }
+
+    uint64_t count() const { return total; }
+
+    // Latency below which `percent` of the values are, in nanoseconds
+    double percentile(double percent) const {
+        if (total == 0) {
+            return 0.0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100.0 * total)));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return middleOf(i);
+            }
+        }
+        return middleOf(BUCKETS - 1);
+    }
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+
+    static int bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<int>(value);
+        }
+        const int exponent = 63 - __builtin_clzll(value);
+        const int shift = exponent - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static double middleOf(int bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const int shift = bucket / SUB_BUCKETS - 1;
+        const double low = static_cast<double>(static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift);
+        return low + static_cast<double>(uint64_t(1) << shift) / 2.0;
+    }
+};
+
+struct ServerConfig {
+    ServerAddress address;
+    int maxBatch = 64;               // Most requests answered by one predictBatch() call
+    int maxDelayMicroseconds = 200;  // Longest the first request of a batch waits for more to join it
+    int writeTimeoutMilliseconds = 1000;  // A client that leaves a response unread this long is disconnected
+};
+
+// What a server did since the previous takeStats()
+struct ServerStats {
+    double seconds = 0.0;
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    double p50Microseconds = 0.0;  // From a request's last byte read to its response written, waits for room included
+    double p99Microseconds = 0.0;
+
+    double requestsPerSecond() const { return seconds > 0.0 ? requests / seconds : 0.0; }
+    double meanBatch() const { return batches > 0 ? static_cast<double>(requests) / batches : 0.0; }
+};
+
+// Serves `network` to every client of config.address. One thread accepts
+// connections, one thread per connection reads its requests into the
+// pending batch, and one batching thread runs the network.
+//
+// The batching thread starts a batch as soon as a request is pending and
+// waits at most maxDelayMicroseconds from that request's arrival for others
+// to join, or until maxBatch are pending. Requests that arrive while a batch
+// runs form the next one, so under load batches fill up without any delay,
+// and a lone request pays at most the delay. A reader blocks while the
+// pending batch is full, which pushes back on clients through the socket.
+// A client that stops reading its responses can hold up the batching thread
+// for at most writeTimeoutMilliseconds; its connection is then closed.
+//
+// The network is only used by the batching thread. Its own threads split
+// each batch as in predictBatch(). Every response after the hello, rejections
+// included, is written by the batching thread, which keeps them in order.
+template <typename T>
+class InferenceServer {
+public:
+    InferenceServer(NeuralNetwork<T>& network, const ServerConfig& config)
+        : network(network), config(config), inputSize(network.inputCount()), outputSize(network.outputCount()) {
+        this->config.maxBatch = std::max(1, config.maxBatch);
+        this->config.maxDelayMicroseconds = std::max(0, config.maxDelayMicroseconds);
+        this->config.writeTimeoutMilliseconds = std::max(1, config.writeTimeoutMilliseconds);
+        for (Batch& batch : batches) {
+            batch.inputs.resize(this->config.maxBatch, inputSize);
+            batch.requests.resize(this->config.maxBatch);
+        }
+        batchLatencies.resize(this->config.maxBatch);
+        response.resize(sizeof(ResponseHeader) + static_cast<std::size_t>(outputSize) * sizeof(float));
+    }
+
+    ~InferenceServer() { stop(); }
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    // Starts listening and serving. Returns false and sets `error` if the
+    // address cannot be bound.
+    bool start(std::string& error) {
+        listener = openSocket(config.address, true, error);
+        if (listener < 0) {
+            return false;
+        }
+        if (config.address.socketPath.empty() && config.address.port == 0) {
+            sockaddr_in bound = {};
+            socklen_t length = sizeof(bound);
+            getsockname(listener, reinterpret_cast<sockaddr*>(&bound), &length);
+            config.address.port = ntohs(bound.sin_port);
+        }
+        statsStart = std::chrono::steady_clock::now();
+        batcher = std::thread([this] { runBatches(); });
+        acceptor = std::thread([this] { acceptConnections(); });
+        return true;
+    }
+
+    // Stops accepting, closes every connection and waits for the threads.
+    // Requests still pending are dropped.
+    void stop() {
+        if (listener < 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        spaceFree.notify_all();
+        // Wakes the blocking accept()
+        ::shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        ::close(listener);
+        listener = -1;
+        if (!config.address.socketPath.empty()) {
+            ::unlink(config.address.socketPath.c_str());
+        }
+        // Shut down before joining the batching thread, which may be blocked
+        // writing to a client that does not read
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (std::shared_ptr<Connection>& connection : connections) {
+            ::shutdown(connection->socket, SHUT_RDWR);
+        }
+        batcher.join();
+        for (std::shared_ptr<Connection>& connection : connections) {
+            connection->reader.join();
+        }
+        connections.clear();
+    }
+
+    // The address clients connect to, with the port picked for port 0
+    const ServerAddress& address() const { return config.address; }
+
+    // Counts and latencies since the previous call
+    ServerStats takeStats() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        const auto now = std::chrono::steady_clock::now();
+        ServerStats stats;
+        stats.seconds = std::chrono::duration<double>(now - statsStart).count();
+        stats.requests = latencies.count();
+        stats.batches = batchCount;
+        stats.p50Microseconds = latencies.percentile(50.0) / 1e3;
+        stats.p99Microseconds = latencies.percentile(99.0) / 1e3;
+        latencies.clear();
+        batchCount = 0;
+        statsStart = now;
+        return stats;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection {
+        int socket = -1;
+        std::thread reader;
+        std::atomic<bool> finished{false};
+        bool broken = false;    // A response write failed or timed out; only touched by the batching thread
+        std::vector<float> values;
+
+        ~Connection() {
+            if (socket >= 0) {
+                ::close(socket);
+            }
+        }
+    };
+
+    struct Request {
+        std::shared_ptr<Connection> connection;
+        uint32_t id = 0;
+        ResponseStatus status = RESPONSE_OK;  // Not RESPONSE_OK: answered without outputs, its row is unused
+        Clock::time_point arrival;            // When its last byte was read
+    };
+
+    // Rows of inputs and the requests they came from; one is filled by the
+    // readers while the other runs
+    struct Batch {
+        Matrix<T> inputs;
+        std::vector<Request> requests;
+    };
+
+    NeuralNetwork<T>& network;
+    ServerConfig config;
+    const int inputSize;
+    const int outputSize;
+    int listener = -1;
+    std::thread acceptor;
+    std::thread batcher;
+
+    std::mutex connectionsMutex;
+    std::vector<std::shared_ptr<Connection>> connections;
+
+    std::mutex mutex;
+    std::condition_variable ready;      // A request is pending, or stopping
+    std::condition_variable spaceFree;  // The pending batch has room again
+    Batch batches[2];
+    int filling = 0;
+    int pendingCount = 0;
+    bool stopping = false;
+
+    Matrix<T> outputs;
+    std::vector<char> response;
+    // Latencies of the running batch, added to the stats once it is written
+    std::vector<int64_t> batchLatencies;
+
+    std::mutex statsMutex;
+    LatencyHistogram latencies;
+    uint64_t batchCount = 0;
+    Clock::time_point statsStart;
+
+    void acceptConnections() {
+        while (true) {
+            const int socket = ::accept(listener, nullptr, nullptr);
+            if (socket < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            if (config.address.socketPath.empty()) {
+                const int on = 1;
+                setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            // Bounds how long a client that does not read can block a write
+            const timeval timeout = {config.writeTimeoutMilliseconds / 1000,
+                                     config.writeTimeoutMilliseconds % 1000 * 1000};
+            setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+            connection->socket = socket;
+            connection->values.resize(inputSize);
+            ServerHello hello = {};
+            std::memcpy(hello.magic, SERVER_MAGIC, sizeof(hello.magic));
+            hello.version = SERVER_PROTOCOL_VERSION;
+            hello.inputs = static_cast<uint32_t>(inputSize);
+            hello.outputs = static_cast<uint32_t>(outputSize);
+            if (!writeFully(socket, &hello, sizeof(hello))) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            // Joins the readers of connections that have closed since
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [](std::shared_ptr<Connection>& old) {
+                                                 if (!old->finished) {
+                                                     return false;
+                                                 }
+                                                 old->reader.join();
+                                                 return true;
+                                             }),
+                              connections.end());
+            connection->reader = std::thread([this, connection] { readRequests(connection); });
+            connections.push_back(connection);
+        }
+    }
+
+    void readRequests(const std::shared_ptr<Connection>& connection) {
+        RequestHeader header;
+        while (readFully(connection->socket, &header, sizeof(header))) {
+            if (header.count > SERVER_MAX_VALUES) {
+                break;
+            }
+            ResponseStatus status = RESPONSE_OK;
+            if (header.count != static_cast<uint32_t>(inputSize)) {
+                // Skips the values and says why, after the responses before it; the connection stays usable
+                if (!skipValues(connection->socket, header.count)) {
+                    break;
+                }
+                status = RESPONSE_BAD_INPUT_COUNT;
+            } else if (!readFully(connection->socket, connection->values.data(),
+                                  connection->values.size() * sizeof(float))) {
+                break;
+            }
+            if (!enqueue(connection, header.id, status, Clock::now())) {
+                break;
+            }
+        }
+        connection->finished = true;
+    }
+
+    // Reads and drops `count` values a small piece at a time, so a request of
+    // the wrong size costs the reader no allocation
+    static bool skipValues(int socket, uint32_t count) {
+        float discarded[1024];
+        while (count > 0) {
+            const uint32_t piece = std::min<uint32_t>(count, 1024);
+            if (!readFully(socket, discarded, piece * sizeof(float))) {
+                return false;
+            }
+            count -= piece;
+        }
+        return true;
+    }
+
+    // Adds a request to the pending batch; false once the server is stopping.
+    // `arrival` is taken before any wait for room, so latencies include it.
+    bool enqueue(const std::shared_ptr<Connection>& connection, uint32_t id, ResponseStatus status,
+                 Clock::time_point arrival) {
+        std::unique_lock<std::mutex> lock(mutex);
+        spaceFree.wait(lock, [this] { return stopping || pendingCount < config.maxBatch; });
+        if (stopping) {
+            return false;
+        }
+        Batch& batch = batches[filling];
+        T* row = batch.inputs.row(pendingCount);
+        if (status == RESPONSE_OK) {
+            std::copy(connection->values.begin(), connection->values.end(), row);
+        } else {
+            std::fill(row, row + inputSize, T(0));
+        }
+        Request& request = batch.requests[pendingCount];
+        request.connection = connection;
+        request.id = id;
+        request.status = status;
+        request.arrival = arrival;
+        pendingCount++;
+        if (pendingCount == 1 || pendingCount == config.maxBatch) {
+            ready.notify_one();
+        }
+        return true;
+    }
+
+    void runBatches() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this] { return stopping || pendingCount > 0; });
+            if (stopping) {
+                return;
+            }
+            const Clock::time_point deadline =
+                batches[filling].requests[0].arrival + std::chrono::microseconds(config.maxDelayMicroseconds);
+            // Checked first: even an expired wait gives up the CPU, which a lone request pays for
+            if (pendingCount < config.maxBatch && Clock::now() < deadline) {
+                ready.wait_until(lock, deadline, [this] { return stopping || pendingCount >= config.maxBatch; });
+            }
+            if (stopping) {
+                return;
+            }
+            Batch& batch = batches[filling];
+            const int rows = pendingCount;
+            filling = 1 - filling;
+            pendingCount = 0;
+            lock.unlock();
+            spaceFree.notify_all();
+
+            runBatch(batch, rows);
+
+            lock.lock();
+        }
+    }
+
+    void runBatch(Batch& batch, int rows) {
+        const Matrix<T> inputs = Matrix<T>::view(batch.inputs.data(), rows, inputSize);
+        network.predictBatch(inputs, outputs);
+
+        ResponseHeader* header = reinterpret_cast<ResponseHeader*>(response.data());
+        float* values = reinterpret_cast<float*>(response.data() + sizeof(ResponseHeader));
+        int written = 0;
+        for (int r = 0; r < rows; r++) {
+            Request& request = batch.requests[r];
+            Connection& connection = *request.connection;
+            const bool ok = request.status == RESPONSE_OK;
+            header->id = request.id;
+            header->status = request.status;
+            header->count = ok ? static_cast<uint32_t>(outputSize) : 0;
+            if (ok) {
+                std::copy(outputs.row(r), outputs.row(r) + outputSize, values);
+            }
+            if (!connection.broken) {
+                if (writeFully(connection.socket, response.data(),
+                               ok ? response.size() : sizeof(ResponseHeader))) {
+                    batchLatencies[written++] =
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - request.arrival).count();
+                } else {
+                    // Gone or not reading: a partial response cannot be taken back, so the
+                    // connection is closed, which also ends its reader
+                    connection.broken = true;
+                    ::shutdown(connection.socket, SHUT_RDWR);
+                }
+            }
+            request.connection.reset();
+        }
+
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        for (int i = 0; i < written; i++) {
+            latencies.record(batchLatencies[i]);
+        }
+        batchCount++;
+    }
+};
+
+// One connection to an InferenceServer
+class InferenceClient {
+public:
+    InferenceClient() = default;
+    ~InferenceClient() { close(); }
+
+    InferenceClient(const InferenceClient&) = delete;
+    InferenceClient& operator=(const InferenceClient&) = delete;
+
+    // Connects and reads the server's hello. Returns false and sets `error` on failure.
+    bool connect(const ServerAddress& address, std::string& error) {
+        close();
+        socket = openSocket(address, false, error);
+        if (socket < 0) {
+            return false;
+        }
+        if (!readFully(socket, &hello, sizeof(hello))) {
+            error = "no hello from " + address.describe();
+            close();
+            return false;
+        }
+        if (std::memcmp(hello.magic, SERVER_MAGIC, sizeof(hello.magic)) != 0 ||
+            hello.version != SERVER_PROTOCOL_VERSION) {
+            error = address.describe() + " is not an inference server of protocol version " +
+                    std::to_string(SERVER_PROTOCOL_VERSION);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (socket >= 0) {
+            ::close(socket);
+            socket = -1;
+        }
+    }
+
+    int inputs() const { return static_cast<int>(hello.inputs); }
+    int outputs() const { return static_cast<int>(hello.outputs); }
+
+    // Sends a request of inputs() values without waiting for its response
+    bool send(uint32_t id, const float* inputs) {
+        const RequestHeader header = {id, hello.inputs};
+        return writeFully(socket, &header, sizeof(header)) &&
+               writeFully(socket, inputs, static_cast<std::size_t>(hello.inputs) * sizeof(float));
+    }
+
+    // Reads the next response into `outputs` (outputs() values) and its
+    // request's id. Returns false and sets `error` on a rejected request or
+    // a closed connection.
+    bool receive(uint32_t& id, float* outputs, std::string& error) {
+        ResponseHeader header;
+        if (!readFully(socket, &header, sizeof(header))) {
+            error = "connection closed";
+            return false;
+        }
+        id = header.id;
+        if (header.status != RESPONSE_OK || header.count != hello.outputs) {
+            error = "request " + std::to_string(header.id) + " rejected";
+            return false;
+        }
+        if (!readFully(socket, outputs, static_cast<std::size_t>(header.count) * sizeof(float))) {
+            error = "connection closed";
+            return false;
+        }
+        return true;
+    }
+
+    // One request and its response
+    bool predict(const float* inputs, float* outputs, std::string& error) {
+        uint32_t id;
+        if (!send(nextId, inputs)) {
+            error = "connection closed";
+            return false;
+        }
+        return receive(id, outputs, error) && id == nextId++;
+    }
+
+private:
+    int socket = -1;
+    ServerHello hello = {};
+    uint32_t nextId = 0;
+};
+
+struct LoadConfig {
+    ServerAddress address;
+    int connections = 8;   // Concurrent clients, one thread each
+    int pipeline = 1;      // Requests each client keeps in flight
+    double seconds = 5.0;  // Length of the measurement
+    uint64_t seed = 1;     // Of the random inputs
+};
+
+struct LoadReport {
+    double seconds = 0.0;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double p50Microseconds = 0.0;  // Round trip seen by the client
+    double p99Microseconds = 0.0;
+    double p999Microseconds = 0.0;
+
+    double requestsPerSecond() const { return seconds > 0.0 ? requests / seconds : 0.0; }
+};
+
+// Drives a server with closed-loop clients: each connection keeps
+// config.pipeline requests of uniform random inputs in flight and sends the
+// next one as soon as a response comes back. Returns false and sets `error`
+// if a client cannot connect.
+inline bool generateLoad(const LoadConfig& config, LoadReport& report, std::string& error) {
+    const int connections = std::max(1, config.connections);
+    const int pipeline = std::max(1, config.pipeline);
+    std::vector<std::unique_ptr<InferenceClient>> clients;
+    for (int c = 0; c < connections; c++) {
+        clients.push_back(std::make_unique<InferenceClient>());
+        if (!clients.back()->connect(config.address, error)) {
+            return false;
+        }
+    }
+
+    struct ClientResult {
+        LatencyHistogram latencies;
+        uint64_t errors = 0;
+    };
+    std::vector<ClientResult> results(connections);
+    const auto start = std::chrono::steady_clock::now();
+    const auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                 std::chrono::duration<double>(config.seconds));
+    std::vector<std::thread> threads;
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            InferenceClient& client = *clients[c];
+            ClientResult& result = results[c];
+            // A few distinct samples, so that the inputs do not sit in cache as one
+            constexpr int SAMPLES = 16;
+            Xoshiro256 generator(config.seed, static_cast<uint64_t>(c));
+            std::vector<float> inputs(static_cast<std::size_t>(SAMPLES) * client.inputs());
+            for (float& value : inputs) {
+                value = generator.uniform<float>();
+            }
+            std::vector<float> outputs(client.outputs());
+            std::vector<std::chrono::steady_clock::time_point> sent(pipeline);
+            uint32_t nextId = 0;
+            auto sendNext = [&] {
+                sent[nextId % pipeline] = std::chrono::steady_clock::now();
+                const bool ok = client.send(nextId, &inputs[(nextId % SAMPLES) * client.inputs()]);
+                nextId++;
+                return ok;
+            };
+            for (int p = 0; p < pipeline; p++) {
+                if (!sendNext()) {
+                    result.errors++;
+                    return;
+                }
+            }
+            std::string receiveError;
+            uint32_t id;
+            while (true) {
+                if (!client.receive(id, outputs.data(), receiveError)) {
+                    result.errors++;
+                    return;
+                }
+                const auto now = std::chrono::steady_clock::now();
+                result.latencies.record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[id % pipeline]).count());
+                if (now >= end) {
+                    return;
+                }
+                if (!sendNext()) {
+                    result.errors++;
+                    return;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    LatencyHistogram latencies;
+    report = LoadReport();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const ClientResult& result : results) {
+        latencies.merge(result.latencies);
+        report.errors += result.errors;
+    }
+    report.requests = latencies.count();
+    report.p50Microseconds = latencies.percentile(50.0) / 1e3;
+    report.p99Microseconds = latencies.percentile(99.0) / 1e3;
+    report.p999Microseconds = latencies.percentile(99.9) / 1e3;
+    return true;
+}
+
+#endif
@@ -0,0 +1,785 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include "./activation.cpp"
+#include "./optimizer.cpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NN_X86_KERNELS 1
+#endif
+
+// Vectorized building blocks shared by the layers: BLAS-1 style dot/axpy,
+// rank-1 updates, the blocked GEMM used for mini-batches and in-place
+// activations. The generic bodies live in kernelsSimd.cpp, which is compiled
+// once per instruction set below; kernels<T>() picks the widest set the CPU
+// supports the first time it is called.
+
+enum SimdInstructionSet {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Most values of any T one vector holds, on any instruction set
+constexpr int MAX_VEC_WIDTH = 16;
+// Outputs per block of block-sparse weights and samples per panel of the
+// inputs of CSR weights, whole vectors on every instruction set
+constexpr int SPARSE_BLOCK_WIDTH = 16;
+constexpr int SPARSE_PANEL_ROWS = 16;
+
+// 16-bit floats: bfloat16 is the top half of a float (8 exponent and 7
+// mantissa bits), IEEE fp16 has 5 exponent and 10 mantissa bits
+enum HalfFormat : uint32_t {
+    HALF_BFLOAT16,
+    HALF_FLOAT16
+};
+
+inline float halfToFloat(uint16_t value, HalfFormat format) {
+    uint32_t bits = static_cast<uint32_t>(value) << 16;
+    if (format == HALF_FLOAT16) {
+        const uint32_t sign = bits & 0x80000000;
+        const uint32_t exponent = (value >> 10) & 0x1F;
+        const uint32_t mantissa = value & 0x3FF;
+        if (exponent == 0) {
+            // Zero or subnormal, mantissa * 2^-24 exactly
+            const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+            return sign ? -magnitude : magnitude;
+        }
+        bits = sign | (exponent == 0x1F ? 0x7F800000 : (exponent + 112) << 23) | mantissa << 13;
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// value rounded to nearest even; fp16 overflows to infinity and NaNs keep
+// the top of their payload and come out quiet, as the vector conversions do
+inline uint16_t floatToHalf(float value, HalfFormat format) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (format == HALF_BFLOAT16) {
+        if (magnitude > 0x7F800000) {
+            return static_cast<uint16_t>(bits >> 16 | 0x40);
+        }
+        return static_cast<uint16_t>((bits + 0x7FFF + (bits >> 16 & 1)) >> 16);
+    }
+    const uint32_t sign = bits >> 16 & 0x8000;
+    if (magnitude > 0x7F800000) {
+        return static_cast<uint16_t>(sign | 0x7E00 | (magnitude >> 13 & 0x3FF));
+    }
+    if (magnitude >= 0x477FF000) {
+        // 65520, halfway past the largest fp16, and up
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (magnitude < 0x38800000) {
+        // Below 2^-14: subnormal, a whole number of 2^-24
+        float scaled;
+        std::memcpy(&scaled, &magnitude, sizeof(scaled));
+        return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(scaled * 16777216.0f)));
+    }
+    // Rebias the exponent from 127 to 15 and round off 13 mantissa bits; a
+    // carry out of the mantissa bumps the exponent, as it should
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    const uint32_t rest = magnitude & 0x1FFF;
+    half += rest > 0x1000 || (rest == 0x1000 && (half & 1));
+    return static_cast<uint16_t>(sign | half);
+}
+
+template <typename T>
+struct KernelTable {
+    const char* name;
+    // Returns sum(a[i] * b[i])
+    T (*dot)(const T* a, const T* b, int count);
+    // y += alpha * x
+    void (*axpy)(T alpha, const T* x, T* y, int count);
+    // matrix[i][j] += alpha * x[i] * y[j] for a rows x cols row-major matrix
+    void (*outerUpdate)(T alpha, const T* x, int rows, const T* y, int cols, T* matrix);
+    // In-place activations
+    void (*sigmoid)(T* values, int count);
+    void (*tanh)(T* values, int count);
+    void (*relu)(T* values, int count);
+    void (*softmax)(T* values, int count);
+    // c = a * b with a rows x inner, b inner x cols
+    void (*gemm)(const T* a, const T* b, T* c, int rows, int inner, int cols);
+    // c = activation(a * b + bias) in one pass, bias (cols values) may be null
+    void (*denseForward)(const T* a, const T* b, const T* bias, T* c, int rows, int inner, int cols,
+                         ActivationFunction activation);
+    // c = a * b^T with a rows x inner, b cols x inner
+    void (*gemmTransposedB)(const T* a, const T* b, T* c, int rows, int inner, int cols);
+    // c += scale * a^T * b with a samples x rows, b samples x cols
+    void (*gemmTransposedAAccumulate)(const T* a, const T* b, T* c, int samples, int rows, int cols, T scale);
+    // Fused optimizer steps over `count` parameters, see ParameterUpdate.
+    // velocity = momentum * velocity + g, parameters += learningRate * velocity
+    // (learningRate * (g + momentum * velocity) with nesterov)
+    void (*momentumUpdate)(T* parameters, const T* gradients, T* velocity, int count, const ParameterUpdate<T>& update);
+    // m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2,
+    // parameters += learningRate * m' / (sqrt(v') + epsilon) with m', v' bias corrected
+    void (*adamUpdate)(T* parameters, const T* gradients, T* m, T* v, int count, const ParameterUpdate<T>& update);
+    // Writes the nonzeros of dense[0, count) and their positions to the
+    // front of `nonzeros` and `indices` and returns how many there are. Both
+    // need room for count + MAX_VEC_WIDTH entries: whole vectors are stored.
+    int (*packNonzeros)(const T* dense, int count, T* nonzeros, int* indices);
+    // Sparse-input variants of denseForward and gemmTransposedAAccumulate: a
+    // is given by its nonzeros, row r holding values[k] at column indices[k]
+    // for k in [rowStarts[r], rowStarts[r + 1]) (see SparseRows), and the
+    // zeros are skipped. Both add the nonzero products in the order of the
+    // dense kernels.
+    void (*sparseDenseForward)(const int* rowStarts, const int* indices, const T* values, const T* b, const T* bias,
+                               T* c, int rows, int cols, ActivationFunction activation);
+    void (*sparseGemmTransposedAAccumulate)(const int* rowStarts, const int* indices, const T* values, const T* b,
+                                            T* c, int samples, int cols, T scale);
+    // Stride-1 3x3 convolution of one height x width image with zero padding
+    // of 1, without im2col: output pixel (y, x) holds `filters` values (channels
+    // last), activation(bias + the 3x3 window around (y, x) times weights),
+    // with weights row (ky * 3 + kx) * channels + c. Input value (c, y, x) is
+    // read at input[c * channelStride + (y * width + x) * pixelStride], so
+    // planar and channels-last images are both read in place.
+    void (*conv3x3Forward)(const T* input, const T* weights, const T* bias, T* output, int height, int width,
+                           int channels, int filters, int channelStride, int pixelStride,
+                           ActivationFunction activation);
+    // Dense layer with sparse weights, c = activation(a * w + bias) with a
+    // rows x inner and bias cols values. csrForward takes the nonzeros of
+    // each column of w: output j sums values[k] * a(s, indices[k]) for k in
+    // [starts[j], starts[j + 1]). It reads a in panels of SPARSE_PANEL_ROWS
+    // samples, panel p holding a(p * SPARSE_PANEL_ROWS + t, i) at
+    // a[(p * inner + i) * SPARSE_PANEL_ROWS + t] with the last panel padded,
+    // except for a single sample, which is read as is. blockSparseForward
+    // takes the nonzero 1 x SPARSE_BLOCK_WIDTH blocks of w's rows: block
+    // column jb (outputs from jb * SPARSE_BLOCK_WIDTH) holds blocks
+    // [starts[jb], starts[jb + 1]), block k being the SPARSE_BLOCK_WIDTH values
+    // of input row indices[k] at values + k * SPARSE_BLOCK_WIDTH, zero-padded
+    // past cols.
+    void (*csrForward)(const int* starts, const int* indices, const T* values, const T* a, const T* bias, T* c,
+                       int rows, int inner, int cols, ActivationFunction activation);
+    void (*blockSparseForward)(const int* starts, const int* indices, const T* values, const T* a, const T* bias,
+                               T* c, int rows, int inner, int cols, ActivationFunction activation);
+    // Inverted dropout from `count` integers uniform in [0, 2^24): mask[i] is
+    // keptScale where uniform24[i] < keepThreshold and 0 elsewhere, then values[i] *= mask[i]
+    void (*dropout)(T* values, T* mask, const int32_t* uniform24, int count, T keepThreshold, T keptScale);
+    // Quantized dense layer: c = activation(scales * (a * b^T) + bias) with a
+    // rows x inner and b cols x inner int8 values, each row of either starting
+    // every `stride` bytes. Products are summed in int32 and scales[j] turns
+    // the sums of column j back into T; bias may be null.
+    void (*denseInt8)(const int8_t* a, const int8_t* b, const T* scales, const T* bias, T* c, int rows, int inner,
+                      int stride, int cols, ActivationFunction activation);
+    // quantized = values / scale rounded to nearest and clamped to [-127, 127],
+    // with inverseScale = 1 / scale
+    void (*quantizeInt8)(const T* values, int8_t* quantized, int count, T inverseScale);
+    // Dense layer on 16-bit floats: c = activation(a * b + bias) with a rows x
+    // inner and b inner x cols values in `format`, bias cols values (may be
+    // null). Both are widened to float as they are loaded; products are
+    // summed in float over each block of inner values, then added to c.
+    void (*denseHalf)(const uint16_t* a, const uint16_t* b, const T* bias, T* c, int rows, int inner, int cols,
+                      ActivationFunction activation, HalfFormat format);
+    // half[i] = floatToHalf(values[i], format), doubles going through float
+    void (*toHalf)(const T* values, uint16_t* half, int count, HalfFormat format);
+};
+
+// Vectorized exp: x = n * ln2 + r with |r| <= ln2 / 2 and e^r from its Taylor
+// polynomial, coefficients[k] = 1 / k!. Relative error stays below 2 ulp with
+// `degree` terms, and below 3e-6 with the `fastDegree` terms of ACTIVATION_FAST.
+template <typename T>
+struct ExpConstants;
+
+template <>
+struct ExpConstants<double> {
+    static constexpr int degree = 12;
+    static constexpr int fastDegree = 5;
+    static constexpr double coefficients[degree + 1] = {
+        1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+        1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600,
+    };
+    static constexpr double min = -708.0;
+    static constexpr double max = 709.0;
+    static constexpr double log2e = 1.4426950408889634;
+    static constexpr double ln2High = 0.693145751953125;
+    static constexpr double ln2Low = 1.4286068203094173e-06;
+};
+
+template <>
+struct ExpConstants<float> {
+    static constexpr int degree = 7;
+    static constexpr int fastDegree = 5;
+    static constexpr float coefficients[degree + 1] = {
+        1.0f, 1.0f, 1.0f / 2, 1.0f / 6, 1.0f / 24, 1.0f / 120, 1.0f / 720, 1.0f / 5040,
+    };
+    static constexpr float min = -87.0f;
+    static constexpr float max = 88.0f;
+    static constexpr float log2e = 1.44269504f;
+    static constexpr float ln2High = 0.693359375f;
+    static constexpr float ln2Low = -2.12194440e-4f;
+};
+
+// Sigmoid sampled every 1 / POINTS_PER_UNIT over [-RANGE, RANGE] for
+// ACTIVATION_TABLE. The last point is repeated so that interpolating at the
+// upper end never reads past the table.
+template <typename T>
+struct SigmoidTable {
+    static constexpr int POINTS_PER_UNIT = 32;
+    static constexpr int RANGE = 16;
+    static constexpr int POINTS = 2 * RANGE * POINTS_PER_UNIT + 1;
+    alignas(64) T values[POINTS + 1];
+
+    SigmoidTable() {
+        for (int i = 0; i < POINTS; i++) {
+            const double x = static_cast<double>(i) / POINTS_PER_UNIT - RANGE;
+            values[i] = static_cast<T>(1.0 / (1.0 + std::exp(-x)));
+        }
+        values[POINTS] = values[POINTS - 1];
+    }
+};
+
+template <typename T>
+inline const SigmoidTable<T> sigmoidTable{};
+
+namespace kernels_scalar {
+
+template <typename T>
+struct Vec {
+    using Reg = T;
+    static constexpr int width = 1;
+
+    static Reg load(const T* pointer) { return *pointer; }
+    static void store(T* pointer, Reg value) { *pointer = value; }
+    static Reg set1(T value) { return value; }
+    static Reg zero() { return T(0); }
+    static Reg add(Reg a, Reg b) { return a + b; }
+    static Reg sub(Reg a, Reg b) { return a - b; }
+    static Reg mul(Reg a, Reg b) { return a * b; }
+    static Reg div(Reg a, Reg b) { return a / b; }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return c - a * b; }
+    static Reg max(Reg a, Reg b) { return a > b ? a : b; }
+    static Reg min(Reg a, Reg b) { return a < b ? a : b; }
+    static Reg sqrt(Reg value) { return std::sqrt(value); }
+    static Reg round(Reg value) { return std::nearbyint(value); }
+    static Reg scale2(Reg value, Reg exponent) { return std::ldexp(value, static_cast<int>(exponent)); }
+    // table[index], index holding an integral value
+    static Reg gather(const T* table, Reg index) { return table[static_cast<int>(index)]; }
+    // `width` int32 values converted to T
+    static Reg loadInt32(const int32_t* pointer) { return static_cast<T>(*pointer); }
+    // value where a < b, zero elsewhere
+    static Reg selectLess(Reg a, Reg b, Reg value) { return a < b ? value : T(0); }
+    static T reduceAdd(Reg value) { return value; }
+    static T reduceMax(Reg value) { return value; }
+    // Stores the nonzero lanes of value, and first + their lane numbers, at
+    // the front of values and indices and returns how many; all `width`
+    // entries of both may be written
+    static int storeNonzeros(Reg value, int first, T* values, int* indices) {
+        *values = value;
+        *indices = first;
+        return value != T(0);
+    }
+};
+
+// Integer multiply-adds of the int8 kernels: `width` int8 values are
+// widened per load, and madd adds their pairwise products to int32 lanes
+struct Int8Vec {
+    using Reg = int32_t;
+    using Acc = int32_t;
+    static constexpr int width = 1;
+    static constexpr int rows = 2;  // Rows of a per block of denseInt8
+
+    static Reg load(const int8_t* pointer) { return *pointer; }
+    static Acc zero() { return 0; }
+    static Acc madd(Reg a, Reg b, Acc sum) { return sum + a * b; }
+    static int32_t reduceAdd(Acc value) { return value; }
+};
+
+// 16-bit floats of the half kernels, widened to float per load and rounded
+// back per store
+struct HalfVec {
+    static float loadBfloat16(const uint16_t* pointer) { return halfToFloat(*pointer, HALF_BFLOAT16); }
+    static float loadFloat16(const uint16_t* pointer) { return halfToFloat(*pointer, HALF_FLOAT16); }
+    static void storeBfloat16(uint16_t* pointer, float value) { *pointer = floatToHalf(value, HALF_BFLOAT16); }
+    static void storeFloat16(uint16_t* pointer, float value) { *pointer = floatToHalf(value, HALF_FLOAT16); }
+};
+
+constexpr const char* NAME = "scalar";
+#include "./kernelsSimd.cpp"
+
+}
+
+#ifdef NN_X86_KERNELS
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+// For every 8-bit mask, the lane numbers of its set bits lowest first and
+// how many there are: the permutation packing the selected lanes of a vector
+// at its front, for the storeNonzeros of CPUs without a compress instruction
+struct LeftPackTable {
+    alignas(32) int32_t lanes[256][8];
+    int32_t counts[256];
+
+    constexpr LeftPackTable() : lanes(), counts() {
+        for (int mask = 0; mask < 256; mask++) {
+            for (int lane = 0; lane < 8; lane++) {
+                if ((mask >> lane) & 1) {
+                    lanes[mask][counts[mask]++] = lane;
+                }
+            }
+        }
+    }
+};
+inline constexpr LeftPackTable LEFT_PACK = {};
+
+namespace kernels_avx2 {
+
+template <typename T>
+struct Vec;
+
+template <>
+struct Vec<double> {
+    using Reg = __m256d;
+    static constexpr int width = 4;
+
+    static Reg load(const double* pointer) { return _mm256_loadu_pd(pointer); }
+    static void store(double* pointer, Reg value) { _mm256_storeu_pd(pointer, value); }
+    static Reg set1(double value) { return _mm256_set1_pd(value); }
+    static Reg zero() { return _mm256_setzero_pd(); }
+    static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm256_fnmadd_pd(a, b, c); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+    static Reg min(Reg a, Reg b) { return _mm256_min_pd(a, b); }
+    static Reg sqrt(Reg value) { return _mm256_sqrt_pd(value); }
+    static Reg round(Reg value) { return _mm256_round_pd(value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg scale2(Reg value, Reg exponent) {
+        // Adding 1.5 * 2^52 leaves the integer exponent in the low mantissa bits;
+        // biasing and shifting it into the exponent field builds 2^exponent.
+        const __m256i bits = _mm256_castpd_si256(_mm256_add_pd(exponent, _mm256_set1_pd(6755399441055744.0)));
+        const __m256i biased = _mm256_add_epi64(bits, _mm256_set1_epi64x(1023));
+        return _mm256_mul_pd(value, _mm256_castsi256_pd(_mm256_slli_epi64(biased, 52)));
+    }
+    // The masked gathers avoid GCC 12's -Wmaybe-uninitialized on the unmasked ones
+    static Reg gather(const double* table, Reg index) {
+        const Reg all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        return _mm256_mask_i32gather_pd(zero(), table, _mm256_cvtpd_epi32(index), all, 8);
+    }
+    static Reg loadInt32(const int32_t* pointer) {
+        return _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pointer)));
+    }
+    static Reg selectLess(Reg a, Reg b, Reg value) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), value); }
+    static double reduceAdd(Reg value) {
+        __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(value), _mm256_extractf128_pd(value, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+    }
+    static double reduceMax(Reg value) {
+        __m128d max = _mm_max_pd(_mm256_castpd256_pd128(value), _mm256_extractf128_pd(value, 1));
+        return _mm_cvtsd_f64(_mm_max_sd(max, _mm_unpackhi_pd(max, max)));
+    }
+    static int storeNonzeros(Reg value, int first, double* values, int* indices) {
+        const int mask = _mm256_movemask_pd(_mm256_cmp_pd(value, zero(), _CMP_NEQ_UQ));
+        const __m256i order = _mm256_load_si256(reinterpret_cast<const __m256i*>(LEFT_PACK.lanes[mask]));
+        // Lane k of the result takes 32-bit half k % 2 of double lane order[k / 2]
+        const __m256i halves = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_permutevar8x32_epi32(order, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3)), 1),
+            _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values),
+                            _mm256_permutevar8x32_epi32(_mm256_castpd_si256(value), halves));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices),
+                         _mm256_castsi256_si128(_mm256_add_epi32(order, _mm256_set1_epi32(first))));
+        return LEFT_PACK.counts[mask];
+    }
+};
+
+template <>
+struct Vec<float> {
+    using Reg = __m256;
+    static constexpr int width = 8;
+
+    static Reg load(const float* pointer) { return _mm256_loadu_ps(pointer); }
+    static void store(float* pointer, Reg value) { _mm256_storeu_ps(pointer, value); }
+    static Reg set1(float value) { return _mm256_set1_ps(value); }
+    static Reg zero() { return _mm256_setzero_ps(); }
+    static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm256_fnmadd_ps(a, b, c); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+    static Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+    static Reg sqrt(Reg value) { return _mm256_sqrt_ps(value); }
+    static Reg round(Reg value) { return _mm256_round_ps(value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Reg scale2(Reg value, Reg exponent) {
+        // exponent is already integral and within the normal range
+        const __m256i biased = _mm256_add_epi32(_mm256_cvtps_epi32(exponent), _mm256_set1_epi32(127));
+        return _mm256_mul_ps(value, _mm256_castsi256_ps(_mm256_slli_epi32(biased, 23)));
+    }
+    static Reg gather(const float* table, Reg index) {
+        const Reg all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        return _mm256_mask_i32gather_ps(zero(), table, _mm256_cvtps_epi32(index), all, 4);
+    }
+    static Reg loadInt32(const int32_t* pointer) {
+        return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pointer)));
+    }
+    static Reg selectLess(Reg a, Reg b, Reg value) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ), value); }
+    static float reduceAdd(Reg value) {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        return _mm_cvtss_f32(_mm_add_ss(sum, _mm_movehdup_ps(sum)));
+    }
+    static float reduceMax(Reg value) {
+        __m128 max = _mm_max_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+        max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+        return _mm_cvtss_f32(_mm_max_ss(max, _mm_movehdup_ps(max)));
+    }
+    static int storeNonzeros(Reg value, int first, float* values, int* indices) {
+        const int mask = _mm256_movemask_ps(_mm256_cmp_ps(value, zero(), _CMP_NEQ_UQ));
+        const __m256i order = _mm256_load_si256(reinterpret_cast<const __m256i*>(LEFT_PACK.lanes[mask]));
+        _mm256_storeu_ps(values, _mm256_permutevar8x32_ps(value, order));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices), _mm256_add_epi32(order, _mm256_set1_epi32(first)));
+        return LEFT_PACK.counts[mask];
+    }
+};
+
+// 32 int8 values per load. maddubs multiplies unsigned by signed bytes, so
+// the sign of a moves onto b: |a| * (b * sign(a)) is a * b, and a pair of
+// those products is at most 2 * 127 * 127, inside the int16 its saturating
+// add produces as long as neither side holds -128 (quantizers clamp to
+// [-127, 127]). madd_epi16 against ones then widens the pairs to int32.
+struct Int8Vec {
+    using Reg = __m256i;
+    using Acc = __m256i;
+    static constexpr int width = 32;
+    static constexpr int rows = 2;  // 8 accumulators and 4 columns of 16 registers
+
+    static Reg load(const int8_t* pointer) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pointer)); }
+    static Acc zero() { return _mm256_setzero_si256(); }
+    static Acc madd(Reg a, Reg b, Acc sum) {
+        const __m256i pairs = _mm256_maddubs_epi16(_mm256_abs_epi8(a), _mm256_sign_epi8(b, a));
+        return _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+    }
+    static int32_t reduceAdd(Acc value) {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        sum = _mm_add_epi32(sum, _mm_unpackhi_epi64(sum, sum));
+        return _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_shuffle_epi32(sum, 1)));
+    }
+};
+
+// 8 16-bit floats per load. bfloat16 widens by a shift into the top half of
+// each lane, fp16 with F16C; rounding bfloat16 adds 0x7FFF plus the lowest
+// kept bit (to nearest even) before the shift back, NaNs excepted.
+struct HalfVec {
+    static __m256 loadBfloat16(const uint16_t* pointer) {
+        const __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pointer));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(half), 16));
+    }
+    static __m256 loadFloat16(const uint16_t* pointer) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pointer)));
+    }
+    static void storeBfloat16(uint16_t* pointer, __m256 value) {
+        const __m256i bits = _mm256_castps_si256(value);
+        const __m256i high = _mm256_srli_epi32(bits, 16);
+        const __m256i bias = _mm256_add_epi32(_mm256_and_si256(high, _mm256_set1_epi32(1)), _mm256_set1_epi32(0x7FFF));
+        const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, bias), 16);
+        const __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+        const __m256i half = _mm256_blendv_epi8(rounded, _mm256_or_si256(high, _mm256_set1_epi32(0x40)), nan);
+        // packus works within 128-bit lanes, leaving the results in quarters 0 and 2
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(half, half), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pointer), _mm256_castsi256_si128(packed));
+    }
+    static void storeFloat16(uint16_t* pointer, __m256 value) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pointer), _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+constexpr const char* NAME = "avx2";
+#include "./kernelsSimd.cpp"
+
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#endif
+
+namespace kernels_avx512 {
+
+template <typename T>
+struct Vec;
+
+template <>
+struct Vec<double> {
+    using Reg = __m512d;
+    static constexpr int width = 8;
+
+    static Reg load(const double* pointer) { return _mm512_loadu_pd(pointer); }
+    static void store(double* pointer, Reg value) { _mm512_storeu_pd(pointer, value); }
+    static Reg set1(double value) { return _mm512_set1_pd(value); }
+    static Reg zero() { return _mm512_setzero_pd(); }
+    static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm512_fnmadd_pd(a, b, c); }
+    // GCC 12 flags the undefined pass-through of the unmasked max/min/roundscale/scalef,
+    // sqrt, cvt and gather and the _mm512_reduce_* intrinsics with -Wmaybe-uninitialized,
+    // so the full-mask forms are used and reductions go through memory.
+    static Reg max(Reg a, Reg b) { return _mm512_mask_max_pd(a, 0xFF, a, b); }
+    static Reg min(Reg a, Reg b) { return _mm512_mask_min_pd(a, 0xFF, a, b); }
+    static Reg sqrt(Reg value) { return _mm512_mask_sqrt_pd(value, 0xFF, value); }
+    static Reg round(Reg value) {
+        return _mm512_mask_roundscale_pd(value, 0xFF, value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static Reg scale2(Reg value, Reg exponent) { return _mm512_mask_scalef_pd(value, 0xFF, value, exponent); }
+    static Reg gather(const double* table, Reg index) {
+        const __m256i indices = _mm512_mask_cvtpd_epi32(_mm256_setzero_si256(), 0xFF, index);
+        return _mm512_mask_i32gather_pd(zero(), 0xFF, indices, table, 8);
+    }
+    static Reg loadInt32(const int32_t* pointer) {
+        return _mm512_mask_cvtepi32_pd(zero(), 0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pointer)));
+    }
+    static Reg selectLess(Reg a, Reg b, Reg value) {
+        return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ), value);
+    }
+    static double reduceAdd(Reg value) {
+        alignas(64) double lanes[width];
+        _mm512_store_pd(lanes, value);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+    static double reduceMax(Reg value) {
+        alignas(64) double lanes[width];
+        _mm512_store_pd(lanes, value);
+        return *std::max_element(lanes, lanes + width);
+    }
+    static int storeNonzeros(Reg value, int first, double* values, int* indices) {
+        const __mmask8 mask = _mm512_cmp_pd_mask(value, zero(), _CMP_NEQ_UQ);
+        const __m512i lanes = _mm512_add_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 0, 0, 0, 0, 0, 0, 0, 0),
+                                               _mm512_set1_epi32(first));
+        _mm512_storeu_pd(values, _mm512_maskz_compress_pd(mask, value));
+        _mm512_mask_compressstoreu_epi32(indices, mask, lanes);
+        return LEFT_PACK.counts[mask];
+    }
+};
+
+template <>
+struct Vec<float> {
+    using Reg = __m512;
+    static constexpr int width = 16;
+
+    static Reg load(const float* pointer) { return _mm512_loadu_ps(pointer); }
+    static void store(float* pointer, Reg value) { _mm512_storeu_ps(pointer, value); }
+    static Reg set1(float value) { return _mm512_set1_ps(value); }
+    static Reg zero() { return _mm512_setzero_ps(); }
+    static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm512_fnmadd_ps(a, b, c); }
+    static Reg max(Reg a, Reg b) { return _mm512_mask_max_ps(a, 0xFFFF, a, b); }
+    static Reg min(Reg a, Reg b) { return _mm512_mask_min_ps(a, 0xFFFF, a, b); }
+    static Reg sqrt(Reg value) { return _mm512_mask_sqrt_ps(value, 0xFFFF, value); }
+    static Reg round(Reg value) {
+        return _mm512_mask_roundscale_ps(value, 0xFFFF, value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static Reg scale2(Reg value, Reg exponent) { return _mm512_mask_scalef_ps(value, 0xFFFF, value, exponent); }
+    static Reg gather(const float* table, Reg index) {
+        const __m512i indices = _mm512_mask_cvtps_epi32(_mm512_setzero_si512(), 0xFFFF, index);
+        return _mm512_mask_i32gather_ps(zero(), 0xFFFF, indices, table, 4);
+    }
+    static Reg loadInt32(const int32_t* pointer) {
+        return _mm512_mask_cvtepi32_ps(zero(), 0xFFFF, _mm512_loadu_si512(pointer));
+    }
+    static Reg selectLess(Reg a, Reg b, Reg value) {
+        return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), value);
+    }
+    static float reduceAdd(Reg value) {
+        alignas(64) float lanes[width];
+        _mm512_store_ps(lanes, value);
+        float sum = 0.0f;
+        for (int i = 0; i < width; i += 4) {
+            sum += (lanes[i] + lanes[i + 1]) + (lanes[i + 2] + lanes[i + 3]);
+        }
+        return sum;
+    }
+    static float reduceMax(Reg value) {
+        alignas(64) float lanes[width];
+        _mm512_store_ps(lanes, value);
+        return *std::max_element(lanes, lanes + width);
+    }
+    static int storeNonzeros(Reg value, int first, float* values, int* indices) {
+        const __mmask16 mask = _mm512_cmp_ps_mask(value, zero(), _CMP_NEQ_UQ);
+        const __m512i lanes = _mm512_add_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(first));
+        _mm512_storeu_ps(values, _mm512_maskz_compress_ps(mask, value));
+        _mm512_storeu_si512(indices, _mm512_maskz_compress_epi32(mask, lanes));
+        return LEFT_PACK.counts[mask & 0xFF] + LEFT_PACK.counts[mask >> 8];
+    }
+};
+
+// 64 int8 values per load, with the sign trick of the AVX2 kernels. AVX-512
+// has no sign_epi8, so b is negated under the mask of the negative bytes of a.
+struct Int8Vec {
+    using Reg = __m512i;
+    using Acc = __m512i;
+    static constexpr int width = 64;
+    static constexpr int rows = 4;  // 16 accumulators and 4 columns of 32 registers
+
+    static Reg load(const int8_t* pointer) { return _mm512_loadu_si512(pointer); }
+    static Acc zero() { return _mm512_setzero_si512(); }
+    static Acc madd(Reg a, Reg b, Acc sum) {
+        const __m512i signedB = _mm512_mask_sub_epi8(b, _mm512_movepi8_mask(a), _mm512_setzero_si512(), b);
+        const __m512i pairs = _mm512_maddubs_epi16(_mm512_abs_epi8(a), signedB);
+        return _mm512_add_epi32(sum, _mm512_madd_epi16(pairs, _mm512_set1_epi16(1)));
+    }
+    static int32_t reduceAdd(Acc value) {
+        alignas(64) int32_t lanes[16];
+        _mm512_store_si512(lanes, value);
+        int32_t sum = 0;
+        for (int i = 0; i < 16; i += 4) {
+            sum += (lanes[i] + lanes[i + 1]) + (lanes[i + 2] + lanes[i + 3]);
+        }
+        return sum;
+    }
+};
+
+// 16 16-bit floats per load, as the AVX2 HalfVec; AVX-512F converts fp16 and
+// narrows the bfloat16 lanes itself. Full-mask forms again keep GCC 12 quiet.
+struct HalfVec {
+    static __m512 loadBfloat16(const uint16_t* pointer) {
+        const __m256i half = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pointer));
+        return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, half), 16));
+    }
+    static __m512 loadFloat16(const uint16_t* pointer) {
+        const __m256i half = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pointer));
+        return _mm512_mask_cvtph_ps(_mm512_setzero_ps(), 0xFFFF, half);
+    }
+    static void storeBfloat16(uint16_t* pointer, __m512 value) {
+        const __m512i bits = _mm512_castps_si512(value);
+        const __m512i high = _mm512_maskz_srli_epi32(0xFFFF, bits, 16);
+        const __m512i bias = _mm512_add_epi32(_mm512_and_si512(high, _mm512_set1_epi32(1)), _mm512_set1_epi32(0x7FFF));
+        const __m512i rounded = _mm512_maskz_srli_epi32(0xFFFF, _mm512_add_epi32(bits, bias), 16);
+        const __mmask16 nan = _mm512_cmp_ps_mask(value, value, _CMP_UNORD_Q);
+        const __m512i half = _mm512_mask_or_epi32(rounded, nan, high, _mm512_set1_epi32(0x40));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pointer), _mm512_maskz_cvtepi32_epi16(0xFFFF, half));
+    }
+    static void storeFloat16(uint16_t* pointer, __m512 value) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pointer),
+                            _mm512_maskz_cvtps_ph(0xFFFF, value, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+
+constexpr const char* NAME = "avx512";
+#include "./kernelsSimd.cpp"
+
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+inline bool isInstructionSetSupported(SimdInstructionSet instructionSet) {
+    switch (instructionSet) {
+    case SIMD_SCALAR:
+        return true;
+#ifdef NN_X86_KERNELS
+    case SIMD_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    case SIMD_AVX512:
+        __builtin_cpu_init();
+        // BW for the int8 kernels; every AVX-512 CPU but Xeon Phi has it
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return false;
+    }
+}
+
+// Widest supported instruction set, unless NN_SIMD=scalar|avx2|avx512 asks
+// for a narrower one (handy to compare paths on the same machine).
+inline SimdInstructionSet detectInstructionSet() {
+    SimdInstructionSet best = SIMD_SCALAR;
+    for (SimdInstructionSet candidate : {SIMD_AVX2, SIMD_AVX512}) {
+        if (isInstructionSetSupported(candidate)) {
+            best = candidate;
+        }
+    }
+
+    const char* requested = std::getenv("NN_SIMD");
+    if (requested != nullptr) {
+        SimdInstructionSet forced = best;
+        if (std::strcmp(requested, "scalar") == 0) {
+            forced = SIMD_SCALAR;
+        } else if (std::strcmp(requested, "avx2") == 0) {
+            forced = SIMD_AVX2;
+        } else if (std::strcmp(requested, "avx512") == 0) {
+            forced = SIMD_AVX512;
+        }
+        if (forced < best) {
+            best = forced;
+        }
+    }
+    return best;
+}
+
+// Kernels of one instruction set whose activations run at `accuracy`. Only
+// the activation kernels and denseForward differ between accuracies.
+template <typename T>
+const KernelTable<T>& kernelTable(SimdInstructionSet instructionSet, ActivationAccuracy accuracy = ACTIVATION_EXACT) {
+    static const KernelTable<T> scalar[] = {
+        kernels_scalar::table<T, ACTIVATION_EXACT>(),
+        kernels_scalar::table<T, ACTIVATION_FAST>(),
+        kernels_scalar::table<T, ACTIVATION_TABLE>(),
+    };
+#ifdef NN_X86_KERNELS
+    static const KernelTable<T> avx2[] = {
+        kernels_avx2::table<T, ACTIVATION_EXACT>(),
+        kernels_avx2::table<T, ACTIVATION_FAST>(),
+        kernels_avx2::table<T, ACTIVATION_TABLE>(),
+    };
+    static const KernelTable<T> avx512[] = {
+        kernels_avx512::table<T, ACTIVATION_EXACT>(),
+        kernels_avx512::table<T, ACTIVATION_FAST>(),
+        kernels_avx512::table<T, ACTIVATION_TABLE>(),
+    };
+    switch (instructionSet) {
+    case SIMD_AVX2:
+        return avx2[accuracy];
+    case SIMD_AVX512:
+        return avx512[accuracy];
+    default:
+        break;
+    }
+#else
+    (void)instructionSet;
+#endif
+    return scalar[accuracy];
+}
+
+// Kernels for the widest instruction set available on this CPU.
+template <typename T>
+const KernelTable<T>& kernels(ActivationAccuracy accuracy = ACTIVATION_EXACT) {
+    static const SimdInstructionSet instructionSet = detectInstructionSet();
+    return kernelTable<T>(instructionSet, accuracy);
+}
+
+#endif
@@ -0,0 +1,1361 @@
+// Generic kernel bodies, included by kernels.cpp once per instruction set.
+// The enclosing namespace provides Vec<T>, the register traits of that
+// instruction set, and NAME; there is deliberately no include guard.
+
+// The element-wise math below is written once for registers of V, which
+// defaults to this instruction set's Vec<T>; the scalar tails of the loops
+// pass kernels_scalar::Vec<T> so every element goes through the same
+// approximation.
+template <typename T, ActivationAccuracy P, typename V = Vec<T>>
+inline typename V::Reg expVec(typename V::Reg x) {
+    using C = ExpConstants<T>;
+    if constexpr (V::width == 1 && P == ACTIVATION_EXACT) {
+        // The scalar build keeps libm's exp
+        return std::exp(x);
+    }
+    constexpr int degree = P == ACTIVATION_EXACT ? C::degree : C::fastDegree;
+    x = V::min(V::max(x, V::set1(C::min)), V::set1(C::max));
+
+    // x = n * ln2 + r, ln2 split in two parts so r keeps full precision
+    const typename V::Reg n = V::round(V::mul(x, V::set1(C::log2e)));
+    typename V::Reg r = V::fnmadd(n, V::set1(C::ln2High), x);
+    r = V::fnmadd(n, V::set1(C::ln2Low), r);
+
+    // Horner evaluation of sum(r^k / k!) for k <= degree
+    typename V::Reg polynomial = V::set1(C::coefficients[degree]);
+    for (int k = degree - 1; k >= 0; k--) {
+        polynomial = V::fmadd(polynomial, r, V::set1(C::coefficients[k]));
+    }
+    return V::scale2(polynomial, n);
+}
+
+template <typename T>
+T dot(const T* a, const T* b, int count) {
+    using V = Vec<T>;
+    typename V::Reg sum0 = V::zero();
+    typename V::Reg sum1 = V::zero();
+    int i = 0;
+    for (; i + 2 * V::width <= count; i += 2 * V::width) {
+        sum0 = V::fmadd(V::load(a + i), V::load(b + i), sum0);
+        sum1 = V::fmadd(V::load(a + i + V::width), V::load(b + i + V::width), sum1);
+    }
+    for (; i + V::width <= count; i += V::width) {
+        sum0 = V::fmadd(V::load(a + i), V::load(b + i), sum0);
+    }
+    T sum = V::reduceAdd(V::add(sum0, sum1));
+    for (; i < count; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+void axpy(T alpha, const T* x, T* y, int count) {
+    using V = Vec<T>;
+    const typename V::Reg factor = V::set1(alpha);
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        V::store(y + i, V::fmadd(factor, V::load(x + i), V::load(y + i)));
+    }
+    for (; i < count; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+template <typename T>
+void outerUpdate(T alpha, const T* x, int rows, const T* y, int cols, T* matrix) {
+    for (int i = 0; i < rows; i++) {
+        axpy<T>(alpha * x[i], y, matrix + static_cast<std::size_t>(i) * cols, cols);
+    }
+}
+
+// Sigmoid interpolated from sigmoidTable: with u the position of x in
+// table steps, the two points around u are gathered. Rounding u - 1/2 to
+// nearest gives the lower point (or, on a tie, the upper one with weight 1).
+template <typename T, typename V = Vec<T>>
+inline typename V::Reg sigmoidTableVec(typename V::Reg x) {
+    using Table = SigmoidTable<T>;
+    const T* values = sigmoidTable<T>.values;
+    typename V::Reg u =
+        V::fmadd(x, V::set1(T(Table::POINTS_PER_UNIT)), V::set1(T(Table::RANGE * Table::POINTS_PER_UNIT)));
+    u = V::min(V::max(u, V::zero()), V::set1(T(Table::POINTS - 1)));
+    const typename V::Reg index = V::round(V::sub(u, V::set1(T(0.5))));
+    const typename V::Reg low = V::gather(values, index);
+    const typename V::Reg high = V::gather(values + 1, index);
+    return V::fmadd(V::sub(u, index), V::sub(high, low), low);
+}
+
+template <typename T, ActivationAccuracy P, typename V = Vec<T>>
+inline typename V::Reg sigmoidVec(typename V::Reg x) {
+    if constexpr (P == ACTIVATION_TABLE) {
+        return sigmoidTableVec<T, V>(x);
+    } else {
+        const typename V::Reg one = V::set1(T(1));
+        return V::div(one, V::add(one, expVec<T, P, V>(V::sub(V::zero(), x))));
+    }
+}
+
+// tanh(x) = 1 - 2 / (e^2x + 1), a single exp per element, or 2 * sigmoid(2x) - 1 from the table
+template <typename T, ActivationAccuracy P, typename V = Vec<T>>
+inline typename V::Reg tanhVec(typename V::Reg x) {
+    const typename V::Reg one = V::set1(T(1));
+    const typename V::Reg two = V::set1(T(2));
+    if constexpr (P == ACTIVATION_TABLE) {
+        return V::fmadd(two, sigmoidTableVec<T, V>(V::mul(two, x)), V::sub(V::zero(), one));
+    } else {
+        return V::sub(one, V::div(two, V::add(expVec<T, P, V>(V::mul(two, x)), one)));
+    }
+}
+
+// Element-wise part of an activation, on a register and on a single value.
+// SOFTMAX is the identity here; it is normalized per row once a row is complete.
+template <typename T, ActivationFunction A, ActivationAccuracy P, typename V = Vec<T>>
+inline typename V::Reg activateVec(typename V::Reg x) {
+    if constexpr (A == SIGMOID) {
+        return sigmoidVec<T, P, V>(x);
+    } else if constexpr (A == TANH) {
+        return tanhVec<T, P, V>(x);
+    } else if constexpr (A == RELU) {
+        return V::max(x, V::zero());
+    } else if constexpr (A == TANH_DERIVATIVE) {
+        const typename V::Reg t = tanhVec<T, P, V>(x);
+        return V::fnmadd(t, t, V::set1(T(1)));
+    } else {
+        return x;
+    }
+}
+
+// The approximate modes reuse activateVec on one-element registers; the
+// exact mode calls libm.
+template <typename T, ActivationFunction A, ActivationAccuracy P>
+inline T activateScalar(T x) {
+    if constexpr (P != ACTIVATION_EXACT) {
+        return activateVec<T, A, P, kernels_scalar::Vec<T>>(x);
+    } else if constexpr (A == SIGMOID) {
+        return T(1) / (T(1) + std::exp(-x));
+    } else if constexpr (A == TANH) {
+        return std::tanh(x);
+    } else if constexpr (A == RELU) {
+        return std::max(T(0), x);
+    } else if constexpr (A == TANH_DERIVATIVE) {
+        const T t = std::tanh(x);
+        return T(1) - t * t;
+    } else {
+        return x;
+    }
+}
+
+template <typename T, ActivationFunction A, ActivationAccuracy P>
+void activateInPlace(T* values, int count) {
+    using V = Vec<T>;
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        V::store(values + i, activateVec<T, A, P>(V::load(values + i)));
+    }
+    for (; i < count; i++) {
+        values[i] = activateScalar<T, A, P>(values[i]);
+    }
+}
+
+template <typename T, ActivationAccuracy P>
+void sigmoid(T* values, int count) {
+    activateInPlace<T, SIGMOID, P>(values, count);
+}
+
+template <typename T, ActivationAccuracy P>
+void tanh(T* values, int count) {
+    activateInPlace<T, TANH, P>(values, count);
+}
+
+template <typename T, ActivationAccuracy P>
+void relu(T* values, int count) {
+    activateInPlace<T, RELU, P>(values, count);
+}
+
+// The table has no exp, so ACTIVATION_TABLE normalizes with the FAST exp
+template <typename T, ActivationAccuracy P>
+void softmax(T* values, int count) {
+    constexpr ActivationAccuracy EXP_ACCURACY = P == ACTIVATION_TABLE ? ACTIVATION_FAST : P;
+    using V = Vec<T>;
+    if (count <= 0) {
+        return;
+    }
+
+    // Subtracting the maximum keeps every exponent <= 0, so nothing overflows
+    typename V::Reg maxVec = V::set1(values[0]);
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        maxVec = V::max(maxVec, V::load(values + i));
+    }
+    T max = V::reduceMax(maxVec);
+    for (; i < count; i++) {
+        max = std::max(max, values[i]);
+    }
+
+    const typename V::Reg shift = V::set1(max);
+    typename V::Reg sumVec = V::zero();
+    i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        const typename V::Reg e = expVec<T, EXP_ACCURACY>(V::sub(V::load(values + i), shift));
+        V::store(values + i, e);
+        sumVec = V::add(sumVec, e);
+    }
+    T sum = V::reduceAdd(sumVec);
+    for (; i < count; i++) {
+        values[i] = expVec<T, EXP_ACCURACY, kernels_scalar::Vec<T>>(values[i] - max);
+        sum += values[i];
+    }
+
+    const typename V::Reg inverse = V::set1(T(1) / sum);
+    i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        V::store(values + i, V::mul(V::load(values + i), inverse));
+    }
+    for (; i < count; i++) {
+        values[i] *= T(1) / sum;
+    }
+}
+
+// Rows of b kept hot in cache while they are reused by every row of a.
+constexpr int GEMM_BLOCK_ROWS = 64;
+
+// c = activation(a * b + bias), blocked over the inner dimension so a tile of b
+// stays in cache while it is applied to every row of a. The micro-kernel keeps
+// a 4 x 2-vector tile of c in registers across the whole inner block: every
+// pair of vectors loaded from b feeds eight fused multiply-adds and c is only
+// touched once per block. c starts from the bias, and the last inner block
+// applies the activation to the tile while it is still in registers, so the
+// bias and activation cost no extra pass over c (softmax, which needs whole
+// rows, runs on each group of four rows right after they are finished).
+template <typename T, ActivationFunction A, ActivationAccuracy P>
+void denseForwardWith(const T* a, const T* b, const T* bias, T* c, int rows, int inner, int cols) {
+    using V = Vec<T>;
+    using Reg = typename V::Reg;
+    for (int r = 0; r < rows; r++) {
+        T* cRow = c + static_cast<std::size_t>(r) * cols;
+        if (bias != nullptr) {
+            std::copy(bias, bias + cols, cRow);
+        } else {
+            std::fill(cRow, cRow + cols, T(0));
+        }
+    }
+
+    const int blocks = std::max(1, (inner + GEMM_BLOCK_ROWS - 1) / GEMM_BLOCK_ROWS);
+    for (int block = 0; block < blocks; block++) {
+        const int kBlock = block * GEMM_BLOCK_ROWS;
+        const int kEnd = std::min(kBlock + GEMM_BLOCK_ROWS, inner);
+        const bool lastBlock = block == blocks - 1;
+        int r = 0;
+        for (; r + 4 <= rows; r += 4) {
+            const T* a0 = a + static_cast<std::size_t>(r) * inner;
+            const T* a1 = a0 + inner;
+            const T* a2 = a1 + inner;
+            const T* a3 = a2 + inner;
+            T* c0 = c + static_cast<std::size_t>(r) * cols;
+            T* c1 = c0 + cols;
+            T* c2 = c1 + cols;
+            T* c3 = c2 + cols;
+            int j = 0;
+            for (; j + 2 * V::width <= cols; j += 2 * V::width) {
+                Reg c00 = V::load(c0 + j), c01 = V::load(c0 + j + V::width);
+                Reg c10 = V::load(c1 + j), c11 = V::load(c1 + j + V::width);
+                Reg c20 = V::load(c2 + j), c21 = V::load(c2 + j + V::width);
+                Reg c30 = V::load(c3 + j), c31 = V::load(c3 + j + V::width);
+                for (int k = kBlock; k < kEnd; k++) {
+                    const T* bRow = b + static_cast<std::size_t>(k) * cols + j;
+                    const Reg b0 = V::load(bRow);
+                    const Reg b1 = V::load(bRow + V::width);
+                    Reg s = V::set1(a0[k]);
+                    c00 = V::fmadd(s, b0, c00);
+                    c01 = V::fmadd(s, b1, c01);
+                    s = V::set1(a1[k]);
+                    c10 = V::fmadd(s, b0, c10);
+                    c11 = V::fmadd(s, b1, c11);
+                    s = V::set1(a2[k]);
+                    c20 = V::fmadd(s, b0, c20);
+                    c21 = V::fmadd(s, b1, c21);
+                    s = V::set1(a3[k]);
+                    c30 = V::fmadd(s, b0, c30);
+                    c31 = V::fmadd(s, b1, c31);
+                }
+                if (lastBlock) {
+                    c00 = activateVec<T, A, P>(c00);
+                    c01 = activateVec<T, A, P>(c01);
+                    c10 = activateVec<T, A, P>(c10);
+                    c11 = activateVec<T, A, P>(c11);
+                    c20 = activateVec<T, A, P>(c20);
+                    c21 = activateVec<T, A, P>(c21);
+                    c30 = activateVec<T, A, P>(c30);
+                    c31 = activateVec<T, A, P>(c31);
+                }
+                V::store(c0 + j, c00);
+                V::store(c0 + j + V::width, c01);
+                V::store(c1 + j, c10);
+                V::store(c1 + j + V::width, c11);
+                V::store(c2 + j, c20);
+                V::store(c2 + j + V::width, c21);
+                V::store(c3 + j, c30);
+                V::store(c3 + j + V::width, c31);
+            }
+            // A last single vector, such as all of a 16-filter convolution in float on AVX-512
+            for (; j + V::width <= cols; j += V::width) {
+                Reg c00 = V::load(c0 + j), c10 = V::load(c1 + j), c20 = V::load(c2 + j), c30 = V::load(c3 + j);
+                for (int k = kBlock; k < kEnd; k++) {
+                    const Reg b0 = V::load(b + static_cast<std::size_t>(k) * cols + j);
+                    c00 = V::fmadd(V::set1(a0[k]), b0, c00);
+                    c10 = V::fmadd(V::set1(a1[k]), b0, c10);
+                    c20 = V::fmadd(V::set1(a2[k]), b0, c20);
+                    c30 = V::fmadd(V::set1(a3[k]), b0, c30);
+                }
+                if (lastBlock) {
+                    c00 = activateVec<T, A, P>(c00);
+                    c10 = activateVec<T, A, P>(c10);
+                    c20 = activateVec<T, A, P>(c20);
+                    c30 = activateVec<T, A, P>(c30);
+                }
+                V::store(c0 + j, c00);
+                V::store(c1 + j, c10);
+                V::store(c2 + j, c20);
+                V::store(c3 + j, c30);
+            }
+            for (; j < cols; j++) {
+                T sum0 = c0[j], sum1 = c1[j], sum2 = c2[j], sum3 = c3[j];
+                for (int k = kBlock; k < kEnd; k++) {
+                    const T value = b[static_cast<std::size_t>(k) * cols + j];
+                    sum0 += a0[k] * value;
+                    sum1 += a1[k] * value;
+                    sum2 += a2[k] * value;
+                    sum3 += a3[k] * value;
+                }
+                if (lastBlock) {
+                    sum0 = activateScalar<T, A, P>(sum0);
+                    sum1 = activateScalar<T, A, P>(sum1);
+                    sum2 = activateScalar<T, A, P>(sum2);
+                    sum3 = activateScalar<T, A, P>(sum3);
+                }
+                c0[j] = sum0;
+                c1[j] = sum1;
+                c2[j] = sum2;
+                c3[j] = sum3;
+            }
+            if constexpr (A == SOFTMAX) {
+                if (lastBlock) {
+                    for (T* cRow : {c0, c1, c2, c3}) {
+                        softmax<T, P>(cRow, cols);
+                    }
+                }
+            }
+        }
+        for (; r < rows; r++) {
+            const T* aRow = a + static_cast<std::size_t>(r) * inner;
+            T* cRow = c + static_cast<std::size_t>(r) * cols;
+            for (int k = kBlock; k < kEnd; k++) {
+                axpy<T>(aRow[k], b + static_cast<std::size_t>(k) * cols, cRow, cols);
+            }
+            if (lastBlock) {
+                // The row was just written and is still in cache
+                activateInPlace<T, A, P>(cRow, cols);
+                if constexpr (A == SOFTMAX) {
+                    softmax<T, P>(cRow, cols);
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+void gemm(const T* a, const T* b, T* c, int rows, int inner, int cols) {
+    denseForwardWith<T, LINEAR, ACTIVATION_EXACT>(a, b, nullptr, c, rows, inner, cols);
+}
+
+template <typename T, ActivationAccuracy P>
+void denseForward(const T* a, const T* b, const T* bias, T* c, int rows, int inner, int cols,
+                  ActivationFunction activation) {
+    switch (activation) {
+    case SIGMOID:
+        return denseForwardWith<T, SIGMOID, P>(a, b, bias, c, rows, inner, cols);
+    case TANH:
+        return denseForwardWith<T, TANH, P>(a, b, bias, c, rows, inner, cols);
+    case RELU:
+        return denseForwardWith<T, RELU, P>(a, b, bias, c, rows, inner, cols);
+    case TANH_DERIVATIVE:
+        return denseForwardWith<T, TANH_DERIVATIVE, P>(a, b, bias, c, rows, inner, cols);
+    case SOFTMAX:
+        return denseForwardWith<T, SOFTMAX, P>(a, b, bias, c, rows, inner, cols);
+    case LINEAR:
+    default:
+        return denseForwardWith<T, LINEAR, P>(a, b, bias, c, rows, inner, cols);
+    }
+}
+
+// c = a * b^T: each element is the dot product of a row of a and a row of b.
+// Four rows of b share every vector loaded from a.
+template <typename T>
+void gemmTransposedB(const T* a, const T* b, T* c, int rows, int inner, int cols) {
+    using V = Vec<T>;
+    for (int r = 0; r < rows; r++) {
+        const T* aRow = a + static_cast<std::size_t>(r) * inner;
+        T* cRow = c + static_cast<std::size_t>(r) * cols;
+        int j = 0;
+        for (; j + 4 <= cols; j += 4) {
+            const T* b0 = b + static_cast<std::size_t>(j) * inner;
+            const T* b1 = b0 + inner;
+            const T* b2 = b1 + inner;
+            const T* b3 = b2 + inner;
+            typename V::Reg sum0 = V::zero(), sum1 = V::zero(), sum2 = V::zero(), sum3 = V::zero();
+            int k = 0;
+            for (; k + V::width <= inner; k += V::width) {
+                const typename V::Reg value = V::load(aRow + k);
+                sum0 = V::fmadd(value, V::load(b0 + k), sum0);
+                sum1 = V::fmadd(value, V::load(b1 + k), sum1);
+                sum2 = V::fmadd(value, V::load(b2 + k), sum2);
+                sum3 = V::fmadd(value, V::load(b3 + k), sum3);
+            }
+            T total0 = V::reduceAdd(sum0), total1 = V::reduceAdd(sum1);
+            T total2 = V::reduceAdd(sum2), total3 = V::reduceAdd(sum3);
+            for (; k < inner; k++) {
+                total0 += aRow[k] * b0[k];
+                total1 += aRow[k] * b1[k];
+                total2 += aRow[k] * b2[k];
+                total3 += aRow[k] * b3[k];
+            }
+            cRow[j] = total0;
+            cRow[j + 1] = total1;
+            cRow[j + 2] = total2;
+            cRow[j + 3] = total3;
+        }
+        for (; j < cols; j++) {
+            cRow[j] = dot<T>(aRow, b + static_cast<std::size_t>(j) * inner, inner);
+        }
+    }
+}
+
+// Samples folded into a register tile of c per pass, see gemmTransposedAAccumulate()
+constexpr int GEMM_BLOCK_SAMPLES = 256;
+
+// Rows x Vectors tile of c at row i and column j, plus scale * a^T * b over
+// samples [first, last): every vector loaded from b feeds one fused
+// multiply-add per row of the tile
+template <typename T, int Rows, int Vectors>
+inline void transposedATile(const T* a, const T* b, T* c, int first, int last, int rows, int cols, int i, int j,
+                            T scale) {
+    using V = Vec<T>;
+    using Reg = typename V::Reg;
+    Reg sums[Rows][Vectors];
+    for (int r = 0; r < Rows; r++) {
+        for (int v = 0; v < Vectors; v++) {
+            sums[r][v] = V::load(c + static_cast<std::size_t>(i + r) * cols + j + v * V::width);
+        }
+    }
+    for (int s = first; s < last; s++) {
+        const T* aRow = a + static_cast<std::size_t>(s) * rows + i;
+        const T* bRow = b + static_cast<std::size_t>(s) * cols + j;
+        Reg values[Vectors];
+        for (int v = 0; v < Vectors; v++) {
+            values[v] = V::load(bRow + v * V::width);
+        }
+        for (int r = 0; r < Rows; r++) {
+            const Reg factor = V::set1(scale * aRow[r]);
+            for (int v = 0; v < Vectors; v++) {
+                sums[r][v] = V::fmadd(factor, values[v], sums[r][v]);
+            }
+        }
+    }
+    for (int r = 0; r < Rows; r++) {
+        for (int v = 0; v < Vectors; v++) {
+            V::store(c + static_cast<std::size_t>(i + r) * cols + j + v * V::width, sums[r][v]);
+        }
+    }
+}
+
+// Rows rows of c starting at row i, over samples [first, last)
+template <typename T, int Rows>
+inline void transposedARows(const T* a, const T* b, T* c, int first, int last, int rows, int cols, int i, T scale) {
+    using V = Vec<T>;
+    int j = 0;
+    for (; j + 2 * V::width <= cols; j += 2 * V::width) {
+        transposedATile<T, Rows, 2>(a, b, c, first, last, rows, cols, i, j, scale);
+    }
+    for (; j + V::width <= cols; j += V::width) {
+        transposedATile<T, Rows, 1>(a, b, c, first, last, rows, cols, i, j, scale);
+    }
+    if (j == cols) {
+        return;
+    }
+    for (int s = first; s < last; s++) {
+        const T* aRow = a + static_cast<std::size_t>(s) * rows + i;
+        const T* bRow = b + static_cast<std::size_t>(s) * cols;
+        for (int r = 0; r < Rows; r++) {
+            const T factor = scale * aRow[r];
+            T* cRow = c + static_cast<std::size_t>(i + r) * cols;
+            for (int k = j; k < cols; k++) {
+                cRow[k] += factor * bRow[k];
+            }
+        }
+    }
+}
+
+// c += scale * a^T * b, the mini-batch weight update: a holds the layer inputs
+// and b the matching errors, one sample per row. A tile of four rows of c
+// stays in registers while a block of samples is folded into it, and the
+// block's rows of a and b stay in cache across the tiles. Every element of c
+// adds the samples one after another, as sparseGemmTransposedAAccumulate does.
+template <typename T>
+void gemmTransposedAAccumulate(const T* a, const T* b, T* c, int samples, int rows, int cols, T scale) {
+    for (int first = 0; first < samples; first += GEMM_BLOCK_SAMPLES) {
+        const int last = std::min(first + GEMM_BLOCK_SAMPLES, samples);
+        int i = 0;
+        for (; i + 4 <= rows; i += 4) {
+            transposedARows<T, 4>(a, b, c, first, last, rows, cols, i, scale);
+        }
+        for (; i < rows; i++) {
+            transposedARows<T, 1>(a, b, c, first, last, rows, cols, i, scale);
+        }
+    }
+}
+
+template <typename T>
+int packNonzeros(const T* dense, int count, T* nonzeros, int* indices) {
+    using V = Vec<T>;
+    int packed = 0;
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        packed += V::storeNonzeros(V::load(dense + i), i, nonzeros + packed, indices + packed);
+    }
+    for (; i < count; i++) {
+        packed += kernels_scalar::Vec<T>::storeNonzeros(dense[i], i, nonzeros + packed, indices + packed);
+    }
+    return packed;
+}
+
+// Applies `activation` to a finished row of a layer's outputs
+template <typename T, ActivationAccuracy P>
+void activateRow(T* values, int count, ActivationFunction activation) {
+    switch (activation) {
+    case SIGMOID:
+        return activateInPlace<T, SIGMOID, P>(values, count);
+    case TANH:
+        return activateInPlace<T, TANH, P>(values, count);
+    case RELU:
+        return activateInPlace<T, RELU, P>(values, count);
+    case TANH_DERIVATIVE:
+        return activateInPlace<T, TANH_DERIVATIVE, P>(values, count);
+    case SOFTMAX:
+        return softmax<T, P>(values, count);
+    case LINEAR:
+    default:
+        return;
+    }
+}
+
+// Only the rows of b matching a nonzero input are read: c starts from the
+// bias and takes four of them per pass over the row of c.
+template <typename T, ActivationAccuracy P>
+void sparseDenseForward(const int* rowStarts, const int* indices, const T* values, const T* b, const T* bias, T* c,
+                        int rows, int cols, ActivationFunction activation) {
+    using V = Vec<T>;
+    for (int r = 0; r < rows; r++) {
+        T* cRow = c + static_cast<std::size_t>(r) * cols;
+        if (bias != nullptr) {
+            std::copy(bias, bias + cols, cRow);
+        } else {
+            std::fill(cRow, cRow + cols, T(0));
+        }
+        int k = rowStarts[r];
+        const int end = rowStarts[r + 1];
+        for (; k + 4 <= end; k += 4) {
+            const T* b0 = b + static_cast<std::size_t>(indices[k]) * cols;
+            const T* b1 = b + static_cast<std::size_t>(indices[k + 1]) * cols;
+            const T* b2 = b + static_cast<std::size_t>(indices[k + 2]) * cols;
+            const T* b3 = b + static_cast<std::size_t>(indices[k + 3]) * cols;
+            const typename V::Reg v0 = V::set1(values[k]), v1 = V::set1(values[k + 1]);
+            const typename V::Reg v2 = V::set1(values[k + 2]), v3 = V::set1(values[k + 3]);
+            int j = 0;
+            for (; j + V::width <= cols; j += V::width) {
+                typename V::Reg sum = V::load(cRow + j);
+                sum = V::fmadd(v0, V::load(b0 + j), sum);
+                sum = V::fmadd(v1, V::load(b1 + j), sum);
+                sum = V::fmadd(v2, V::load(b2 + j), sum);
+                sum = V::fmadd(v3, V::load(b3 + j), sum);
+                V::store(cRow + j, sum);
+            }
+            for (; j < cols; j++) {
+                cRow[j] += values[k] * b0[j];
+                cRow[j] += values[k + 1] * b1[j];
+                cRow[j] += values[k + 2] * b2[j];
+                cRow[j] += values[k + 3] * b3[j];
+            }
+        }
+        for (; k < end; k++) {
+            axpy<T>(values[k], b + static_cast<std::size_t>(indices[k]) * cols, cRow, cols);
+        }
+        activateRow<T, P>(cRow, cols, activation);
+    }
+}
+
+// Each nonzero input adds its scaled errors to one row of c; the rows of c
+// that only see zeros are never touched.
+template <typename T>
+void sparseGemmTransposedAAccumulate(const int* rowStarts, const int* indices, const T* values, const T* b, T* c,
+                                     int samples, int cols, T scale) {
+    for (int s = 0; s < samples; s++) {
+        const T* bRow = b + static_cast<std::size_t>(s) * cols;
+        for (int k = rowStarts[s]; k < rowStarts[s + 1]; k++) {
+            axpy<T>(scale * values[k], bRow, c + static_cast<std::size_t>(indices[k]) * cols, cols);
+        }
+    }
+}
+
+// Pixels consecutive output pixels of row y, starting at column x, times
+// Vectors vectors of filters starting at filter j: the 3x3 counterpart of the
+// denseForward micro-kernel, with the im2col patch read straight from the
+// image. Every weight vector loaded feeds one fused multiply-add per pixel.
+// Taps outside the image are skipped, which only happens at the borders
+// (Pixels is 1 there).
+template <typename T, ActivationFunction A, ActivationAccuracy P, int Pixels, int Vectors>
+inline void conv3x3Tile(const T* input, const T* weights, const T* bias, T* output, int y, int x, int j, int height,
+                        int width, int channels, int filters, int channelStride, int pixelStride) {
+    using V = Vec<T>;
+    using Reg = typename V::Reg;
+    Reg sums[Pixels][Vectors];
+    for (int p = 0; p < Pixels; p++) {
+        for (int v = 0; v < Vectors; v++) {
+            sums[p][v] = V::load(bias + j + v * V::width);
+        }
+    }
+    const int kyFirst = y == 0 ? 1 : 0;
+    const int kyLast = y == height - 1 ? 1 : 2;
+    const int kxFirst = x == 0 ? 1 : 0;
+    const int kxLast = x + Pixels == width ? 1 : 2;
+    for (int ky = kyFirst; ky <= kyLast; ky++) {
+        for (int kx = kxFirst; kx <= kxLast; kx++) {
+            const T* pixel = input + (static_cast<std::size_t>(y + ky - 1) * width + x + kx - 1) * pixelStride;
+            const T* tap = weights + static_cast<std::size_t>(ky * 3 + kx) * channels * filters + j;
+            for (int c = 0; c < channels; c++) {
+                const T* values = pixel + static_cast<std::size_t>(c) * channelStride;
+                const T* row = tap + static_cast<std::size_t>(c) * filters;
+                Reg b[Vectors];
+                for (int v = 0; v < Vectors; v++) {
+                    b[v] = V::load(row + v * V::width);
+                }
+                for (int p = 0; p < Pixels; p++) {
+                    const Reg s = V::set1(values[p * pixelStride]);
+                    for (int v = 0; v < Vectors; v++) {
+                        sums[p][v] = V::fmadd(s, b[v], sums[p][v]);
+                    }
+                }
+            }
+        }
+    }
+    for (int p = 0; p < Pixels; p++) {
+        T* outputs = output + (static_cast<std::size_t>(y) * width + x + p) * filters + j;
+        for (int v = 0; v < Vectors; v++) {
+            V::store(outputs + v * V::width, activateVec<T, A, P>(sums[p][v]));
+        }
+    }
+}
+
+// The filters that do not fill a vector, one at a time
+template <typename T, ActivationFunction A, ActivationAccuracy P, int Pixels>
+inline void conv3x3Columns(const T* input, const T* weights, const T* bias, T* output, int y, int x, int first,
+                           int height, int width, int channels, int filters, int channelStride, int pixelStride) {
+    const int kyFirst = y == 0 ? 1 : 0;
+    const int kyLast = y == height - 1 ? 1 : 2;
+    const int kxFirst = x == 0 ? 1 : 0;
+    const int kxLast = x + Pixels == width ? 1 : 2;
+    for (int j = first; j < filters; j++) {
+        T sums[Pixels];
+        std::fill(sums, sums + Pixels, bias[j]);
+        for (int ky = kyFirst; ky <= kyLast; ky++) {
+            for (int kx = kxFirst; kx <= kxLast; kx++) {
+                const T* pixel = input + (static_cast<std::size_t>(y + ky - 1) * width + x + kx - 1) * pixelStride;
+                const T* tap = weights + static_cast<std::size_t>(ky * 3 + kx) * channels * filters + j;
+                for (int c = 0; c < channels; c++) {
+                    const T weight = tap[static_cast<std::size_t>(c) * filters];
+                    for (int p = 0; p < Pixels; p++) {
+                        sums[p] += pixel[static_cast<std::size_t>(c) * channelStride + p * pixelStride] * weight;
+                    }
+                }
+            }
+        }
+        for (int p = 0; p < Pixels; p++) {
+            output[(static_cast<std::size_t>(y) * width + x + p) * filters + j] = activateScalar<T, A, P>(sums[p]);
+        }
+    }
+}
+
+template <typename T, ActivationFunction A, ActivationAccuracy P, int Pixels>
+inline void conv3x3Pixels(const T* input, const T* weights, const T* bias, T* output, int y, int x, int height,
+                          int width, int channels, int filters, int channelStride, int pixelStride) {
+    using V = Vec<T>;
+    int j = 0;
+    for (; j + 2 * V::width <= filters; j += 2 * V::width) {
+        conv3x3Tile<T, A, P, Pixels, 2>(input, weights, bias, output, y, x, j, height, width, channels, filters,
+                                        channelStride, pixelStride);
+    }
+    for (; j + V::width <= filters; j += V::width) {
+        conv3x3Tile<T, A, P, Pixels, 1>(input, weights, bias, output, y, x, j, height, width, channels, filters,
+                                        channelStride, pixelStride);
+    }
+    conv3x3Columns<T, A, P, Pixels>(input, weights, bias, output, y, x, j, height, width, channels, filters,
+                                    channelStride, pixelStride);
+}
+
+// Four pixels at a time across the inside of each row, one at a time at the
+// border columns where the window overhangs the image
+template <typename T, ActivationFunction A, ActivationAccuracy P>
+void conv3x3ForwardWith(const T* input, const T* weights, const T* bias, T* output, int height, int width,
+                        int channels, int filters, int channelStride, int pixelStride) {
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        if (width > 1) {
+            conv3x3Pixels<T, A, P, 1>(input, weights, bias, output, y, x++, height, width, channels, filters,
+                                      channelStride, pixelStride);
+        }
+        for (; x + 4 < width; x += 4) {
+            conv3x3Pixels<T, A, P, 4>(input, weights, bias, output, y, x, height, width, channels, filters,
+                                      channelStride, pixelStride);
+        }
+        for (; x < width; x++) {
+            conv3x3Pixels<T, A, P, 1>(input, weights, bias, output, y, x, height, width, channels, filters,
+                                      channelStride, pixelStride);
+        }
+        if constexpr (A == SOFTMAX) {
+            for (int p = 0; p < width; p++) {
+                softmax<T, P>(output + (static_cast<std::size_t>(y) * width + p) * filters, filters);
+            }
+        }
+    }
+}
+
+template <typename T, ActivationAccuracy P>
+void conv3x3Forward(const T* input, const T* weights, const T* bias, T* output, int height, int width, int channels,
+                    int filters, int channelStride, int pixelStride, ActivationFunction activation) {
+    switch (activation) {
+    case SIGMOID:
+        return conv3x3ForwardWith<T, SIGMOID, P>(input, weights, bias, output, height, width, channels, filters,
+                                                 channelStride, pixelStride);
+    case TANH:
+        return conv3x3ForwardWith<T, TANH, P>(input, weights, bias, output, height, width, channels, filters,
+                                              channelStride, pixelStride);
+    case RELU:
+        return conv3x3ForwardWith<T, RELU, P>(input, weights, bias, output, height, width, channels, filters,
+                                              channelStride, pixelStride);
+    case TANH_DERIVATIVE:
+        return conv3x3ForwardWith<T, TANH_DERIVATIVE, P>(input, weights, bias, output, height, width, channels,
+                                                         filters, channelStride, pixelStride);
+    case SOFTMAX:
+        return conv3x3ForwardWith<T, SOFTMAX, P>(input, weights, bias, output, height, width, channels, filters,
+                                                 channelStride, pixelStride);
+    case LINEAR:
+    default:
+        return conv3x3ForwardWith<T, LINEAR, P>(input, weights, bias, output, height, width, channels, filters,
+                                                channelStride, pixelStride);
+    }
+}
+
+// One panel of samples for every output. A nonzero weight is one broadcast
+// and one fused multiply-add per vector of the panel, its inputs being one
+// contiguous row of the panel; each output's nonzeros are spread over Chains
+// independent sums so that the multiply-adds do not wait on each other.
+template <typename T>
+inline void csrPanel(const int* starts, const int* indices, const T* values, const T* panel, const T* bias, T* c,
+                     int s, int count, int cols) {
+    using V = Vec<T>;
+    constexpr int Vectors = SPARSE_PANEL_ROWS / V::width;
+    constexpr int Chains = Vectors >= 4 ? 1 : 4 / Vectors;
+    static_assert(SPARSE_PANEL_ROWS % V::width == 0, "panels must hold whole vectors");
+    alignas(64) T lanes[SPARSE_PANEL_ROWS];
+    for (int j = 0; j < cols; j++) {
+        typename V::Reg sums[Chains][Vectors];
+        for (int chain = 0; chain < Chains; chain++) {
+            for (int v = 0; v < Vectors; v++) {
+                sums[chain][v] = V::zero();
+            }
+        }
+        int k = starts[j];
+        const int end = starts[j + 1];
+        for (; k + Chains <= end; k += Chains) {
+            for (int chain = 0; chain < Chains; chain++) {
+                const typename V::Reg weight = V::set1(values[k + chain]);
+                const T* inputs = panel + static_cast<std::size_t>(indices[k + chain]) * SPARSE_PANEL_ROWS;
+                for (int v = 0; v < Vectors; v++) {
+                    sums[chain][v] = V::fmadd(weight, V::load(inputs + v * V::width), sums[chain][v]);
+                }
+            }
+        }
+        for (; k < end; k++) {
+            const typename V::Reg weight = V::set1(values[k]);
+            const T* inputs = panel + static_cast<std::size_t>(indices[k]) * SPARSE_PANEL_ROWS;
+            for (int v = 0; v < Vectors; v++) {
+                sums[0][v] = V::fmadd(weight, V::load(inputs + v * V::width), sums[0][v]);
+            }
+        }
+        for (int v = 0; v < Vectors; v++) {
+            typename V::Reg total = V::set1(bias[j]);
+            for (int chain = 0; chain < Chains; chain++) {
+                total = V::add(total, sums[chain][v]);
+            }
+            V::store(lanes + v * V::width, total);
+        }
+        for (int t = 0; t < count; t++) {
+            c[static_cast<std::size_t>(s + t) * cols + j] = lanes[t];
+        }
+    }
+}
+
+// A single sample gathers the inputs of each output's nonzeros instead
+template <typename T, ActivationAccuracy P>
+void csrForward(const int* starts, const int* indices, const T* values, const T* a, const T* bias, T* c, int rows,
+                int inner, int cols, ActivationFunction activation) {
+    using V = Vec<T>;
+    if (rows == 1) {
+        for (int j = 0; j < cols; j++) {
+            typename V::Reg sum = V::zero();
+            int k = starts[j];
+            for (; k + V::width <= starts[j + 1]; k += V::width) {
+                sum = V::fmadd(V::load(values + k), V::gather(a, V::loadInt32(indices + k)), sum);
+            }
+            T total = bias[j] + V::reduceAdd(sum);
+            for (; k < starts[j + 1]; k++) {
+                total += values[k] * a[indices[k]];
+            }
+            c[j] = total;
+        }
+    } else {
+        for (int s = 0; s < rows; s += SPARSE_PANEL_ROWS) {
+            const T* panel = a + static_cast<std::size_t>(s) * inner;
+            csrPanel<T>(starts, indices, values, panel, bias, c, s, std::min(SPARSE_PANEL_ROWS, rows - s), cols);
+        }
+    }
+    for (int r = 0; r < rows; r++) {
+        activateRow<T, P>(c + static_cast<std::size_t>(r) * cols, cols, activation);
+    }
+}
+
+// Rows samples of block column jb: every block's weights are loaded once
+// and feed each sample with one broadcast input
+template <typename T, int Rows>
+inline void blockSparseTile(const int* starts, const int* indices, const T* values, const T* a, const T* bias, T* c,
+                            int r, int inner, int cols, int jb) {
+    using V = Vec<T>;
+    constexpr int Vectors = SPARSE_BLOCK_WIDTH / V::width;
+    static_assert(SPARSE_BLOCK_WIDTH % V::width == 0, "blocks must hold whole vectors");
+    const int first = jb * SPARSE_BLOCK_WIDTH;
+    const int width = std::min(SPARSE_BLOCK_WIDTH, cols - first);
+    alignas(64) T lanes[SPARSE_BLOCK_WIDTH] = {};
+    std::copy(bias + first, bias + first + width, lanes);
+    typename V::Reg sums[Rows][Vectors];
+    for (int v = 0; v < Vectors; v++) {
+        const typename V::Reg start = V::load(lanes + v * V::width);
+        for (int row = 0; row < Rows; row++) {
+            sums[row][v] = start;
+        }
+    }
+    for (int k = starts[jb]; k < starts[jb + 1]; k++) {
+        const T* block = values + static_cast<std::size_t>(k) * SPARSE_BLOCK_WIDTH;
+        typename V::Reg weights[Vectors];
+        for (int v = 0; v < Vectors; v++) {
+            weights[v] = V::load(block + v * V::width);
+        }
+        for (int row = 0; row < Rows; row++) {
+            const typename V::Reg input = V::set1(a[static_cast<std::size_t>(r + row) * inner + indices[k]]);
+            for (int v = 0; v < Vectors; v++) {
+                sums[row][v] = V::fmadd(input, weights[v], sums[row][v]);
+            }
+        }
+    }
+    for (int row = 0; row < Rows; row++) {
+        T* cRow = c + static_cast<std::size_t>(r + row) * cols + first;
+        if (width == SPARSE_BLOCK_WIDTH) {
+            for (int v = 0; v < Vectors; v++) {
+                V::store(cRow + v * V::width, sums[row][v]);
+            }
+        } else {
+            for (int v = 0; v < Vectors; v++) {
+                V::store(lanes + v * V::width, sums[row][v]);
+            }
+            std::copy(lanes, lanes + width, cRow);
+        }
+    }
+}
+
+// Four samples per pass over the blocks (two when a block takes four or more
+// vectors, to stay within the registers)
+template <typename T, ActivationAccuracy P>
+void blockSparseForward(const int* starts, const int* indices, const T* values, const T* a, const T* bias, T* c,
+                        int rows, int inner, int cols, ActivationFunction activation) {
+    constexpr int ROWS = SPARSE_BLOCK_WIDTH / Vec<T>::width <= 2 ? 4 : 2;
+    const int blockColumns = (cols + SPARSE_BLOCK_WIDTH - 1) / SPARSE_BLOCK_WIDTH;
+    int r = 0;
+    for (; r + ROWS <= rows; r += ROWS) {
+        for (int jb = 0; jb < blockColumns; jb++) {
+            blockSparseTile<T, ROWS>(starts, indices, values, a, bias, c, r, inner, cols, jb);
+        }
+    }
+    for (; r < rows; r++) {
+        for (int jb = 0; jb < blockColumns; jb++) {
+            blockSparseTile<T, 1>(starts, indices, values, a, bias, c, r, inner, cols, jb);
+        }
+    }
+    for (r = 0; r < rows; r++) {
+        activateRow<T, P>(c + static_cast<std::size_t>(r) * cols, cols, activation);
+    }
+}
+
+// The gradient of one parameter after scaling and the L2 penalty
+template <typename T, typename V = Vec<T>>
+inline typename V::Reg scaledGradient(typename V::Reg gradient, typename V::Reg parameter,
+                                      const ParameterUpdate<T>& update) {
+    return V::fnmadd(V::set1(update.l2Penalty), parameter, V::mul(V::set1(update.gradientScale), gradient));
+}
+
+template <typename T, typename V = Vec<T>>
+inline void momentumStep(T* parameters, const T* gradients, T* velocity, int i, const ParameterUpdate<T>& update) {
+    const typename V::Reg parameter = V::load(parameters + i);
+    const typename V::Reg gradient = scaledGradient<T, V>(V::load(gradients + i), parameter, update);
+    const typename V::Reg momentum = V::set1(update.momentum);
+    const typename V::Reg next = V::fmadd(momentum, V::load(velocity + i), gradient);
+    V::store(velocity + i, next);
+    const typename V::Reg step = update.nesterov ? V::fmadd(momentum, next, gradient) : next;
+    V::store(parameters + i, V::fmadd(V::set1(update.learningRate), step, parameter));
+}
+
+template <typename T>
+void momentumUpdate(T* parameters, const T* gradients, T* velocity, int count, const ParameterUpdate<T>& update) {
+    using V = Vec<T>;
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        momentumStep<T>(parameters, gradients, velocity, i, update);
+    }
+    for (; i < count; i++) {
+        momentumStep<T, kernels_scalar::Vec<T>>(parameters, gradients, velocity, i, update);
+    }
+}
+
+template <typename T, typename V = Vec<T>>
+inline void adamStep(T* parameters, const T* gradients, T* m, T* v, int i, const ParameterUpdate<T>& update) {
+    typename V::Reg parameter = V::load(parameters + i);
+    const typename V::Reg gradient = scaledGradient<T, V>(V::load(gradients + i), parameter, update);
+    parameter = V::fnmadd(V::set1(update.decay), parameter, parameter);
+
+    const typename V::Reg beta1 = V::set1(update.beta1);
+    const typename V::Reg beta2 = V::set1(update.beta2);
+    // beta * moment + (1 - beta) * x = beta * (moment - x) + x
+    const typename V::Reg first = V::fmadd(beta1, V::sub(V::load(m + i), gradient), gradient);
+    const typename V::Reg square = V::mul(gradient, gradient);
+    const typename V::Reg second = V::fmadd(beta2, V::sub(V::load(v + i), square), square);
+    V::store(m + i, first);
+    V::store(v + i, second);
+
+    const typename V::Reg denominator =
+        V::add(V::sqrt(V::mul(second, V::set1(update.secondCorrection))), V::set1(update.epsilon));
+    const typename V::Reg step = V::div(V::mul(first, V::set1(update.firstCorrection)), denominator);
+    V::store(parameters + i, V::fmadd(V::set1(update.learningRate), step, parameter));
+}
+
+template <typename T>
+void adamUpdate(T* parameters, const T* gradients, T* m, T* v, int count, const ParameterUpdate<T>& update) {
+    using V = Vec<T>;
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        adamStep<T>(parameters, gradients, m, v, i, update);
+    }
+    for (; i < count; i++) {
+        adamStep<T, kernels_scalar::Vec<T>>(parameters, gradients, m, v, i, update);
+    }
+}
+
+template <typename T, typename V = Vec<T>>
+inline void dropoutStep(T* values, T* mask, const int32_t* uniform24, int i, T keepThreshold, T keptScale) {
+    const typename V::Reg kept =
+        V::selectLess(V::loadInt32(uniform24 + i), V::set1(keepThreshold), V::set1(keptScale));
+    V::store(mask + i, kept);
+    V::store(values + i, V::mul(V::load(values + i), kept));
+}
+
+template <typename T>
+void dropout(T* values, T* mask, const int32_t* uniform24, int count, T keepThreshold, T keptScale) {
+    using V = Vec<T>;
+    int i = 0;
+    for (; i + V::width <= count; i += V::width) {
+        dropoutStep<T>(values, mask, uniform24, i, keepThreshold, keptScale);
+    }
+    for (; i < count; i++) {
+        dropoutStep<T, kernels_scalar::Vec<T>>(values, mask, uniform24, i, keepThreshold, keptScale);
+    }
+}
+
+// int32 sums of Rows rows of a against four rows of b. Every vector of a is
+// shared by the four columns and every one of b by the Rows rows.
+template <int Rows>
+inline void int8Block(const int8_t* a, const int8_t* b, int inner, int stride, int32_t totals[][4]) {
+    using I = Int8Vec;
+    typename I::Acc sums[Rows][4];
+    for (int r = 0; r < Rows; r++) {
+        for (int j = 0; j < 4; j++) {
+            sums[r][j] = I::zero();
+        }
+    }
+    int k = 0;
+    for (; k + I::width <= inner; k += I::width) {
+        typename I::Reg columns[4];
+        for (int j = 0; j < 4; j++) {
+            columns[j] = I::load(b + static_cast<std::size_t>(j) * stride + k);
+        }
+        for (int r = 0; r < Rows; r++) {
+            const typename I::Reg value = I::load(a + static_cast<std::size_t>(r) * stride + k);
+            for (int j = 0; j < 4; j++) {
+                sums[r][j] = I::madd(value, columns[j], sums[r][j]);
+            }
+        }
+    }
+    for (int r = 0; r < Rows; r++) {
+        const int8_t* aRow = a + static_cast<std::size_t>(r) * stride;
+        for (int j = 0; j < 4; j++) {
+            const int8_t* bRow = b + static_cast<std::size_t>(j) * stride;
+            int32_t total = I::reduceAdd(sums[r][j]);
+            for (int i = k; i < inner; i++) {
+                total += aRow[i] * bRow[i];
+            }
+            totals[r][j] = total;
+        }
+    }
+}
+
+// Quantized dense layer over blocks of Int8Vec::rows rows and four columns;
+// each block of rows is dequantized and activated while in cache.
+template <typename T, ActivationAccuracy P>
+void denseInt8(const int8_t* a, const int8_t* b, const T* scales, const T* bias, T* c, int rows, int inner, int stride,
+               int cols, ActivationFunction activation) {
+    constexpr int BLOCK = Int8Vec::rows;
+    auto finish = [&](int j, int32_t sum) { return static_cast<T>(sum) * scales[j] + (bias ? bias[j] : T(0)); };
+    for (int r = 0; r < rows; r += BLOCK) {
+        const int8_t* aRows = a + static_cast<std::size_t>(r) * stride;
+        T* cRows = c + static_cast<std::size_t>(r) * cols;
+        const int blockRows = std::min(BLOCK, rows - r);
+        int32_t totals[BLOCK][4];
+        int j = 0;
+        for (; j + 4 <= cols; j += 4) {
+            const int8_t* bRows = b + static_cast<std::size_t>(j) * stride;
+            if (blockRows == BLOCK) {
+                int8Block<BLOCK>(aRows, bRows, inner, stride, totals);
+            } else {
+                for (int i = 0; i < blockRows; i++) {
+                    int8Block<1>(aRows + static_cast<std::size_t>(i) * stride, bRows, inner, stride, totals + i);
+                }
+            }
+            for (int i = 0; i < blockRows; i++) {
+                for (int o = 0; o < 4; o++) {
+                    cRows[i * cols + j + o] = finish(j + o, totals[i][o]);
+                }
+            }
+        }
+        for (; j < cols; j++) {
+            const int8_t* bRow = b + static_cast<std::size_t>(j) * stride;
+            for (int i = 0; i < blockRows; i++) {
+                const int8_t* aRow = aRows + static_cast<std::size_t>(i) * stride;
+                int32_t total = 0;
+                for (int k = 0; k < inner; k++) {
+                    total += aRow[k] * bRow[k];
+                }
+                cRows[i * cols + j] = finish(j, total);
+            }
+        }
+        for (int i = 0; i < blockRows; i++) {
+            activateRow<T, P>(cRows + i * cols, cols, activation);
+        }
+    }
+}
+
+// quantized[i] = values[i] * inverseScale rounded to nearest and clamped to
+// [-127, 127]; a plain loop the compiler vectorizes for this namespace's target
+template <typename T>
+void quantizeInt8(const T* values, int8_t* quantized, int count, T inverseScale) {
+    for (int i = 0; i < count; i++) {
+        const T scaled = std::min(T(127), std::max(T(-127), values[i] * inverseScale));
+        quantized[i] = static_cast<int8_t>(static_cast<int32_t>(std::nearbyint(scaled)));
+    }
+}
+
+// 16-bit values of format F widened to a float vector
+template <HalfFormat F>
+inline typename Vec<float>::Reg loadHalf(const uint16_t* pointer) {
+    if constexpr (F == HALF_BFLOAT16) {
+        return HalfVec::loadBfloat16(pointer);
+    } else {
+        return HalfVec::loadFloat16(pointer);
+    }
+}
+
+// target[0, Vec<float>::width) += sums
+template <typename T>
+inline void addFloats(T* target, typename Vec<float>::Reg sums) {
+    using V = Vec<float>;
+    if constexpr (std::is_same<T, float>::value) {
+        V::store(target, V::add(V::load(target), sums));
+    } else {
+        float lanes[V::width];
+        V::store(lanes, sums);
+        for (int i = 0; i < V::width; i++) {
+            target[i] += lanes[i];
+        }
+    }
+}
+
+// Rows x Vectors tile of c at row r and column j, plus a * b over the inner
+// block [k, kEnd): `widened` holds that block of the Rows rows of a as
+// float, interleaved (the Rows values of inner index i side by side), and b
+// is widened as it is loaded. The tile sums from zero in float and is added
+// to c once per block. Rows is 1 or 4 and Vectors 1 or 2; the tile is
+// written out register by register as in denseForwardWith, since GCC keeps
+// the sums of a loop over the rows in memory.
+template <typename T, HalfFormat F, int Rows, int Vectors>
+inline void halfTile(const float* widened, const uint16_t* b, T* c, int k, int kEnd, int cols, int r, int j) {
+    using V = Vec<float>;
+    using Reg = typename V::Reg;
+    Reg c00 = V::zero(), c01 = V::zero(), c10 = V::zero(), c11 = V::zero();
+    Reg c20 = V::zero(), c21 = V::zero(), c30 = V::zero(), c31 = V::zero();
+    for (int i = k; i < kEnd; i++) {
+        const uint16_t* bRow = b + static_cast<std::size_t>(i) * cols + j;
+        const Reg b0 = loadHalf<F>(bRow);
+        const Reg b1 = Vectors == 2 ? loadHalf<F>(bRow + V::width) : V::zero();
+        const float* factors = widened + (i - k) * Rows;
+        Reg s = V::set1(factors[0]);
+        c00 = V::fmadd(s, b0, c00);
+        c01 = Vectors == 2 ? V::fmadd(s, b1, c01) : c01;
+        if (Rows == 4) {
+            s = V::set1(factors[1]);
+            c10 = V::fmadd(s, b0, c10);
+            c11 = Vectors == 2 ? V::fmadd(s, b1, c11) : c11;
+            s = V::set1(factors[2]);
+            c20 = V::fmadd(s, b0, c20);
+            c21 = Vectors == 2 ? V::fmadd(s, b1, c21) : c21;
+            s = V::set1(factors[3]);
+            c30 = V::fmadd(s, b0, c30);
+            c31 = Vectors == 2 ? V::fmadd(s, b1, c31) : c31;
+        }
+    }
+    const Reg sums[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (int row = 0; row < Rows; row++) {
+        for (int v = 0; v < Vectors; v++) {
+            addFloats(c + static_cast<std::size_t>(r + row) * cols + j + v * V::width, sums[row][v]);
+        }
+    }
+}
+
+// The last cols - j columns (fewer than a vector) of the same tile, with b
+// taken from `tail`: those columns of each row of the block, widened and
+// zero-padded to a vector
+template <typename T, int Rows>
+inline void halfTailTile(const float* widened, const float* tail, T* c, int k, int kEnd, int cols, int r, int j) {
+    using V = Vec<float>;
+    using Reg = typename V::Reg;
+    Reg c0 = V::zero(), c1 = V::zero(), c2 = V::zero(), c3 = V::zero();
+    for (int i = 0; i < kEnd - k; i++) {
+        const Reg b0 = V::load(tail + i * V::width);
+        const float* factors = widened + i * Rows;
+        c0 = V::fmadd(V::set1(factors[0]), b0, c0);
+        if (Rows == 4) {
+            c1 = V::fmadd(V::set1(factors[1]), b0, c1);
+            c2 = V::fmadd(V::set1(factors[2]), b0, c2);
+            c3 = V::fmadd(V::set1(factors[3]), b0, c3);
+        }
+    }
+    float lanes[4][MAX_VEC_WIDTH];
+    V::store(lanes[0], c0);
+    V::store(lanes[1], c1);
+    V::store(lanes[2], c2);
+    V::store(lanes[3], c3);
+    for (int row = 0; row < Rows; row++) {
+        T* cRow = c + static_cast<std::size_t>(r + row) * cols;
+        for (int o = j; o < cols; o++) {
+            cRow[o] += lanes[row][o - j];
+        }
+    }
+}
+
+// One row of c plus a * b over the inner block [k, kEnd), for a single
+// sample or the last rows of a batch: four rows of b at a time are swept across every column and added
+// into c, so that the weights stream from memory in order instead of being
+// walked down a few columns at a time
+template <typename T, HalfFormat F>
+inline void halfStreamRow(const float* widened, const uint16_t* b, T* c, int k, int kEnd, int cols) {
+    using V = Vec<float>;
+    using Reg = typename V::Reg;
+    int i = k;
+    for (; i + 4 <= kEnd; i += 4) {
+        const uint16_t* b0 = b + static_cast<std::size_t>(i) * cols;
+        const uint16_t* b1 = b0 + cols;
+        const uint16_t* b2 = b1 + cols;
+        const uint16_t* b3 = b2 + cols;
+        const float* factors = widened + i - k;
+        const Reg s0 = V::set1(factors[0]), s1 = V::set1(factors[1]);
+        const Reg s2 = V::set1(factors[2]), s3 = V::set1(factors[3]);
+        int j = 0;
+        for (; j + V::width <= cols; j += V::width) {
+            Reg sum = V::mul(s0, loadHalf<F>(b0 + j));
+            sum = V::fmadd(s1, loadHalf<F>(b1 + j), sum);
+            sum = V::fmadd(s2, loadHalf<F>(b2 + j), sum);
+            sum = V::fmadd(s3, loadHalf<F>(b3 + j), sum);
+            addFloats(c + j, sum);
+        }
+        for (; j < cols; j++) {
+            c[j] += factors[0] * halfToFloat(b0[j], F) + factors[1] * halfToFloat(b1[j], F) +
+                    factors[2] * halfToFloat(b2[j], F) + factors[3] * halfToFloat(b3[j], F);
+        }
+    }
+    for (; i < kEnd; i++) {
+        const uint16_t* bRow = b + static_cast<std::size_t>(i) * cols;
+        const float factor = widened[i - k];
+        const Reg s = V::set1(factor);
+        int j = 0;
+        for (; j + V::width <= cols; j += V::width) {
+            addFloats(c + j, V::mul(s, loadHalf<F>(bRow + j)));
+        }
+        for (; j < cols; j++) {
+            c[j] += factor * halfToFloat(bRow[j], F);
+        }
+    }
+}
+
+// Rows rows of c from row r plus a * b over the inner block [k, kEnd). The
+// block of those rows of a is widened once, for every column; `tail` holds
+// the block's last columns of b for halfTailTile.
+template <typename T, HalfFormat F, int Rows>
+inline void halfRows(const uint16_t* a, const uint16_t* b, const float* tail, T* c, int k, int kEnd, int inner,
+                     int cols, int r) {
+    using V = Vec<float>;
+    float rowBlock[GEMM_BLOCK_ROWS];
+    float widened[GEMM_BLOCK_ROWS * Rows];
+    for (int row = 0; row < Rows; row++) {
+        const uint16_t* aRow = a + static_cast<std::size_t>(r + row) * inner;
+        int i = k;
+        for (; i + V::width <= kEnd; i += V::width) {
+            V::store(rowBlock + i - k, loadHalf<F>(aRow + i));
+        }
+        for (; i < kEnd; i++) {
+            rowBlock[i - k] = halfToFloat(aRow[i], F);
+        }
+        for (i = 0; i < kEnd - k; i++) {
+            widened[i * Rows + row] = rowBlock[i];
+        }
+    }
+    if (Rows == 1 && cols >= V::width) {
+        halfStreamRow<T, F>(widened, b, c + static_cast<std::size_t>(r) * cols, k, kEnd, cols);
+        return;
+    }
+    int j = 0;
+    for (; j + 2 * V::width <= cols; j += 2 * V::width) {
+        halfTile<T, F, Rows, 2>(widened, b, c, k, kEnd, cols, r, j);
+    }
+    for (; j + V::width <= cols; j += V::width) {
+        halfTile<T, F, Rows, 1>(widened, b, c, k, kEnd, cols, r, j);
+    }
+    if (j < cols) {
+        halfTailTile<T, Rows>(widened, tail, c, k, kEnd, cols, r, j);
+    }
+}
+
+// Dense layer on 16-bit floats, blocked like denseForwardWith: GEMM_BLOCK_ROWS
+// rows of b stay in cache while every group of four rows of a runs through
+// them with a 4 x 2-vector tile of float sums in registers; leftover rows
+// stream through the block instead. c starts from the bias, and the rows are
+// activated after the last block.
+template <typename T, ActivationAccuracy P, HalfFormat F>
+void denseHalfWith(const uint16_t* a, const uint16_t* b, const T* bias, T* c, int rows, int inner, int cols,
+                   ActivationFunction activation) {
+    using V = Vec<float>;
+    // Columns from tailStart on are fewer than a vector
+    const int tailStart = cols - cols % V::width;
+    float tail[GEMM_BLOCK_ROWS * MAX_VEC_WIDTH] = {};
+    for (int r = 0; r < rows; r++) {
+        T* cRow = c + static_cast<std::size_t>(r) * cols;
+        if (bias != nullptr) {
+            std::copy(bias, bias + cols, cRow);
+        } else {
+            std::fill(cRow, cRow + cols, T(0));
+        }
+    }
+    for (int k = 0; k < inner; k += GEMM_BLOCK_ROWS) {
+        const int kEnd = std::min(k + GEMM_BLOCK_ROWS, inner);
+        for (int i = k; i < kEnd && tailStart < cols; i++) {
+            const uint16_t* bRow = b + static_cast<std::size_t>(i) * cols;
+            for (int o = tailStart; o < cols; o++) {
+                tail[(i - k) * V::width + o - tailStart] = halfToFloat(bRow[o], F);
+            }
+        }
+        int r = 0;
+        for (; r + 4 <= rows; r += 4) {
+            halfRows<T, F, 4>(a, b, tail, c, k, kEnd, inner, cols, r);
+        }
+        for (; r < rows; r++) {
+            halfRows<T, F, 1>(a, b, tail, c, k, kEnd, inner, cols, r);
+        }
+    }
+    for (int r = 0; r < rows; r++) {
+        activateRow<T, P>(c + static_cast<std::size_t>(r) * cols, cols, activation);
+    }
+}
+
+template <typename T, ActivationAccuracy P>
+void denseHalf(const uint16_t* a, const uint16_t* b, const T* bias, T* c, int rows, int inner, int cols,
+               ActivationFunction activation, HalfFormat format) {
+    if (format == HALF_BFLOAT16) {
+        denseHalfWith<T, P, HALF_BFLOAT16>(a, b, bias, c, rows, inner, cols, activation);
+    } else {
+        denseHalfWith<T, P, HALF_FLOAT16>(a, b, bias, c, rows, inner, cols, activation);
+    }
+}
+
+// Floats are rounded a vector at a time, doubles one by one through float
+template <typename T>
+void toHalf(const T* values, uint16_t* half, int count, HalfFormat format) {
+    int i = 0;
+    if constexpr (std::is_same<T, float>::value) {
+        using V = Vec<float>;
+        if (format == HALF_BFLOAT16) {
+            for (; i + V::width <= count; i += V::width) {
+                HalfVec::storeBfloat16(half + i, V::load(values + i));
+            }
+        } else {
+            for (; i + V::width <= count; i += V::width) {
+                HalfVec::storeFloat16(half + i, V::load(values + i));
+            }
+        }
+    }
+    for (; i < count; i++) {
+        half[i] = floatToHalf(static_cast<float>(values[i]), format);
+    }
+}
+
+template <typename T, ActivationAccuracy P>
+KernelTable<T> table() {
+    return {
+        NAME,
+        &dot<T>,
+        &axpy<T>,
+        &outerUpdate<T>,
+        &sigmoid<T, P>,
+        &tanh<T, P>,
+        &relu<T, P>,
+        &softmax<T, P>,
+        &gemm<T>,
+        &denseForward<T, P>,
+        &gemmTransposedB<T>,
+        &gemmTransposedAAccumulate<T>,
+        &momentumUpdate<T>,
+        &adamUpdate<T>,
+        &packNonzeros<T>,
+        &sparseDenseForward<T, P>,
+        &sparseGemmTransposedAAccumulate<T>,
+        &conv3x3Forward<T, P>,
+        &csrForward<T, P>,
+        &blockSparseForward<T, P>,
+        &dropout<T>,
+        &denseInt8<T, P>,
+        &quantizeInt8<T>,
+        &denseHalf<T, P>,
+        &toHalf<T>,
+    };
+}
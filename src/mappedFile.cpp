@@ -0,0 +1,71 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped into memory. Pages are read from the page cache on
+// first access, so opening costs the same whatever the file size and only
+// the parts actually touched become resident.
+class MappedFile {
+public:
+    enum Access {
+        READ_ONLY,     // Shared read-only pages
+        COPY_ON_WRITE  // Writable private pages; writes never reach the file
+    };
+
+    ~MappedFile() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps `path`; returns nullptr and sets `error` on failure.
+    static std::shared_ptr<MappedFile> open(const std::string& path, Access access, std::string& error) {
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            error = "unable to open " + path;
+            return nullptr;
+        }
+        struct stat status;
+        if (fstat(descriptor, &status) != 0) {
+            ::close(descriptor);
+            error = "unable to stat " + path;
+            return nullptr;
+        }
+
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        file->length = static_cast<std::size_t>(status.st_size);
+        if (file->length > 0) {
+            const int protection = access == COPY_ON_WRITE ? PROT_READ | PROT_WRITE : PROT_READ;
+            const int flags = access == COPY_ON_WRITE ? MAP_PRIVATE : MAP_SHARED;
+            file->mapping = mmap(nullptr, file->length, protection, flags, descriptor, 0);
+        }
+        ::close(descriptor);
+        if (file->length > 0 && file->mapping == MAP_FAILED) {
+            error = "unable to map " + path;
+            return nullptr;
+        }
+        return file;
+    }
+
+    // Only writable with COPY_ON_WRITE access
+    unsigned char* data() const { return length > 0 ? static_cast<unsigned char*>(mapping) : nullptr; }
+    std::size_t size() const { return length; }
+
+private:
+    void* mapping = MAP_FAILED;
+    std::size_t length = 0;
+
+    MappedFile() = default;
+};
+
+#endif
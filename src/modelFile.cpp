@@ -0,0 +1,445 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "./mappedFile.cpp"
+
+// Binary model format, little-endian:
+//
+//   ModelFileHeader            64 bytes
+//   ModelFileLayer[layerCount] 16 bytes each
+//   padding                    up to header.dataOffset, a multiple of 64
+//   layers                     one block per layer: inputs x outputs row-major weights of
+//                              header.dtype, then its outputs biases, zero-padded to a
+//                              multiple of 64 bytes (version 1: weights only, no padding)
+//
+// A layer's inputs and outputs are the shape of its weight matrix: the
+// values per sample in and out for dense layers, the window size and the
+// filter count for convolutions, and 0 x 0 for layers without weights.
+//
+// The header's sizes are checked on every open, so a truncated file is always
+// rejected. The checksum covers every byte after the header; verifying it
+// reads the whole file, so it is only done on request (by the converter and
+// by loaders that copy every weight anyway) and a mapped load only touches
+// the pages it uses. Every weight matrix starts on a 64-byte boundary in the
+// in-memory layout, so a file of the network's own dtype is mapped and used
+// in place.
+
+constexpr char MODEL_FILE_MAGIC[8] = {'N', 'N', 'M', 'O', 'D', 'E', 'L', '\0'};
+// Version 1 files have no biases; they still load, with zero biases.
+// Version 2 files have only dense layers and no input shape; they load as is.
+constexpr uint32_t MODEL_FILE_VERSION = 3;
+constexpr std::size_t MODEL_FILE_ALIGNMENT = 64;
+
+enum ModelDType : uint32_t {
+    DTYPE_FLOAT32 = 1,
+    DTYPE_FLOAT64 = 2
+};
+
+template <typename T>
+constexpr ModelDType dtypeOf();
+
+template <>
+constexpr ModelDType dtypeOf<float>() { return DTYPE_FLOAT32; }
+
+template <>
+constexpr ModelDType dtypeOf<double>() { return DTYPE_FLOAT64; }
+
+inline std::size_t dtypeSize(uint32_t dtype) {
+    switch (dtype) {
+    case DTYPE_FLOAT32:
+        return sizeof(float);
+    case DTYPE_FLOAT64:
+        return sizeof(double);
+    default:
+        return 0;
+    }
+}
+
+struct ModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layerCount;
+    uint32_t dataOffset;     // Offset of the first weight from the start of the file
+    uint64_t dataBytes;      // Size of the layer blocks
+    uint64_t checksum;       // FNV-1a of bytes [sizeof(ModelFileHeader), dataOffset + dataBytes)
+    uint32_t inputShape[3];  // Channels, height and width of image inputs, zeros otherwise
+    uint8_t reserved[12];
+};
+static_assert(sizeof(ModelFileHeader) == 64, "model file header must stay 64 bytes");
+
+struct ModelFileLayer {
+    uint32_t inputs;
+    uint32_t outputs;
+    uint32_t activation;     // ActivationFunction value
+    uint32_t geometry;       // LayerType and window, see packLayerGeometry(); 0 for dense layers
+};
+static_assert(sizeof(ModelFileLayer) == 16, "model file layer entry must stay 16 bytes");
+
+// 64-bit FNV-1a, continuing from `hash`
+inline uint64_t fnv1a(const void* data, std::size_t bytes, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* current = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < bytes; i++) {
+        hash = (hash ^ current[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Size of a layer's block in a file of the given version and dtype
+inline uint64_t layerBlockBytes(const ModelFileLayer& layer, uint32_t version, std::size_t valueBytes) {
+    const uint64_t weightBytes = static_cast<uint64_t>(layer.inputs) * layer.outputs * valueBytes;
+    if (version < 2) {
+        return weightBytes;
+    }
+    const uint64_t bytes = weightBytes + static_cast<uint64_t>(layer.outputs) * valueBytes;
+    return (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+inline std::size_t modelDataOffset(std::size_t layerCount) {
+    std::size_t end = sizeof(ModelFileHeader) + layerCount * sizeof(ModelFileLayer);
+    return (end + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+// Writes a model file. `weights[i]` holds the layers[i].inputs x
+// layers[i].outputs weights of layer i and `biases[i]` its layers[i].outputs
+// biases; `inputShape` is the header's. The file is written next to `path`
+// and renamed over it, so readers never see a half-written model.
+template <typename T>
+bool writeModelFile(const std::string& path, const std::vector<ModelFileLayer>& layers, const std::vector<const T*>& weights,
+                    const std::vector<const T*>& biases, std::string& error,
+                    const std::array<uint32_t, 3>& inputShape = {}) {
+    ModelFileHeader header = {};
+    std::memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic));
+    std::copy(inputShape.begin(), inputShape.end(), header.inputShape);
+    header.version = MODEL_FILE_VERSION;
+    header.dtype = dtypeOf<T>();
+    header.layerCount = static_cast<uint32_t>(layers.size());
+    header.dataOffset = static_cast<uint32_t>(modelDataOffset(layers.size()));
+
+    std::vector<char> table(header.dataOffset - sizeof(ModelFileHeader), 0);
+    std::memcpy(table.data(), layers.data(), layers.size() * sizeof(ModelFileLayer));
+    const char padding[MODEL_FILE_ALIGNMENT] = {};
+    uint64_t checksum = fnv1a(table.data(), table.size());
+    for (std::size_t i = 0; i < layers.size(); i++) {
+        const std::size_t weightBytes = static_cast<std::size_t>(layers[i].inputs) * layers[i].outputs * sizeof(T);
+        const std::size_t biasBytes = layers[i].outputs * sizeof(T);
+        const std::size_t blockBytes = layerBlockBytes(layers[i], MODEL_FILE_VERSION, sizeof(T));
+        checksum = fnv1a(weights[i], weightBytes, checksum);
+        checksum = fnv1a(biases[i], biasBytes, checksum);
+        checksum = fnv1a(padding, blockBytes - weightBytes - biasBytes, checksum);
+        header.dataBytes += blockBytes;
+    }
+    header.checksum = checksum;
+
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "unable to open " + temporaryPath;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(table.data(), table.size());
+    for (std::size_t i = 0; i < layers.size(); i++) {
+        file.write(reinterpret_cast<const char*>(weights[i]),
+                   static_cast<std::streamsize>(layers[i].inputs) * layers[i].outputs * sizeof(T));
+        file.write(reinterpret_cast<const char*>(biases[i]), static_cast<std::streamsize>(layers[i].outputs) * sizeof(T));
+        const std::size_t valueBytes = (static_cast<std::size_t>(layers[i].inputs) + 1) * layers[i].outputs * sizeof(T);
+        file.write(padding, static_cast<std::streamsize>(layerBlockBytes(layers[i], MODEL_FILE_VERSION, sizeof(T)) - valueBytes));
+    }
+    file.close();
+    if (!file) {
+        error = "failed to write " + temporaryPath;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        error = "failed to replace " + path;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// A model file mapped copy-on-write: the weights can be read in place and
+// even trained in place, writes go to private pages and never reach the file.
+class ModelFile {
+public:
+    // Maps and validates `path`; returns nullptr and sets `error` on failure.
+    // `verifyChecksum` also hashes every byte after the header, which pages in
+    // the whole file.
+    static std::shared_ptr<ModelFile> open(const std::string& path, std::string& error, bool verifyChecksum = false) {
+        std::shared_ptr<MappedFile> mapped = MappedFile::open(path, MappedFile::COPY_ON_WRITE, error);
+        if (mapped == nullptr) {
+            return nullptr;
+        }
+        if (mapped->size() < sizeof(ModelFileHeader)) {
+            error = path + " is not a model file";
+            return nullptr;
+        }
+
+        std::shared_ptr<ModelFile> file(new ModelFile(mapped));
+        if (!file->validate(verifyChecksum, error)) {
+            error = path + ": " + error;
+            return nullptr;
+        }
+        return file;
+    }
+
+    // True when `path` starts with the model file magic
+    static bool isModelFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[sizeof(MODEL_FILE_MAGIC)] = {};
+        file.read(magic, sizeof(magic));
+        return file && std::memcmp(magic, MODEL_FILE_MAGIC, sizeof(magic)) == 0;
+    }
+
+    const ModelFileHeader& header() const { return *reinterpret_cast<const ModelFileHeader*>(bytes()); }
+
+    const ModelFileLayer& layer(std::size_t index) const {
+        return reinterpret_cast<const ModelFileLayer*>(bytes() + sizeof(ModelFileHeader))[index];
+    }
+
+    // Weights of layer `index`, in the file's dtype
+    void* weights(std::size_t index) {
+        std::size_t offset = header().dataOffset;
+        for (std::size_t i = 0; i < index; i++) {
+            offset += layerBlockBytes(layer(i), header().version, dtypeSize(header().dtype));
+        }
+        return bytes() + offset;
+    }
+
+    // Biases of layer `index`, nullptr for version 1 files
+    void* biases(std::size_t index) {
+        if (header().version < 2) {
+            return nullptr;
+        }
+        return static_cast<unsigned char*>(weights(index)) +
+               static_cast<std::size_t>(layer(index).inputs) * layer(index).outputs * dtypeSize(header().dtype);
+    }
+
+private:
+    std::shared_ptr<MappedFile> mapped;
+
+    explicit ModelFile(std::shared_ptr<MappedFile> mapped) : mapped(std::move(mapped)) {}
+
+    unsigned char* bytes() const { return mapped->data(); }
+
+    bool validate(bool verifyChecksum, std::string& error) const {
+        const ModelFileHeader& fileHeader = header();
+        if (std::memcmp(fileHeader.magic, MODEL_FILE_MAGIC, sizeof(fileHeader.magic)) != 0) {
+            error = "not a model file";
+            return false;
+        }
+        if (fileHeader.version < 1 || fileHeader.version > MODEL_FILE_VERSION) {
+            error = "unsupported model file version " + std::to_string(fileHeader.version);
+            return false;
+        }
+        if (dtypeSize(fileHeader.dtype) == 0) {
+            error = "unknown dtype " + std::to_string(fileHeader.dtype);
+            return false;
+        }
+        if (fileHeader.dataOffset != modelDataOffset(fileHeader.layerCount) ||
+            fileHeader.dataOffset + fileHeader.dataBytes != mapped->size()) {
+            error = "truncated or oversized file";
+            return false;
+        }
+        uint64_t expectedBytes = 0;
+        for (std::size_t i = 0; i < fileHeader.layerCount; i++) {
+            expectedBytes += layerBlockBytes(layer(i), fileHeader.version, dtypeSize(fileHeader.dtype));
+        }
+        if (expectedBytes != fileHeader.dataBytes) {
+            error = "layer shapes do not match the data size";
+            return false;
+        }
+        if (verifyChecksum &&
+            fnv1a(bytes() + sizeof(ModelFileHeader), mapped->size() - sizeof(ModelFileHeader)) != fileHeader.checksum) {
+            error = "checksum mismatch";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Model files of the inference-only networks share one layout, little-endian:
+//
+//   PackedFileHeader             64 bytes, the magic naming the format
+//   ModelFileLayer[layerCount]   16 bytes each, as in model files
+//   per layer                    a block in the format's own layout, zero-padded
+//                                to a multiple of 64 bytes
+//
+// Loaders copy every value out of the file, so the checksum is always verified.
+
+struct PackedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layerCount;
+    uint64_t dataBytes;  // Size of everything after the header
+    uint64_t checksum;   // FNV-1a of bytes [sizeof(PackedFileHeader), end of file)
+    uint32_t options;    // Format specific, 0 when unused
+    uint8_t reserved[28];
+};
+static_assert(sizeof(PackedFileHeader) == 64, "packed file header must stay 64 bytes");
+
+// Collects a packed file in memory: the layer table, then each layer's block
+// through append() and endBlock(). write() puts it under a temporary name and
+// renames it over the path, so readers never see a half-written model.
+class PackedFileWriter {
+public:
+    explicit PackedFileWriter(const std::vector<ModelFileLayer>& layers) : layerCount(layers.size()) {
+        append(layers.data(), layers.size() * sizeof(ModelFileLayer));
+        blockStart = data.size();
+    }
+
+    void append(const void* bytes, std::size_t count) {
+        const char* first = static_cast<const char*>(bytes);
+        data.insert(data.end(), first, first + count);
+    }
+
+    // Appends `count` values stored as float32
+    template <typename T>
+    void appendFloats(const T* values, std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            const float stored = static_cast<float>(values[i]);
+            append(&stored, sizeof(stored));
+        }
+    }
+
+    // Zero-pads the current block to a multiple of MODEL_FILE_ALIGNMENT and starts the next
+    void endBlock() {
+        const std::size_t bytes = data.size() - blockStart;
+        data.resize(blockStart + (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT, 0);
+        blockStart = data.size();
+    }
+
+    bool write(const std::string& path, const char (&magic)[8], uint32_t version, uint32_t options,
+               std::string& error) const {
+        PackedFileHeader header = {};
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        header.layerCount = static_cast<uint32_t>(layerCount);
+        header.dataBytes = data.size();
+        header.checksum = fnv1a(data.data(), data.size());
+        header.options = options;
+
+        const std::string temporaryPath = path + ".tmp";
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            error = "unable to open " + temporaryPath;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        file.close();
+        if (!file) {
+            error = "failed to write " + temporaryPath;
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            error = "failed to replace " + path;
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<char> data;
+    std::size_t layerCount;
+    std::size_t blockStart;
+};
+
+// A packed file mapped read-only, with its header, size, checksum and layer
+// chain checked. The blocks are left to the format, which reads them in
+// order with read() and readFloat().
+class PackedFileReader {
+public:
+    // Maps `path`, which must carry `magic` and `version`; `kind` names the
+    // format in errors. Every layer's inputs must be the previous layer's
+    // outputs, since the forward passes size their buffers by them.
+    bool open(const std::string& path, const char (&magic)[8], uint32_t version, const std::string& kind,
+              std::string& error) {
+        mapped = MappedFile::open(path, MappedFile::READ_ONLY, error);
+        if (mapped == nullptr) {
+            return false;
+        }
+        if (mapped->size() < sizeof(fileHeader)) {
+            error = path + " is not a " + kind;
+            return false;
+        }
+        std::memcpy(&fileHeader, mapped->data(), sizeof(fileHeader));
+        if (std::memcmp(fileHeader.magic, magic, sizeof(fileHeader.magic)) != 0) {
+            error = path + " is not a " + kind;
+            return false;
+        }
+        if (fileHeader.version != version) {
+            error = path + ": unsupported " + kind + " version " + std::to_string(fileHeader.version);
+            return false;
+        }
+        const unsigned char* data = mapped->data() + sizeof(fileHeader);
+        if (sizeof(fileHeader) + fileHeader.dataBytes != mapped->size()) {
+            error = path + ": truncated or oversized file";
+            return false;
+        }
+        if (fnv1a(data, fileHeader.dataBytes) != fileHeader.checksum) {
+            error = path + ": checksum mismatch";
+            return false;
+        }
+        const uint64_t tableBytes = static_cast<uint64_t>(fileHeader.layerCount) * sizeof(ModelFileLayer);
+        if (tableBytes > fileHeader.dataBytes) {
+            error = path + ": layer shapes do not match the data size";
+            return false;
+        }
+        fileLayers.resize(fileHeader.layerCount);
+        std::memcpy(fileLayers.data(), data, tableBytes);
+        for (std::size_t l = 1; l < fileLayers.size(); l++) {
+            if (fileLayers[l].inputs != fileLayers[l - 1].outputs) {
+                error = path + ": layer " + std::to_string(l) + " has " + std::to_string(fileLayers[l].inputs) +
+                        " inputs but layer " + std::to_string(l - 1) + " has " +
+                        std::to_string(fileLayers[l - 1].outputs) + " outputs";
+                return false;
+            }
+        }
+        firstBlock = data + tableBytes;
+        blocksBytes = fileHeader.dataBytes - tableBytes;
+        return true;
+    }
+
+    const PackedFileHeader& header() const { return fileHeader; }
+    const std::vector<ModelFileLayer>& layers() const { return fileLayers; }
+    // The layer blocks, dataSize() bytes from the end of the layer table
+    const unsigned char* blocks() const { return firstBlock; }
+    uint64_t dataSize() const { return blocksBytes; }
+
+    // Copies `count` bytes out of the file and advances `current` past them
+    static void read(const unsigned char*& current, void* target, std::size_t count) {
+        std::memcpy(target, current, count);
+        current += count;
+    }
+
+    // Reads a float32 value as T
+    template <typename T>
+    static T readFloat(const unsigned char*& current) {
+        float value;
+        read(current, &value, sizeof(value));
+        return static_cast<T>(value);
+    }
+
+private:
+    std::shared_ptr<MappedFile> mapped;
+    PackedFileHeader fileHeader = {};
+    std::vector<ModelFileLayer> fileLayers;
+    const unsigned char* firstBlock = nullptr;
+    uint64_t blocksBytes = 0;
+};
+
+#endif
@@ -10,25 +10,87 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdlib>
+#include <memory>
+#include <numeric>
+#include "./checkpoint.cpp"
+#include "./convolution.cpp"
+#include "./dataLoader.cpp"
+#include "./fixedNetwork.cpp"
+#include "./modelFile.cpp"
 #include "./progressBar.cpp"
+#include "./random.cpp"
+#include "./telemetry.cpp"
+#include "./tensor.cpp"
+#include "./threadPool.cpp"
 
 class MathUtils {
 public:
-    static double sigmoid(double x) {
-        return 1.0 / (1.0 + exp(-x));
+    template <typename T>
+    static T sigmoid(T x) {
+        return T(1) / (T(1) + std::exp(-x));
     }
-    static double tanh(double x) {
-        return (exp(x) - exp(-x)) / (exp(x) + exp(-x));
+    template <typename T>
+    static T tanh(T x) {
+        return std::tanh(x);
     }
 };
 
-enum ActivationFunction {
-    TANH,
-    SIGMOID,
-    RELU,
-    LINEAR,
-    TANH_DERIVATIVE,
-    SOFTMAX
+// Rows an inference pass runs at a time: a predictBatch() worker's share,
+// and the batch the inference-only networks size their buffers for
+constexpr int INFERENCE_CHUNK_ROWS = 256;
+
+enum ParallelMode {
+    ALL_REDUCE,  // Workers compute gradients on shards of each batch, summed in a fixed order
+    HOGWILD      // Workers train on their own batches and update the shared weights without locks
+};
+
+// A layer of the network. A DENSE layer has `size` outputs, each
+// activation(weights * inputs + bias). The image layers are built with
+// conv2d(), maxPool() and flatten().
+struct LayerConfig {
+    int size;
+    ActivationFunction activation;
+    LayerType type = DENSE;
+    int kernel = 0;    // Window size of CONV2D and MAX_POOL layers
+    int stride = 0;    // 0: 1 for CONV2D, kernel for MAX_POOL
+    int padding = -1;  // -1: kernel / 2 for CONV2D, so odd kernels keep the image size, 0 for MAX_POOL
+};
+
+// `filters` kernel x kernel filters slid over the image, each output being
+// activation(window * filter + bias) for one filter at one position
+inline LayerConfig conv2d(int filters, int kernel, ActivationFunction activation, int stride = 1, int padding = -1) {
+    return {filters, activation, CONV2D, kernel, stride, padding};
+}
+
+// The largest value of each size x size window of every channel, windows
+// `stride` apart (0: size, so that they do not overlap)
+inline LayerConfig maxPool(int size, int stride = 0) {
+    return {0, LINEAR, MAX_POOL, size, stride, 0};
+}
+
+// The image as a plain vector, before the dense layers of a convolutional network
+inline LayerConfig flatten() {
+    return {0, LINEAR, FLATTEN};
+}
+
+// What magnitude pruning removes, see pruneWeights()
+enum PruningGranularity {
+    PRUNE_WEIGHTS,  // Single weights, for SPARSE_CSR storage
+    PRUNE_BLOCKS    // 1 x SPARSE_BLOCK_WIDTH blocks of consecutive outputs, for SPARSE_BLOCKS storage
+};
+
+// Gradual magnitude pruning during train(): every `interval` steps from
+// startStep to endStep the network is pruned to
+// targetSparsity * (1 - (1 - progress)^3), so most weights go early while
+// the rest of the network can still adapt, and the last few go slowly.
+// Validation checkpoints of a network still being pruned neither stop the
+// run nor count as the best weights. targetSparsity 0 disables it.
+struct PruningConfig {
+    double targetSparsity = 0.0;
+    long startStep = 0;
+    long endStep = 0;
+    long interval = 100;
+    PruningGranularity granularity = PRUNE_WEIGHTS;
 };
 
 struct NeuralNetworkConfig {
@@ -37,257 +99,1649 @@ struct NeuralNetworkConfig {
     int outputSize;
     double learningRate;
     ActivationFunction activationFunction;
+    int batchSize = 1;  // Samples per training step; 1 keeps per-sample backpropagation
+    int threads = 1;    // Training threads; 0 uses every hardware thread
+    ParallelMode parallelMode = ALL_REDUCE;
+    // How sigmoid, tanh and softmax are evaluated, see activation.cpp for the error bounds
+    ActivationAccuracy activationAccuracy = ACTIVATION_EXACT;
+    // The first layer skips zero inputs when at most this fraction of a
+    // batch's inputs is nonzero (MNIST pixels are about 19%, and the dense
+    // kernels win above about 30%); 0 disables it
+    double sparseInputDensity = 0.25;
+    // Update rule, and the learning rate of each step relative to learningRate
+    OptimizerConfig optimizer = {};
+    LearningRateSchedule learningRateSchedule = {};
+    // Seeds weight initialization, sampling and dropout; two runs with the same
+    // nonzero seed and settings train bit-identical weights (HOGWILD aside,
+    // whose races depend on scheduling). 0 draws a fresh seed.
+    uint64_t seed = 0;
+    // Progress reporting and the JSON dump of train() runs, see telemetry.cpp
+    TelemetryConfig telemetry = {};
+    // Periodic checkpoints of train() runs for resumeTraining(), see checkpoint.cpp
+    CheckpointConfig checkpoint = {};
+    // Layers after the input, first hidden layer to output layer. When empty the
+    // network has one hiddenSize hidden layer and an outputSize output layer.
+    std::vector<LayerConfig> layers = {};
+    // Channels, height and width of image inputs, stored planar (channel by
+    // channel, as CIFAR stores them); needed by CONV2D and MAX_POOL layers
+    ImageShape inputShape = {};
+    // Gradual magnitude pruning of the dense layers, see PruningConfig
+    PruningConfig pruning = {};
 };
 
+// Input/target pairs, the format every training and scoring entry point takes
+template <typename T>
+using TrainingData = std::vector<std::pair<std::vector<T>, std::vector<T>>>;
+
+struct EvaluationResult {
+    std::size_t samples = 0;
+    double accuracy = 0.0;          // Fraction of samples whose highest output is the label
+    int topK = 1;
+    double topKAccuracy = 0.0;      // Fraction of samples whose label is among the topK highest outputs
+    Matrix<long> confusionMatrix;   // [label][prediction] sample counts
+};
+
+// Feed-forward network, a stack of dense layers (optionally after
+// convolution and pooling layers) computing in T (float or double).
+// `NeuralNetwork network(config, SIGMOID)` deduces double.
+template <typename T = double>
 class NeuralNetwork {
 private:
     int inputSize;
-    int hiddenSize;
     int outputSize;
-    double learningRate;
-    double dropoutRate;
+    T learningRate;
+    T dropoutRate;
     ActivationFunction activationFunction;
+    ActivationAccuracy activationAccuracy;
+    double sparseInputDensity;
+    int batchSize;
+    ImageShape inputShape;
 
-    struct {
-        std::vector<std::vector<double>> inputToHidden;
-        std::vector<std::vector<double>> hiddenToOutput;
-    } weights;
+    // A CONV2D layer runs as a dense layer over the im2col patches of its
+    // window, one row per output position; MAX_POOL and FLATTEN layers have
+    // no parameters.
+    struct Layer {
+        int inputs;         // Values per sample
+        int outputs;
+        ActivationFunction activation;
+        Matrix<T> weights;  // inputs x outputs, CONV2D: patch size x filters, 0 x 0 without parameters
+        Matrix<T> biases;   // 1 x outputs, CONV2D: 1 x filters, 1 x 0 without parameters
+        LayerType type = DENSE;
+        ImageWindow window; // CONV2D and MAX_POOL
+    };
+    std::vector<Layer> layers;
+    // Best weights seen by train(), kept between calls so checkpoints reuse their buffers
+    std::vector<Layer> checkpointLayers;
 
-public:
-    NeuralNetwork(const NeuralNetworkConfig& config, ActivationFunction activationFunction, double dropoutRate = 0.0)
-        : inputSize(config.inputSize), hiddenSize(config.hiddenSize),
-            outputSize(config.outputSize), learningRate(config.learningRate),
-            activationFunction(activationFunction), dropoutRate(dropoutRate) {
+    OptimizerConfig optimizer;
+    LearningRateSchedule learningRateSchedule;
+    // Optimizer steps taken so far; they drive the schedule and Adam's bias correction
+    std::atomic<long> optimizerSteps{0};
+    // Optimizer state of one parameter matrix, in matrices of the same shape:
+    // the velocity for MOMENTUM and NESTEROV, both moments for ADAM and ADAMW
+    struct Moments {
+        Matrix<T> first;
+        Matrix<T> second;
+    };
+    std::vector<Moments> weightMoments;
+    std::vector<Moments> biasMoments;
 
-        // Initialize the weights of the neural network with random values
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<double> dist(0.0, 1.0);
+    // Whether the optimizer keeps `moment` for every parameter: SGD keeps no
+    // state, momentum a velocity and Adam two moments. Layers without
+    // parameters have empty moments either way.
+    bool keepsMoment(Matrix<T> Moments::*moment) const {
+        if (moment == &Moments::first) {
+            return optimizer.type != SGD;
+        }
+        return optimizer.type == ADAM || optimizer.type == ADAMW;
+    }
 
-        weights.inputToHidden = std::vector<std::vector<double>>(inputSize, std::vector<double>(hiddenSize));
-        weights.hiddenToOutput = std::vector<std::vector<double>>(hiddenSize, std::vector<double>(outputSize));
+    PruningConfig pruningConfig;
+    // [l] 1 for the kept weights of layer l and 0 for the pruned ones, empty
+    // for layers that are not pruned
+    std::vector<Matrix<T>> pruningMasks;
 
-        for (int i = 0; i < inputSize; i++) {
-            for (int j = 0; j < hiddenSize; j++) {
-                weights.inputToHidden[i][j] = dist(gen);
+    // Mini-batch buffers, one sample per row, reused across training steps.
+    // Each training thread owns one workspace.
+    struct BatchWorkspace {
+        std::vector<Matrix<T>> activations;     // [0] the inputs, [l + 1] the outputs of layer l after dropout
+        std::vector<Matrix<T>> preActivations;  // [l] weights * inputs + bias of layer l, when its derivative needs them
+        std::vector<Matrix<T>> dropoutMasks;    // [l] 0 or 1 / (1 - dropoutRate) per output of hidden layer l
+        std::vector<Matrix<T>> errors;          // [l] the errors at the pre-activations of layer l
+        std::vector<Matrix<T>> weightGradients;
+        std::vector<Matrix<T>> biasGradients;
+        Matrix<T> targets;
+        Matrix<T> outputs;
+        std::vector<int32_t> uniform24;         // Dropout draws, see applyDropout()
+        SparseRows<T> sparseInputs;             // The first layer's inputs, when sparseInputsPacked
+        bool sparseInputsPacked = false;
+        std::vector<Matrix<T>> patches;         // [l] im2col rows of CONV2D layer l, sample by sample
+        Matrix<T> channelsLastInputs;           // The planar inputs of a first CONV2D layer, channels last
+        Matrix<T> patchErrors;                  // Errors at the patches of the CONV2D layer being backpropagated
+        Matrix<T> transposedWeights;            // Its weights, filters x patch size
+        std::vector<std::vector<int32_t>> poolSources;  // [l] the input of each output of MAX_POOL layer l
+        Xoshiro256 sampler;                     // Stream w + 1 of the network seed for workspace w
+    };
+    std::vector<BatchWorkspace> workspaces;
+    std::vector<std::size_t> sampleIndices;
+    std::unique_ptr<ThreadPool> threadPool;
+    ParallelMode parallelMode;
+    // Keeps the file mapped while the weights are views into it
+    std::shared_ptr<ModelFile> mappedModel;
+    TelemetryConfig telemetryConfig;
+    // Counters of the current or last train() run
+    TrainingTelemetry trainingTelemetry;
+    CheckpointConfig checkpointConfig;
+    // Created by the first train() run with a checkpoint path
+    std::unique_ptr<CheckpointWriter<T>> checkpointWriter;
+    // Where the next train() run starts, set by resumeTraining()
+    struct ResumePoint {
+        bool pending = false;
+        long iteration = 0;
+        double bestValidationLoss = 0.0;
+        bool hasBest = false;
+        long loaderBatch = -1;
+    };
+    ResumePoint resumePoint;
+
+    template <typename From>
+    static void convertWeights(const From* values, Matrix<T>& matrix) {
+        std::transform(values, values + matrix.size(), matrix.data(), [](From value) { return static_cast<T>(value); });
+    }
+
+    std::vector<ModelFileLayer> modelLayers() const {
+        std::vector<ModelFileLayer> fileLayers;
+        for (const Layer& layer : layers) {
+            fileLayers.push_back({static_cast<uint32_t>(layer.weights.rows()),
+                                  static_cast<uint32_t>(layer.weights.cols()), static_cast<uint32_t>(layer.activation),
+                                  packLayerGeometry(layer.type, layer.window)});
+        }
+        return fileLayers;
+    }
+
+    std::array<uint32_t, 3> fileInputShape() const {
+        return {static_cast<uint32_t>(inputShape.channels), static_cast<uint32_t>(inputShape.height),
+                static_cast<uint32_t>(inputShape.width)};
+    }
+
+    Matrix<T>& batchInputs(BatchWorkspace& batch) { return batch.activations[0]; }
+
+    void resizeBatch(BatchWorkspace& batch, int rows) {
+        batch.activations.resize(layers.size() + 1);
+        batch.preActivations.resize(layers.size());
+        batch.dropoutMasks.resize(layers.size());
+        batch.errors.resize(layers.size());
+        batch.activations[0].resize(rows, inputSize);
+        batch.targets.resize(rows, outputSize);
+    }
+
+    // Packs `rows` samples of first-layer inputs into the workspace's sparse
+    // rows when they are sparse enough, see NeuralNetworkConfig::sparseInputDensity
+    void packSparseInputs(const T* inputs, int rows, BatchWorkspace& workspace) {
+        const double limit = sparseInputDensity * rows * inputSize;
+        workspace.sparseInputsPacked =
+            sparseInputDensity > 0 && layers[0].type == DENSE &&
+            workspace.sparseInputs.pack(inputs, rows, inputSize, static_cast<std::size_t>(limit));
+    }
+
+    // Outputs of layer l over `rows` samples. A dense layer computes
+    // activation(inputs * weights + biases), through the sparse kernel for
+    // the first layer when its inputs are packed. A CONV2D layer does the
+    // same on the im2col patches of each sample, which the training pass
+    // (`training`) keeps for the weight gradient; otherwise stride-1 3x3
+    // layers with same padding run the direct kernel, which needs no patches.
+    // MAX_POOL layers record where each output came from for the backward pass.
+    void layerForward(std::size_t l, const T* inputs, int rows, T* outputs, ActivationFunction activation,
+                      BatchWorkspace& workspace, bool training) {
+        const KernelTable<T>& simd = kernels<T>(activationAccuracy);
+        const Layer& layer = layers[l];
+        const ImageWindow& window = layer.window;
+        switch (layer.type) {
+        case CONV2D:
+            if (!training && window.kernel == 3 && window.stride == 1 && window.padding == 1) {
+                for (int r = 0; r < rows; r++) {
+                    simd.conv3x3Forward(inputs + static_cast<std::size_t>(r) * layer.inputs, layer.weights.data(),
+                                        layer.biases.data(), outputs + static_cast<std::size_t>(r) * layer.outputs,
+                                        window.input.height, window.input.width, window.input.channels,
+                                        window.output.channels, window.channelStride(), window.pixelStride(),
+                                        activation);
+                }
+            } else {
+                // Planar images are turned channels last first, so that every
+                // window row is copied in one piece
+                ImageWindow lowered = window;
+                const T* images = inputs;
+                if (window.planarInput) {
+                    workspace.channelsLastInputs.resize(rows, layer.inputs);
+                    for (int r = 0; r < rows; r++) {
+                        planarToChannelsLast(window.input, inputs + static_cast<std::size_t>(r) * layer.inputs,
+                                             workspace.channelsLastInputs.row(r));
+                    }
+                    lowered.planarInput = false;
+                    images = workspace.channelsLastInputs.data();
+                }
+                workspace.patches.resize(layers.size());
+                Matrix<T>& patches = workspace.patches[l];
+                patches.resize(rows * window.positions(), window.patchSize());
+                for (int r = 0; r < rows; r++) {
+                    im2col(lowered, images + static_cast<std::size_t>(r) * layer.inputs,
+                           patches.row(r * window.positions()));
+                }
+                simd.denseForward(patches.data(), layer.weights.data(), layer.biases.data(), outputs, patches.rows(),
+                                  patches.cols(), window.output.channels, activation);
             }
+            break;
+        case MAX_POOL: {
+            workspace.poolSources.resize(layers.size());
+            std::vector<int32_t>& sources = workspace.poolSources[l];
+            sources.resize(static_cast<std::size_t>(rows) * layer.outputs);
+            for (int r = 0; r < rows; r++) {
+                maxPoolForward(window, inputs + static_cast<std::size_t>(r) * layer.inputs,
+                               outputs + static_cast<std::size_t>(r) * layer.outputs,
+                               sources.data() + static_cast<std::size_t>(r) * layer.outputs);
+            }
+            break;
         }
+        case FLATTEN:
+            std::copy(inputs, inputs + static_cast<std::size_t>(rows) * layer.inputs, outputs);
+            break;
+        default:
+            if (l == 0 && workspace.sparseInputsPacked) {
+                const SparseRows<T>& sparse = workspace.sparseInputs;
+                simd.sparseDenseForward(sparse.rowStarts.data(), sparse.indices.data(), sparse.values.data(),
+                                        layer.weights.data(), layer.biases.data(), outputs, rows, layer.outputs,
+                                        activation);
+            } else {
+                simd.denseForward(inputs, layer.weights.data(), layer.biases.data(), outputs, rows, layer.inputs,
+                                  layer.outputs, activation);
+            }
+        }
+    }
 
-        for (int i = 0; i < hiddenSize; i++) {
-            for (int j = 0; j < outputSize; j++) {
-                weights.hiddenToOutput[i][j] = dist(gen);
+    // c += scale * (layer l inputs)^T * errors, skipping zero first-layer
+    // inputs when packed. The inputs of a CONV2D layer are its patches, and
+    // its errors have one row of filters per patch.
+    void accumulateWeightErrors(BatchWorkspace& batch, std::size_t l, Matrix<T>& c, T scale) {
+        if (layers[l].type == CONV2D) {
+            const Matrix<T>& patches = batch.patches[l];
+            kernels<T>().gemmTransposedAAccumulate(patches.data(), batch.errors[l].data(), c.data(), patches.rows(),
+                                                   patches.cols(), c.cols(), scale);
+        } else if (layers[l].type != DENSE) {
+            return;
+        } else if (l == 0 && batch.sparseInputsPacked) {
+            gemmTransposedAAccumulate(batch.sparseInputs, batch.errors[0], c, scale);
+        } else {
+            gemmTransposedAAccumulate(batch.activations[l], batch.errors[l], c, scale);
+        }
+    }
+
+    // Dropout applies to the outputs of the hidden layers that have parameters
+    bool hasDropout(std::size_t l) const {
+        return dropoutRate > 0 && l + 1 < layers.size() && (layers[l].type == DENSE || layers[l].type == CONV2D);
+    }
+
+    // Derivatives that cannot be computed from the layer outputs alone
+    static bool needsPreActivations(ActivationFunction activation) { return activation == TANH_DERIVATIVE; }
+
+    // Training forward pass over the packed batch. Caches what the backward
+    // pass needs: every layer's outputs, the pre-activations of the layers
+    // that need them, and the dropout mask of every hidden layer.
+    void forwardPass(BatchWorkspace& batch) {
+        const KernelTable<T>& simd = kernels<T>(activationAccuracy);
+        const int rows = batchInputs(batch).rows();
+        packSparseInputs(batchInputs(batch).data(), rows, batch);
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            Matrix<T>& outputs = batch.activations[l + 1];
+            outputs.resize(rows, layer.outputs);
+            if (needsPreActivations(layer.activation)) {
+                Matrix<T>& preActivations = batch.preActivations[l];
+                preActivations.resize(rows, layer.outputs);
+                layerForward(l, batch.activations[l].data(), rows, preActivations.data(), LINEAR, batch, true);
+                std::copy(preActivations.data(), preActivations.data() + outputs.size(), outputs.data());
+                simd.tanh(outputs.data(), static_cast<int>(outputs.size()));
+                for (std::size_t i = 0; i < outputs.size(); i++) {
+                    outputs.data()[i] = T(1) - outputs.data()[i] * outputs.data()[i];
+                }
+            } else {
+                layerForward(l, batch.activations[l].data(), rows, outputs.data(), layer.activation, batch, true);
+            }
+
+            if (hasDropout(l)) {
+                Matrix<T>& mask = batch.dropoutMasks[l];
+                mask.resize(rows, layer.outputs);
+                applyDropout(batch, outputs.data(), mask.data(), static_cast<int>(outputs.size()));
             }
         }
     }
 
-    double activate(double x) {
-        switch (activationFunction) {
+    // Inverted dropout over `count` outputs: each is kept with probability
+    // 1 - dropoutRate and scaled by 1 / (1 - dropoutRate), the factor applied
+    // (or 0) going to `mask`. The uniforms are drawn in bulk, two per
+    // generator call, and compared and applied by the vectorized kernel.
+    void applyDropout(BatchWorkspace& workspace, T* outputs, T* mask, int count) {
+        workspace.uniform24.resize(count);
+        workspace.sampler.fill24(workspace.uniform24.data(), count);
+        const T keepThreshold = (T(1) - dropoutRate) * T(1 << 24);
+        kernels<T>().dropout(outputs, mask, workspace.uniform24.data(), count, keepThreshold,
+                             T(1) / (T(1) - dropoutRate));
+    }
+
+    // Turns the errors at a layer's outputs into errors at its
+    // pre-activations, multiplying by the derivative of `activation`. The
+    // derivatives are written in terms of the outputs y, each read as
+    // outputs[i] * outputScale (undoing the dropout scaling of kept units;
+    // dropped units already have zero error). A hidden SOFTMAX layer is
+    // treated as linear.
+    static void applyActivationDerivative(ActivationFunction activation, const T* outputs, const T* preActivations,
+                                          T outputScale, T* errors, std::size_t count) {
+        switch (activation) {
         case SIGMOID:
-            return MathUtils::sigmoid(x);
+            for (std::size_t i = 0; i < count; i++) {
+                const T y = outputs[i] * outputScale;
+                errors[i] *= y * (T(1) - y);
+            }
+            break;
         case TANH:
-            return MathUtils::tanh(x);
+            for (std::size_t i = 0; i < count; i++) {
+                const T y = outputs[i] * outputScale;
+                errors[i] *= T(1) - y * y;
+            }
+            break;
         case RELU:
-            return std::max(0.0, x);  // ReLU activation function
-        case LINEAR:
-            return x;  // Linear activation function
+            for (std::size_t i = 0; i < count; i++) {
+                errors[i] = outputs[i] > T(0) ? errors[i] : T(0);
+            }
+            break;
         case TANH_DERIVATIVE:
-            return 1.0 - MathUtils::tanh(x) * MathUtils::tanh(x);  // Derivative of tanh
-        case SOFTMAX:
-            // Softmax will be applied during the feedforward step
-            return x;
+            // d/dz (1 - tanh(z)^2) = -2 tanh(z) (1 - tanh(z)^2)
+            for (std::size_t i = 0; i < count; i++) {
+                const T value = MathUtils::tanh(preActivations[i]);
+                errors[i] *= T(-2) * value * (T(1) - value * value);
+            }
+            break;
         default:
-            return MathUtils::tanh(x);
+            break;
+        }
+    }
+
+    // Errors at the inputs of layer l, which are the outputs of layer l - 1,
+    // from the errors at its pre-activations. A CONV2D layer spreads the
+    // errors of each patch back over the image (col2im), summing where
+    // windows overlap; a MAX_POOL layer hands each error to the input its
+    // window picked.
+    void propagateErrors(BatchWorkspace& batch, std::size_t l, Matrix<T>& inputErrors) {
+        const Layer& layer = layers[l];
+        const Matrix<T>& errors = batch.errors[l];
+        const int rows = errors.rows();
+        switch (layer.type) {
+        case CONV2D: {
+            // errors * weights^T through the blocked GEMM: its inner dimension,
+            // the filter count, is too short for gemmTransposedB's dot products
+            const ImageWindow& window = layer.window;
+            const Matrix<T>& weights = layer.weights;
+            Matrix<T>& transposed = batch.transposedWeights;
+            transposed.resize(weights.cols(), weights.rows());
+            for (int i = 0; i < weights.rows(); i++) {
+                for (int j = 0; j < weights.cols(); j++) {
+                    transposed(j, i) = weights(i, j);
+                }
+            }
+            Matrix<T>& patchErrors = batch.patchErrors;
+            patchErrors.resize(rows * window.positions(), window.patchSize());
+            kernels<T>().gemm(errors.data(), transposed.data(), patchErrors.data(), patchErrors.rows(),
+                              transposed.rows(), transposed.cols());
+            inputErrors.resize(rows, layer.inputs);
+            inputErrors.fill(T(0));
+            for (int r = 0; r < rows; r++) {
+                col2imAdd(window, patchErrors.row(r * window.positions()), inputErrors.row(r));
+            }
+            break;
+        }
+        case MAX_POOL: {
+            const int32_t* sources = batch.poolSources[l].data();
+            inputErrors.resize(rows, layer.inputs);
+            inputErrors.fill(T(0));
+            for (int r = 0; r < rows; r++) {
+                maxPoolBackward(layer.window, errors.row(r), sources + static_cast<std::size_t>(r) * layer.outputs,
+                                inputErrors.row(r));
+            }
+            break;
+        }
+        case FLATTEN:
+            inputErrors.resize(rows, layer.inputs);
+            std::copy(errors.data(), errors.data() + errors.size(), inputErrors.data());
+            break;
+        default:
+            gemmTransposedB(errors, layer.weights, inputErrors);
         }
     }
 
-    std::vector<double> feedforward(const std::vector<double>& inputs, bool isTraining = true) {
-        std::vector<double> hiddenOutputs(hiddenSize, 0.0);
+    // Errors at every layer's pre-activations, from the last layer back to
+    // the first, from the values cached by forwardPass(). The output errors
+    // are the gradient of the squared error, except for SIGMOID and SOFTMAX
+    // output layers: they are trained on the cross-entropy, whose gradient at
+    // the pre-activations is exactly target - output.
+    void backwardPass(BatchWorkspace& batch) {
+        const int rows = batchInputs(batch).rows();
+        const std::size_t last = layers.size() - 1;
+        Matrix<T>& outputErrors = batch.errors[last];
+        const Matrix<T>& outputs = batch.activations.back();
+        outputErrors.resize(rows, outputSize);
+        for (std::size_t i = 0; i < outputErrors.size(); i++) {
+            outputErrors.data()[i] = batch.targets.data()[i] - outputs.data()[i];
+        }
+        if (trainingTelemetry.recording()) {
+            const int count = static_cast<int>(outputErrors.size());
+            trainingTelemetry.addSamples(rows, kernels<T>().dot(outputErrors.data(), outputErrors.data(), count),
+                                         outputSize);
+        }
+        if (layers[last].activation != SOFTMAX && layers[last].activation != SIGMOID) {
+            applyActivationDerivative(layers[last].activation, outputs.data(), batch.preActivations[last].data(), T(1),
+                                      outputErrors.data(), outputErrors.size());
+        }
 
-        // Calculate the outputs of the hidden layer
-        for (int i = 0; i < hiddenSize; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < inputSize; j++) {
-                sum += inputs[j] * weights.inputToHidden[j][i];
+        for (std::size_t l = last; l > 0; l--) {
+            Matrix<T>& errors = batch.errors[l - 1];
+            propagateErrors(batch, l, errors);
+            T outputScale = T(1);
+            if (hasDropout(l - 1)) {
+                const T* mask = batch.dropoutMasks[l - 1].data();
+                for (std::size_t i = 0; i < errors.size(); i++) {
+                    errors.data()[i] *= mask[i];
+                }
+                outputScale = T(1) - dropoutRate;
             }
-            hiddenOutputs[i] = activate(sum);
+            applyActivationDerivative(layers[l - 1].activation, batch.activations[l].data(),
+                                      batch.preActivations[l - 1].data(), outputScale, errors.data(), errors.size());
+        }
+    }
 
-            // Apply dropout during training
-            if (isTraining && dropoutRate > 0.0) {
-                if (static_cast<double>(rand()) / RAND_MAX < dropoutRate) {
-                    hiddenOutputs[i] = 0.0;
-                } else {
-                    hiddenOutputs[i] /= (1.0 - dropoutRate);
+    void computeBatchErrors(BatchWorkspace& batch) {
+        {
+            PhaseTimer timer(trainingTelemetry, PHASE_FORWARD);
+            forwardPass(batch);
+        }
+        PhaseTimer timer(trainingTelemetry, PHASE_BACKWARD);
+        backwardPass(batch);
+    }
+
+    // bias += scale * column sums of errors, read as rows of one error per
+    // bias (a CONV2D layer's errors have a row per output position)
+    static void accumulateBiasErrors(const Matrix<T>& errors, Matrix<T>& biases, T scale) {
+        const KernelTable<T>& simd = kernels<T>();
+        const int cols = biases.cols();
+        const std::size_t rows = cols > 0 ? errors.size() / cols : 0;
+        for (std::size_t r = 0; r < rows; r++) {
+            simd.axpy(scale, errors.data() + r * cols, biases.data(), cols);
+        }
+    }
+
+    // Scalars of optimizer step `step` for the weights, whose gradients are
+    // gradientScale times the summed errors. The biases use the same ones
+    // without weight decay, see biasUpdate().
+    ParameterUpdate<T> parameterUpdate(long step, T gradientScale) const {
+        const double rate = learningRateSchedule.rate(static_cast<double>(learningRate), step);
+        ParameterUpdate<T> update;
+        update.gradientScale = gradientScale;
+        update.learningRate = static_cast<T>(rate);
+        update.momentum = static_cast<T>(optimizer.momentum);
+        update.nesterov = optimizer.type == NESTEROV;
+        update.beta1 = static_cast<T>(optimizer.beta1);
+        update.beta2 = static_cast<T>(optimizer.beta2);
+        update.epsilon = static_cast<T>(optimizer.epsilon);
+        update.firstCorrection = static_cast<T>(1.0 / (1.0 - std::pow(optimizer.beta1, static_cast<double>(step + 1))));
+        update.secondCorrection = static_cast<T>(1.0 / (1.0 - std::pow(optimizer.beta2, static_cast<double>(step + 1))));
+        if (optimizer.type == ADAMW) {
+            update.decay = static_cast<T>(rate * optimizer.weightDecay);
+        } else {
+            update.l2Penalty = static_cast<T>(optimizer.weightDecay);
+        }
+        return update;
+    }
+
+    static ParameterUpdate<T> biasUpdate(ParameterUpdate<T> update) {
+        update.l2Penalty = T(0);
+        update.decay = T(0);
+        return update;
+    }
+
+    // Applies the optimizer step to the `count` parameters starting at
+    // `offset` in one parameter matrix, from the gradients and moments at the
+    // same positions
+    void updateParameters(Matrix<T>& parameters, const Matrix<T>& gradients, Moments& moments, std::size_t offset,
+                          int count, const ParameterUpdate<T>& update) {
+        const KernelTable<T>& simd = kernels<T>();
+        T* values = parameters.data() + offset;
+        const T* gradient = gradients.data() + offset;
+        switch (optimizer.type) {
+        case MOMENTUM:
+        case NESTEROV:
+            simd.momentumUpdate(values, gradient, moments.first.data() + offset, count, update);
+            break;
+        case ADAM:
+        case ADAMW:
+            simd.adamUpdate(values, gradient, moments.first.data() + offset, moments.second.data() + offset, count,
+                            update);
+            break;
+        default:
+            if (update.l2Penalty != T(0)) {
+                simd.axpy(-update.learningRate * update.l2Penalty, values, values, count);
+            }
+            simd.axpy(update.learningRate * update.gradientScale, gradient, values, count);
+        }
+    }
+
+    // Sums every layer's gradient over the batch into the workspace's gradient buffers
+    void computeGradients(BatchWorkspace& batch) {
+        PhaseTimer timer(trainingTelemetry, PHASE_BACKWARD);
+        batch.weightGradients.resize(layers.size());
+        batch.biasGradients.resize(layers.size());
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            batch.weightGradients[l].resize(layers[l].weights.rows(), layers[l].weights.cols());
+            batch.biasGradients[l].resize(1, layers[l].biases.cols());
+            batch.weightGradients[l].fill(T(0));
+            batch.biasGradients[l].fill(T(0));
+            accumulateWeightErrors(batch, l, batch.weightGradients[l], T(1));
+            accumulateBiasErrors(batch.errors[l], batch.biasGradients[l], T(1));
+        }
+    }
+
+    // One optimizer step with the gradient averaged over the batch. Plain SGD
+    // folds the gradient straight into the weights; the other rules go
+    // through the workspace's gradient buffers.
+    void applyBatchErrors(BatchWorkspace& batch) {
+        const ParameterUpdate<T> update = parameterUpdate(optimizerSteps++, T(1) / batchInputs(batch).rows());
+        if (optimizer.type == SGD) {
+            PhaseTimer timer(trainingTelemetry, PHASE_UPDATE);
+            const KernelTable<T>& simd = kernels<T>();
+            const T scale = update.learningRate * update.gradientScale;
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                Matrix<T>& weights = layers[l].weights;
+                if (update.l2Penalty != T(0)) {
+                    simd.axpy(-update.learningRate * update.l2Penalty, weights.data(), weights.data(),
+                              static_cast<int>(weights.size()));
                 }
+                accumulateWeightErrors(batch, l, weights, scale);
+                accumulateBiasErrors(batch.errors[l], layers[l].biases, scale);
+            }
+            maskPrunedWeights();
+            return;
+        }
+        computeGradients(batch);
+        PhaseTimer timer(trainingTelemetry, PHASE_UPDATE);
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            updateParameters(layers[l].weights, batch.weightGradients[l], weightMoments[l], 0,
+                             static_cast<int>(layers[l].weights.size()), update);
+            updateParameters(layers[l].biases, batch.biasGradients[l], biasMoments[l], 0,
+                             static_cast<int>(layers[l].biases.size()), biasUpdate(update));
+        }
+        maskPrunedWeights();
+    }
+
+    // Zeroes the weights pruneWeights() removed again after an optimizer step
+    void maskPrunedWeights() {
+        for (std::size_t l = 0; l < pruningMasks.size(); l++) {
+            const T* mask = pruningMasks[l].data();
+            T* weights = layers[l].weights.data();
+            for (std::size_t i = 0; i < pruningMasks[l].size(); i++) {
+                weights[i] *= mask[i];
+            }
+        }
+    }
+
+    // Sparsity the gradual pruning schedule has reached at `step`
+    double scheduledSparsity(long step) const {
+        if (step < pruningConfig.startStep) {
+            return 0.0;
+        }
+        double progress = 1.0;
+        if (pruningConfig.endStep > pruningConfig.startStep) {
+            progress = std::min(1.0, static_cast<double>(step - pruningConfig.startStep) /
+                                         (pruningConfig.endStep - pruningConfig.startStep));
+        }
+        return pruningConfig.targetSparsity * (1.0 - std::pow(1.0 - progress, 3));
+    }
+
+    void trainPackedBatch(BatchWorkspace& batch) {
+        computeBatchErrors(batch);
+        applyBatchErrors(batch);
+    }
+
+    void packSample(BatchWorkspace& batch, int row, const std::vector<T>& inputs, const std::vector<T>& targets) {
+        std::copy(inputs.begin(), inputs.begin() + inputSize, batchInputs(batch).row(row));
+        std::copy(targets.begin(), targets.begin() + outputSize, batch.targets.row(row));
+    }
+
+    void packRandomBatch(BatchWorkspace& batch, int samples,
+                         const TrainingData<T>& trainingData) {
+        PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+        resizeBatch(batch, samples);
+        for (int s = 0; s < samples; s++) {
+            const auto& [inputs, targets] = trainingData[batch.sampler.below(trainingData.size())];
+            packSample(batch, s, inputs, targets);
+        }
+    }
+
+    // One synchronous data-parallel step over `samples` samples: every worker
+    // packs its shard with packShard(shard, first, last) and computes its
+    // gradient, then the shards are summed in worker order, so results do not
+    // depend on scheduling, and the optimizer step is applied to the sum.
+    template <typename PackShard>
+    void trainAllReduceStep(int samples, PackShard packShard) {
+        const int shards = std::min(threadPool->size(), samples);
+        threadPool->run(shards, [&](int worker) {
+            BatchWorkspace& shard = workspaces[worker];
+            const int first = worker * samples / shards;
+            const int last = (worker + 1) * samples / shards;
+            {
+                PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+                resizeBatch(shard, last - first);
+                packShard(shard, first, last);
+            }
+            computeBatchErrors(shard);
+            computeGradients(shard);
+        });
+
+        const ParameterUpdate<T> update = parameterUpdate(optimizerSteps++, T(1) / samples);
+        const KernelTable<T>& simd = kernels<T>();
+        // Each worker sums the same slice of rows of every gradient into the
+        // first shard's buffers, then updates those rows of the parameters
+        auto reduceRows = [&](Matrix<T>& target, std::vector<Matrix<T>> BatchWorkspace::*gradients, Moments& moments,
+                              std::size_t l, int worker, const ParameterUpdate<T>& rowUpdate) {
+            const int first = worker * target.rows() / shards;
+            const int last = (worker + 1) * target.rows() / shards;
+            const int count = (last - first) * target.cols();
+            Matrix<T>& sum = (workspaces[0].*gradients)[l];
+            for (int k = 1; k < shards; k++) {
+                const Matrix<T>& source = (workspaces[k].*gradients)[l];
+                simd.axpy(T(1), source.row(first), sum.row(first), count);
+            }
+            updateParameters(target, sum, moments, static_cast<std::size_t>(first) * target.cols(), count, rowUpdate);
+        };
+        threadPool->run(shards, [&](int worker) {
+            PhaseTimer timer(trainingTelemetry, PHASE_UPDATE);
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                reduceRows(layers[l].weights, &BatchWorkspace::weightGradients, weightMoments[l], l, worker, update);
+                reduceRows(layers[l].biases, &BatchWorkspace::biasGradients, biasMoments[l], l, worker,
+                           biasUpdate(update));
             }
+        });
+        maskPrunedWeights();
+    }
+
+    // All-reduce step on batchSize samples drawn from trainingData on the calling thread
+    void trainAllReduceStep(const TrainingData<T>& trainingData) {
+        sampleIndices.resize(batchSize);
+        for (std::size_t& index : sampleIndices) {
+            index = workspaces[0].sampler.below(trainingData.size());
+        }
+        trainAllReduceStep(batchSize, [&](BatchWorkspace& shard, int first, int last) {
+            for (int s = first; s < last; s++) {
+                const auto& [inputs, targets] = trainingData[sampleIndices[s]];
+                packSample(shard, s - first, inputs, targets);
+            }
+        });
+    }
+
+    // Copies rows [first, last) of a loader batch into the workspace
+    void packLoaderRows(BatchWorkspace& batch, const DataBatch<T>& samples, int first, int last) {
+        std::copy(samples.inputs.row(first), samples.inputs.row(first) + (last - first) * inputSize,
+                  batchInputs(batch).data());
+        std::copy(samples.targets.row(first), samples.targets.row(first) + (last - first) * outputSize,
+                  batch.targets.data());
+    }
+
+    // Copies the training state into `snapshot`, reusing its matrices from the
+    // previous checkpoint; the in-memory copy is all the trainer waits for
+    void fillSnapshot(TrainingSnapshot<T>& snapshot, long iteration, long total, double bestValidationLoss,
+                      bool hasBest, long loaderBatch) {
+        CheckpointHeader& header = snapshot.header;
+        header.optimizerType = static_cast<uint32_t>(optimizer.type);
+        header.iteration = iteration;
+        header.totalIterations = total;
+        header.optimizerSteps = optimizerSteps.load();
+        header.loaderBatch = loaderBatch;
+        header.bestValidationLoss = bestValidationLoss;
+        header.hasBest = hasBest ? 1 : 0;
+        snapshot.layers = modelLayers();
+
+        snapshot.generators.resize(workspaces.size() * 4);
+        for (std::size_t w = 0; w < workspaces.size(); w++) {
+            workspaces[w].sampler.getState(&snapshot.generators[w * 4]);
         }
 
-        std::vector<double> outputs(outputSize, 0.0);
+        std::size_t count = 0;
+        auto add = [&](const Matrix<T>& matrix) {
+            if (count == snapshot.matrices.size()) {
+                snapshot.matrices.emplace_back();
+            }
+            snapshot.matrices[count++] = matrix;
+        };
+        for (const Layer& layer : layers) {
+            add(layer.weights);
+            add(layer.biases);
+        }
+        for (auto moment : {&Moments::first, &Moments::second}) {
+            if (keepsMoment(moment)) {
+                for (std::size_t l = 0; l < layers.size(); l++) {
+                    add(weightMoments[l].*moment);
+                    add(biasMoments[l].*moment);
+                }
+            }
+        }
+        if (hasBest) {
+            for (const Layer& layer : checkpointLayers) {
+                add(layer.weights);
+                add(layer.biases);
+            }
+        }
+        snapshot.matrices.resize(count);
+    }
 
-        // Calculate the outputs of the output layer
-        for (int i = 0; i < outputSize; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < hiddenSize; j++) {
-                sum += hiddenOutputs[j] * weights.hiddenToOutput[j][i];
+    // Trains until numberOfIterations steps have run, checking the validation
+    // loss every checkpointInterval steps and stopping once it stops
+    // improving; the best weights seen are restored at the end. step(limit)
+    // runs at least one and at most `limit` steps and returns how many it ran.
+    // With a checkpoint path the state is also saved every checkpoint.interval
+    // steps and when the run ends; `loader` is the DataLoader the steps draw
+    // from, if any, whose position is saved with it.
+    template <typename Step>
+    void runTraining(const TrainingData<T>& validationData, long numberOfIterations, int checkpointInterval,
+                     DataLoader<T>* loader, Step step) {
+        double bestValidationLoss = std::numeric_limits<double>::max();
+        bool hasCheckpoint = false;
+        long first = 0;
+        if (resumePoint.pending) {
+            resumePoint.pending = false;
+            first = resumePoint.iteration;
+            bestValidationLoss = resumePoint.bestValidationLoss;
+            hasCheckpoint = resumePoint.hasBest;
+            if (loader != nullptr && resumePoint.loaderBatch >= 0) {
+                loader->seek(resumePoint.loaderBatch);
             }
-            outputs[i] = activate(sum);
         }
+        if (!checkpointConfig.path.empty() &&
+            (!checkpointWriter || checkpointWriter->filePath() != checkpointConfig.path)) {
+            checkpointWriter = std::make_unique<CheckpointWriter<T>>(checkpointConfig.path);
+        }
+        CheckpointWriter<T>* writer = checkpointConfig.path.empty() ? nullptr : checkpointWriter.get();
+        const long saveInterval = std::max(1L, checkpointConfig.interval);
+        const bool pruning = pruningConfig.targetSparsity > 0.0;
+        const long pruneInterval = std::max(1L, pruningConfig.interval);
+        // Checkpoints do not keep the masks; the pruned weights are the zeros,
+        // which pruning to the same sparsity picks again
+        if (pruning && first > pruningConfig.startStep) {
+            pruneWeights(scheduledSparsity(std::min(first, pruningConfig.endStep)), pruningConfig.granularity);
+        }
+        auto saveCheckpoint = [&](long iteration) {
+            {
+                PhaseTimer timer(trainingTelemetry, PHASE_CHECKPOINT);
+                fillSnapshot(writer->acquire(), iteration, numberOfIterations, bestValidationLoss, hasCheckpoint,
+                             loader != nullptr ? loader->batchesServed() : -1);
+            }
+            writer->submit();
+        };
+
+        trainingTelemetry.start(numberOfIterations - first, checkpointInterval, telemetryConfig.phaseTimers);
+        ProgressBar progressBar(numberOfIterations - first, trainingTelemetry, telemetryConfig);
+        long i = first;
+        bool stopped = false;
+        while (i < numberOfIterations) {
+            long limit = std::min(numberOfIterations - i, checkpointInterval - i % checkpointInterval);
+            if (writer != nullptr) {
+                limit = std::min(limit, saveInterval - i % saveInterval);
+            }
+            if (pruning && i < pruningConfig.endStep) {
+                limit = std::min({limit, pruneInterval - i % pruneInterval, pruningConfig.endStep - i});
+            }
+            const long steps = step(limit);
+            i += steps;
+            trainingTelemetry.setSteps(i);
+            progressBar.update(steps);
+
+            // Weights from before a pruning step are no longer candidates for the best
+            if (pruning && i > pruningConfig.startStep && i <= pruningConfig.endStep &&
+                (i % pruneInterval == 0 || i == pruningConfig.endStep)) {
+                pruneWeights(scheduledSparsity(i), pruningConfig.granularity);
+                bestValidationLoss = std::numeric_limits<double>::max();
+                hasCheckpoint = false;
+            }
 
-        // Apply softmax activation for the output layer
-        if (activationFunction == ActivationFunction::SOFTMAX) {
-            double expSum = 0.0;
-            for (int i = 0; i < outputSize; i++) {
-                expSum += exp(outputs[i]);
+            // Evaluate on validation set periodically and save checkpoints
+            if (i % checkpointInterval == 0) {
+                double validationLoss;
+                {
+                    PhaseTimer timer(trainingTelemetry, PHASE_VALIDATION);
+                    validationLoss = calculateLoss(validationData);
+                }
+                trainingTelemetry.addLoss(validationLoss);
+                if (validationLoss < bestValidationLoss) {
+                    bestValidationLoss = validationLoss;
+                    // Copy-assigning reuses the checkpoint's storage from the previous checkpoint
+                    checkpointLayers = layers;
+                    hasCheckpoint = true;
+                } else if (!pruning || i >= pruningConfig.endStep) {
+                    // If the validation loss has not improved, stop training
+                    stopped = true;
+                    break;
+                }
+            }
+            if (writer != nullptr && i % saveInterval == 0 && i < numberOfIterations) {
+                saveCheckpoint(i);
             }
+        }
 
-            for (int i = 0; i < outputSize; i++) {
-                outputs[i] = exp(outputs[i]) / expSum;
+        // The last checkpoint marks the run complete, so that resuming it only restores the best weights
+        if (writer != nullptr) {
+            saveCheckpoint(stopped ? numberOfIterations : i);
+        }
+        // Restore best weights
+        if (hasCheckpoint) {
+            layers = checkpointLayers;
+        }
+        trainingTelemetry.finish();
+        progressBar.finish();
+        std::string checkpointError;
+        if (writer != nullptr && !writer->flush(&checkpointError)) {
+            std::cerr << "Unable to write checkpoint: " << checkpointError << std::endl;
+        }
+        if (!telemetryConfig.jsonPath.empty()) {
+            std::ofstream file(telemetryConfig.jsonPath);
+            if (file) {
+                trainingTelemetry.writeJson(file);
+            } else {
+                std::cerr << "Unable to write telemetry to " << telemetryConfig.jsonPath << std::endl;
             }
         }
+    }
 
-        return outputs;
+    // Calls task(worker) once per training thread, on the pool when there is one
+    template <typename Task>
+    void runOnWorkers(Task task) {
+        if (threadPool) {
+            threadPool->run(threadPool->size(), task);
+        } else {
+            task(0);
+        }
     }
 
-    void backpropagation(const std::vector<double>& inputs, const std::vector<double>& targets) {
-        std::vector<double> hiddenOutputs(hiddenSize, 0.0);
-        std::vector<double> outputs(outputSize, 0.0);
+    // Inference forward pass over `rows` packed samples, writing `rows` x outputSize values
+    void forwardRows(const T* inputs, int rows, T* outputs, BatchWorkspace& workspace) {
+        workspace.activations.resize(layers.size() + 1);
+        packSparseInputs(inputs, rows, workspace);
+        const T* layerInputs = inputs;
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            T* layerOutputs = outputs;
+            if (l + 1 < layers.size()) {
+                workspace.activations[l + 1].resize(rows, layer.outputs);
+                layerOutputs = workspace.activations[l + 1].data();
+            }
+            layerForward(l, layerInputs, rows, layerOutputs, layer.activation, workspace, false);
+            layerInputs = layerOutputs;
+        }
+    }
 
-        // Calculate the outputs of the hidden layer and the final output
-        for (int i = 0; i < hiddenSize; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < inputSize; j++) {
-                sum += inputs[j] * weights.inputToHidden[j][i];
+    // Hogwild: every worker runs its share of the iterations on its own random
+    // batches and adds its updates straight into the shared weights. Updates
+    // from different threads may interleave and occasionally overwrite each
+    // other; with small learning rates that costs little accuracy, and the
+    // workers never wait on each other. Optimizer moments are shared the same way.
+    void trainHogwild(const TrainingData<T>& trainingData, long iterations) {
+        const int threads = threadPool->size();
+        threadPool->run(threads, [&](int worker) {
+            BatchWorkspace& batch = workspaces[worker];
+            for (long i = worker; i < iterations; i += threads) {
+                packRandomBatch(batch, batchSize, trainingData);
+                trainPackedBatch(batch);
             }
-            hiddenOutputs[i] = activate(sum);
+        });
+    }
+
+public:
+    // Builds the layers listed in config.layers, or when there are none a
+    // hiddenSize hidden layer and an outputSize output layer both using
+    // `activationFunction` (with SOFTMAX, a linear hidden layer and a softmax
+    // output layer). Weights start Glorot uniform (He uniform for RELU layers)
+    // and biases at zero. CONV2D and MAX_POOL layers need config.inputShape
+    // (for the first) or an image layer before them.
+    NeuralNetwork(const NeuralNetworkConfig& config, ActivationFunction activationFunction, double dropoutRate = 0.0)
+        : inputSize(config.inputSize), outputSize(0), learningRate(config.learningRate),
+            dropoutRate(dropoutRate), activationFunction(activationFunction),
+            activationAccuracy(config.activationAccuracy), sparseInputDensity(config.sparseInputDensity),
+            batchSize(std::max(1, config.batchSize)), inputShape(config.inputShape), optimizer(config.optimizer),
+            learningRateSchedule(config.learningRateSchedule), pruningConfig(config.pruning),
+            parallelMode(config.parallelMode), telemetryConfig(config.telemetry), checkpointConfig(config.checkpoint) {
+
+        // Stream 0 of the seed initializes the weights, stream w + 1 drives workspace w
+        uint64_t seed = config.seed;
+        if (seed == 0) {
+            std::random_device rd;
+            seed = (static_cast<uint64_t>(rd()) << 32) | rd();
         }
+        Xoshiro256 gen(seed, 0);
 
-        for (int i = 0; i < outputSize; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < hiddenSize; j++) {
-                sum += hiddenOutputs[j] * weights.hiddenToOutput[j][i];
+        int threads = config.threads > 0 ? config.threads : static_cast<int>(std::thread::hardware_concurrency());
+        threads = std::max(1, threads);
+        workspaces.resize(threads);
+        for (std::size_t w = 0; w < workspaces.size(); w++) {
+            workspaces[w].sampler.seed(seed, w + 1);
+        }
+        if (threads > 1) {
+            threadPool = std::make_unique<ThreadPool>(threads);
+        }
+
+        std::vector<LayerConfig> layerConfigs = config.layers;
+        if (layerConfigs.empty()) {
+            const ActivationFunction hiddenActivation = activationFunction == SOFTMAX ? LINEAR : activationFunction;
+            layerConfigs = {{config.hiddenSize, hiddenActivation}, {config.outputSize, activationFunction}};
+        }
+
+        // Image layers would walk inputShape.size() values of each row of
+        // inputSize, so a shape that does not fit is dropped and they degrade
+        // as without one
+        if (!inputShape.empty() && inputShape.size() != inputSize) {
+            std::cerr << "Input shape " << inputShape.channels << "x" << inputShape.height << "x" << inputShape.width
+                      << " does not match " << inputSize << " inputs, ignoring it" << std::endl;
+            inputShape = {};
+        }
+        // The image the next layer reads, empty once the values are a plain vector
+        ImageShape image = inputShape;
+        bool planar = true;
+        int inputs = inputSize;
+        for (const LayerConfig& layerConfig : layerConfigs) {
+            Layer layer = {inputs, layerConfig.size, layerConfig.activation, Matrix<T>(), Matrix<T>(1, 0), DENSE, {}};
+            layer.type = layerConfig.type;
+            if ((layer.type == CONV2D || layer.type == MAX_POOL) && image.empty()) {
+                std::cerr << "Layer " << layers.size() << " needs an image input, see NeuralNetworkConfig::inputShape"
+                          << std::endl;
+                layer.type = FLATTEN;
+            }
+            // Fan-in and fan-out of each weight
+            int fanIn = inputs;
+            int fanOut = layerConfig.size;
+            switch (layer.type) {
+            case CONV2D:
+                layer.window = imageWindow(image, planar, layerConfig.kernel, std::max(1, layerConfig.stride),
+                                           layerConfig.padding < 0 ? layerConfig.kernel / 2 : layerConfig.padding,
+                                           layerConfig.size);
+                layer.weights.resize(layer.window.patchSize(), layerConfig.size);
+                layer.biases = Matrix<T>(1, layerConfig.size, T(0));
+                fanIn = layer.window.patchSize();
+                fanOut = layer.window.kernel * layer.window.kernel * layerConfig.size;
+                image = layer.window.output;
+                planar = false;
+                break;
+            case MAX_POOL:
+                layer.activation = LINEAR;
+                layer.window = imageWindow(image, planar, layerConfig.kernel,
+                                           layerConfig.stride > 0 ? layerConfig.stride : layerConfig.kernel,
+                                           std::max(0, layerConfig.padding), image.channels);
+                image = layer.window.output;
+                planar = false;
+                break;
+            case FLATTEN:
+                layer.activation = LINEAR;
+                image = {};
+                break;
+            default:
+                layer.weights.resize(inputs, layerConfig.size);
+                layer.biases = Matrix<T>(1, layerConfig.size, T(0));
+                image = {};
             }
-            outputs[i] = activate(sum);
+            layer.outputs = layer.type == CONV2D || layer.type == MAX_POOL ? image.size()
+                            : layer.type == FLATTEN                       ? inputs
+                                                                          : layerConfig.size;
+            // Glorot uniform, or He uniform for RELU, so that pre-activations start
+            // with unit scale whatever the layer width and nothing saturates
+            const double limit = layer.activation == RELU ? std::sqrt(6.0 / fanIn) : std::sqrt(6.0 / (fanIn + fanOut));
+            for (std::size_t i = 0; i < layer.weights.size(); i++) {
+                layer.weights.data()[i] = static_cast<T>(limit * (2.0 * gen.uniform<double>() - 1.0));
+            }
+            inputs = layer.outputs;
+            layers.push_back(std::move(layer));
         }
+        outputSize = inputs;
 
-        // Calculate the output error
-        std::vector<double> outputErrors(outputSize, 0.0);
-        for (int i = 0; i < outputSize; i++) {
-            outputErrors[i] = targets[i] - outputs[i];
+        weightMoments.resize(layers.size());
+        biasMoments.resize(layers.size());
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Matrix<T>& weights = layers[l].weights;
+            for (auto moment : {&Moments::first, &Moments::second}) {
+                if (keepsMoment(moment)) {
+                    weightMoments[l].*moment = Matrix<T>(weights.rows(), weights.cols(), T(0));
+                    biasMoments[l].*moment = Matrix<T>(1, layers[l].biases.cols(), T(0));
+                }
+            }
         }
+    }
+
+    // Number of layers, output layer included
+    int layerCount() const { return static_cast<int>(layers.size()); }
+    // Values per sample into and out of the network
+    int inputCount() const { return inputSize; }
+    int outputCount() const { return outputSize; }
 
-        // Calculate the hidden layer error
-        std::vector<double> hiddenErrors(hiddenSize, 0.0);
-        for (int i = 0; i < hiddenSize; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < outputSize; j++) {
-                sum += outputErrors[j] * weights.hiddenToOutput[i][j];
+    // Parameters of layer l, 0 being the first hidden layer: weights are
+    // inputs x outputs and biases 1 x outputs for DENSE layers, see Layer
+    // for the others
+    const Matrix<T>& layerWeights(int l) const { return layers[l].weights; }
+    const Matrix<T>& layerBiases(int l) const { return layers[l].biases; }
+    ActivationFunction layerActivation(int l) const { return layers[l].activation; }
+    LayerType layerType(int l) const { return layers[l].type; }
+    // Values per sample out of layer l
+    int layerOutputs(int l) const { return layers[l].outputs; }
+
+    // Weights and biases of every layer
+    std::size_t parameterCount() const {
+        std::size_t count = 0;
+        for (const Layer& layer : layers) {
+            count += layer.weights.size() + layer.biases.size();
+        }
+        return count;
+    }
+
+    // One-shot magnitude pruning: zeroes the `sparsity` fraction of each
+    // hidden dense layer's weights with the smallest magnitude, or of its
+    // 1 x SPARSE_BLOCK_WIDTH blocks with the smallest L2 norm. The output
+    // layer and convolutions are kept whole. The pruned weights stay zero
+    // through later train() calls, which fine-tune the rest; sparsity 0 lets
+    // them grow back.
+    void pruneWeights(double sparsity, PruningGranularity granularity = PRUNE_WEIGHTS) {
+        pruningMasks.assign(layers.size(), Matrix<T>());
+        if (sparsity <= 0.0) {
+            return;
+        }
+        const int width = granularity == PRUNE_BLOCKS ? SPARSE_BLOCK_WIDTH : 1;
+        std::vector<T> scores;
+        std::vector<std::size_t> order;
+        for (std::size_t l = 0; l + 1 < layers.size(); l++) {
+            if (layers[l].type != DENSE) {
+                continue;
             }
-            hiddenErrors[i] = hiddenOutputs[i] * (1.0 - hiddenOutputs[i]) * sum;
+            Matrix<T>& weights = layers[l].weights;
+            const int groups = (weights.cols() + width - 1) / width;
+            scores.assign(static_cast<std::size_t>(weights.rows()) * groups, T(0));
+            for (int i = 0; i < weights.rows(); i++) {
+                for (int j = 0; j < weights.cols(); j++) {
+                    scores[static_cast<std::size_t>(i) * groups + j / width] += weights(i, j) * weights(i, j);
+                }
+            }
+            // Ties go by position, so the count is exact and runs are repeatable
+            const std::size_t pruned =
+                std::min(scores.size(), static_cast<std::size_t>(std::llround(sparsity * scores.size())));
+            order.resize(scores.size());
+            std::iota(order.begin(), order.end(), std::size_t(0));
+            std::nth_element(order.begin(), order.begin() + pruned, order.end(), [&](std::size_t a, std::size_t b) {
+                return scores[a] < scores[b] || (scores[a] == scores[b] && a < b);
+            });
+
+            Matrix<T>& mask = pruningMasks[l];
+            mask = Matrix<T>(weights.rows(), weights.cols(), T(1));
+            for (std::size_t k = 0; k < pruned; k++) {
+                const int i = static_cast<int>(order[k] / groups);
+                const int first = static_cast<int>(order[k] % groups) * width;
+                std::fill(mask.row(i) + first, mask.row(i) + std::min(first + width, weights.cols()), T(0));
+            }
+        }
+        maskPrunedWeights();
+    }
+
+    // Fraction of layer l's weights that are zero
+    double weightSparsity(int l) const {
+        const Matrix<T>& weights = layers[l].weights;
+        if (weights.size() == 0) {
+            return 0.0;
         }
+        return static_cast<double>(std::count(weights.data(), weights.data() + weights.size(), T(0))) /
+               weights.size();
+    }
 
-        // Update the weights from the hidden layer to the output
-        for (int i = 0; i < hiddenSize; i++) {
-            for (int j = 0; j < outputSize; j++) {
-                weights.hiddenToOutput[i][j] += learningRate * outputErrors[j] * hiddenOutputs[i];
+    // Phase times, throughput, losses and allocations of the current or last train() run
+    const TrainingTelemetry& telemetry() const { return trainingTelemetry; }
+
+    // Exact scalar activation, whatever activationAccuracy is
+    T activate(T x) {
+        switch (activationFunction) {
+        case SIGMOID:
+            return MathUtils::sigmoid(x);
+        case TANH:
+            return MathUtils::tanh(x);
+        case RELU:
+            return std::max(T(0), x);  // ReLU activation function
+        case LINEAR:
+            return x;  // Linear activation function
+        case TANH_DERIVATIVE: {
+            const T value = MathUtils::tanh(x);
+            return T(1) - value * value;  // Derivative of tanh
+        }
+        case SOFTMAX:
+            // Softmax will be applied during the feedforward step
+            return x;
+        default:
+            return MathUtils::tanh(x);
+        }
+    }
+
+    // Applies activate() to every value in place, through the vectorized kernels
+    // of the configured accuracy where one exists
+    void activateAll(T* values, int count) {
+        const KernelTable<T>& simd = kernels<T>(activationAccuracy);
+        switch (activationFunction) {
+        case SIGMOID:
+            simd.sigmoid(values, count);
+            break;
+        case TANH:
+            simd.tanh(values, count);
+            break;
+        case RELU:
+            simd.relu(values, count);
+            break;
+        case LINEAR:
+        case SOFTMAX:
+            break;
+        default:
+            for (int i = 0; i < count; i++) {
+                values[i] = activate(values[i]);
+            }
+        }
+    }
+
+    // Forward pass for one sample: reads inputSize values from `inputs` and
+    // writes outputSize values to `outputs`. The hidden layer outputs live in
+    // the first training workspace, so this does not allocate once warm; it
+    // must not run concurrently with training or another feedforward.
+    void feedforward(const T* inputs, T* outputs, bool isTraining = true) {
+        BatchWorkspace& workspace = workspaces[0];
+        workspace.activations.resize(layers.size() + 1);
+        packSparseInputs(inputs, 1, workspace);
+        const T* layerInputs = inputs;
+
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            T* layerOutputs = outputs;
+            if (l + 1 < layers.size()) {
+                workspace.activations[l + 1].resize(1, layer.outputs);
+                layerOutputs = workspace.activations[l + 1].data();
+            }
+            layerForward(l, layerInputs, 1, layerOutputs, layer.activation, workspace, false);
+
+            // Apply dropout to the hidden layers during training
+            if (isTraining && hasDropout(l)) {
+                workspace.dropoutMasks.resize(layers.size());
+                Matrix<T>& mask = workspace.dropoutMasks[l];
+                mask.resize(1, layer.outputs);
+                applyDropout(workspace, layerOutputs, mask.data(), layer.outputs);
             }
+            layerInputs = layerOutputs;
+        }
+    }
+
+    // Same as above, resizing `outputs` to outputSize (no allocation once it has that capacity)
+    void feedforward(const std::vector<T>& inputs, std::vector<T>& outputs, bool isTraining = true) {
+        outputs.resize(outputSize);
+        feedforward(inputs.data(), outputs.data(), isTraining);
+    }
+
+    std::vector<T> feedforward(const std::vector<T>& inputs, bool isTraining = true) {
+        std::vector<T> outputs(outputSize);
+        feedforward(inputs.data(), outputs.data(), isTraining);
+        return outputs;
+    }
+
+    void backpropagation(const std::vector<T>& inputs, const std::vector<T>& targets) {
+        BatchWorkspace& sample = workspaces[0];
+        {
+            PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+            resizeBatch(sample, 1);
+            packSample(sample, 0, inputs, targets);
         }
+        trainPackedBatch(sample);
+    }
 
-        // Update the weights from the input to the hidden layer
-        for (int i = 0; i < inputSize; i++) {
-            for (int j = 0; j < hiddenSize; j++) {
-                weights.inputToHidden[i][j] += learningRate * hiddenErrors[j] * inputs[i];
+    // Runs the forward and backward passes over every sample of the batch as
+    // matrix-matrix products and applies a single averaged weight update.
+    void trainBatch(const TrainingData<T>& samples) {
+        if (samples.empty()) {
+            return;
+        }
+        BatchWorkspace& batch = workspaces[0];
+        const int count = static_cast<int>(samples.size());
+        {
+            PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+            resizeBatch(batch, count);
+            for (int s = 0; s < count; s++) {
+                packSample(batch, s, samples[s].first, samples[s].second);
             }
         }
+        trainPackedBatch(batch);
     }
 
     void train(
-            const std::vector<std::pair<std::vector<double>, std::vector<double>>>& trainingData,
-            const std::vector<std::pair<std::vector<double>, std::vector<double>>>& validationData,
+            const TrainingData<T>& trainingData,
+            const TrainingData<T>& validationData,
             long numberOfIterations,
             int checkpointInterval = 1000
         ) {
-            double bestValidationLoss = std::numeric_limits<double>::max();
-            std::vector<std::vector<double>> bestWeightsInputToHidden;
-            std::vector<std::vector<double>> bestWeightsHiddenToOutput;
-
-            ProgressBar progressBar(numberOfIterations);
-            for (int i = 0; i < numberOfIterations; i++) {
-                progressBar.update();
-                int randomIndex = rand() % trainingData.size();
-                const auto& [randomInputs, randomTargets] = trainingData[randomIndex];
-                backpropagation(randomInputs, randomTargets);
-
-                // Evaluate on validation set periodically and save checkpoints
-                if ((i + 1) % checkpointInterval == 0) {
-                    double validationLoss = calculateLoss(validationData);
-                    if (validationLoss < bestValidationLoss) {
-                        bestValidationLoss = validationLoss;
-                        bestWeightsInputToHidden = weights.inputToHidden;
-                        bestWeightsHiddenToOutput = weights.hiddenToOutput;
-                    } else {
-                        // If the validation loss has not improved, stop training
-                        break;
+            runTraining(validationData, numberOfIterations, checkpointInterval, nullptr, [&](long limit) -> long {
+                if (threadPool && parallelMode == HOGWILD) {
+                    // Run every iteration up to the next checkpoint in one go
+                    trainHogwild(trainingData, limit);
+                    return limit;
+                } else if (threadPool && batchSize > 1) {
+                    trainAllReduceStep(trainingData);
+                } else if (batchSize == 1) {
+                    const std::size_t randomIndex = workspaces[0].sampler.below(trainingData.size());
+                    const auto& [randomInputs, randomTargets] = trainingData[randomIndex];
+                    backpropagation(randomInputs, randomTargets);
+                } else {
+                    packRandomBatch(workspaces[0], batchSize, trainingData);
+                    trainPackedBatch(workspaces[0]);
+                }
+                return 1;
+            });
+        }
+
+    // Same as above, with one step per batch of the loader: its batch size
+    // replaces config.batchSize, and the samples are never all held as T.
+    // With several threads each batch is split across them (ALL_REDUCE);
+    // HOGWILD applies to TrainingData only.
+    void train(
+            DataLoader<T>& loader,
+            const TrainingData<T>& validationData,
+            long numberOfIterations,
+            int checkpointInterval = 1000
+        ) {
+            if (loader.sampleWidth() != inputSize || loader.classCount() != outputSize) {
+                std::cerr << "Unable to train: loader samples are " << loader.sampleWidth() << " -> "
+                          << loader.classCount() << ", expected " << inputSize << " -> " << outputSize << std::endl;
+                return;
+            }
+            runTraining(validationData, numberOfIterations, checkpointInterval, &loader, [&](long) -> long {
+                const DataBatch<T>* batch;
+                {
+                    PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+                    batch = &loader.next();
+                }
+                const DataBatch<T>& samples = *batch;
+                const int rows = samples.inputs.rows();
+                if (threadPool && rows > 1) {
+                    trainAllReduceStep(rows, [&](BatchWorkspace& shard, int first, int last) {
+                        packLoaderRows(shard, samples, first, last);
+                    });
+                } else {
+                    {
+                        PhaseTimer timer(trainingTelemetry, PHASE_DATA_LOADING);
+                        resizeBatch(workspaces[0], rows);
+                        packLoaderRows(workspaces[0], samples, 0, rows);
+                    }
+                    trainPackedBatch(workspaces[0]);
+                }
+                return 1;
+            });
+        }
+
+    // Loads a checkpoint written by a train() run with config.checkpoint set,
+    // so that the next train() call continues that run where it stopped:
+    // weights, optimizer state, sampling and dropout streams, the best
+    // weights so far and, for DataLoader runs, the loader position. Called
+    // with the same training data, loader options and numberOfIterations, and
+    // the same number of threads, the resumed run trains bit-identical weights
+    // to one that was never stopped (HOGWILD aside).
+    bool resumeTraining(const std::string& filePath) {
+        TrainingSnapshot<T> snapshot;
+        std::string error;
+        if (!readCheckpointFile<T>(filePath, snapshot, error)) {
+            std::cerr << "Unable to resume training: " << error << std::endl;
+            return false;
+        }
+        const CheckpointHeader& header = snapshot.header;
+        if (header.layerCount != layers.size()) {
+            std::cerr << "Unable to resume training: " << filePath << " has " << header.layerCount
+                      << " layers, expected " << layers.size() << std::endl;
+            return false;
+        }
+        const std::vector<ModelFileLayer> expectedLayers = modelLayers();
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const ModelFileLayer& fileLayer = snapshot.layers[l];
+            if (fileLayer.inputs != expectedLayers[l].inputs || fileLayer.outputs != expectedLayers[l].outputs ||
+                fileLayer.geometry != expectedLayers[l].geometry) {
+                std::cerr << "Unable to resume training: layer " << l << " of " << filePath << " is "
+                          << fileLayer.inputs << "x" << fileLayer.outputs << ", expected " << expectedLayers[l].inputs
+                          << "x" << expectedLayers[l].outputs << std::endl;
+                return false;
+            }
+        }
+        const std::size_t momentSets = (keepsMoment(&Moments::first) ? 1 : 0) + (keepsMoment(&Moments::second) ? 1 : 0);
+        const std::size_t expected = 2 * layers.size() * (1 + momentSets + (header.hasBest ? 1 : 0));
+        if (header.optimizerType != static_cast<uint32_t>(optimizer.type) || header.matrixCount != expected) {
+            std::cerr << "Unable to resume training: " << filePath << " was written with another optimizer"
+                      << std::endl;
+            return false;
+        }
+
+        std::size_t next = 0;
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            layers[l].activation = static_cast<ActivationFunction>(snapshot.layers[l].activation);
+            layers[l].weights = std::move(snapshot.matrices[next++]);
+            layers[l].biases = std::move(snapshot.matrices[next++]);
+        }
+        activationFunction = layers.back().activation;
+        mappedModel.reset();
+        pruningMasks.clear();
+        for (auto moment : {&Moments::first, &Moments::second}) {
+            if (keepsMoment(moment)) {
+                for (std::size_t l = 0; l < layers.size(); l++) {
+                    weightMoments[l].*moment = std::move(snapshot.matrices[next++]);
+                    biasMoments[l].*moment = std::move(snapshot.matrices[next++]);
+                }
+            }
+        }
+        if (header.hasBest) {
+            checkpointLayers = layers;
+            for (Layer& layer : checkpointLayers) {
+                layer.weights = std::move(snapshot.matrices[next++]);
+                layer.biases = std::move(snapshot.matrices[next++]);
+            }
+        }
+        optimizerSteps = static_cast<long>(header.optimizerSteps);
+        // A different thread count keeps the streams of the workspaces both runs have
+        const std::size_t generators = std::min<std::size_t>(workspaces.size(), header.generatorCount);
+        for (std::size_t w = 0; w < generators; w++) {
+            workspaces[w].sampler.setState(&snapshot.generators[w * 4]);
+        }
+
+        resumePoint.pending = true;
+        resumePoint.iteration = static_cast<long>(header.iteration);
+        resumePoint.bestValidationLoss = header.bestValidationLoss;
+        resumePoint.hasBest = header.hasBest != 0;
+        resumePoint.loaderBatch = static_cast<long>(header.loaderBatch);
+        return true;
+    }
+
+    // Inference for every row of `inputs` (one sample per row), spread over the
+    // training threads. `outputs` is resized to inputs.rows() x outputSize.
+    void predictBatch(const Matrix<T>& inputs, Matrix<T>& outputs) {
+        outputs.resize(inputs.rows(), outputSize);
+        const int chunks = (inputs.rows() + INFERENCE_CHUNK_ROWS - 1) / INFERENCE_CHUNK_ROWS;
+        std::atomic<int> nextChunk{0};
+        runOnWorkers([&](int worker) {
+            for (int chunk = nextChunk.fetch_add(1); chunk < chunks; chunk = nextChunk.fetch_add(1)) {
+                const int first = chunk * INFERENCE_CHUNK_ROWS;
+                const int rows = std::min(INFERENCE_CHUNK_ROWS, inputs.rows() - first);
+                forwardRows(inputs.row(first), rows, outputs.row(first), workspaces[worker]);
+            }
+        });
+    }
+
+    // Classifies `count` samples and scores them against their labels.
+    // loadInput(i, row) writes the inputSize inputs of sample i into row and
+    // labelOf(i) returns its class; both are called from the worker threads.
+    // Samples are packed into per-thread buffers, so nothing is allocated per
+    // sample.
+    template <typename LoadInput, typename LabelOf>
+    EvaluationResult evaluate(std::size_t count, LoadInput loadInput, LabelOf labelOf, int topK = 5) {
+        struct WorkerScore {
+            long correct = 0;
+            long topKCorrect = 0;
+            Matrix<long> confusion;
+        };
+        std::vector<WorkerScore> scores(workspaces.size());
+        const std::size_t chunks = (count + INFERENCE_CHUNK_ROWS - 1) / INFERENCE_CHUNK_ROWS;
+        std::atomic<std::size_t> nextChunk{0};
+
+        runOnWorkers([&](int worker) {
+            BatchWorkspace& workspace = workspaces[worker];
+            WorkerScore& score = scores[worker];
+            score.confusion = Matrix<long>(outputSize, outputSize, 0);
+            for (std::size_t chunk = nextChunk.fetch_add(1); chunk < chunks; chunk = nextChunk.fetch_add(1)) {
+                const std::size_t first = chunk * INFERENCE_CHUNK_ROWS;
+                const int rows = static_cast<int>(std::min<std::size_t>(INFERENCE_CHUNK_ROWS, count - first));
+                workspace.activations.resize(layers.size() + 1);
+                Matrix<T>& inputs = workspace.activations[0];
+                inputs.resize(rows, inputSize);
+                workspace.outputs.resize(rows, outputSize);
+                for (int r = 0; r < rows; r++) {
+                    loadInput(first + r, inputs.row(r));
+                }
+                forwardRows(inputs.data(), rows, workspace.outputs.data(), workspace);
+
+                for (int r = 0; r < rows; r++) {
+                    const T* output = workspace.outputs.row(r);
+                    const int label = static_cast<int>(labelOf(first + r));
+                    const int prediction = static_cast<int>(std::max_element(output, output + outputSize) - output);
+                    // The label is in the top k when fewer than k outputs beat it
+                    int higher = 0;
+                    for (int i = 0; i < outputSize; i++) {
+                        higher += output[i] > output[label];
                     }
+                    score.correct += prediction == label;
+                    score.topKCorrect += higher < topK;
+                    score.confusion(label, prediction)++;
                 }
             }
+        });
 
-            // Restore best weights
-            weights.inputToHidden = bestWeightsInputToHidden;
-            weights.hiddenToOutput = bestWeightsHiddenToOutput;
+        EvaluationResult result;
+        result.samples = count;
+        result.topK = topK;
+        result.confusionMatrix = Matrix<long>(outputSize, outputSize, 0);
+        long correct = 0;
+        long topKCorrect = 0;
+        for (const WorkerScore& score : scores) {
+            correct += score.correct;
+            topKCorrect += score.topKCorrect;
+            for (std::size_t i = 0; i < score.confusion.size(); i++) {
+                result.confusionMatrix.data()[i] += score.confusion.data()[i];
+            }
+        }
+        if (count > 0) {
+            result.accuracy = static_cast<double>(correct) / count;
+            result.topKAccuracy = static_cast<double>(topKCorrect) / count;
         }
+        return result;
+    }
 
+    // Same as above for input/one-hot target pairs, the label being the highest target
+    EvaluationResult evaluate(const TrainingData<T>& data, int topK = 5) {
+        return evaluate(
+            data.size(),
+            [&](std::size_t i, T* row) { std::copy(data[i].first.begin(), data[i].first.begin() + inputSize, row); },
+            [&](std::size_t i) {
+                const std::vector<T>& targets = data[i].second;
+                return std::max_element(targets.begin(), targets.begin() + outputSize) - targets.begin();
+            },
+            topK);
+    }
 
-    double calculateLoss(const std::vector<std::pair<std::vector<double>, std::vector<double>>>& data) {
+    // Mean squared error over `data`, without dropout
+    double calculateLoss(const TrainingData<T>& data) {
+        Matrix<T>& outputs = workspaces[0].outputs;
+        outputs.resize(1, outputSize);
         double totalLoss = 0.0;
         for (const auto& [inputs, targets] : data) {
-            auto outputs = feedforward(inputs);
+            feedforward(inputs.data(), outputs.data(), false);
             double instanceLoss = 0.0;
             for (int i = 0; i < outputSize; ++i) {
-                instanceLoss += pow(targets[i] - outputs[i], 2); // Using mean squared error
+                instanceLoss += pow(targets[i] - outputs.data()[i], 2); // Using mean squared error
             }
             totalLoss += instanceLoss / outputSize;
         }
         return totalLoss / data.size();
     }
 
+    // Writes the model in the binary format described in modelFile.cpp
     void saveModel(const std::string& filePath) {
-        std::ofstream file(filePath);
-        if (file.is_open()) {
-            for (const auto& row : weights.inputToHidden) {
-                for (const double val : row) {
-                    file << val << ' ';
-                }
+        std::vector<const T*> weights;
+        std::vector<const T*> biases;
+        for (const Layer& layer : layers) {
+            weights.push_back(layer.weights.data());
+            biases.push_back(layer.biases.data());
+        }
+        std::string error;
+        if (!writeModelFile<T>(filePath, modelLayers(), weights, biases, error, fileInputShape())) {
+            std::cout << "Unable to save model: " << error << std::endl;
+        }
+    }
+
+    // Loads a model saved by saveModel(). A file of the network's own dtype is
+    // memory-mapped and its weights used in place; the other dtype is
+    // converted. Files in the old text format are still read, see loadTextModel().
+    // The checksum is only verified with `verifyChecksum`, since that reads
+    // the whole file; shapes and sizes are always checked.
+    int loadModel(const std::string& filePath, bool verifyChecksum = false) {
+        if (!ModelFile::isModelFile(filePath)) {
+            std::ifstream probe(filePath);
+            if (probe.is_open()) {
+                return loadTextModel(filePath);
             }
-            for (const auto& row : weights.hiddenToOutput) {
-                for (const double val : row) {
-                    file << val << ' ';
-                }
+            std::cout << "No model found at " << filePath << std::endl;
+            return false;
+        }
+
+        std::string error;
+        std::shared_ptr<ModelFile> file = ModelFile::open(filePath, error, verifyChecksum);
+        if (file == nullptr) {
+            std::cout << "Unable to load model: " << error << std::endl;
+            return false;
+        }
+        if (file->header().layerCount != layers.size()) {
+            std::cout << "Unable to load model: " << filePath << " has " << file->header().layerCount
+                      << " layers, expected " << layers.size() << std::endl;
+            return false;
+        }
+        const std::vector<ModelFileLayer> expectedLayers = modelLayers();
+        for (std::size_t i = 0; i < layers.size(); i++) {
+            const ModelFileLayer& fileLayer = file->layer(i);
+            if (fileLayer.inputs != expectedLayers[i].inputs || fileLayer.outputs != expectedLayers[i].outputs) {
+                std::cout << "Unable to load model: layer " << i << " of " << filePath << " is " << fileLayer.inputs
+                          << "x" << fileLayer.outputs << ", expected " << expectedLayers[i].inputs << "x"
+                          << expectedLayers[i].outputs << std::endl;
+                return false;
+            }
+            if (fileLayer.geometry != expectedLayers[i].geometry) {
+                std::cout << "Unable to load model: layer " << i << " of " << filePath
+                          << " is another kind of layer or window" << std::endl;
+                return false;
             }
-            file.close();
-        } else {
-            std::cout << "Unable to open file " << filePath << std::endl;
         }
-    }
+        const std::array<uint32_t, 3> shape = fileInputShape();
+        if (!inputShape.empty() && file->header().inputShape[0] != 0 &&
+            !std::equal(shape.begin(), shape.end(), file->header().inputShape)) {
+            std::cout << "Unable to load model: " << filePath << " was trained on images of another shape"
+                      << std::endl;
+            return false;
+        }
 
-    int loadModel(const std::string& filePath) {
-        std::ifstream file(filePath);
-        if (file.is_open()) {
-            for (auto& row : weights.inputToHidden) {
-                for (double& val : row) {
-                    file >> val;
+        for (std::size_t i = 0; i < layers.size(); i++) {
+            Layer& layer = layers[i];
+            const int rows = static_cast<int>(expectedLayers[i].inputs);
+            const int cols = static_cast<int>(expectedLayers[i].outputs);
+            layer.activation = static_cast<ActivationFunction>(file->layer(i).activation);
+            if (file->header().dtype == dtypeOf<T>()) {
+                layer.weights = Matrix<T>::view(static_cast<T*>(file->weights(i)), rows, cols);
+            } else {
+                layer.weights.resize(rows, cols);
+                if (file->header().dtype == DTYPE_FLOAT32) {
+                    convertWeights(static_cast<const float*>(file->weights(i)), layer.weights);
+                } else {
+                    convertWeights(static_cast<const double*>(file->weights(i)), layer.weights);
                 }
             }
-            for (auto& row : weights.hiddenToOutput) {
-                for (double& val : row) {
-                    file >> val;
+
+            if (file->biases(i) == nullptr) {
+                layer.biases = Matrix<T>(1, cols, T(0));
+            } else if (file->header().dtype == dtypeOf<T>()) {
+                layer.biases = Matrix<T>::view(static_cast<T*>(file->biases(i)), 1, cols);
+            } else {
+                layer.biases.resize(1, cols);
+                if (file->header().dtype == DTYPE_FLOAT32) {
+                    convertWeights(static_cast<const float*>(file->biases(i)), layer.biases);
+                } else {
+                    convertWeights(static_cast<const double*>(file->biases(i)), layer.biases);
                 }
             }
-            file.close();
-            return true;
-        } else {
+        }
+        activationFunction = layers.back().activation;
+        mappedModel = file;
+        pruningMasks.clear();
+        return true;
+    }
+
+    // Reads the whitespace separated weights written by earlier versions of
+    // saveModel(), for migrating old *-model.txt files. Those networks had a
+    // single hidden layer and no biases.
+    int loadTextModel(const std::string& filePath) {
+        std::ifstream file(filePath);
+        if (!file.is_open()) {
             std::cout << "No model found at " << filePath << std::endl;
             return false;
         }
+        if (layers.size() != 2) {
+            std::cout << "Unable to load model: text models have exactly one hidden layer" << std::endl;
+            return false;
+        }
+        std::vector<Matrix<T>> weights;
+        for (const Layer& layer : layers) {
+            weights.emplace_back(layer.inputs, layer.outputs);
+            for (std::size_t i = 0; i < weights.back().size(); i++) {
+                file >> weights.back().data()[i];
+            }
+        }
+        if (!file) {
+            std::cout << "Unable to load model: " << filePath << " has fewer weights than the network" << std::endl;
+            return false;
+        }
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            layers[l].weights = std::move(weights[l]);
+            layers[l].biases = Matrix<T>(1, layers[l].outputs, T(0));
+        }
+        return true;
     }
 };
 
+// The shape of the network saved at `path`, for programs that load models
+// they were not built for: fills in config.inputSize, config.inputShape and
+// config.layers, and `activation` with the output layer's. The other fields
+// of `config` are left as they are. Returns false and sets `error` if the
+// file is not a readable model file.
+inline bool readModelConfig(const std::string& path, NeuralNetworkConfig& config, ActivationFunction& activation,
+                            std::string& error) {
+    std::shared_ptr<ModelFile> file = ModelFile::open(path, error);
+    if (file == nullptr) {
+        return false;
+    }
+    const ModelFileHeader& header = file->header();
+    if (header.layerCount == 0) {
+        error = path + " has no layers";
+        return false;
+    }
+    config.inputShape = {static_cast<int>(header.inputShape[0]), static_cast<int>(header.inputShape[1]),
+                         static_cast<int>(header.inputShape[2])};
+    config.inputSize = config.inputShape.empty() ? static_cast<int>(file->layer(0).inputs) : config.inputShape.size();
+    config.layers.clear();
+    for (uint32_t l = 0; l < header.layerCount; l++) {
+        const ModelFileLayer& layer = file->layer(l);
+        const LayerType type = static_cast<LayerType>(layer.geometry & 0xff);
+        const int kernel = static_cast<int>(layer.geometry >> 8 & 0xff);
+        const int stride = static_cast<int>(layer.geometry >> 16 & 0xff);
+        const int padding = static_cast<int>(layer.geometry >> 24 & 0xff);
+        const ActivationFunction layerActivation = static_cast<ActivationFunction>(layer.activation);
+        if (type == CONV2D) {
+            config.layers.push_back(conv2d(static_cast<int>(layer.outputs), kernel, layerActivation, stride, padding));
+        } else if (type == MAX_POOL) {
+            LayerConfig pool = maxPool(kernel, stride);
+            pool.padding = padding;
+            config.layers.push_back(pool);
+        } else if (type == FLATTEN) {
+            config.layers.push_back(flatten());
+        } else {
+            config.layers.push_back({static_cast<int>(layer.outputs), layerActivation});
+        }
+    }
+    activation = config.layers.back().activation;
+    return true;
+}
+
 #endif
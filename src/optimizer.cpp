@@ -0,0 +1,83 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <algorithm>
+#include <cmath>
+
+// Update rule applied to the weights after each training step. Gradients are
+// in the network's sign convention: the averaged errors point downhill, so
+// every rule adds learningRate times its step to the parameters.
+enum OptimizerType {
+    SGD,       // parameters += learningRate * gradient
+    MOMENTUM,  // Heavy-ball momentum: the step is a decaying sum of past gradients
+    NESTEROV,  // Momentum with the look-ahead correction of Nesterov's method
+    ADAM,      // Per-parameter steps from bias-corrected first and second moments
+    ADAMW      // ADAM with weight decay applied to the weights directly rather than to the gradient
+};
+
+struct OptimizerConfig {
+    OptimizerType type = SGD;
+    double momentum = 0.9;      // MOMENTUM, NESTEROV
+    double beta1 = 0.9;         // ADAM, ADAMW: first moment decay
+    double beta2 = 0.999;       // ADAM, ADAMW: second moment decay
+    double epsilon = 1e-8;      // ADAM, ADAMW: added to the root of the second moment
+    // L2 penalty on the weights (not the biases). ADAMW decays the weights by
+    // learningRate * weightDecay per step; the other rules add the penalty to the gradient.
+    double weightDecay = 0.0;
+};
+
+enum LearningRateScheduleType {
+    CONSTANT_SCHEDULE,  // The configured learning rate throughout
+    STEP_SCHEDULE,      // Multiplied by stepDecay every stepSize steps
+    COSINE_SCHEDULE     // Cosine annealing down to minLearningRate over totalSteps
+};
+
+// Learning rate as a function of the optimizer step. A linear warmup from
+// zero over the first warmupSteps steps comes before any schedule, whose
+// steps are then counted from the end of the warmup.
+struct LearningRateSchedule {
+    LearningRateScheduleType type = CONSTANT_SCHEDULE;
+    long warmupSteps = 0;
+    long stepSize = 1000;          // STEP_SCHEDULE
+    double stepDecay = 0.1;        // STEP_SCHEDULE
+    long totalSteps = 1;           // COSINE_SCHEDULE, warmup excluded
+    double minLearningRate = 0.0;  // COSINE_SCHEDULE
+
+    // Learning rate of step `step` (counted from 0) for a base rate of `learningRate`
+    double rate(double learningRate, long step) const {
+        if (step < warmupSteps) {
+            return learningRate * (step + 1) / warmupSteps;
+        }
+        step -= warmupSteps;
+        switch (type) {
+        case STEP_SCHEDULE:
+            return learningRate * std::pow(stepDecay, static_cast<double>(step / std::max(1L, stepSize)));
+        case COSINE_SCHEDULE: {
+            const double progress = std::min(1.0, static_cast<double>(step) / std::max(1L, totalSteps));
+            return minLearningRate + 0.5 * (learningRate - minLearningRate) * (1.0 + std::cos(M_PI * progress));
+        }
+        default:
+            return learningRate;
+        }
+    }
+};
+
+// Everything one optimizer step needs besides the buffers, computed once per
+// step and shared by every parameter matrix. The gradient read by the update
+// kernels is gradientScale * gradients[i].
+template <typename T>
+struct ParameterUpdate {
+    T gradientScale = T(1);
+    T learningRate = T(0);
+    T momentum = T(0);
+    bool nesterov = false;
+    T beta1 = T(0);
+    T beta2 = T(0);
+    T epsilon = T(0);
+    T firstCorrection = T(1);   // 1 / (1 - beta1^t)
+    T secondCorrection = T(1);  // 1 / (1 - beta2^t)
+    T l2Penalty = T(0);         // Subtracted from the gradient times the parameter
+    T decay = T(0);             // Parameters shrink by decay * parameter before the step (ADAMW)
+};
+
+#endif
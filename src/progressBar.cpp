@@ -1,33 +1,128 @@
+#ifndef PROGRESS_BAR_H
+#define PROGRESS_BAR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
+#include <unistd.h>
+#include "./telemetry.cpp"
 
+// Progress of a train() run on std::cout, with the rate, ETA and latest
+// losses from its telemetry. On a terminal it is a bar redrawn at most every
+// barInterval seconds; otherwise (logs, pipes) a line every lineInterval
+// seconds. update() is a counter increment on most calls: the clock is only
+// read every `stride` updates, a stride adapted to read it about once a
+// millisecond whatever the step time.
 class ProgressBar {
 public:
-    ProgressBar(int total, int width = 50) : total(total), width(width), progress(0) {}
+    ProgressBar(long total, const TrainingTelemetry& telemetry, const TelemetryConfig& config, int width = 50)
+        : total(total), width(width), telemetry(telemetry) {
+        mode = config.progress;
+        if (mode == PROGRESS_AUTO) {
+            mode = isatty(fileno(stdout)) ? PROGRESS_BAR : PROGRESS_LINES;
+        }
+        interval = mode == PROGRESS_BAR ? config.barInterval : config.lineInterval;
+        lastCheck = lastDraw = std::chrono::steady_clock::now();
+    }
 
-    void update() {
-        ++progress;
+    void update(long steps = 1) {
+        progress += steps;
+        if (progress >= nextCheck) {
+            check();
+        }
+    }
 
-        float percentage = static_cast<float>(progress) / total;
-        int currentWidth = static_cast<int>(percentage * width);
+    // Draws the final state with the total time, also when the run stopped early
+    void finish() {
+        finished = true;
+        if (mode != PROGRESS_OFF) {
+            draw();
+            if (mode == PROGRESS_BAR) {
+                std::cout << std::endl;
+            }
+        }
+    }
+
+private:
+    static constexpr double CHECK_SECONDS = 0.001;
+
+    long total;
+    int width;
+    const TrainingTelemetry& telemetry;
+    ProgressMode mode;
+    double interval;
+    long progress = 0;
+    bool finished = false;
+    long stride = 1;
+    long nextCheck = 1;
+    long lastCheckProgress = 0;
+    std::chrono::steady_clock::time_point lastCheck;
+    std::chrono::steady_clock::time_point lastDraw;
 
-        std::cout << "[";
-        for (int i = 0; i < currentWidth; ++i) {
-            std::cout << "=";
+    void check() {
+        const auto now = std::chrono::steady_clock::now();
+        const double sinceCheck = std::chrono::duration<double>(now - lastCheck).count();
+        const long updates = progress - lastCheckProgress;
+        if (sinceCheck > 0.0) {
+            stride = std::clamp(static_cast<long>(updates * CHECK_SECONDS / sinceCheck), 1L, 1L << 20);
         }
-        for (int i = currentWidth; i < width; ++i) {
-            std::cout << " ";
+        lastCheck = now;
+        lastCheckProgress = progress;
+        nextCheck = progress + stride;
+        if (mode != PROGRESS_OFF && std::chrono::duration<double>(now - lastDraw).count() >= interval) {
+            lastDraw = now;
+            draw();
         }
-        std::cout << "] " << std::fixed << std::setprecision(1) << (percentage * 100.0) << "%\r";
-        std::cout.flush();
+    }
 
-        if (progress == total) {
-            std::cout << std::endl;  // Move to the next line after completion
+    static void writeDuration(double seconds) {
+        const long whole = static_cast<long>(seconds + 0.5);
+        if (whole >= 3600) {
+            std::cout << whole / 3600 << "h" << std::setw(2) << std::setfill('0') << whole / 60 % 60 << "m";
+        } else if (whole >= 60) {
+            std::cout << whole / 60 << "m" << std::setw(2) << std::setfill('0') << whole % 60 << "s";
+        } else {
+            std::cout << whole << "s";
         }
+        std::cout << std::setfill(' ');
     }
 
-private:
-    int total;
-    int width;
-    int progress;
+    // Leaves std::cout's number formatting as it found it
+    void draw() {
+        const std::ios_base::fmtflags flags = std::cout.flags();
+        const std::streamsize precision = std::cout.precision();
+        const double fraction = total > 0 ? static_cast<double>(progress) / total : 1.0;
+        if (mode == PROGRESS_BAR) {
+            const int filled = std::min(width, static_cast<int>(fraction * width));
+            std::cout << "[";
+            for (int i = 0; i < width; ++i) {
+                std::cout << (i < filled ? '=' : ' ');
+            }
+            std::cout << "] ";
+        } else {
+            std::cout << "step " << progress << "/" << total << " ";
+        }
+        std::cout << std::fixed << std::setprecision(1) << fraction * 100.0 << "%  " << std::setprecision(0)
+                  << telemetry.samplesPerSecond() << " samples/s  ";
+        const double elapsed = telemetry.elapsedSeconds();
+        if (!finished && progress > 0) {
+            std::cout << "ETA ";
+            writeDuration(elapsed / progress * (total - progress));
+        } else {
+            writeDuration(elapsed);
+        }
+        if (!telemetry.lossCurve().empty()) {
+            std::cout << "  loss " << std::defaultfloat << std::setprecision(4)
+                      << telemetry.lossCurve().back().validationLoss;
+        }
+        // Trailing spaces clear what is left of a longer previous bar
+        std::cout << (mode == PROGRESS_BAR ? "    \r" : "\n");
+        std::cout.flush();
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
 };
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef QUANTIZED_H
+#define QUANTIZED_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "./modelFile.cpp"
+#include "./nn.cpp"
+#include "./tensor.cpp"
+
+// Post-training int8 quantization for serving a trained NeuralNetwork.
+//
+// Weights are quantized symmetrically per output neuron: column j of a layer
+// is stored as round(w / s_j) in [-127, 127] with s_j = max |w| / 127. The
+// inputs of each layer get one scale, calibrated on sample data: the chosen
+// percentile of |input| maps to 127 and larger values saturate. Products are
+// summed in int32 by the denseInt8 kernel and each sum is turned back into T
+// with input scale * s_j before the bias and activation, so only the matrix
+// products run on integers.
+//
+// Quantized models are packed files (see modelFile.cpp) whose layer blocks
+// hold float inputScale, float weightScales[outputs], float biases[outputs]
+// and int8 weights[outputs][inputs].
+
+constexpr char QUANTIZED_FILE_MAGIC[8] = {'N', 'N', 'Q', 'U', 'A', 'N', 'T', '\0'};
+constexpr uint32_t QUANTIZED_FILE_VERSION = 1;
+// Rows of quantized weights and inputs start on this boundary, zero-padded
+constexpr int QUANTIZED_ROW_ALIGNMENT = 64;
+
+struct QuantizationConfig {
+    // Percentile of the calibration |input| values of each layer that maps to
+    // 127; 100 keeps the largest value, lower values clip rare outliers to
+    // resolve the bulk of the distribution more finely
+    double calibrationPercentile = 99.99;
+};
+
+// The quantized model against the float model it came from, see compareQuantized()
+struct QuantizationReport {
+    std::size_t samples = 0;
+    double floatAccuracy = 0.0;
+    double quantizedAccuracy = 0.0;
+    double accuracyDelta = 0.0;      // quantizedAccuracy - floatAccuracy
+    double agreement = 0.0;          // Fraction of samples both models assign the same class
+    double maxOutputError = 0.0;     // Largest absolute difference between their outputs
+    std::size_t floatBytes = 0;      // Weights and biases of the float model
+    std::size_t quantizedBytes = 0;  // Weights, scales and biases of the quantized model
+};
+
+// Inference-only int8 copy of a NeuralNetwork<T>. predictBatch() reuses its
+// buffers, so a network serves one thread at a time; give each serving
+// thread its own copy.
+template <typename T = float>
+class QuantizedNetwork {
+public:
+    QuantizedNetwork() = default;
+
+    // Quantizes `network`, calibrating the input scale of every layer on the
+    // rows of `calibrationInputs` (a few hundred representative samples),
+    // which are run through the float network once. Only networks of dense
+    // layers are quantized; others give an empty network.
+    static QuantizedNetwork quantize(const NeuralNetwork<T>& network, const Matrix<T>& calibrationInputs,
+                                     const QuantizationConfig& config = {}) {
+        QuantizedNetwork quantized;
+        for (int l = 0; l < network.layerCount(); l++) {
+            if (network.layerType(l) != DENSE) {
+                std::cerr << "Unable to quantize: layer " << l << " is not a dense layer" << std::endl;
+                return quantized;
+            }
+        }
+        const KernelTable<T>& simd = kernels<T>();
+        Matrix<T> current = calibrationInputs;
+        Matrix<T> next;
+        std::vector<T> magnitudes;
+        for (int l = 0; l < network.layerCount(); l++) {
+            const Matrix<T>& weights = network.layerWeights(l);
+            const Matrix<T>& biases = network.layerBiases(l);
+            Layer layer;
+            layer.inputs = weights.rows();
+            layer.outputs = weights.cols();
+            layer.stride = paddedStride(layer.inputs);
+            layer.activation = network.layerActivation(l);
+
+            magnitudes.resize(current.size());
+            std::transform(current.data(), current.data() + current.size(), magnitudes.begin(),
+                           [](T value) { return std::abs(value); });
+            layer.inputScale = scaleFor(percentile(magnitudes, config.calibrationPercentile));
+
+            layer.weights.assign(static_cast<std::size_t>(layer.outputs) * layer.stride, 0);
+            layer.weightScales.resize(layer.outputs);
+            for (int j = 0; j < layer.outputs; j++) {
+                T largest = T(0);
+                for (int i = 0; i < layer.inputs; i++) {
+                    largest = std::max(largest, std::abs(weights(i, j)));
+                }
+                const T scale = scaleFor(largest);
+                layer.weightScales[j] = scale;
+                int8_t* row = &layer.weights[static_cast<std::size_t>(j) * layer.stride];
+                for (int i = 0; i < layer.inputs; i++) {
+                    row[i] = quantizeValue(weights(i, j) / scale);
+                }
+            }
+            layer.biases.assign(biases.data(), biases.data() + layer.outputs);
+            layer.updateScales();
+
+            if (l + 1 < network.layerCount()) {
+                next.resize(current.rows(), layer.outputs);
+                simd.denseForward(current.data(), weights.data(), biases.data(), next.data(), current.rows(),
+                                  layer.inputs, layer.outputs, layer.activation);
+                std::swap(current, next);
+            }
+            quantized.layers.push_back(std::move(layer));
+        }
+        return quantized;
+    }
+
+    int layerCount() const { return static_cast<int>(layers.size()); }
+    int inputSize() const { return layers.empty() ? 0 : layers.front().inputs; }
+    int outputSize() const { return layers.empty() ? 0 : layers.back().outputs; }
+
+    // Bytes of the int8 weights and the float scales and biases, as saved;
+    // in memory the weight rows are also padded to QUANTIZED_ROW_ALIGNMENT
+    std::size_t modelBytes() const {
+        std::size_t bytes = 0;
+        for (const Layer& layer : layers) {
+            bytes += static_cast<std::size_t>(layer.inputs) * layer.outputs +
+                     sizeof(float) * (1 + 2 * static_cast<std::size_t>(layer.outputs));
+        }
+        return bytes;
+    }
+
+    // Inference for every row of `inputs`; `outputs` is resized to inputs.rows() x outputSize()
+    void predictBatch(const Matrix<T>& inputs, Matrix<T>& outputs) {
+        outputs.resize(inputs.rows(), outputSize());
+        for (int first = 0; first < inputs.rows(); first += INFERENCE_CHUNK_ROWS) {
+            const int rows = std::min(INFERENCE_CHUNK_ROWS, inputs.rows() - first);
+            forwardRows(inputs.row(first), rows, outputs.row(first));
+        }
+    }
+
+    // Inference for one sample of inputSize() values into outputSize() values
+    void predict(const T* inputs, T* outputs) { forwardRows(inputs, 1, outputs); }
+
+    // Classifies input/one-hot target pairs, the label being the highest target
+    EvaluationResult evaluate(const TrainingData<T>& data, int topK = 5) {
+        const int classes = outputSize();
+        EvaluationResult result;
+        result.samples = data.size();
+        result.topK = topK;
+        result.confusionMatrix = Matrix<long>(classes, classes, 0);
+        Matrix<T> inputs;
+        Matrix<T> outputs;
+        long correct = 0;
+        long topKCorrect = 0;
+        for (std::size_t first = 0; first < data.size(); first += INFERENCE_CHUNK_ROWS) {
+            const int rows = static_cast<int>(std::min<std::size_t>(INFERENCE_CHUNK_ROWS, data.size() - first));
+            packInputs(data, first, rows, inputs);
+            predictBatch(inputs, outputs);
+            for (int r = 0; r < rows; r++) {
+                const T* output = outputs.row(r);
+                const int label = labelOf(data[first + r]);
+                const int prediction = static_cast<int>(std::max_element(output, output + classes) - output);
+                int higher = 0;
+                for (int i = 0; i < classes; i++) {
+                    higher += output[i] > output[label];
+                }
+                correct += prediction == label;
+                topKCorrect += higher < topK;
+                result.confusionMatrix(label, prediction)++;
+            }
+        }
+        if (!data.empty()) {
+            result.accuracy = static_cast<double>(correct) / data.size();
+            result.topKAccuracy = static_cast<double>(topKCorrect) / data.size();
+        }
+        return result;
+    }
+
+    bool save(const std::string& filePath, std::string& error) const {
+        std::vector<ModelFileLayer> entries;
+        for (const Layer& layer : layers) {
+            entries.push_back({static_cast<uint32_t>(layer.inputs), static_cast<uint32_t>(layer.outputs),
+                               static_cast<uint32_t>(layer.activation), 0});
+        }
+        PackedFileWriter file(entries);
+        for (const Layer& layer : layers) {
+            file.appendFloats(&layer.inputScale, 1);
+            file.appendFloats(layer.weightScales.data(), layer.weightScales.size());
+            file.appendFloats(layer.biases.data(), layer.biases.size());
+            for (int j = 0; j < layer.outputs; j++) {
+                file.append(&layer.weights[static_cast<std::size_t>(j) * layer.stride], layer.inputs);
+            }
+            file.endBlock();
+        }
+        return file.write(filePath, QUANTIZED_FILE_MAGIC, QUANTIZED_FILE_VERSION, 0, error);
+    }
+
+    bool load(const std::string& filePath, std::string& error) {
+        PackedFileReader file;
+        if (!file.open(filePath, QUANTIZED_FILE_MAGIC, QUANTIZED_FILE_VERSION, "quantized model", error)) {
+            return false;
+        }
+        const std::vector<ModelFileLayer>& entries = file.layers();
+        uint64_t expectedBytes = 0;
+        for (const ModelFileLayer& entry : entries) {
+            expectedBytes += blockBytes(entry.inputs, entry.outputs);
+        }
+        if (expectedBytes != file.dataSize()) {
+            error = filePath + ": layer shapes do not match the data size";
+            return false;
+        }
+
+        std::vector<Layer> loaded(entries.size());
+        const unsigned char* block = file.blocks();
+        for (std::size_t l = 0; l < entries.size(); l++) {
+            Layer& layer = loaded[l];
+            layer.inputs = static_cast<int>(entries[l].inputs);
+            layer.outputs = static_cast<int>(entries[l].outputs);
+            layer.stride = paddedStride(layer.inputs);
+            layer.activation = static_cast<ActivationFunction>(entries[l].activation);
+            const unsigned char* current = block;
+            layer.inputScale = PackedFileReader::readFloat<T>(current);
+            layer.weightScales.resize(layer.outputs);
+            layer.biases.resize(layer.outputs);
+            for (T& scale : layer.weightScales) {
+                scale = PackedFileReader::readFloat<T>(current);
+            }
+            for (T& bias : layer.biases) {
+                bias = PackedFileReader::readFloat<T>(current);
+            }
+            layer.weights.assign(static_cast<std::size_t>(layer.outputs) * layer.stride, 0);
+            for (int j = 0; j < layer.outputs; j++) {
+                PackedFileReader::read(current, &layer.weights[static_cast<std::size_t>(j) * layer.stride],
+                                       layer.inputs);
+            }
+            layer.updateScales();
+            block += blockBytes(layer.inputs, layer.outputs);
+        }
+        layers = std::move(loaded);
+        return true;
+    }
+
+private:
+    struct Layer {
+        int inputs = 0;
+        int outputs = 0;
+        int stride = 0;              // Bytes between rows of weights and of quantized inputs
+        ActivationFunction activation = LINEAR;
+        T inputScale = T(1);         // Real value of one step of the quantized inputs
+        AlignedVector<int8_t> weights;  // outputs x stride, row j holding the weights into output j
+        std::vector<T> weightScales;    // Real value of one step of weight row j
+        AlignedVector<T> scales;        // inputScale * weightScales[j], what the kernel multiplies sums by
+        AlignedVector<T> biases;
+
+        void updateScales() {
+            scales.resize(outputs);
+            for (int j = 0; j < outputs; j++) {
+                scales[j] = inputScale * weightScales[j];
+            }
+        }
+    };
+    std::vector<Layer> layers;
+    // Buffers of forwardRows(), reused from call to call
+    AlignedVector<int8_t> quantizedInputs;
+    Matrix<T> hidden[2];
+
+    static int paddedStride(int inputs) {
+        return (inputs + QUANTIZED_ROW_ALIGNMENT - 1) / QUANTIZED_ROW_ALIGNMENT * QUANTIZED_ROW_ALIGNMENT;
+    }
+
+    static uint64_t blockBytes(uint64_t inputs, uint64_t outputs) {
+        const uint64_t bytes = sizeof(float) * (1 + 2 * outputs) + inputs * outputs;
+        return (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+    }
+
+    // Scale mapping `largest` to 127; all-zero data keeps a unit scale
+    static T scaleFor(T largest) { return largest > T(0) ? largest / T(127) : T(1); }
+
+    static int8_t quantizeValue(T value) {
+        return static_cast<int8_t>(std::lrint(std::min(T(127), std::max(T(-127), value))));
+    }
+
+    static T percentile(std::vector<T>& values, double percent) {
+        if (values.empty()) {
+            return T(0);
+        }
+        const double clamped = std::min(100.0, std::max(0.0, percent));
+        const std::size_t index = static_cast<std::size_t>(clamped / 100.0 * (values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    static int labelOf(const std::pair<std::vector<T>, std::vector<T>>& sample) {
+        const std::vector<T>& targets = sample.second;
+        return static_cast<int>(std::max_element(targets.begin(), targets.end()) - targets.begin());
+    }
+
+    static void packInputs(const TrainingData<T>& data, std::size_t first, int rows, Matrix<T>& inputs) {
+        const int width = static_cast<int>(data[first].first.size());
+        inputs.resize(rows, width);
+        for (int r = 0; r < rows; r++) {
+            std::copy(data[first + r].first.begin(), data[first + r].first.end(), inputs.row(r));
+        }
+    }
+
+    void forwardRows(const T* inputs, int rows, T* outputs) {
+        const KernelTable<T>& simd = kernels<T>();
+        const T* layerInputs = inputs;
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            // Padding stays zero, so the kernel may read whole vectors past the inputs
+            quantizedInputs.resize(static_cast<std::size_t>(rows) * layer.stride);
+            const T inverseScale = T(1) / layer.inputScale;
+            for (int r = 0; r < rows; r++) {
+                const T* row = layerInputs + static_cast<std::size_t>(r) * layer.inputs;
+                int8_t* quantizedRow = &quantizedInputs[static_cast<std::size_t>(r) * layer.stride];
+                simd.quantizeInt8(row, quantizedRow, layer.inputs, inverseScale);
+                std::fill(quantizedRow + layer.inputs, quantizedRow + layer.stride, int8_t(0));
+            }
+            T* layerOutputs = outputs;
+            if (l + 1 < layers.size()) {
+                Matrix<T>& buffer = hidden[l % 2];
+                buffer.resize(rows, layer.outputs);
+                layerOutputs = buffer.data();
+            }
+            simd.denseInt8(quantizedInputs.data(), layer.weights.data(), layer.scales.data(), layer.biases.data(),
+                           layerOutputs, rows, layer.stride, layer.stride, layer.outputs, layer.activation);
+            layerInputs = layerOutputs;
+        }
+    }
+};
+
+// Scores `quantized` and the float `network` it was made from on `data`:
+// their accuracies, how often they agree and how far their outputs drift
+template <typename T>
+QuantizationReport compareQuantized(NeuralNetwork<T>& network, QuantizedNetwork<T>& quantized,
+                                    const TrainingData<T>& data) {
+    QuantizationReport report;
+    report.samples = data.size();
+    if (data.empty()) {
+        return report;
+    }
+    const int classes = quantized.outputSize();
+    Matrix<T> inputs(static_cast<int>(data.size()), quantized.inputSize());
+    for (std::size_t i = 0; i < data.size(); i++) {
+        std::copy(data[i].first.begin(), data[i].first.end(), inputs.row(static_cast<int>(i)));
+    }
+    Matrix<T> floatOutputs;
+    Matrix<T> quantizedOutputs;
+    network.predictBatch(inputs, floatOutputs);
+    quantized.predictBatch(inputs, quantizedOutputs);
+
+    long floatCorrect = 0;
+    long quantizedCorrect = 0;
+    long agreeing = 0;
+    for (std::size_t i = 0; i < data.size(); i++) {
+        const T* floatRow = floatOutputs.row(static_cast<int>(i));
+        const T* quantizedRow = quantizedOutputs.row(static_cast<int>(i));
+        const std::vector<T>& targets = data[i].second;
+        const long label = std::max_element(targets.begin(), targets.end()) - targets.begin();
+        const long floatClass = std::max_element(floatRow, floatRow + classes) - floatRow;
+        const long quantizedClass = std::max_element(quantizedRow, quantizedRow + classes) - quantizedRow;
+        floatCorrect += floatClass == label;
+        quantizedCorrect += quantizedClass == label;
+        agreeing += floatClass == quantizedClass;
+        for (int j = 0; j < classes; j++) {
+            report.maxOutputError =
+                std::max(report.maxOutputError, static_cast<double>(std::abs(floatRow[j] - quantizedRow[j])));
+        }
+    }
+    report.floatAccuracy = static_cast<double>(floatCorrect) / data.size();
+    report.quantizedAccuracy = static_cast<double>(quantizedCorrect) / data.size();
+    report.accuracyDelta = report.quantizedAccuracy - report.floatAccuracy;
+    report.agreement = static_cast<double>(agreeing) / data.size();
+    for (int l = 0; l < network.layerCount(); l++) {
+        report.floatBytes += (network.layerWeights(l).size() + network.layerBiases(l).size()) * sizeof(T);
+    }
+    report.quantizedBytes = quantized.modelBytes();
+    return report;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// xoshiro256+ (Blackman and Vigna): 256 bits of state, a handful of cycles per
+// 64-bit output and no locking, so every training thread owns one. Seeded
+// through splitmix64 from a seed and a stream number, so each thread of a
+// seeded run gets its own reproducible sequence. Everything drawn from it
+// here is computed bit for bit the same on every platform, unlike the
+// <random> distributions, whose algorithms are left to the standard library.
+// It still satisfies UniformRandomBitGenerator for use with <random>.
+class Xoshiro256 {
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+
+    void seed(uint64_t seed, uint64_t stream = 0) {
+        uint64_t mix = seed ^ splitmix64(stream);
+        for (uint64_t& word : state) {
+            word = splitmix64(mix);
+        }
+    }
+
+    // The full generator state, for checkpoints: a generator restored with
+    // setState() continues the exact sequence of the one it was saved from
+    void getState(uint64_t words[4]) const { std::copy(state, state + 4, words); }
+    void setState(const uint64_t words[4]) { std::copy(words, words + 4, state); }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator()() {
+        const uint64_t result = state[0] + state[3];
+        const uint64_t shifted = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= shifted;
+        state[3] = (state[3] << 45) | (state[3] >> 19);
+        return result;
+    }
+
+    // Uniform in [0, bound) without the bias of a modulo (Lemire's
+    // multiply-shift, redrawing in the rare cases that would be biased)
+    uint64_t below(uint64_t bound) {
+        __uint128_t product = static_cast<__uint128_t>((*this)()) * bound;
+        uint64_t low = static_cast<uint64_t>(product);
+        if (low < bound) {
+            const uint64_t threshold = (0 - bound) % bound;
+            while (low < threshold) {
+                product = static_cast<__uint128_t>((*this)()) * bound;
+                low = static_cast<uint64_t>(product);
+            }
+        }
+        return static_cast<uint64_t>(product >> 64);
+    }
+
+    // Uniform in [0, 1), from the top bits (the lowest bits of xoshiro256+ are its weakest)
+    template <typename T>
+    T uniform() {
+        if constexpr (sizeof(T) == sizeof(float)) {
+            return static_cast<T>((*this)() >> 40) * T(0x1.0p-24);
+        } else {
+            return static_cast<T>((*this)() >> 11) * T(0x1.0p-53);
+        }
+    }
+
+    // Fills `count` integers uniform in [0, 2^24), two per 64-bit draw, for
+    // kernels that turn them into dropout masks
+    void fill24(int32_t* values, int count) {
+        int i = 0;
+        for (; i + 2 <= count; i += 2) {
+            const uint64_t bits = (*this)();
+            values[i] = static_cast<int32_t>(bits >> 40);
+            values[i + 1] = static_cast<int32_t>((bits >> 8) & 0xFFFFFF);
+        }
+        if (i < count) {
+            values[i] = static_cast<int32_t>((*this)() >> 40);
+        }
+    }
+
+private:
+    uint64_t state[4];
+
+    static uint64_t splitmix64(uint64_t& x) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t splitmix64(uint64_t&& x) { return splitmix64(x); }
+};
+
+// Fisher-Yates shuffle with Xoshiro256::below(), so a seeded shuffle gives the
+// same order everywhere (std::shuffle's algorithm is implementation-defined)
+template <typename Iterator>
+void shuffle(Iterator first, Iterator last, Xoshiro256& generator) {
+    for (std::size_t i = static_cast<std::size_t>(last - first); i > 1; i--) {
+        std::swap(first[i - 1], first[generator.below(i)]);
+    }
+}
+
+#endif
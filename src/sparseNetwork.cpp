@@ -0,0 +1,358 @@
+#ifndef SPARSE_NETWORK_H
+#define SPARSE_NETWORK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "./modelFile.cpp"
+#include "./nn.cpp"
+#include "./tensor.cpp"
+
+// Sparse-weight inference for a pruned NeuralNetwork (see pruneWeights()).
+//
+// Each layer keeps only its nonzero weights, in one of two layouts:
+//
+//   SPARSE_CSR     the nonzeros of each output's weight column with their
+//                  input indices (CSR of the transposed weight matrix). A
+//                  batch is repacked in panels of 16 samples so that each
+//                  nonzero reads one vector of consecutive samples; a single
+//                  sample gathers its inputs.
+//   SPARSE_BLOCKS  the nonzero 1 x SPARSE_BLOCK_WIDTH blocks of each input's
+//                  weight row (PRUNE_BLOCKS leaves whole blocks at zero), run
+//                  as full vectors with no gathers and one index per block.
+//
+// Layers denser than maxDensity (the unpruned output layer, say) stay dense,
+// as sparse kernels only win well below half density. Outputs match the
+// pruned network up to the order the products are summed in.
+//
+// Sparse models are packed files (see modelFile.cpp). The geometry of each
+// layer entry is its SparseFormat, and its block holds:
+//
+//   uint32 stored,
+//   SPARSE_DENSE:  float weights[inputs][outputs]
+//   SPARSE_CSR:    int32 starts[outputs + 1], int32 indices[stored], float values[stored]
+//   SPARSE_BLOCKS: int32 starts[block columns + 1], int32 indices[stored],
+//                  float values[stored][SPARSE_BLOCK_WIDTH]
+//   float biases[outputs]
+//
+// `stored` counts weights for dense layers, nonzeros for CSR and blocks for
+// block-sparse layers.
+
+constexpr char SPARSE_FILE_MAGIC[8] = {'N', 'N', 'S', 'P', 'A', 'R', 'S', 'E'};
+constexpr uint32_t SPARSE_FILE_VERSION = 1;
+// Largest fraction of nonzero weights (or blocks) a layer is stored sparse at
+constexpr double SPARSE_MAX_DENSITY = 0.35;
+
+enum SparseFormat : uint32_t {
+    SPARSE_DENSE,
+    SPARSE_CSR,
+    SPARSE_BLOCKS
+};
+
+// Inference-only sparse copy of a pruned NeuralNetwork<T>. predictBatch()
+// reuses its buffers, so a network serves one thread at a time; give each
+// serving thread its own copy.
+template <typename T = float>
+class SparseNetwork {
+public:
+    SparseNetwork() = default;
+
+    // Stores every layer of `network` at most maxDensity nonzero in `format`
+    // and the others dense. Only networks of dense layers are converted;
+    // others give an empty network.
+    static SparseNetwork fromNetwork(const NeuralNetwork<T>& network, SparseFormat format,
+                                     double maxDensity = SPARSE_MAX_DENSITY) {
+        SparseNetwork sparse;
+        for (int l = 0; l < network.layerCount(); l++) {
+            if (network.layerType(l) != DENSE) {
+                std::cerr << "Unable to convert to sparse: layer " << l << " is not a dense layer" << std::endl;
+                return sparse;
+            }
+        }
+        for (int l = 0; l < network.layerCount(); l++) {
+            const Matrix<T>& weights = network.layerWeights(l);
+            const Matrix<T>& biases = network.layerBiases(l);
+            Layer layer;
+            layer.inputs = weights.rows();
+            layer.outputs = weights.cols();
+            layer.activation = network.layerActivation(l);
+            layer.biases.assign(biases.data(), biases.data() + layer.outputs);
+            layer.format = format;
+            if (format == SPARSE_CSR) {
+                packColumns(weights, layer);
+            } else if (format == SPARSE_BLOCKS) {
+                packBlocks(weights, layer);
+            }
+            if (format == SPARSE_DENSE || layer.density() > maxDensity) {
+                layer.format = SPARSE_DENSE;
+                layer.starts.clear();
+                layer.indices.clear();
+                layer.values.assign(weights.data(), weights.data() + weights.size());
+            }
+            sparse.layers.push_back(std::move(layer));
+        }
+        return sparse;
+    }
+
+    int layerCount() const { return static_cast<int>(layers.size()); }
+    int inputSize() const { return layers.empty() ? 0 : layers.front().inputs; }
+    int outputSize() const { return layers.empty() ? 0 : layers.back().outputs; }
+    SparseFormat layerFormat(int l) const { return layers[l].format; }
+    // Fraction of layer l's weights that are stored, padding of partly zero blocks included
+    double layerDensity(int l) const { return layers[l].density(); }
+
+    // Bytes of the stored weights, indices and biases, as saved
+    std::size_t modelBytes() const {
+        std::size_t bytes = 0;
+        for (const Layer& layer : layers) {
+            bytes += sizeof(float) * (layer.values.size() + layer.biases.size()) +
+                     sizeof(int32_t) * (layer.starts.size() + layer.indices.size());
+        }
+        return bytes;
+    }
+
+    // Inference for every row of `inputs`; `outputs` is resized to inputs.rows() x outputSize()
+    void predictBatch(const Matrix<T>& inputs, Matrix<T>& outputs) {
+        outputs.resize(inputs.rows(), outputSize());
+        for (int first = 0; first < inputs.rows(); first += INFERENCE_CHUNK_ROWS) {
+            const int rows = std::min(INFERENCE_CHUNK_ROWS, inputs.rows() - first);
+            forwardRows(inputs.row(first), rows, outputs.row(first));
+        }
+    }
+
+    // Inference for one sample of inputSize() values into outputSize() values
+    void predict(const T* inputs, T* outputs) { forwardRows(inputs, 1, outputs); }
+
+    bool save(const std::string& filePath, std::string& error) const {
+        std::vector<ModelFileLayer> entries;
+        for (const Layer& layer : layers) {
+            entries.push_back({static_cast<uint32_t>(layer.inputs), static_cast<uint32_t>(layer.outputs),
+                               static_cast<uint32_t>(layer.activation), static_cast<uint32_t>(layer.format)});
+        }
+        PackedFileWriter file(entries);
+        for (const Layer& layer : layers) {
+            const uint32_t stored = static_cast<uint32_t>(layer.storedCount());
+            file.append(&stored, sizeof(stored));
+            file.append(layer.starts.data(), sizeof(int32_t) * layer.starts.size());
+            file.append(layer.indices.data(), sizeof(int32_t) * layer.indices.size());
+            file.appendFloats(layer.values.data(), layer.values.size());
+            file.appendFloats(layer.biases.data(), layer.biases.size());
+            file.endBlock();
+        }
+        return file.write(filePath, SPARSE_FILE_MAGIC, SPARSE_FILE_VERSION, 0, error);
+    }
+
+    bool load(const std::string& filePath, std::string& error) {
+        PackedFileReader file;
+        if (!file.open(filePath, SPARSE_FILE_MAGIC, SPARSE_FILE_VERSION, "sparse model", error)) {
+            return false;
+        }
+        const std::vector<ModelFileLayer>& entries = file.layers();
+        const unsigned char* data = file.blocks();
+        uint64_t offset = 0;
+        std::vector<Layer> loaded(entries.size());
+        for (std::size_t l = 0; l < entries.size(); l++) {
+            Layer& layer = loaded[l];
+            layer.inputs = static_cast<int>(entries[l].inputs);
+            layer.outputs = static_cast<int>(entries[l].outputs);
+            layer.activation = static_cast<ActivationFunction>(entries[l].activation);
+            layer.format = static_cast<SparseFormat>(entries[l].geometry);
+            uint32_t stored = 0;
+            if (layer.format > SPARSE_BLOCKS || offset + sizeof(stored) > file.dataSize()) {
+                error = filePath + ": layer " + std::to_string(l) + " is not a sparse layer";
+                return false;
+            }
+            std::memcpy(&stored, data + offset, sizeof(stored));
+            const uint64_t bytes = blockBytes(layer.format, layer.outputs, stored);
+            if (offset + bytes > file.dataSize()) {
+                error = filePath + ": layer shapes do not match the data size";
+                return false;
+            }
+            const unsigned char* current = data + offset + sizeof(stored);
+            layer.starts.resize(startCount(layer.format, layer.outputs));
+            layer.indices.resize(layer.format == SPARSE_DENSE ? 0 : stored);
+            layer.values.resize(static_cast<std::size_t>(stored) * valuesPerStored(layer.format));
+            layer.biases.resize(layer.outputs);
+            PackedFileReader::read(current, layer.starts.data(), sizeof(int32_t) * layer.starts.size());
+            PackedFileReader::read(current, layer.indices.data(), sizeof(int32_t) * layer.indices.size());
+            for (T& value : layer.values) {
+                value = PackedFileReader::readFloat<T>(current);
+            }
+            for (T& bias : layer.biases) {
+                bias = PackedFileReader::readFloat<T>(current);
+            }
+            if (!layer.valid(stored)) {
+                error = filePath + ": layer " + std::to_string(l) + " has out-of-range indices";
+                return false;
+            }
+            offset += bytes;
+        }
+        if (offset != file.dataSize()) {
+            error = filePath + ": layer shapes do not match the data size";
+            return false;
+        }
+        layers = std::move(loaded);
+        return true;
+    }
+
+private:
+    struct Layer {
+        int inputs = 0;
+        int outputs = 0;
+        ActivationFunction activation = LINEAR;
+        SparseFormat format = SPARSE_DENSE;
+        // SPARSE_DENSE: inputs x outputs weights; SPARSE_CSR: the nonzeros;
+        // SPARSE_BLOCKS: SPARSE_BLOCK_WIDTH values per block
+        AlignedVector<T> values;
+        std::vector<int> starts;   // CSR: first nonzero of each output; BLOCKS: first block of each block column
+        std::vector<int> indices;  // Input of each nonzero or block
+        AlignedVector<T> biases;
+
+        std::size_t storedCount() const { return format == SPARSE_DENSE ? values.size() : indices.size(); }
+
+        double density() const {
+            const std::size_t total = static_cast<std::size_t>(inputs) * outputs;
+            return total == 0 ? 0.0 : static_cast<double>(values.size()) / total;
+        }
+
+        // Whether the starts run from 0 to `stored` in order and every index names an input
+        bool valid(uint32_t stored) const {
+            if (format == SPARSE_DENSE) {
+                return stored == static_cast<uint64_t>(inputs) * outputs;
+            }
+            if (starts.front() != 0 || starts.back() != static_cast<int64_t>(stored) ||
+                !std::is_sorted(starts.begin(), starts.end())) {
+                return false;
+            }
+            return std::all_of(indices.begin(), indices.end(), [&](int i) { return i >= 0 && i < inputs; });
+        }
+    };
+    std::vector<Layer> layers;
+    // Buffers of forwardRows(), reused from call to call
+    Matrix<T> hidden[2];
+    AlignedVector<T> panelInputs;
+
+    static int blockColumns(int outputs) { return (outputs + SPARSE_BLOCK_WIDTH - 1) / SPARSE_BLOCK_WIDTH; }
+
+    static std::size_t startCount(SparseFormat format, int outputs) {
+        switch (format) {
+        case SPARSE_CSR:
+            return static_cast<std::size_t>(outputs) + 1;
+        case SPARSE_BLOCKS:
+            return static_cast<std::size_t>(blockColumns(outputs)) + 1;
+        default:
+            return 0;
+        }
+    }
+
+    static int valuesPerStored(SparseFormat format) { return format == SPARSE_BLOCKS ? SPARSE_BLOCK_WIDTH : 1; }
+
+    static uint64_t blockBytes(SparseFormat format, int outputs, uint64_t stored) {
+        const uint64_t indices = format == SPARSE_DENSE ? 0 : stored;
+        const uint64_t bytes = sizeof(uint32_t) + sizeof(int32_t) * (startCount(format, outputs) + indices) +
+                               sizeof(float) * (stored * valuesPerStored(format) + static_cast<uint64_t>(outputs));
+        return (bytes + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+    }
+
+    // CSR of the weight columns: the nonzero weights into each output
+    static void packColumns(const Matrix<T>& weights, Layer& layer) {
+        layer.starts.assign(1, 0);
+        for (int j = 0; j < layer.outputs; j++) {
+            for (int i = 0; i < layer.inputs; i++) {
+                if (weights(i, j) != T(0)) {
+                    layer.indices.push_back(i);
+                    layer.values.push_back(weights(i, j));
+                }
+            }
+            layer.starts.push_back(static_cast<int>(layer.indices.size()));
+        }
+    }
+
+    // The 1 x SPARSE_BLOCK_WIDTH blocks of weight rows holding a nonzero,
+    // grouped by block column; the last column's blocks are zero-padded
+    static void packBlocks(const Matrix<T>& weights, Layer& layer) {
+        layer.starts.assign(1, 0);
+        for (int jb = 0; jb < blockColumns(layer.outputs); jb++) {
+            const int first = jb * SPARSE_BLOCK_WIDTH;
+            const int width = std::min(SPARSE_BLOCK_WIDTH, layer.outputs - first);
+            for (int i = 0; i < layer.inputs; i++) {
+                const T* block = weights.row(i) + first;
+                if (std::any_of(block, block + width, [](T value) { return value != T(0); })) {
+                    layer.indices.push_back(i);
+                    layer.values.insert(layer.values.end(), block, block + width);
+                    layer.values.resize(layer.values.size() + SPARSE_BLOCK_WIDTH - width, T(0));
+                }
+            }
+            layer.starts.push_back(static_cast<int>(layer.indices.size()));
+        }
+    }
+
+    // inputs (rows x inner) into the panels csrForward() reads, the last one
+    // zero-padded. Full panels read their rows side by side and write each
+    // panel row in one go.
+    void packPanels(const T* inputs, int rows, int inner) {
+        const int panels = (rows + SPARSE_PANEL_ROWS - 1) / SPARSE_PANEL_ROWS;
+        panelInputs.resize(static_cast<std::size_t>(panels) * inner * SPARSE_PANEL_ROWS);
+        for (int p = 0; p < panels; p++) {
+            T* panel = panelInputs.data() + static_cast<std::size_t>(p) * inner * SPARSE_PANEL_ROWS;
+            const int first = p * SPARSE_PANEL_ROWS;
+            const T* rowInputs = inputs + static_cast<std::size_t>(first) * inner;
+            if (first + SPARSE_PANEL_ROWS <= rows) {
+                for (int i = 0; i < inner; i++) {
+                    for (int t = 0; t < SPARSE_PANEL_ROWS; t++) {
+                        panel[static_cast<std::size_t>(i) * SPARSE_PANEL_ROWS + t] =
+                            rowInputs[static_cast<std::size_t>(t) * inner + i];
+                    }
+                }
+            } else {
+                std::fill(panel, panel + static_cast<std::size_t>(inner) * SPARSE_PANEL_ROWS, T(0));
+                for (int t = 0; t < rows - first; t++) {
+                    for (int i = 0; i < inner; i++) {
+                        panel[static_cast<std::size_t>(i) * SPARSE_PANEL_ROWS + t] =
+                            rowInputs[static_cast<std::size_t>(t) * inner + i];
+                    }
+                }
+            }
+        }
+    }
+
+    void forwardRows(const T* inputs, int rows, T* outputs) {
+        const KernelTable<T>& simd = kernels<T>();
+        const T* layerInputs = inputs;
+        for (std::size_t l = 0; l < layers.size(); l++) {
+            const Layer& layer = layers[l];
+            T* layerOutputs = outputs;
+            if (l + 1 < layers.size()) {
+                Matrix<T>& buffer = hidden[l % 2];
+                buffer.resize(rows, layer.outputs);
+                layerOutputs = buffer.data();
+            }
+            switch (layer.format) {
+            case SPARSE_CSR: {
+                const T* panels = layerInputs;
+                if (rows > 1) {
+                    packPanels(layerInputs, rows, layer.inputs);
+                    panels = panelInputs.data();
+                }
+                simd.csrForward(layer.starts.data(), layer.indices.data(), layer.values.data(), panels,
+                                layer.biases.data(), layerOutputs, rows, layer.inputs, layer.outputs,
+                                layer.activation);
+                break;
+            }
+            case SPARSE_BLOCKS:
+                simd.blockSparseForward(layer.starts.data(), layer.indices.data(), layer.values.data(), layerInputs,
+                                        layer.biases.data(), layerOutputs, rows, layer.inputs, layer.outputs,
+                                        layer.activation);
+                break;
+            default:
+                simd.denseForward(layerInputs, layer.values.data(), layer.biases.data(), layerOutputs, rows,
+                                  layer.inputs, layer.outputs, layer.activation);
+            }
+            layerInputs = layerOutputs;
+        }
+    }
+};
+
+#endif
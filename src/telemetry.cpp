@@ -0,0 +1,269 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// What train() measures while it runs: time per training phase, samples,
+// losses and optionally heap allocations. Counters are atomics updated once
+// per phase per step, so they stay cheap next to the work they measure and
+// work from every training thread; phase times are summed over threads.
+enum TrainingPhase {
+    PHASE_FORWARD,       // Forward passes of the training batches
+    PHASE_BACKWARD,      // Error backpropagation and gradient sums
+    PHASE_UPDATE,        // Optimizer steps (with plain SGD, the gradient product fused into them)
+    PHASE_VALIDATION,    // Validation loss at the checkpoints
+    PHASE_DATA_LOADING,  // Sampling and packing batches, waiting for the DataLoader
+    PHASE_CHECKPOINT,    // Copying the training state for the checkpoint writer
+    PHASE_COUNT
+};
+
+inline const char* phaseName(TrainingPhase phase) {
+    static const char* const names[PHASE_COUNT] = {"forward",    "backward",    "update",
+                                                   "validation", "dataLoading", "checkpoint"};
+    return names[phase];
+}
+
+enum ProgressMode {
+    PROGRESS_AUTO,   // A bar when standard output is a terminal, lines otherwise
+    PROGRESS_BAR,    // A single line redrawn in place
+    PROGRESS_LINES,  // One line per report, for logs and pipes
+    PROGRESS_OFF
+};
+
+struct TelemetryConfig {
+    ProgressMode progress = PROGRESS_AUTO;
+    double barInterval = 0.1;    // Seconds between redraws of the bar
+    double lineInterval = 10.0;  // Seconds between progress lines
+    // Phase timers cost two clock reads per phase and step, noticeable only on tiny networks
+    bool phaseTimers = true;
+    std::string jsonPath;        // When set, every train() run writes its telemetry there as JSON
+};
+
+// Heap allocations counted by the replacement operator new below. Counting
+// is opt-in: it replaces the global allocator, which a program may only do
+// once, so define NN_TELEMETRY_ALLOCATIONS before including nn.cpp only in
+// programs that do not replace it themselves.
+inline std::atomic<long> telemetryAllocations{0};
+
+#ifdef NN_TELEMETRY_ALLOCATIONS
+void* operator new(std::size_t bytes) {
+    telemetryAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(bytes == 0 ? 1 : bytes)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment) {
+    telemetryAllocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* memory = std::aligned_alloc(align, (bytes + align - 1) / align * align)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+#pragma GCC diagnostic pop
+
+constexpr bool TELEMETRY_COUNTS_ALLOCATIONS = true;
+#else
+constexpr bool TELEMETRY_COUNTS_ALLOCATIONS = false;
+#endif
+
+// Timestamps for the phase timers: the cycle counter on x86 (a few
+// nanoseconds per read), converted to seconds with the rate measured over
+// the run, and steady_clock nanoseconds elsewhere
+inline uint64_t telemetryTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+#endif
+}
+
+class TrainingTelemetry {
+public:
+    struct LossPoint {
+        long step;
+        double trainingLoss;    // Mean squared error of the training batches since the previous point
+        double validationLoss;  // calculateLoss() on the validation data
+    };
+
+    // Resets every counter for a run of totalSteps steps with a validation
+    // loss every checkpointInterval steps. Phases are only timed during a
+    // run, and only with timePhases.
+    void start(long totalSteps, long checkpointInterval, bool timePhases = true) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            phaseTicks[p].store(0, std::memory_order_relaxed);
+            phaseCalls[p].store(0, std::memory_order_relaxed);
+        }
+        sampleCount.store(0, std::memory_order_relaxed);
+        lossSum.store(0.0, std::memory_order_relaxed);
+        lossCount.store(0, std::memory_order_relaxed);
+        losses.clear();
+        // Reserved up front so that recording losses never allocates once warm
+        losses.reserve(totalSteps / std::max(1L, checkpointInterval) + 1);
+        stepCount = 0;
+        this->totalSteps = totalSteps;
+        startAllocations = telemetryAllocations.load(std::memory_order_relaxed);
+        startTime = std::chrono::steady_clock::now();
+        startTicks = telemetryTicks();
+        running = true;
+        timing = timePhases;
+    }
+
+    void finish() {
+        endTime = std::chrono::steady_clock::now();
+        endTicks = telemetryTicks();
+        endAllocations = telemetryAllocations.load(std::memory_order_relaxed);
+        running = false;
+        timing = false;
+    }
+
+    bool timingPhases() const { return timing; }
+    // Whether a train() run is in progress; samples and losses are only counted then
+    bool recording() const { return running; }
+
+    void addPhase(TrainingPhase phase, uint64_t ticks) {
+        phaseTicks[phase].fetch_add(ticks, std::memory_order_relaxed);
+        phaseCalls[phase].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // `samples` samples trained with `squaredError` summed over their outputs
+    void addSamples(long samples, double squaredError, int outputs) {
+        sampleCount.fetch_add(samples, std::memory_order_relaxed);
+        double sum = lossSum.load(std::memory_order_relaxed);
+        while (!lossSum.compare_exchange_weak(sum, sum + squaredError / outputs, std::memory_order_relaxed)) {
+        }
+        lossCount.fetch_add(samples, std::memory_order_relaxed);
+    }
+
+    void setSteps(long steps) { stepCount = steps; }
+
+    // Records a checkpoint's validation loss with the training loss since the last one
+    void addLoss(double validationLoss) {
+        const long count = lossCount.exchange(0, std::memory_order_relaxed);
+        const double sum = lossSum.exchange(0.0, std::memory_order_relaxed);
+        losses.push_back({stepCount, count > 0 ? sum / count : 0.0, validationLoss});
+    }
+
+    long steps() const { return stepCount; }
+    long total() const { return totalSteps; }
+    long samples() const { return sampleCount.load(std::memory_order_relaxed); }
+    const std::vector<LossPoint>& lossCurve() const { return losses; }
+
+    double elapsedSeconds() const {
+        const auto end = running ? std::chrono::steady_clock::now() : endTime;
+        return std::chrono::duration<double>(end - startTime).count();
+    }
+
+    double samplesPerSecond() const {
+        const double seconds = elapsedSeconds();
+        return seconds > 0.0 ? samples() / seconds : 0.0;
+    }
+
+    double phaseSeconds(TrainingPhase phase) const {
+        return phaseTicks[phase].load(std::memory_order_relaxed) / ticksPerSecond();
+    }
+
+    long phaseCount(TrainingPhase phase) const { return phaseCalls[phase].load(std::memory_order_relaxed); }
+
+    // Allocations during the run, or -1 unless NN_TELEMETRY_ALLOCATIONS is defined
+    long allocations() const {
+        if (!TELEMETRY_COUNTS_ALLOCATIONS) {
+            return -1;
+        }
+        const long end = running ? telemetryAllocations.load(std::memory_order_relaxed) : endAllocations;
+        return end - startAllocations;
+    }
+
+    void writeJson(std::ostream& out) const {
+        const std::streamsize precision = out.precision(9);
+        out << "{\n  \"steps\": " << stepCount << ",\n  \"totalSteps\": " << totalSteps
+            << ",\n  \"samples\": " << samples() << ",\n  \"seconds\": " << elapsedSeconds()
+            << ",\n  \"samplesPerSecond\": " << samplesPerSecond() << ",\n  \"phases\": {";
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const TrainingPhase phase = static_cast<TrainingPhase>(p);
+            out << (p == 0 ? "\n" : ",\n") << "    \"" << phaseName(phase) << "\": {\"seconds\": "
+                << phaseSeconds(phase) << ", \"calls\": " << phaseCount(phase) << "}";
+        }
+        out << "\n  },\n  \"allocations\": ";
+        if (allocations() < 0) {
+            out << "null";
+        } else {
+            out << allocations();
+        }
+        out << ",\n  \"losses\": [";
+        for (std::size_t i = 0; i < losses.size(); i++) {
+            out << (i == 0 ? "\n" : ",\n") << "    {\"step\": " << losses[i].step << ", \"trainingLoss\": "
+                << losses[i].trainingLoss << ", \"validationLoss\": " << losses[i].validationLoss << "}";
+        }
+        out << "\n  ]\n}\n";
+        out.precision(precision);
+    }
+
+private:
+    std::atomic<uint64_t> phaseTicks[PHASE_COUNT] = {};
+    std::atomic<long> phaseCalls[PHASE_COUNT] = {};
+    std::atomic<long> sampleCount{0};
+    std::atomic<double> lossSum{0.0};
+    std::atomic<long> lossCount{0};
+    std::vector<LossPoint> losses;
+    long stepCount = 0;
+    long totalSteps = 0;
+    long startAllocations = 0;
+    long endAllocations = 0;
+    bool running = false;
+    bool timing = false;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+    uint64_t startTicks = 0;
+    uint64_t endTicks = 0;
+
+    double ticksPerSecond() const {
+        const double seconds = elapsedSeconds();
+        const uint64_t ticks = (running ? telemetryTicks() : endTicks) - startTicks;
+        return seconds > 0.0 && ticks > 0 ? ticks / seconds : 1e9;
+    }
+};
+
+// Adds the time until the end of the scope to one phase, when the telemetry is timing phases
+class PhaseTimer {
+public:
+    PhaseTimer(TrainingTelemetry& telemetry, TrainingPhase phase)
+        : telemetry(telemetry), phase(phase), start(telemetry.timingPhases() ? telemetryTicks() : 0) {}
+    ~PhaseTimer() {
+        if (start != 0) {
+            telemetry.addPhase(phase, telemetryTicks() - start);
+        }
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    TrainingTelemetry& telemetry;
+    TrainingPhase phase;
+    uint64_t start;
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#include "./kernels.cpp"
+
+// Allocator handing out cache-line aligned blocks, so that the first element of
+// every buffer can be loaded with aligned vector instructions.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    // Through aligned operator new rather than aligned_alloc, so a replaced
+    // global operator new (such as an allocation counter) sees every buffer.
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* pointer, std::size_t) noexcept {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Dense row-major matrix stored in a single aligned block.
+//
+// Weight matrices are laid out as [fanIn][fanOut]: row i holds every weight
+// leaving input neuron i. The forward pass accumulates `input[i] * row(i)`
+// into the output sums, the backward pass takes `dot(row(i), errors)` and the
+// update adds `rate * input[i] * errors` to row(i), so all three walk the
+// rows front to back.
+//
+// A matrix can also be a view of memory it does not own (see view()), which
+// is how memory-mapped model files are used without copying. Copies of a
+// view own their data, and resizing a view turns it into an owning matrix.
+template <typename T>
+class Matrix {
+public:
+    Matrix() : numRows(0), numCols(0) {}
+
+    Matrix(int rows, int cols, T value = T())
+        : numRows(rows), numCols(cols), storage(static_cast<std::size_t>(rows) * cols, value) {}
+
+    Matrix(const Matrix& other)
+        : numRows(other.numRows), numCols(other.numCols), storage(other.data(), other.data() + other.size()) {}
+
+    Matrix(Matrix&& other) noexcept
+        : numRows(std::exchange(other.numRows, 0)), numCols(std::exchange(other.numCols, 0)),
+          storage(std::move(other.storage)), external(std::exchange(other.external, nullptr)) {}
+
+    Matrix& operator=(const Matrix& other) {
+        if (this != &other) {
+            numRows = other.numRows;
+            numCols = other.numCols;
+            storage.assign(other.data(), other.data() + other.size());
+            external = nullptr;
+        }
+        return *this;
+    }
+
+    Matrix& operator=(Matrix&& other) noexcept {
+        if (this != &other) {
+            numRows = std::exchange(other.numRows, 0);
+            numCols = std::exchange(other.numCols, 0);
+            storage = std::move(other.storage);
+            external = std::exchange(other.external, nullptr);
+        }
+        return *this;
+    }
+
+    // Matrix over rows x cols values at `values`, which must outlive it
+    static Matrix view(T* values, int rows, int cols) {
+        Matrix matrix;
+        matrix.numRows = rows;
+        matrix.numCols = cols;
+        matrix.external = values;
+        return matrix;
+    }
+
+    int rows() const { return numRows; }
+    int cols() const { return numCols; }
+    std::size_t size() const { return static_cast<std::size_t>(numRows) * numCols; }
+    bool empty() const { return size() == 0; }
+    bool isView() const { return external != nullptr; }
+
+    T* data() { return external != nullptr ? external : storage.data(); }
+    const T* data() const { return external != nullptr ? external : storage.data(); }
+
+    T* row(int r) { return data() + static_cast<std::size_t>(r) * numCols; }
+    const T* row(int r) const { return data() + static_cast<std::size_t>(r) * numCols; }
+
+    T& operator()(int r, int c) { return row(r)[c]; }
+    const T& operator()(int r, int c) const { return row(r)[c]; }
+
+    void fill(T value) {
+        std::fill(data(), data() + size(), value);
+    }
+
+    // Reshape without preserving contents; storage is only reallocated when it grows.
+    void resize(int rows, int cols) {
+        numRows = rows;
+        numCols = cols;
+        external = nullptr;
+        storage.resize(static_cast<std::size_t>(rows) * cols);
+    }
+
+private:
+    int numRows;
+    int numCols;
+    AlignedVector<T> storage;
+    T* external = nullptr;
+};
+
+// The nonzeros of a matrix, row by row (compressed sparse rows): row r holds
+// values[k] at column indices[k] for k in [rowStarts[r], rowStarts[r + 1]).
+// Inputs such as MNIST pixels are mostly exact zeros, and the sparse kernels
+// skip the weights those would multiply.
+template <typename T>
+struct SparseRows {
+    std::vector<int> rowStarts;
+    std::vector<int> indices;
+    std::vector<T> values;
+
+    int rows() const { return static_cast<int>(rowStarts.size()) - 1; }
+    int nonzeros() const { return rowStarts.empty() ? 0 : rowStarts.back(); }
+
+    // Packs the nonzeros of `rows` x `cols` dense values, giving up and
+    // returning false once there are more than maxNonzeros. The buffers only
+    // grow, so repacking same-sized batches does not allocate.
+    bool pack(const T* dense, int rows, int cols, std::size_t maxNonzeros) {
+        const KernelTable<T>& simd = kernels<T>();
+        rowStarts.resize(static_cast<std::size_t>(rows) + 1);
+        // packNonzeros may write a row and a vector past the limit before it is checked
+        if (indices.size() < maxNonzeros + cols + MAX_VEC_WIDTH) {
+            indices.resize(maxNonzeros + cols + MAX_VEC_WIDTH);
+            values.resize(maxNonzeros + cols + MAX_VEC_WIDTH);
+        }
+        std::size_t count = 0;
+        rowStarts[0] = 0;
+        for (int r = 0; r < rows; r++) {
+            count += simd.packNonzeros(dense + static_cast<std::size_t>(r) * cols, cols, values.data() + count,
+                                       indices.data() + count);
+            if (count > maxNonzeros) {
+                rowStarts.clear();
+                return false;
+            }
+            rowStarts[r + 1] = static_cast<int>(count);
+        }
+        return true;
+    }
+};
+
+// C = A * B, each sample of a mini-batch being a row of A.
+template <typename T>
+void gemm(const Matrix<T>& a, const Matrix<T>& b, Matrix<T>& c) {
+    c.resize(a.rows(), b.cols());
+    kernels<T>().gemm(a.data(), b.data(), c.data(), a.rows(), a.cols(), b.cols());
+}
+
+// C = A * B^T
+template <typename T>
+void gemmTransposedB(const Matrix<T>& a, const Matrix<T>& b, Matrix<T>& c) {
+    c.resize(a.rows(), b.rows());
+    kernels<T>().gemmTransposedB(a.data(), b.data(), c.data(), a.rows(), a.cols(), b.rows());
+}
+
+// C += scale * A^T * B, used for weight updates: A holds the layer inputs of a
+// mini-batch and B the matching errors, one sample per row.
+template <typename T>
+void gemmTransposedAAccumulate(const Matrix<T>& a, const Matrix<T>& b, Matrix<T>& c, T scale) {
+    kernels<T>().gemmTransposedAAccumulate(a.data(), b.data(), c.data(), a.rows(), a.cols(), b.cols(), scale);
+}
+
+// Same as above with A given by its nonzeros; the rows of C of inputs that
+// are zero throughout the batch are left untouched
+template <typename T>
+void gemmTransposedAAccumulate(const SparseRows<T>& a, const Matrix<T>& b, Matrix<T>& c, T scale) {
+    kernels<T>().sparseGemmTransposedAAccumulate(a.rowStarts.data(), a.indices.data(), a.values.data(), b.data(),
+                                                 c.data(), a.rows(), b.cols(), scale);
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool: run() hands out task indices to the workers and to the
+// calling thread, and returns once every task has finished. Threads are
+// created once and parked between runs, so a run costs a wake-up rather than
+// a thread spawn.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) : stopping(false), generation(0), taskCount(0), pending(0) {
+        for (int i = 1; i < std::max(1, threads); i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads taking part in run(), including the caller
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Calls task(i) for every i in [0, count) and waits for all of them. The
+    // task is referenced rather than copied into a std::function, so a run
+    // never allocates.
+    template <typename Task>
+    void run(int count, const Task& task) {
+        if (count <= 0) {
+            return;
+        }
+        if (workers.empty() || count == 1) {
+            for (int i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+        dispatch(count, TaskRef{&task, [](const void* context, int i) { (*static_cast<const Task*>(context))(i); }});
+    }
+
+private:
+    // Type-erased reference to a task owned by the caller of run()
+    struct TaskRef {
+        const void* context;
+        void (*invoke)(const void* context, int i);
+
+        void operator()(int i) const { invoke(context, i); }
+    };
+
+    void dispatch(int count, const TaskRef& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentTask = &task;
+            taskCount = count;
+            nextTask.store(0);
+            pending = count;
+            generation++;
+        }
+        wakeUp.notify_all();
+
+        finishTasks(runTasks(task, count), false);
+
+        // Workers that picked this run up must be out of runTasks() before
+        // the task (owned by the caller) goes away or the counter is reset.
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0 && busyWorkers == 0; });
+        currentTask = nullptr;
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable done;
+    bool stopping;
+    long generation;
+    const TaskRef* currentTask = nullptr;
+    int taskCount;
+    int pending;
+    int busyWorkers = 0;
+    std::atomic<int> nextTask{0};
+
+    int runTasks(const TaskRef& task, int count) {
+        int finished = 0;
+        for (int i = nextTask.fetch_add(1); i < count; i = nextTask.fetch_add(1)) {
+            task(i);
+            finished++;
+        }
+        return finished;
+    }
+
+    void finishTasks(int finished, bool leavingWorker) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending -= finished;
+        if (leavingWorker) {
+            busyWorkers--;
+        }
+        if (pending == 0 && busyWorkers == 0) {
+            done.notify_one();
+        }
+    }
+
+    void workerLoop() {
+        long seenGeneration = 0;
+        while (true) {
+            const TaskRef* task;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+                if (currentTask == nullptr) {
+                    continue;
+                }
+                task = currentTask;
+                count = taskCount;
+                busyWorkers++;
+            }
+            finishTasks(runTasks(*task, count), true);
+        }
+    }
+};
+
+#endif
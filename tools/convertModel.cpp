@@ -0,0 +1,63 @@
+#include <cstring>
+#include "../src/nn.cpp"
+
+// Converts a model saved in the old text format (*-model.txt) to the binary
+// model format. The text files carry no shapes, so the network dimensions and
+// activation are given on the command line, e.g. for the MNIST example:
+//
+//   ./convert_model mnist-model.txt mnist-model.bin 784 128 10 sigmoid
+bool parseActivation(const char* name, ActivationFunction& activation) {
+    const std::pair<const char*, ActivationFunction> names[] = {
+        {"tanh", TANH}, {"sigmoid", SIGMOID}, {"relu", RELU}, {"linear", LINEAR}, {"softmax", SOFTMAX},
+    };
+    for (const auto& [candidate, value] : names) {
+        if (std::strcmp(name, candidate) == 0) {
+            activation = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+int convert(const NeuralNetworkConfig& config, const std::string& textPath, const std::string& binaryPath) {
+    NeuralNetwork<T> network(config, config.activationFunction);
+    if (!network.loadTextModel(textPath)) {
+        return EXIT_FAILURE;
+    }
+    network.saveModel(binaryPath);
+    return network.loadModel(binaryPath, true) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 7 || argc > 8) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <model.txt> <model.bin> <inputSize> <hiddenSize> <outputSize> <activation> [float|double]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    NeuralNetworkConfig config;
+    config.inputSize = std::atoi(argv[3]);
+    config.hiddenSize = std::atoi(argv[4]);
+    config.outputSize = std::atoi(argv[5]);
+    config.learningRate = 0.0;
+    if (config.inputSize <= 0 || config.hiddenSize <= 0 || config.outputSize <= 0) {
+        std::cerr << "Layer sizes must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!parseActivation(argv[6], config.activationFunction)) {
+        std::cerr << "Unknown activation " << argv[6] << " (tanh, sigmoid, relu, linear or softmax)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string dtype = argc == 8 ? argv[7] : "double";
+    if (dtype == "float") {
+        return convert<float>(config, argv[1], argv[2]);
+    }
+    if (dtype == "double") {
+        return convert<double>(config, argv[1], argv[2]);
+    }
+    std::cerr << "Unknown dtype " << dtype << " (float or double)" << std::endl;
+    return EXIT_FAILURE;
+}
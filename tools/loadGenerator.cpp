@@ -0,0 +1,44 @@
+#include <cstring>
+#include "../src/inferenceServer.cpp"
+
+// Benchmarks a running server (tools/serve.cpp) with closed-loop clients:
+// every connection keeps a number of requests in flight and sends the next
+// as soon as a response arrives. Prints requests per second and the
+// p50/p99/p99.9 round-trip latency seen by the clients.
+int main(int argc, char** argv) {
+    LoadConfig config;
+    config.address.port = 7878;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            config.address.socketPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            config.address.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            config.connections = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+            config.pipeline = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config.seconds = std::atof(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--socket PATH | --port PORT] [--connections N] [--pipeline N] [--seconds SECONDS]"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    LoadReport report;
+    std::string error;
+    if (!generateLoad(config, report, error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << std::fixed << std::setprecision(1) << config.connections << " connections x " << config.pipeline
+              << " in flight: " << report.requestsPerSecond() << " requests/s, p50 " << report.p50Microseconds
+              << " us, p99 " << report.p99Microseconds << " us, p99.9 " << report.p999Microseconds << " us";
+    if (report.errors > 0) {
+        std::cout << ", " << report.errors << " connections failed";
+    }
+    std::cout << std::endl;
+    return report.errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
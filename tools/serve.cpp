@@ -0,0 +1,87 @@
+#include <csignal>
+#include <cstring>
+#include "../src/inferenceServer.cpp"
+
+// Serves a saved model over a local socket until interrupted, printing the
+// request rate, mean batch size and p50/p99 latency every few seconds. The
+// network's shape comes from the model file, e.g.
+//
+//   ./serve mnist-model.bin --socket /tmp/mnist.sock --max-batch 64 --max-delay-us 200
+//   ./load_generator --socket /tmp/mnist.sock --connections 16 --seconds 10
+volatile std::sig_atomic_t interrupted = 0;
+
+void onSignal(int) { interrupted = 1; }
+
+void printStats(const ServerStats& stats) {
+    std::cout << std::fixed << std::setprecision(1) << stats.requestsPerSecond() << " requests/s, mean batch "
+              << stats.meanBatch() << ", p50 " << stats.p50Microseconds << " us, p99 " << stats.p99Microseconds
+              << " us" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    ServerConfig config;
+    config.address.port = 7878;
+    int threads = 1;
+    double reportSeconds = 5.0;
+    bool usage = argc < 2;
+    for (int i = 2; i < argc && !usage; i++) {
+        if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            config.address.socketPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            config.address.port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-batch") == 0 && i + 1 < argc) {
+            config.maxBatch = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-delay-us") == 0 && i + 1 < argc) {
+            config.maxDelayMicroseconds = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportSeconds = std::atof(argv[++i]);
+        } else {
+            usage = true;
+        }
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <model.bin> [--socket PATH | --port PORT] [--max-batch N] [--max-delay-us MICROSECONDS]"
+                     " [--threads N] [--report SECONDS]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    NeuralNetworkConfig networkConfig;
+    ActivationFunction activation;
+    std::string error;
+    if (!readModelConfig(argv[1], networkConfig, activation, error)) {
+        std::cerr << "Unable to load model: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    networkConfig.threads = threads;
+    NeuralNetwork<float> network(networkConfig, activation);
+    if (!network.loadModel(argv[1])) {
+        return EXIT_FAILURE;
+    }
+
+    InferenceServer<float> server(network, config);
+    if (!server.start(error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::cout << "Serving " << argv[1] << " (" << network.inputCount() << " inputs, " << network.outputCount()
+              << " outputs) on " << server.address().describe() << ", batches of up to " << config.maxBatch
+              << " within " << config.maxDelayMicroseconds << " us" << std::endl;
+
+    auto lastReport = std::chrono::steady_clock::now();
+    while (!interrupted) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (std::chrono::steady_clock::now() - lastReport >= std::chrono::duration<double>(reportSeconds)) {
+            lastReport = std::chrono::steady_clock::now();
+            printStats(server.takeStats());
+        }
+    }
+    server.stop();
+    printStats(server.takeStats());
+    return EXIT_SUCCESS;
+}
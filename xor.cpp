@@ -5,11 +5,13 @@ int main(void) {
     config.inputSize = 2;
     config.hiddenSize = 3;
     config.outputSize = 1;
-    config.learningRate = 0.1;
+    config.learningRate = 0.5;
+    config.batchSize = 4;
+    config.optimizer.type = MOMENTUM;
 
     NeuralNetwork neuralNetwork(config, SIGMOID);
 
-    int modelLoaded = neuralNetwork.loadModel("xor-model.txt");
+    int modelLoaded = neuralNetwork.loadModel("xor-model.bin");
 
     if (!modelLoaded) {
         std::vector<std::pair<std::vector<double>, std::vector<double>>> trainingData = {
@@ -20,10 +22,16 @@ int main(void) {
         };
 
         std::cout << "Training..." << std::endl;
-        neuralNetwork.train(trainingData, trainingData, 10000000);
+        neuralNetwork.train(trainingData, trainingData, 20000);
         std::cout << "Done!" << std::endl;
 
-        neuralNetwork.saveModel("xor-model.txt");
+        neuralNetwork.saveModel("xor-model.bin");
+    }
+
+    // The same model with its sizes fixed at compile time, for fast single-sample inference
+    FixedNetwork<2, 3, 1, SIGMOID> fixedNetwork;
+    if (!fixedNetwork.loadModel("xor-model.bin")) {
+        return EXIT_FAILURE;
     }
 
     std::vector<std::vector<double>> testData = {
@@ -35,7 +43,7 @@ int main(void) {
 
     int correctPredictions = 0;
     for (auto& input : testData) {
-        auto output = neuralNetwork.feedforward(input);
+        auto output = fixedNetwork.predict({input[0], input[1]});
         bool correct = (output[0] < 0.5 && input[0] == 0.0 && input[1] == 0.0) ||
                         (output[0] > 0.5 && input[0] == 0.0 && input[1] == 1.0) ||
                         (output[0] > 0.5 && input[0] == 1.0 && input[1] == 0.0) ||
@@ -48,7 +56,7 @@ int main(void) {
     std::cout << "Accuracy: " << (correctPredictions / static_cast<double>(testData.size())) * 100 << "%" << std::endl;
 
     for (auto& input : testData) {
-        auto output = neuralNetwork.feedforward(input);
+        auto output = fixedNetwork.predict({input[0], input[1]});
         bool correct = (output[0] < 0.5 && input[0] == 0.0 && input[1] == 0.0) ||
                         (output[0] > 0.5 && input[0] == 0.0 && input[1] == 1.0) ||
                         (output[0] > 0.5 && input[0] == 1.0 && input[1] == 0.0) ||